@@ -0,0 +1,213 @@
+#include "architecture.hpp"
+#include "layerFullyConnected.hpp"
+#include "layerBinaryOutput.hpp"
+#include "layerSoftmax.hpp"
+#include "layerConvolutional.hpp"
+#include "layerBatchNormalize.hpp"
+#include <sstream>
+#include <stdexcept>
+
+namespace {
+
+struct SpecLine
+{
+   int number;
+   std::vector<std::string> words;
+};
+
+[[noreturn]] void spec_error(const SpecLine& line, const std::string& reason)
+{
+   throw std::runtime_error("architecture line " + std::to_string(line.number) + ": " + reason);
+}
+
+// the words of each line that isn't blank or a comment
+std::vector<SpecLine> split_lines(const std::string& architecture)
+{
+   std::vector<SpecLine> lines;
+   std::istringstream in(architecture);
+   std::string text;
+   for (int number = 1; std::getline(in, text); number++)
+   {
+      text = text.substr(0, text.find('#'));
+      std::istringstream words(text);
+      SpecLine line{number, {}};
+      for (std::string word; words >> word;) line.words.push_back(word);
+      if (not line.words.empty()) lines.push_back(std::move(line));
+   }
+   return lines;
+}
+
+// `lines` from `pos` up to the `end` closing the current block with every `repeat` unrolled.
+// Leaves `pos` past that `end`, or past the last line at the top level
+std::vector<SpecLine> expand(const std::vector<SpecLine>& lines, std::size_t& pos, bool top_level)
+{
+   std::vector<SpecLine> out;
+   while (pos < lines.size())
+   {
+      const SpecLine& line = lines[pos++];
+      if (line.words[0] == "end")
+      {
+         if (top_level) spec_error(line, "end without repeat");
+         return out;
+      }
+      if (line.words[0] != "repeat")
+      {
+         out.push_back(line);
+         continue;
+      }
+      if (line.words.size() != 2) spec_error(line, "expected repeat <n>");
+      int n = 0;
+      try { n = std::stoi(line.words[1]); } catch (std::exception&) {}
+      if (n <= 0) spec_error(line, "repeat count must be a positive integer");
+      const std::vector<SpecLine> body = expand(lines, pos, false);
+      for (int i = 0; i < n; i++) out.insert(out.end(), body.begin(), body.end());
+   }
+   if (not top_level) spec_error(lines.back(), "repeat without end");
+   return out;
+}
+
+// reads the arguments of one layer line in order, with the optional ones last
+class Arguments
+{
+public:
+   Arguments(const SpecLine& line) :m_line{line} {}
+
+   bool more() const { return m_next < m_line.words.size(); }
+
+   int integer()
+   {
+      const std::string& word = next("an integer");
+      std::size_t end = 0;
+      int value = 0;
+      try { value = std::stoi(word, &end); } catch (std::exception&) {}
+      if (end != word.size() || value <= 0) spec_error(m_line, "expected a positive integer, got " + word);
+      return value;
+   }
+
+   float real(float fallback)
+   {
+      if (not more()) return fallback;
+      const std::string& word = next("a number");
+      std::size_t end = 0;
+      float value = 0.f;
+      try { value = std::stof(word, &end); } catch (std::exception&) {}
+      if (end != word.size()) spec_error(m_line, "expected a number, got " + word);
+      return value;
+   }
+
+   ActivationFunction activation()
+   {
+      const std::string& word = next("an activation");
+      for (ActivationFunction activation_function : {RELU, SIGMOID, LINEAR})
+      {
+         if (word == activation_name(activation_function)) return activation_function;
+      }
+      spec_error(m_line, "unknown activation " + word);
+   }
+
+   Padding padding()
+   {
+      const std::string& word = next("same or valid");
+      if (word == "same") return SAME;
+      if (word == "valid") return VALID;
+      spec_error(m_line, "unknown padding " + word);
+   }
+
+   InitializationMode initialization()
+   {
+      if (not more()) return HE;
+      const std::string& word = next("he or normal");
+      if (word == "he") return HE;
+      if (word == "normal") return NORMAL;
+      spec_error(m_line, "unknown initialization " + word);
+   }
+
+   void done() const
+   {
+      if (more()) spec_error(m_line, "unexpected " + m_line.words[m_next]);
+   }
+
+private:
+   const std::string& next(const std::string& expected)
+   {
+      if (not more()) spec_error(m_line, "missing " + expected);
+      return m_line.words[m_next++];
+   }
+
+   const SpecLine& m_line;
+   std::size_t m_next = 1;
+};
+
+std::unique_ptr<Layer> build_layer(const SpecLine& line)
+{
+   Arguments args(line);
+   std::unique_ptr<Layer> layer;
+   const std::string& type = line.words[0];
+   if (type == "fully_connected")
+   {
+      const int inputs = args.integer();
+      const int outputs = args.integer();
+      const ActivationFunction activation_function = args.activation();
+      layer = std::make_unique<LayerFullyConnected>(inputs, outputs, args.initialization(), activation_function);
+   }
+   else if (type == "binary_output")
+   {
+      const int inputs = args.integer();
+      layer = std::make_unique<LayerBinaryOutput>(inputs, args.initialization());
+   }
+   else if (type == "softmax")
+   {
+      layer = std::make_unique<LayerSoftmax>(args.integer());
+   }
+   else if (type == "convolutional")
+   {
+      const int input_height = args.integer();
+      const int input_width = args.integer();
+      const int channels = args.integer();
+      const int kernel_height = args.integer();
+      const int kernel_width = args.integer();
+      const int filters = args.integer();
+      const Padding padding = args.padding();
+      const ActivationFunction activation_function = args.activation();
+      layer = std::make_unique<LayerConvolutional>(input_height, input_width, channels, kernel_height, kernel_width, filters,
+                                                   padding, args.initialization(), activation_function);
+   }
+   else if (type == "batch_normalize")
+   {
+      const int channels = args.integer();
+      const int plane_size = args.integer();
+      const ActivationFunction activation_function = args.activation();
+      const float momentum = args.real(0.1f);
+      const float epsilon = args.real(1e-5f);
+      layer = std::make_unique<LayerBatchNormalize>(channels, plane_size, activation_function, momentum, epsilon);
+   }
+   else
+   {
+      spec_error(line, "unknown layer " + type);
+   }
+   args.done();
+   return layer;
+}
+
+}
+
+std::vector<std::unique_ptr<Layer>> build_layers(const std::string& architecture)
+{
+   const std::vector<SpecLine> lines = split_lines(architecture);
+   std::size_t pos = 0;
+   const std::vector<SpecLine> expanded = expand(lines, pos, true);
+   if (expanded.empty()) throw std::runtime_error("architecture has no layers");
+
+   std::vector<std::unique_ptr<Layer>> layers;
+   for (const SpecLine& line : expanded)
+   {
+      std::unique_ptr<Layer> layer = build_layer(line);
+      if (not layers.empty() && layers.back()->output_size != layer->input_size)
+      {
+         spec_error(line, "takes " + std::to_string(layer->input_size) + " inputs but the layer before has " +
+                          std::to_string(layers.back()->output_size) + " outputs");
+      }
+      layers.push_back(std::move(layer));
+   }
+   return layers;
+}
@@ -0,0 +1,21 @@
+#pragma once
+
+#include <memory>
+#include <string>
+#include <vector>
+#include "layer.hpp"
+
+// Networks described in text, one layer per line in the form Layer::describe() writes them,
+// so a checkpoint's architecture header builds the net it was saved from:
+//
+//   fully_connected <inputs> <outputs> <activation> [he|normal]
+//   binary_output <inputs> [he|normal]
+//   softmax <size>
+//   convolutional <input_height> <input_width> <channels> <kernel_height> <kernel_width> <filters> <same|valid> <activation> [he|normal]
+//   batch_normalize <channels> <plane_size> <activation> [momentum] [epsilon]
+//
+// Activations are relu, sigmoid or linear, initialization defaults to he. The lines between
+// `repeat <n>` and `end` are repeated n times, eg. for a tower of convolutions, and '#' starts
+// a comment. Throws std::runtime_error naming the line of the first mistake, including a
+// layer whose inputs don't match the outputs of the one before
+std::vector<std::unique_ptr<Layer>> build_layers(const std::string& architecture);
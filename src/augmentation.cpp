@@ -0,0 +1,73 @@
+#include "augmentation.hpp"
+#include "oclData.hpp"
+#include "errors.hpp"
+#include "cpuKernels.hpp"
+#include "backend.hpp"
+#include <iostream>
+
+BatchPermutation::BatchPermutation(std::vector<int> permutation)
+   :m_permutation{std::move(permutation)}
+{
+   Mat::setup();
+   if (mat_backend == CPU_BACKEND) return;
+   m_buffer = cl::Buffer(ocl_context, CL_MEM_READ_ONLY, m_permutation.size()*sizeof(cl_int));
+   m_event = ocl_upload(m_buffer, std::vector<std::int32_t>(m_permutation.begin(), m_permutation.end()));
+}
+
+ParallelMat BatchPermutation::apply(const ParallelMat& batch, const std::vector<std::uint8_t>& selected) const
+{
+   const unsigned size = batch.m_height*batch.m_width;
+   const unsigned count = batch.m_count;
+   assert(size == m_permutation.size() && selected.size() == count);
+
+   if (mat_backend == CPU_BACKEND)
+   {
+      auto out = std::make_shared<std::vector<float>>(std::size_t(size)*count);
+      cpu_permute_selected(batch.hostData(), out->data(), m_permutation.data(), selected.data(), size, count);
+      return ParallelMat(batch.m_height, batch.m_width, count, out);
+   }
+
+   cl::Buffer out_buffer(ocl_context, CL_MEM_READ_WRITE, std::size_t(size)*count*sizeof(float));
+   cl::Buffer selected_buffer(ocl_context, CL_MEM_READ_ONLY, count*sizeof(cl_int));
+   cl::Event out_event;
+
+   try {
+      const cl::Event selected_event = ocl_upload(selected_buffer, std::vector<std::int32_t>(selected.begin(), selected.end()));
+      const cl_int n = size;
+
+      permute_selected_kernel.setArg( 0, batch.buffer() );
+      permute_selected_kernel.setArg( 1, out_buffer );
+      permute_selected_kernel.setArg( 2, m_buffer );
+      permute_selected_kernel.setArg( 3, selected_buffer );
+      permute_selected_kernel.setArg( 4, n );
+
+      auto deps = ocl_wait_list({batch.m_event, m_event, selected_event});
+
+      ocl_queue.enqueueNDRangeKernel( permute_selected_kernel, cl::NullRange, cl::NDRange(std::size_t(size)*count), cl::NullRange, &deps, &out_event );
+   }
+   catch(cl::Error& err) {
+      std::cout << "Error in batch permutation: " << err.what() << "(" << getErrorString(err.err()) << ")" << std::endl;
+   }
+
+   return ParallelMat(batch.m_height, batch.m_width, count, out_buffer, out_event);
+}
+
+BatchPermutation mirror_inputs()
+{
+   std::vector<int> permutation(POSITION_INPUT_SIZE);
+   for (int i = 0; i < POSITION_INPUT_SIZE; i++) permutation[i] = i ^ 7;
+   return BatchPermutation(std::move(permutation));
+}
+
+BatchPermutation mirror_policy()
+{
+   std::vector<int> permutation(POLICY_SIZE);
+   for (int i = 0; i < 64*64; i++) permutation[i] = ((i / 64) ^ 7)*64 + ((i % 64) ^ 7);
+   // underpromotions are indexed by the file moved from and the direction, -1, 0 or +1 files
+   for (int i = 0; i < POLICY_SIZE - 64*64; i++)
+   {
+      const int file = i / 9, direction = i / 3 % 3, piece = i % 3;
+      permutation[64*64 + i] = 64*64 + ((7 - file)*3 + (2 - direction))*3 + piece;
+   }
+   return BatchPermutation(std::move(permutation));
+}
@@ -0,0 +1,38 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+#include "parallelMat.hpp"
+#include "trainingData.hpp"
+
+// a reordering of the elements of each matrix of a batch, applied on the device to the
+// matrices picked per call. The table is uploaded once
+class BatchPermutation
+{
+public:
+   // element i of a permuted matrix is element `permutation[i]` of the original
+   explicit BatchPermutation(std::vector<int> permutation);
+
+   // `batch` with its matrices i where `selected[i]` is set permuted, the others as they are
+   ParallelMat apply(const ParallelMat& batch, const std::vector<std::uint8_t>& selected) const;
+
+   unsigned size() const { return m_permutation.size(); }
+
+private:
+   std::vector<int> m_permutation;
+   cl::Buffer m_buffer;
+   cl::Event m_event;
+};
+
+// Data augmentation by the symmetries of chess. The inputs are already seen from the side to
+// move, so swapping the colors (and flipping the board vertically) gives the same inputs and
+// policy and needs no transform. Swapping files a and h is a symmetry as long as neither
+// side can castle any more
+
+// whether swapping files a and h keeps `board` the same position
+inline bool mirror_symmetric(const PackedBoard& board) { return ((board.flags >> 1) & 0xF) == 0; }
+
+// files a and h swapped in the inputs of encode_position
+BatchPermutation mirror_inputs();
+// files a and h swapped in the policy targets, see policy_index
+BatchPermutation mirror_policy();
@@ -0,0 +1,41 @@
+#include "backend.hpp"
+#include "oclData.hpp"
+#include <iostream>
+#include <cstdlib>
+#include <string>
+
+bool backend_setup = false;
+Backend mat_backend = OPENCL_BACKEND;
+
+void backend_init()
+{
+   const char* backend = std::getenv("CHESS_BACKEND");
+   backend_init(backend != nullptr && std::string(backend) == "cpu" ? CPU_BACKEND : OPENCL_BACKEND);
+}
+
+void backend_init(Backend backend)
+{
+   mat_backend = backend;
+   if (backend == OPENCL_BACKEND && not ocl_setup)
+   {
+      try {
+         ocl_init();
+      }
+      catch(std::exception& err) {
+         std::cout << "Error in backend setup: " << err.what() << std::endl;
+      }
+
+      if (not ocl_setup)
+      {
+         std::cout << "No usable OpenCL device, falling back to the CPU backend" << std::endl;
+         mat_backend = CPU_BACKEND;
+      }
+   }
+   backend_setup = true;
+}
+
+StoragePrecision half_storage()
+{
+   if (mat_backend == CPU_BACKEND) return STORAGE_FP16;
+   return ocl_fp16 ? STORAGE_FP16 : STORAGE_BF16;
+}
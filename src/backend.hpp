@@ -0,0 +1,35 @@
+#pragma once
+
+#include <memory>
+#include <vector>
+
+enum Backend
+{
+   OPENCL_BACKEND = 0,  // Mats live in cl::Buffers and run the kernels in src/kernels
+   CPU_BACKEND = 1      // Mats live in host memory and run the vectorized loops in cpuKernels
+};
+
+// how read-mostly data (inference weights and the activations feeding them) is stored.
+// Arithmetic is float either way
+enum StoragePrecision
+{
+   STORAGE_FP32 = 0,
+   STORAGE_FP16 = 1,    // IEEE half
+   STORAGE_BF16 = 2     // bfloat16, the top half of a float: same range, 8 bits of mantissa
+};
+
+// host storage of a Mat on the CPU backend, shared between views the same way a cl::Buffer is
+using HostBuffer = std::shared_ptr<std::vector<float>>;
+
+extern bool backend_setup;
+extern Backend mat_backend;
+
+// picks the backend from $CHESS_BACKEND ("opencl" or "cpu"), defaulting to OpenCL. Either
+// way it falls back to the CPU when no OpenCL device can be set up. Has to run before the
+// first Mat is made, Mats from different backends can't be mixed
+void backend_init();
+void backend_init(Backend backend);
+
+// the 16 bit format for this backend: FP16 where every OpenCL device supports cl_khr_fp16
+// and on the CPU, bfloat16 otherwise
+StoragePrecision half_storage();
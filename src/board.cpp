@@ -1,6 +1,8 @@
 #include "board.hpp"
+#include "nnue.hpp"
 #include <vector>
 #include <algorithm>
+#include <cassert>
 
 #include <iostream>
 #include <string>
@@ -97,20 +99,50 @@ void Board::doMove(const Move& move)
 {
    Piece piece = getPiece(move.start).value();
 
+   m_history.push_back(UndoState{
+      .move = move,
+      .piece = piece,
+      .captured = getPiece(move.end),
+      .captured_square = move.end,
+      .black_kingside_available = m_black_kingside_available,
+      .black_queenside_available = m_black_queenside_available,
+      .white_kingside_available = m_white_kingside_available,
+      .white_queenside_available = m_white_queenside_available,
+      .en_passant_square = m_en_passant_square,
+      .halfmoves = m_halfmoves,
+      .fullmoves = m_fullmoves
+   });
+
+   // what leaves and joins the board, for the NNUE accumulator
+   std::array<PlacedPiece, 3> removed;
+   std::array<PlacedPiece, 2> added;
+   int n_removed = 0;
+   int n_added = 0;
+   removed[n_removed++] = {piece, move.start};
+
    bool capture = getPiece(move.end).has_value();
+   if (capture) removed[n_removed++] = {getPiece(move.end).value(), move.end};
    bool en_passant = piece.type == PAWN and move.end == m_en_passant_square;
    if (en_passant)
    {
       // find and remove the captured pawn
-      getPiece(Square{.row = (piece.color == WHITE ? 4 : 3), .col = move.end.col}).reset();
+      Square captured{.row = (piece.color == WHITE ? 4 : 3), .col = move.end.col};
+      m_history.back().captured = getPiece(captured);
+      m_history.back().captured_square = captured;
+      removed[n_removed++] = {getPiece(captured).value(), captured};
+      getPiece(captured).reset();
    }
 
    // castling
    if (piece.type == KING and std::abs(move.end.col - move.start.col) == 2)
    {
       bool kings_side = (move.end.col > move.start.col);
-      OptionalPiece& rook = getPiece(Square{.row = move.start.row, .col = (kings_side ? 7 : 0)});
-      getPiece(Square{.row = move.start.row, .col = (kings_side ? 5 : 3)}) = rook.value();
+      Square rook_start{.row = move.start.row, .col = (kings_side ? 7 : 0)};
+      Square rook_end{.row = move.start.row, .col = (kings_side ? 5 : 3)};
+      OptionalPiece& rook = getPiece(rook_start);
+      removed[n_removed++] = {rook.value(), rook_start};
+      added[n_added++] = {rook.value(), rook_end};
+      getPiece(rook_end) = rook.value();
       rook.reset();
    }
 
@@ -128,6 +160,7 @@ void Board::doMove(const Move& move)
    {
       getPiece(move.end).value().type = move.promotion.value();
    }
+   added[n_added++] = {getPiece(move.end).value(), move.end};
 
    if (piece.type == KING)
    {
@@ -159,6 +192,12 @@ void Board::doMove(const Move& move)
       }
    }
 
+   // a rook taken before it moved can't castle either
+   if (move.end == Square{.row = 0, .col = 7}) m_white_kingside_available = false;
+   if (move.end == Square{.row = 0, .col = 0}) m_white_queenside_available = false;
+   if (move.end == Square{.row = 7, .col = 7}) m_black_kingside_available = false;
+   if (move.end == Square{.row = 7, .col = 0}) m_black_queenside_available = false;
+
    m_en_passant_square.reset();
    if (piece.type == PAWN && std::abs(move.start.row - move.end.row) == 2)
    {
@@ -172,12 +211,129 @@ void Board::doMove(const Move& move)
    else m_halfmoves++;
 
    if (m_current_player == WHITE) m_fullmoves++;
+   if (m_nnue) pushAccumulator(piece, removed.data(), n_removed, added.data(), n_added);
    rebuildPins(BLACK);
    rebuildPins(WHITE);
    rebuildThreatsAndChecks();
 
 }
 
+void Board::undoMove()
+{
+   assert(not m_history.empty());
+   const UndoState state = m_history.back();
+   m_history.pop_back();
+   const Move& move = state.move;
+
+   getPiece(move.end).reset();
+   getPiece(move.start) = state.piece;
+   if (state.captured.has_value()) getPiece(state.captured_square) = state.captured;
+
+   if (state.piece.type == KING and std::abs(move.end.col - move.start.col) == 2)
+   {
+      bool kings_side = (move.end.col > move.start.col);
+      OptionalPiece& rook = getPiece(Square{.row = move.start.row, .col = (kings_side ? 5 : 3)});
+      getPiece(Square{.row = move.start.row, .col = (kings_side ? 7 : 0)}) = rook.value();
+      rook.reset();
+   }
+
+   if (state.piece.type == KING)
+   {
+      if (state.piece.color == WHITE) m_white_king = move.start;
+      else m_black_king = move.start;
+   }
+
+   m_black_kingside_available = state.black_kingside_available;
+   m_black_queenside_available = state.black_queenside_available;
+   m_white_kingside_available = state.white_kingside_available;
+   m_white_queenside_available = state.white_queenside_available;
+   m_en_passant_square = state.en_passant_square;
+   m_halfmoves = state.halfmoves;
+   m_fullmoves = state.fullmoves;
+   m_current_player = state.piece.color;
+
+   if (m_nnue)
+   {
+      // the accumulator from before the move is still there unless it was refreshed since
+      if (m_accumulator_ply > 0) m_accumulator_ply--;
+      else refreshAccumulator();
+   }
+   rebuildPins(BLACK);
+   rebuildPins(WHITE);
+   rebuildThreatsAndChecks();
+}
+
+std::vector<int> Board::nnueFeatures(Color perspective) const
+{
+   const int king = squareIndex(perspective == WHITE ? m_white_king : m_black_king);
+   std::vector<int> features;
+   for (int row = 0; row < 8; row++)
+   {
+      for (int col = 0; col < 8; col++)
+      {
+         const OptionalPiece& p = getPiece({row, col});
+         if (not p.has_value() or p.value().type == KING) continue;
+         features.push_back(nnue_feature(perspective, king, p.value(), 8*row + col));
+      }
+   }
+   return features;
+}
+
+void Board::setNnue(const Nnue* nnue)
+{
+   m_nnue = nnue;
+   m_accumulators.clear();
+   if (m_nnue) refreshAccumulator();
+}
+
+float Board::evaluate() const
+{
+   assert(m_nnue);
+   return m_nnue->evaluate(m_accumulators[m_accumulator_ply], m_current_player);
+}
+
+void Board::refreshAccumulator()
+{
+   m_accumulator_ply = 0;
+   if (m_accumulators.empty()) m_accumulators.emplace_back();
+   m_nnue->refresh(m_accumulators[0], WHITE, nnueFeatures(WHITE));
+   m_nnue->refresh(m_accumulators[0], BLACK, nnueFeatures(BLACK));
+}
+
+void Board::pushAccumulator(const Piece& moved, const PlacedPiece* removed, int n_removed, const PlacedPiece* added, int n_added)
+{
+   if (m_accumulator_ply + 1 == m_accumulators.size()) m_accumulators.emplace_back();
+   const NnueAccumulator& from = m_accumulators[m_accumulator_ply];
+   NnueAccumulator& to = m_accumulators[++m_accumulator_ply];
+
+   for (Color perspective : {WHITE, BLACK})
+   {
+      // every feature is relative to the own king, moving it changes all of them
+      if (moved.type == KING and moved.color == perspective)
+      {
+         m_nnue->refresh(to, perspective, nnueFeatures(perspective));
+         continue;
+      }
+
+      const int king = squareIndex(perspective == WHITE ? m_white_king : m_black_king);
+      std::array<int, 3> removed_features;
+      std::array<int, 2> added_features;
+      int n_removed_features = 0;
+      int n_added_features = 0;
+      for (int i = 0; i < n_removed; i++)
+      {
+         if (removed[i].first.type == KING) continue;
+         removed_features[n_removed_features++] = nnue_feature(perspective, king, removed[i].first, squareIndex(removed[i].second));
+      }
+      for (int i = 0; i < n_added; i++)
+      {
+         if (added[i].first.type == KING) continue;
+         added_features[n_added_features++] = nnue_feature(perspective, king, added[i].first, squareIndex(added[i].second));
+      }
+      m_nnue->update(from, to, perspective, added_features.data(), n_added_features, removed_features.data(), n_removed_features);
+   }
+}
+
 std::set<Move> Board::getAllLegalMoves() const
 {
    std::set<Move> legal_moves;
@@ -216,19 +372,6 @@ std::set<Move> Board::getAllLegalMoves() const
       }
    }
 
-   if (legal_moves.size() == 0)
-   {
-      printBoard();
-      if (m_check_locations.size() == 0)
-      {
-         std::cout << "Stalemate\n";
-      }
-      else
-      {
-         std::cout << "Checkmate, " << (m_current_player == WHITE ? "black" : "white") << " wins\n";
-      }
-   }
-
    return legal_moves;
 }
 
@@ -281,11 +424,17 @@ std::set<Move> Board::getAllLegalPawnMoves(const Square& start) const
            m_en_passant_square.value() == dst);
    };
 
+   // captures onto the last row promote too
+   auto insert_capture = [&](Square dst) {
+      if (dst.row != (pawn.color == WHITE ? 7 : 0)) legal_moves.insert({start, dst});
+      else for (PieceType promotion_type : {ROOK, KNIGHT, BISHOP, QUEEN}) legal_moves.insert({start, dst, promotion_type});
+   };
+
    dst.col += 1;
-   if (legal_pawn_capture(dst)) legal_moves.insert({start, dst});
+   if (legal_pawn_capture(dst)) insert_capture(dst);
 
    dst.col -= 2;
-   if (legal_pawn_capture(dst)) legal_moves.insert({start, dst});
+   if (legal_pawn_capture(dst)) insert_capture(dst);
 
    // if there are move restrictions (piece is pinned, king is in
    // check), limit moves to the union of legal_moves and restrictions
@@ -570,8 +719,10 @@ void Board::reset()
    m_threatened_black_squares.clear();
    m_threatened_white_squares.clear();
    m_check_locations.clear();
+   m_history.clear();
 
    rebuildThreatsAndChecks();
+   if (m_nnue) refreshAccumulator();
 }
 
 
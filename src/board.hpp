@@ -8,6 +8,9 @@
 #include <ostream>
 
 #include "piece.hpp"
+#include "nnueAccumulator.hpp"
+
+class Nnue;
 
 // Board class responsible for pretty much everything. 
 // A1 is (0,0), H8 is (7,7). (row, col)
@@ -108,14 +111,66 @@ public:
    void reset();
    void printBoard() const;
    
+   // empty when the game is over, checkmate if `inCheck()` and stalemate otherwise
    std::set<Move> getAllLegalMoves() const;
 
    // does the move and increments the turn counter etc.
    // `move` is assumed to be legal
    void doMove(const Move& move);
+   // takes back the last `doMove`
+   void undoMove();
+
+   Color currentPlayer() const { return m_current_player; }
+   // whether the side to move is in check
+   bool inCheck() const { return not m_check_locations.empty(); }
+   const OptionalPiece& pieceAt(const Square& square) const { return getPiece(square); }
+   // castling rights, whether or not castling is possible in this position
+   bool kingsideAvailable(Color color) const { return color == WHITE ? m_white_kingside_available : m_black_kingside_available; }
+   bool queensideAvailable(Color color) const { return color == WHITE ? m_white_queenside_available : m_black_queenside_available; }
+   // the square a pawn that just moved two spaces skipped over
+   std::optional<Square> enPassantSquare() const { return m_en_passant_square; }
+   int halfmoves() const { return m_halfmoves; }
+   int fullmoves() const { return m_fullmoves; }
+
+   // HalfKP feature indices (see nnue.hpp) of every non-king piece, from `perspective`
+   std::vector<int> nnueFeatures(Color perspective) const;
+
+   // keeps an accumulator of `nnue` up to date through doMove/undoMove from now on, so
+   // `evaluate` only has to run its dense layers. nullptr stops
+   void setNnue(const Nnue* nnue);
+   // the NNUE's evaluation of the position for the side to move
+   float evaluate() const;
 
 private:
    static bool squareIsOnBoard(const Square& square);
+   static int squareIndex(const Square& square) { return 8*square.row + square.col; }
+
+   // what `doMove` can't work out from the move when taking it back
+   struct UndoState {
+      Move move;
+      Piece piece;               // the moved piece, before any promotion
+      OptionalPiece captured;
+      Square captured_square;    // differs from the move's end for en passant
+      bool black_kingside_available;
+      bool black_queenside_available;
+      bool white_kingside_available;
+      bool white_queenside_available;
+      std::optional<Square> en_passant_square;
+      int halfmoves;
+      int fullmoves;
+   };
+   std::vector<UndoState> m_history;
+
+   using PlacedPiece = std::pair<Piece, Square>;
+   // pushes the accumulator of the position after `moved` took `removed` off the board
+   // and put `added` on it
+   void pushAccumulator(const Piece& moved, const PlacedPiece* removed, int n_removed, const PlacedPiece* added, int n_added);
+   void refreshAccumulator();
+
+   const Nnue* m_nnue = nullptr;
+   // one per ply since the accumulator was last refreshed, kept allocated between searches
+   std::vector<NnueAccumulator> m_accumulators;
+   size_t m_accumulator_ply = 0;
 
    // returns the intersection of `moves` and `restrictions`
    static std::set<Move> restrictedSubset(const std::set<Move>& moves, const std::optional<std::set<Move>>& restrictions);
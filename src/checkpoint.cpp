@@ -0,0 +1,222 @@
+#include "checkpoint.hpp"
+#include "oclData.hpp"
+#include "errors.hpp"
+#include <bit>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <stdexcept>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// the format is little-endian and written as the host lays it out
+static_assert(std::endian::native == std::endian::little);
+
+static constexpr char CHECKPOINT_MAGIC[8] = "CHESSNN";
+
+static std::uint64_t align_up(std::uint64_t offset)
+{
+   return (offset + CHECKPOINT_ALIGNMENT - 1) / CHECKPOINT_ALIGNMENT * CHECKPOINT_ALIGNMENT;
+}
+
+// FNV-1a over 64 bit words rather than bytes, so checking a large checkpoint stays well under
+// the time it takes to read it. `size` is a multiple of 8, the data section is padded to one
+static std::uint64_t checksum(const unsigned char* data, std::size_t size)
+{
+   std::uint64_t hash = 14695981039346656037ull;
+   for (std::size_t i = 0; i < size; i += 8)
+   {
+      std::uint64_t word;
+      std::memcpy(&word, data + i, 8);
+      hash ^= word;
+      hash *= 1099511628211ull;
+   }
+   return hash;
+}
+
+CheckpointWriter::CheckpointWriter(const std::string& architecture)
+   :m_architecture{architecture}
+{
+}
+
+void CheckpointWriter::tensor(const Mat& mat)
+{
+   m_entries.push_back(CheckpointEntry{0, mat.getHeight(), mat.getWidth(), CHECKPOINT_TENSOR, 0});
+   m_tensors.push_back(mat.getVals());
+}
+
+void CheckpointWriter::count(std::uint64_t value)
+{
+   m_entries.push_back(CheckpointEntry{value, 0, 0, CHECKPOINT_COUNT, 0});
+}
+
+void CheckpointWriter::write(const std::string& path) const
+{
+   CheckpointHeader header{};
+   std::memcpy(header.magic, CHECKPOINT_MAGIC, sizeof(header.magic));
+   header.version = CHECKPOINT_VERSION;
+   header.entry_count = m_entries.size();
+   header.architecture_offset = sizeof(CheckpointHeader);
+   header.architecture_size = m_architecture.size();
+   header.entries_offset = align_up(header.architecture_offset + header.architecture_size);
+   header.data_offset = align_up(header.entries_offset + m_entries.size()*sizeof(CheckpointEntry));
+
+   // everything after the header, laid out in memory first so the checksum can be taken
+   std::vector<CheckpointEntry> entries = m_entries;
+   std::uint64_t offset = header.data_offset;
+   size_t tensor = 0;
+   for (CheckpointEntry& entry : entries)
+   {
+      if (entry.type != CHECKPOINT_TENSOR) continue;
+      entry.value = offset;
+      offset = align_up(offset + m_tensors[tensor++].size()*sizeof(float));
+   }
+
+   std::vector<unsigned char> body(offset - sizeof(CheckpointHeader), 0);
+   auto at = [&body](std::uint64_t file_offset) { return body.data() + file_offset - sizeof(CheckpointHeader); };
+   std::memcpy(at(header.architecture_offset), m_architecture.data(), m_architecture.size());
+   std::memcpy(at(header.entries_offset), entries.data(), entries.size()*sizeof(CheckpointEntry));
+   tensor = 0;
+   for (const CheckpointEntry& entry : entries)
+   {
+      if (entry.type != CHECKPOINT_TENSOR) continue;
+      std::memcpy(at(entry.value), m_tensors[tensor].data(), m_tensors[tensor].size()*sizeof(float));
+      tensor++;
+   }
+   header.checksum = checksum(body.data(), body.size());
+
+   std::ofstream file(path, std::ios::binary | std::ios::trunc);
+   file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+   file.write(reinterpret_cast<const char*>(body.data()), body.size());
+   if (not file) throw std::runtime_error("couldn't write checkpoint " + path);
+}
+
+CheckpointReader::CheckpointReader(const std::string& path, bool verify_checksum)
+{
+   const int fd = open(path.c_str(), O_RDONLY);
+   if (fd < 0) throw std::runtime_error("couldn't open checkpoint " + path);
+   struct stat info;
+   if (fstat(fd, &info) != 0 || static_cast<std::size_t>(info.st_size) < sizeof(CheckpointHeader))
+   {
+      close(fd);
+      throw std::runtime_error("checkpoint " + path + " is truncated");
+   }
+   m_size = info.st_size;
+   m_mapping = mmap(nullptr, m_size, PROT_READ, MAP_PRIVATE, fd, 0);
+   close(fd);
+   if (m_mapping == MAP_FAILED)
+   {
+      m_mapping = nullptr;
+      throw std::runtime_error("couldn't map checkpoint " + path);
+   }
+
+   auto fail = [this, &path](const std::string& reason) {
+      munmap(m_mapping, m_size);
+      m_mapping = nullptr;
+      throw std::runtime_error("checkpoint " + path + ": " + reason);
+   };
+
+   const unsigned char* bytes = static_cast<const unsigned char*>(m_mapping);
+   std::memcpy(&m_header, bytes, sizeof(m_header));
+   if (std::memcmp(m_header.magic, CHECKPOINT_MAGIC, sizeof(m_header.magic)) != 0) fail("not a checkpoint");
+   if (m_header.version != CHECKPOINT_VERSION) fail("unsupported version " + std::to_string(m_header.version));
+   if (m_header.architecture_offset + m_header.architecture_size > m_size ||
+       m_header.entries_offset + m_header.entry_count*sizeof(CheckpointEntry) > m_size ||
+       m_header.entries_offset % alignof(CheckpointEntry) != 0)
+   {
+      fail("truncated");
+   }
+   if (verify_checksum && checksum(bytes + sizeof(CheckpointHeader), m_size - sizeof(CheckpointHeader)) != m_header.checksum)
+   {
+      fail("checksum mismatch");
+   }
+
+   m_entries = reinterpret_cast<const CheckpointEntry*>(bytes + m_header.entries_offset);
+   for (std::uint32_t i = 0; i < m_header.entry_count; i++)
+   {
+      const CheckpointEntry& entry = m_entries[i];
+      if (entry.type == CHECKPOINT_TENSOR && entry.value + std::uint64_t(entry.height)*entry.width*sizeof(float) > m_size)
+      {
+         fail("truncated");
+      }
+   }
+
+   // sent while the tensors are being uploaded
+   madvise(m_mapping, m_size, MADV_SEQUENTIAL);
+}
+
+CheckpointReader::~CheckpointReader()
+{
+   if (not m_uploads.empty())
+   {
+      try {
+         cl::Event::waitForEvents(m_uploads);
+      }
+      catch(cl::Error& err) {
+         std::cout << "Error in checkpoint upload: " << err.what() << "(" << getErrorString(err.err()) << ")" << std::endl;
+      }
+   }
+   if (m_mapping) munmap(m_mapping, m_size);
+}
+
+std::string CheckpointReader::architecture() const
+{
+   return std::string(static_cast<const char*>(m_mapping) + m_header.architecture_offset, m_header.architecture_size);
+}
+
+const CheckpointEntry& CheckpointReader::next(CheckpointEntryType type)
+{
+   if (done()) throw std::runtime_error("checkpoint has fewer entries than the net saves");
+   const CheckpointEntry& entry = m_entries[m_next];
+   if (entry.type != type) throw std::runtime_error("checkpoint entry " + std::to_string(m_next) + " has the wrong type");
+   m_next++;
+   return entry;
+}
+
+void CheckpointReader::skip()
+{
+   if (done()) throw std::runtime_error("checkpoint has fewer entries than the net saves");
+   m_next++;
+}
+
+void CheckpointReader::tensor(Mat& mat)
+{
+   const CheckpointEntry& entry = next(CHECKPOINT_TENSOR);
+   const std::size_t N_ELEMENTS = std::size_t(mat.m_height)*mat.m_width;
+   if (std::size_t(entry.height)*entry.width != N_ELEMENTS)
+   {
+      throw std::runtime_error("checkpoint tensor " + std::to_string(m_next - 1) + " is " + std::to_string(entry.height) + "x" +
+                               std::to_string(entry.width) + ", expected " + std::to_string(N_ELEMENTS) + " elements");
+   }
+   const float* vals = reinterpret_cast<const float*>(static_cast<const char*>(m_mapping) + entry.value);
+   if (mat_backend == CPU_BACKEND)
+   {
+      std::memcpy(mat.m_host->data(), vals, N_ELEMENTS*sizeof(float));
+      return;
+   }
+   try {
+      // the mapping stays alive until every upload from it has completed
+      auto deps = ocl_wait_list({mat.m_event});
+      ocl_transfer_queue.enqueueWriteBuffer( mat.m_buffer, CL_FALSE, 0, N_ELEMENTS*sizeof(float), vals, &deps, &mat.m_event );
+      ocl_transfer_queue.flush();
+      m_uploads.push_back(mat.m_event);
+   }
+   catch(cl::Error& err) {
+      std::cout << "Error in checkpoint tensor: " << err.what() << "(" << getErrorString(err.err()) << ")" << std::endl;
+   }
+}
+
+Mat CheckpointReader::tensor()
+{
+   if (done()) throw std::runtime_error("checkpoint has fewer entries than the net saves");
+   Mat mat = Mat::zeros(m_entries[m_next].height, m_entries[m_next].width);
+   tensor(mat);
+   return mat;
+}
+
+std::uint64_t CheckpointReader::count()
+{
+   return next(CHECKPOINT_COUNT).value;
+}
@@ -0,0 +1,100 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include "mat.hpp"
+
+// Binary checkpoints, little-endian:
+//
+//   CheckpointHeader                  64 bytes
+//   architecture                      text, one Layer::describe() line per layer
+//   CheckpointEntry[entry_count]      what each layer saved, in order
+//   data                              every tensor's floats, each starting on a 64 byte boundary
+//
+// The checksum covers everything after the header. Loading maps the file and uploads the
+// tensors to their buffers straight from the mapping
+constexpr std::uint32_t CHECKPOINT_VERSION = 1;
+constexpr std::size_t CHECKPOINT_ALIGNMENT = 64;
+
+struct CheckpointHeader
+{
+   char magic[8];                      // "CHESSNN\0"
+   std::uint32_t version;
+   std::uint32_t entry_count;
+   std::uint64_t architecture_offset;
+   std::uint64_t architecture_size;
+   std::uint64_t entries_offset;
+   std::uint64_t data_offset;
+   std::uint64_t checksum;
+   std::uint64_t reserved;
+};
+static_assert(sizeof(CheckpointHeader) == 64);
+
+enum CheckpointEntryType : std::uint32_t
+{
+   CHECKPOINT_TENSOR = 0,  // `height` x `width` floats at `value`, an offset into the file
+   CHECKPOINT_COUNT = 1    // just `value`, eg. an optimizer's step count
+};
+
+struct CheckpointEntry
+{
+   std::uint64_t value;
+   std::uint32_t height;
+   std::uint32_t width;
+   std::uint32_t type;
+   std::uint32_t reserved;
+};
+static_assert(sizeof(CheckpointEntry) == 24);
+
+// collects what the layers save, then writes it all out at once
+class CheckpointWriter
+{
+public:
+   CheckpointWriter(const std::string& architecture);
+
+   void tensor(const Mat& mat);
+   void count(std::uint64_t value);
+
+   // throws std::runtime_error when the file can't be written
+   void write(const std::string& path) const;
+
+private:
+   std::string m_architecture;
+   std::vector<CheckpointEntry> m_entries;
+   std::vector<std::vector<float>> m_tensors;
+};
+
+// reads back what a CheckpointWriter wrote, in the same order. Throws std::runtime_error when
+// the file is missing, corrupt or doesn't hold what's asked of it
+class CheckpointReader
+{
+public:
+   CheckpointReader(const std::string& path, bool verify_checksum = true);
+   // waits for the uploads reading from the mapping before unmapping it
+   ~CheckpointReader();
+   CheckpointReader(const CheckpointReader&) = delete;
+   CheckpointReader& operator=(const CheckpointReader&) = delete;
+
+   std::string architecture() const;
+
+   // the next entry into `mat`, which must have as many elements
+   void tensor(Mat& mat);
+   // the next entry into a new Mat of the shape it was saved with
+   Mat tensor();
+   std::uint64_t count();
+   // past the next entry, whatever it is
+   void skip();
+
+   bool done() const { return m_next == m_header.entry_count; }
+
+private:
+   const CheckpointEntry& next(CheckpointEntryType type);
+
+   void* m_mapping = nullptr;
+   std::size_t m_size = 0;
+   CheckpointHeader m_header;
+   const CheckpointEntry* m_entries = nullptr;
+   std::uint32_t m_next = 0;
+   std::vector<cl::Event> m_uploads;
+};
@@ -4,6 +4,38 @@
 #include "parallelMat.hpp"
 #include "oclData.hpp"
 #include "errors.hpp"
+#include "cpuKernels.hpp"
+#include "halfMat.hpp"
+#include "int8Mat.hpp"
+#include "optimizer.hpp"
+#include "checkpoint.hpp"
+#include <algorithm>
+
+// scratch buffers of the GEMM paths are kept under this many floats by splitting the batch
+static constexpr size_t CONV_SCRATCH_FLOATS = 1 << 24;
+static constexpr int MATMUL_TILE = 16;
+
+// tiled_matmul.cl over `batch` pairs of matrices, see the kernel for the arguments
+static void enqueueTiledMatmul(const cl::Buffer& A, const cl::Buffer& B, const cl::Buffer& C,
+                               int M, int K, int N, int batch, int A_stride, int B_stride, int B_start, int C_start,
+                               const std::vector<cl::Event>* deps, cl::Event* event)
+{
+   tiled_matmul_kernel.setArg( 0, A );
+   tiled_matmul_kernel.setArg( 1, B );
+   tiled_matmul_kernel.setArg( 2, C );
+   tiled_matmul_kernel.setArg( 3, M );
+   tiled_matmul_kernel.setArg( 4, K );
+   tiled_matmul_kernel.setArg( 5, N );
+   tiled_matmul_kernel.setArg( 6, A_stride );
+   tiled_matmul_kernel.setArg( 7, B_stride );
+   tiled_matmul_kernel.setArg( 8, B_start );
+   tiled_matmul_kernel.setArg( 9, C_start );
+
+   auto round_up = [](int n) { return (n + MATMUL_TILE - 1) / MATMUL_TILE * MATMUL_TILE; };
+   cl::NDRange global( round_up(N), round_up(M), batch );
+   cl::NDRange local( MATMUL_TILE, MATMUL_TILE, 1 );
+   ocl_queue.enqueueNDRangeKernel( tiled_matmul_kernel, cl::NullRange, global, local, deps, event );
+}
 
 
 ConvKernel::ConvKernel (unsigned channels,
@@ -22,11 +54,17 @@ ConvKernel::ConvKernel (unsigned channels,
    ,m_input_height{input_height}
    ,m_input_width{input_width}
 {
-   assert(vals.getWidth() == 1);
-   assert(vals.getHeight() == kernel_height*kernel_width*filters);
+   // [filters][channels][kernel_height][kernel_width], in any matrix shape
+   assert(vals.getWidth()*vals.getHeight() == weightCount());
 
-   m_buffer = cl::Buffer(ocl_context, CL_MEM_READ_WRITE, (kernel_height*kernel_width*filters)*sizeof(float));
-   ocl_queue.enqueueCopyBuffer(vals.m_buffer, m_buffer, 0, 0, (kernel_height*kernel_width*filters)*sizeof(float));
+   if (mat_backend == CPU_BACKEND)
+   {
+      m_host = std::make_shared<std::vector<float>>(*vals.m_host);
+      return;
+   }
+   m_buffer = cl::Buffer(ocl_context, CL_MEM_READ_WRITE, weightCount()*sizeof(float));
+   auto deps = ocl_wait_list({vals.m_event});
+   ocl_queue.enqueueCopyBuffer(vals.m_buffer, m_buffer, 0, 0, weightCount()*sizeof(float), &deps, &m_event);
 }
 
 ConvKernel::ConvKernel (unsigned channels,
@@ -36,7 +74,8 @@ ConvKernel::ConvKernel (unsigned channels,
                         Padding padding,
                         unsigned input_height,
                         unsigned input_width,
-                        const cl::Buffer& vals)
+                        const cl::Buffer& vals,
+                        const cl::Event& vals_event)
    :m_channels{channels}
    ,m_height{kernel_height}
    ,m_width{kernel_width}
@@ -45,8 +84,53 @@ ConvKernel::ConvKernel (unsigned channels,
    ,m_input_height{input_height}
    ,m_input_width{input_width}
 {
-   m_buffer = cl::Buffer(ocl_context, CL_MEM_READ_WRITE, (kernel_height*kernel_width*filters)*sizeof(float));
-   ocl_queue.enqueueCopyBuffer(vals, m_buffer, 0, 0, (kernel_height*kernel_width*filters)*sizeof(float));
+   m_buffer = cl::Buffer(ocl_context, CL_MEM_READ_WRITE, weightCount()*sizeof(float));
+   auto deps = ocl_wait_list({vals_event});
+   ocl_queue.enqueueCopyBuffer(vals, m_buffer, 0, 0, weightCount()*sizeof(float), &deps, &m_event);
+}
+
+ConvKernel::ConvKernel (unsigned channels,
+                        unsigned kernel_height,
+                        unsigned kernel_width,
+                        unsigned filters,
+                        Padding padding,
+                        unsigned input_height,
+                        unsigned input_width,
+                        HostBuffer vals)
+   :m_host{std::move(vals)}
+   ,m_channels{channels}
+   ,m_height{kernel_height}
+   ,m_width{kernel_width}
+   ,m_padding{padding}
+   ,m_filters{filters}
+   ,m_input_height{input_height}
+   ,m_input_width{input_width}
+{
+}
+
+ConvAlgorithm ConvKernel::algorithm(unsigned count) const
+{
+   const bool winograd_possible = (m_height == 3 && m_width == 3);
+   if (m_algorithm == CONV_WINOGRAD && not winograd_possible) return CONV_IM2COL_GEMM;
+   if (m_algorithm != CONV_AUTO) return m_algorithm;
+
+   auto [output_h, output_w] = getOutputHeightWidth();
+   // Winograd does 16 multiplies per 2x2 outputs instead of 36, its transforms are only
+   // paid back once there are enough channels and filters to share them
+   if (winograd_possible && output_h >= 2 && output_w >= 2 && m_channels*m_filters >= 16) return CONV_WINOGRAD;
+
+   // the GEMM reuses each loaded patch across every filter, the direct kernel wins when
+   // there is too little work to fill the tiles
+   const size_t macs = size_t(count)*output_h*output_w*m_height*m_width*m_channels*m_filters;
+   if (m_filters >= 8 && macs >= (1 << 16)) return CONV_IM2COL_GEMM;
+   return CONV_DIRECT;
+}
+
+ConvLayout ConvKernel::layout() const
+{
+   if (m_layout != CONV_LAYOUT_AUTO) return m_layout;
+   // below 4 channels the blocks would be mostly padding
+   return m_channels >= 4 ? CONV_LAYOUT_NHWC4 : CONV_LAYOUT_NCHW;
 }
 
 std::pair<unsigned,unsigned> ConvKernel::getOutputHeightWidth(
@@ -91,10 +175,29 @@ ParallelMat ConvKernel::operator* (const ParallelMat &other) const
    auto [output_h, output_w] = getOutputHeightWidth();
 
    int N_ELEMENTS = output_h*output_w*filters*other.m_count;
+   if (mat_backend == CPU_BACKEND)
+   {
+      auto [padded_h, padded_w] = getPaddedHeightWidth();
+      HostBuffer padded = hostPad(other.hostData(), other.getCount());
+      auto out = std::make_shared<std::vector<float>>(N_ELEMENTS);
+      cpu_convolution(m_host->data(), padded ? padded->data() : other.hostData(), out->data(),
+                      m_width, m_height, padded_w, padded_h, m_channels, m_filters, output_w, output_h, other.getCount());
+      return ParallelMat(output_w*output_h*filters, 1, other.m_count, out);
+   }
    cl::NDRange global( N_ELEMENTS );
-   cl::Buffer in_buffer = parallelPad(other.m_buffer, other.getCount());
-   auto [padded_h, padded_w] = getPaddedHeightWidth();
+   cl::Buffer other_buffer = other.buffer();
    cl::Buffer out_buffer(ocl_context, CL_MEM_READ_WRITE, N_ELEMENTS*sizeof(float));
+   cl::Event out_event;
+
+   const ConvAlgorithm conv_algorithm = algorithm(other.getCount());
+   if (conv_algorithm == CONV_DIRECT && layout() == CONV_LAYOUT_NHWC4)
+   {
+      nhwc4Convolution(other_buffer, out_buffer, other.getCount(), ocl_wait_list({m_event, other.m_event}), &out_event);
+      return ParallelMat(output_w*output_h*filters, 1, other.m_count, out_buffer, out_event);
+   }
+
+   cl::Buffer in_buffer = parallelPad(other_buffer, other.m_event, other.getCount());
+   auto [padded_h, padded_w] = getPaddedHeightWidth();
        
    try {
       parallel_convolution_kernel.setArg( 0,  m_buffer );
@@ -109,12 +212,19 @@ ParallelMat ConvKernel::operator* (const ParallelMat &other) const
       parallel_convolution_kernel.setArg( 9,  static_cast<cl_int>(output_w));
       parallel_convolution_kernel.setArg( 10, static_cast<cl_int>(output_h));
 
-      ocl_queue.enqueueNDRangeKernel( parallel_convolution_kernel, cl::NullRange, global );
+      auto deps = ocl_wait_list({m_event, other.m_event});
+
+      switch (conv_algorithm)
+      {
+         case CONV_WINOGRAD: winogradConvolution(in_buffer, out_buffer, other.getCount(), deps, &out_event); break;
+         case CONV_IM2COL_GEMM: im2colConvolution(in_buffer, out_buffer, other.getCount(), deps, &out_event); break;
+         default: ocl_queue.enqueueNDRangeKernel( parallel_convolution_kernel, cl::NullRange, global, cl::NullRange, &deps, &out_event );
+      }
    }
    catch(cl::Error& err) {
       std::cout << "Error in convKernel parallel convolution: " << err.what() << "(" << getErrorString(err.err()) << ")" << std::endl;
    }
-   return ParallelMat(output_w*output_h*filters, 1, other.m_count, out_buffer);
+   return ParallelMat(output_w*output_h*filters, 1, other.m_count, out_buffer, out_event);
 }
 
 Mat ConvKernel::operator* (const Mat &other) const
@@ -126,11 +236,26 @@ Mat ConvKernel::operator* (const Mat &other) const
    auto [output_h, output_w] = getOutputHeightWidth();
 
    int N_ELEMENTS = output_h*output_w*m_filters;
+   if (mat_backend == CPU_BACKEND)
+   {
+      auto [padded_h, padded_w] = getPaddedHeightWidth();
+      HostBuffer padded = hostPad(other.m_host->data(), 1);
+      auto out = std::make_shared<std::vector<float>>(N_ELEMENTS);
+      cpu_convolution(m_host->data(), padded ? padded->data() : other.m_host->data(), out->data(),
+                      m_width, m_height, padded_w, padded_h, m_channels, m_filters, output_w, output_h, 1);
+      return Mat(output_w*output_h*filters, 1, out);
+   }
+   if (algorithm(1) != CONV_DIRECT || layout() == CONV_LAYOUT_NHWC4)
+   {
+      return (*this * ParallelMat(other.m_height, other.m_width, 1, other.m_buffer, other.m_event)).at(0);
+   }
    cl::NDRange global( N_ELEMENTS );
-   cl::Buffer in_buffer = pad(other.m_buffer);
+   cl::Buffer in_buffer = pad(other.m_buffer, other.m_event);
    auto [padded_h, padded_w] = getPaddedHeightWidth();
 
    cl::Buffer out_buffer(ocl_context, CL_MEM_READ_WRITE, N_ELEMENTS*sizeof(float));
+
+   cl::Event out_event;
        
    try {
       convolution_kernel.setArg( 0,  m_buffer );
@@ -145,133 +270,312 @@ Mat ConvKernel::operator* (const Mat &other) const
       convolution_kernel.setArg( 9,  static_cast<cl_int>(output_w));
       convolution_kernel.setArg( 10, static_cast<cl_int>(output_h));
 
-      ocl_queue.enqueueNDRangeKernel( convolution_kernel, cl::NullRange, global );
+      auto deps = ocl_wait_list({m_event, other.m_event});
+
+      ocl_queue.enqueueNDRangeKernel( convolution_kernel, cl::NullRange, global, cl::NullRange, &deps, &out_event );
    }
    catch(cl::Error& err) {
       std::cout << "Error in convKernel convolution: " << err.what() << "(" << getErrorString(err.err()) << ")" << std::endl;
    }
-   return Mat(output_w*output_h*filters, 1, out_buffer);
+   return Mat(output_w*output_h*filters, 1, out_buffer, out_event);
 }
 
 
-Mat ConvKernel::operator^(const Mat& other) const
+ParallelMat ConvKernel::convolveHalf(const ParallelMat& other, StoragePrecision precision) const
 {
+   if (mat_backend == CPU_BACKEND || precision == STORAGE_FP32) return *this * other;
+
    auto [output_h, output_w] = getOutputHeightWidth();
-   cl::Buffer out_buffer = [this, other, &output_h, &output_w](){
-      if (m_padding == SAME) 
+   auto [padded_h, padded_w] = getPaddedHeightWidth();
+   const unsigned num = other.getCount();
+   const unsigned ROWS = m_channels*m_height*m_width;
+   const unsigned COLS = output_h*output_w;
+   const unsigned CHUNK = std::clamp<size_t>(CONV_SCRATCH_FLOATS / (ROWS*COLS), 1, num);
+   const unsigned N_ELEMENTS = m_filters*COLS*num;
+
+   if (m_half_precision != precision)
+   {
+      m_half = ocl_to_half(m_buffer, m_event, weightCount(), precision, &m_half_event);
+      m_half_precision = precision;
+   }
+
+   cl::Buffer padded = parallelPad(other.buffer(), other.m_event, num);
+   cl::Buffer cols(ocl_context, CL_MEM_READ_WRITE, CHUNK*ROWS*COLS*sizeof(std::uint16_t));
+   cl::Buffer out_buffer(ocl_context, CL_MEM_READ_WRITE, N_ELEMENTS*sizeof(float));
+   cl::Event out_event;
+
+   try {
+      // the weights may have been converted on another device's queue
+      auto deps = ocl_wait_list({other.m_event, m_half_event});
+      for (unsigned first = 0; first < num; first += CHUNK)
       {
-         output_w += m_width - 1;
-         output_h += m_height - 1;
-         return pad(other.m_buffer);
+         const unsigned count = std::min(CHUNK, num - first);
+
+         parallel_im2col_half_kernel.setArg( 0,  padded );
+         parallel_im2col_half_kernel.setArg( 1,  cols );
+         parallel_im2col_half_kernel.setArg( 2,  static_cast<cl_int>(padded_w) );
+         parallel_im2col_half_kernel.setArg( 3,  static_cast<cl_int>(padded_h) );
+         parallel_im2col_half_kernel.setArg( 4,  static_cast<cl_int>(m_channels) );
+         parallel_im2col_half_kernel.setArg( 5,  static_cast<cl_int>(m_width) );
+         parallel_im2col_half_kernel.setArg( 6,  static_cast<cl_int>(m_height) );
+         parallel_im2col_half_kernel.setArg( 7,  static_cast<cl_int>(output_w) );
+         parallel_im2col_half_kernel.setArg( 8,  static_cast<cl_int>(output_h) );
+         parallel_im2col_half_kernel.setArg( 9,  static_cast<cl_int>(first) );
+         parallel_im2col_half_kernel.setArg( 10, static_cast<cl_int>(precision == STORAGE_BF16) );
+         ocl_queue.enqueueNDRangeKernel( parallel_im2col_half_kernel, cl::NullRange, cl::NDRange(count*ROWS*COLS), cl::NullRange, (first == 0 ? &deps : nullptr) );
+
+         ocl_tiled_matmul_half(m_half, cols, out_buffer, m_filters, ROWS, COLS, count, 0, ROWS*COLS, 0, first*m_filters*COLS, precision, nullptr, &out_event);
       }
-      else
-      {
-         int w_padding = m_width - 1;
-         int h_padding = m_height - 1;
-
-         int l = (w_padding+1) / 2;
-         int r = w_padding / 2;
-         int u = (h_padding+1) / 2;
-         int d = h_padding / 2;
+   }
+   catch(cl::Error& err) {
+      std::cout << "Error in convKernel half convolution: " << err.what() << "(" << getErrorString(err.err()) << ")" << std::endl;
+   }
+   return ParallelMat(COLS*m_filters, 1, num, out_buffer, out_event);
+}
 
-         output_w += l + r;
-         output_h += u + d;
+Mat ConvKernel::convolveHalf(const Mat& other, StoragePrecision precision) const
+{
+   if (mat_backend == CPU_BACKEND || precision == STORAGE_FP32) return *this * other;
+   return convolveHalf(ParallelMat(other.m_height, other.m_width, 1, other.m_buffer, other.m_event), precision).at(0);
+}
 
-         return pad(other.m_buffer, l, r, u, d);
-      }
-   }();
+ParallelMat ConvKernel::convolveInt8(const ParallelMat& other, const Int8Mat& weights, float input_scale) const
+{
+   assert(weights.getHeight() == m_filters && weights.getWidth() == m_channels*m_height*m_width);
 
-   cl_int convkernel_w = m_width;
-   cl_int convkernel_h = m_height;
-   cl_int channels = m_channels;
-   cl_int filters = m_filters;
+   auto [output_h, output_w] = getOutputHeightWidth();
+   auto [padded_h, padded_w] = getPaddedHeightWidth();
+   const unsigned num = other.getCount();
+   const unsigned ROWS = m_channels*m_height*m_width;
+   const unsigned COLS = output_h*output_w;
+   const unsigned N_ELEMENTS = m_filters*COLS*num;
+
+   if (mat_backend == CPU_BACKEND)
+   {
+      HostBuffer padded = hostPad(other.hostData(), num);
+      std::vector<std::int8_t> cols(static_cast<size_t>(ROWS)*COLS*num);
+      cpu_im2col_int8(padded ? padded->data() : other.hostData(), cols.data(), input_scale, m_width, m_height,
+                      padded_w, padded_h, m_channels, output_w, output_h, num);
+      auto out = std::make_shared<std::vector<float>>(N_ELEMENTS);
+      cpu_int8_matmul(weights.m_host->data(), weights.m_host_scales->data(), cols.data(), out->data(), input_scale,
+                      m_filters, ROWS, COLS, num);
+      return ParallelMat(COLS*m_filters, 1, num, out);
+   }
 
-   int N_ELEMENTS = m_input_height*m_input_width*m_channels;
-   cl::NDRange global( N_ELEMENTS );
+   // int8 columns take a quarter of the float ones, so four times as many inputs fit the scratch
+   const unsigned CHUNK = std::clamp<size_t>(4*CONV_SCRATCH_FLOATS / (ROWS*COLS), 1, num);
+   cl::Buffer padded = parallelPad(other.buffer(), other.m_event, num);
+   cl::Buffer cols(ocl_context, CL_MEM_READ_WRITE, CHUNK*ROWS*COLS);
+   cl::Buffer out_buffer(ocl_context, CL_MEM_READ_WRITE, N_ELEMENTS*sizeof(float));
+   cl::Event out_event;
 
-   cl::Buffer in_buffer(ocl_context, CL_MEM_READ_WRITE, N_ELEMENTS*sizeof(float));
-       
    try {
-      transpose_conv_kernel.setArg( 0,  m_buffer );
-      transpose_conv_kernel.setArg( 1,  in_buffer);
-      transpose_conv_kernel.setArg( 2,  out_buffer );
-      transpose_conv_kernel.setArg( 3,  convkernel_w );
-      transpose_conv_kernel.setArg( 4,  convkernel_h );
-      transpose_conv_kernel.setArg( 5,  static_cast<cl_int>(m_input_width));
-      transpose_conv_kernel.setArg( 6,  static_cast<cl_int>(m_input_height));
-      transpose_conv_kernel.setArg( 7,  channels );
-      transpose_conv_kernel.setArg( 8,  filters );
-      transpose_conv_kernel.setArg( 9,  static_cast<cl_int>(output_w));
-      transpose_conv_kernel.setArg( 10, static_cast<cl_int>(output_h));
-
-      ocl_queue.enqueueNDRangeKernel( transpose_conv_kernel, cl::NullRange, global );
+      auto deps = ocl_wait_list({other.m_event, weights.m_event, weights.m_scales_event});
+      for (unsigned first = 0; first < num; first += CHUNK)
+      {
+         const unsigned count = std::min(CHUNK, num - first);
+
+         parallel_im2col_int8_kernel.setArg( 0,  padded );
+         parallel_im2col_int8_kernel.setArg( 1,  cols );
+         parallel_im2col_int8_kernel.setArg( 2,  static_cast<cl_int>(padded_w) );
+         parallel_im2col_int8_kernel.setArg( 3,  static_cast<cl_int>(padded_h) );
+         parallel_im2col_int8_kernel.setArg( 4,  static_cast<cl_int>(m_channels) );
+         parallel_im2col_int8_kernel.setArg( 5,  static_cast<cl_int>(m_width) );
+         parallel_im2col_int8_kernel.setArg( 6,  static_cast<cl_int>(m_height) );
+         parallel_im2col_int8_kernel.setArg( 7,  static_cast<cl_int>(output_w) );
+         parallel_im2col_int8_kernel.setArg( 8,  static_cast<cl_int>(output_h) );
+         parallel_im2col_int8_kernel.setArg( 9,  static_cast<cl_int>(first) );
+         parallel_im2col_int8_kernel.setArg( 10, input_scale );
+         ocl_queue.enqueueNDRangeKernel( parallel_im2col_int8_kernel, cl::NullRange, cl::NDRange(count*ROWS*COLS), cl::NullRange, (first == 0 ? &deps : nullptr) );
+
+         ocl_int8_matmul(weights.m_buffer, weights.m_scales, cols, out_buffer, input_scale, m_filters, ROWS, COLS, count, first*m_filters*COLS, nullptr, &out_event);
+      }
    }
    catch(cl::Error& err) {
-      std::cout << "Error in convKernel convolution: " << err.what() << "(" << getErrorString(err.err()) << ")" << std::endl;
+      std::cout << "Error in convKernel int8 convolution: " << err.what() << "(" << getErrorString(err.err()) << ")" << std::endl;
+   }
+   return ParallelMat(COLS*m_filters, 1, num, out_buffer, out_event);
+}
+
+Mat ConvKernel::convolveInt8(const Mat& other, const Int8Mat& weights, float input_scale) const
+{
+   if (mat_backend == CPU_BACKEND)
+   {
+      return convolveInt8(ParallelMat(other.m_height, other.m_width, 1, other.m_host), weights, input_scale).at(0);
    }
-   return Mat(N_ELEMENTS, 1, in_buffer);
+   return convolveInt8(ParallelMat(other.m_height, other.m_width, 1, other.m_buffer, other.m_event), weights, input_scale).at(0);
 }
 
+Mat ConvKernel::weights() const
+{
+   if (mat_backend == CPU_BACKEND) return Mat(m_filters, m_channels*m_height*m_width, m_host);
+   return Mat(m_filters, m_channels*m_height*m_width, m_buffer, m_event);
+}
 
-ParallelMat ConvKernel::operator^(const ParallelMat& other) const
+Mat ConvKernel::operator^(const Mat& other) const
 {
    auto [output_h, output_w] = getOutputHeightWidth();
-   cl::Buffer out_buffer = [this, other, &output_h, &output_w](){
-      if (m_padding == SAME) 
-      {
-         output_w += m_width - 1;
-         output_h += m_height - 1;
-         return pad(other.m_buffer);
-      }
-      else
-      {
-         int w_padding = m_width - 1;
-         int h_padding = m_height - 1;
-
-         int l = (w_padding+1) / 2;
-         int r = w_padding / 2;
-         int u = (h_padding+1) / 2;
-         int d = h_padding / 2;
+   if (mat_backend == CPU_BACKEND)
+   {
+      return (*this ^ ParallelMat(output_h*output_w*m_filters, 1, 1, other.m_host)).at(0);
+   }
+   return (*this ^ ParallelMat(output_h*output_w*m_filters, 1, 1, other.m_buffer, other.m_event)).at(0);
+}
 
-         output_w += l + r;
-         output_h += u + d;
+std::array<int,4> ConvKernel::gradientPadding() const
+{
+   const int w = m_width;
+   const int h = m_height;
+   // SAME mirrors the forward padding, VALID needs a full kernel's worth on every side
+   if (m_padding == SAME) return {(w - 1) - w/2, w/2, (h - 1) - h/2, h/2};
+   return {w - 1, w - 1, h - 1, h - 1};
+}
 
-         return pad(other.m_buffer, l, r, u, d);
-      }
-   }();
+ParallelMat ConvKernel::operator^(const ParallelMat& other) const
+{
+   auto [output_h, output_w] = getOutputHeightWidth();
+   // pads the outputs so every input position sees each output it contributed to
+   auto [l, r, u, d] = gradientPadding();
+   const int padded_w = output_w + l + r;
+   const int padded_h = output_h + u + d;
+   const int N_ELEMENTS = m_input_height*m_input_width*m_channels*other.getCount();
+
+   if (mat_backend == CPU_BACKEND)
+   {
+      HostBuffer padded = std::make_shared<std::vector<float>>(padded_w*padded_h*m_filters*other.getCount());
+      cpu_pad(other.hostData(), padded->data(), output_w, output_h, m_filters, l, r, u, d, other.getCount());
+
+      auto in = std::make_shared<std::vector<float>>(N_ELEMENTS);
+      cpu_transpose_convolution(m_host->data(), in->data(), padded->data(), m_width, m_height, m_input_width, m_input_height,
+                                m_channels, m_filters, padded_w, padded_h, other.getCount());
+      return ParallelMat(N_ELEMENTS/other.getCount(), 1, other.getCount(), in);
+   }
 
-   cl_int convkernel_w = m_width;
-   cl_int convkernel_h = m_height;
-   cl_int channels = m_channels;
-   cl_int filters = m_filters;
+   cl::Buffer out_buffer = parallelPad(other.buffer(), other.m_event, other.getCount(), output_w, output_h, m_filters, l, r, u, d);
 
-   int N_ELEMENTS = m_input_height*m_input_width*m_channels*other.getCount();
    cl::NDRange global( N_ELEMENTS );
-
    cl::Buffer in_buffer(ocl_context, CL_MEM_READ_WRITE, N_ELEMENTS*sizeof(float));
+   cl::Event out_event;
        
    try {
       parallel_transpose_conv_kernel.setArg( 0,  m_buffer );
       parallel_transpose_conv_kernel.setArg( 1,  in_buffer);
       parallel_transpose_conv_kernel.setArg( 2,  out_buffer );
-      parallel_transpose_conv_kernel.setArg( 3,  convkernel_w );
-      parallel_transpose_conv_kernel.setArg( 4,  convkernel_h );
+      parallel_transpose_conv_kernel.setArg( 3,  static_cast<cl_int>(m_width) );
+      parallel_transpose_conv_kernel.setArg( 4,  static_cast<cl_int>(m_height) );
       parallel_transpose_conv_kernel.setArg( 5,  static_cast<cl_int>(m_input_width));
       parallel_transpose_conv_kernel.setArg( 6,  static_cast<cl_int>(m_input_height));
-      parallel_transpose_conv_kernel.setArg( 7,  channels );
-      parallel_transpose_conv_kernel.setArg( 8,  filters );
-      parallel_transpose_conv_kernel.setArg( 9,  static_cast<cl_int>(output_w));
-      parallel_transpose_conv_kernel.setArg( 10, static_cast<cl_int>(output_h));
+      parallel_transpose_conv_kernel.setArg( 7,  static_cast<cl_int>(m_channels) );
+      parallel_transpose_conv_kernel.setArg( 8,  static_cast<cl_int>(m_filters) );
+      parallel_transpose_conv_kernel.setArg( 9,  static_cast<cl_int>(padded_w));
+      parallel_transpose_conv_kernel.setArg( 10, static_cast<cl_int>(padded_h));
+
+      // the padding was enqueued after waiting on `other`, the in-order queue covers the rest
+      auto deps = ocl_wait_list({m_event});
 
-      ocl_queue.enqueueNDRangeKernel( parallel_transpose_conv_kernel, cl::NullRange, global );
+      ocl_queue.enqueueNDRangeKernel( parallel_transpose_conv_kernel, cl::NullRange, global, cl::NullRange, &deps, &out_event );
    }
    catch(cl::Error& err) {
-      std::cout << "Error in convKernel convolution: " << err.what() << "(" << getErrorString(err.err()) << ")" << std::endl;
+      std::cout << "Error in convKernel transpose convolution: " << err.what() << "(" << getErrorString(err.err()) << ")" << std::endl;
    }
-   return ParallelMat(N_ELEMENTS/other.getCount(), 1, other.getCount(), in_buffer);
+   return ParallelMat(N_ELEMENTS/other.getCount(), 1, other.getCount(), in_buffer, out_event);
 }
 
-cl::Buffer ConvKernel::pad(const cl::Buffer& input) const
+void ConvKernel::addWeightGradient(Mat& gradient, const ParallelMat& input, const ParallelMat& delta) const
+{
+   assert(input.getCount() == delta.getCount());
+   assert(gradient.getWidth()*gradient.getHeight() == weightCount());
+   auto [output_h, output_w] = getOutputHeightWidth();
+   auto [padded_h, padded_w] = getPaddedHeightWidth();
+   const unsigned N_ELEMENTS = weightCount();
+
+   if (mat_backend == CPU_BACKEND)
+   {
+      HostBuffer padded = hostPad(input.hostData(), input.getCount());
+      cpu_conv_weight_gradient(padded ? padded->data() : input.hostData(), delta.hostData(), gradient.m_host->data(), m_width, m_height,
+                               padded_w, padded_h, m_channels, m_filters, output_w, output_h, input.getCount());
+      return;
+   }
+
+   cl::Buffer in_buffer = parallelPad(input.buffer(), input.m_event, input.getCount());
+
+   try {
+      parallel_conv_weight_gradient_kernel.setArg( 0,  in_buffer );
+      parallel_conv_weight_gradient_kernel.setArg( 1,  delta.buffer() );
+      parallel_conv_weight_gradient_kernel.setArg( 2,  gradient.m_buffer );
+      parallel_conv_weight_gradient_kernel.setArg( 3,  static_cast<cl_int>(m_width) );
+      parallel_conv_weight_gradient_kernel.setArg( 4,  static_cast<cl_int>(m_height) );
+      parallel_conv_weight_gradient_kernel.setArg( 5,  static_cast<cl_int>(padded_w) );
+      parallel_conv_weight_gradient_kernel.setArg( 6,  static_cast<cl_int>(padded_h) );
+      parallel_conv_weight_gradient_kernel.setArg( 7,  static_cast<cl_int>(m_channels) );
+      parallel_conv_weight_gradient_kernel.setArg( 8,  static_cast<cl_int>(m_filters) );
+      parallel_conv_weight_gradient_kernel.setArg( 9,  static_cast<cl_int>(output_w) );
+      parallel_conv_weight_gradient_kernel.setArg( 10, static_cast<cl_int>(output_h) );
+      parallel_conv_weight_gradient_kernel.setArg( 11, static_cast<cl_int>(input.getCount()) );
+
+      auto deps = ocl_wait_list({gradient.m_event, input.m_event, delta.m_event});
+
+      ocl_queue.enqueueNDRangeKernel( parallel_conv_weight_gradient_kernel, cl::NullRange, cl::NDRange(N_ELEMENTS), cl::NullRange, &deps, &gradient.m_event );
+   }
+   catch(cl::Error& err) {
+      std::cout << "Error in convKernel weight gradient: " << err.what() << "(" << getErrorString(err.err()) << ")" << std::endl;
+   }
+}
+
+const ConvKernel& ConvKernel::weights_eq_op(char op, const Mat& vals)
+{
+   assert(vals.getWidth()*vals.getHeight() == weightCount());
+
+   // the weights seen as a matrix of the same shape as `vals`, so Mat does the update in place
+   if (mat_backend == CPU_BACKEND)
+   {
+      Mat weights(vals.getHeight(), vals.getWidth(), m_host);
+      weights.mat_add_sub_dot_eq_op(op, vals);
+      return *this;
+   }
+
+   Mat weights(vals.getHeight(), vals.getWidth(), m_buffer, m_event);
+   weights.mat_add_sub_dot_eq_op(op, vals);
+   weightsChanged(weights.m_event);
+   return *this;
+}
+
+void ConvKernel::step(ParameterOptimizer& optimizer, Mat& grads, float learning_rate, float grad_scale)
+{
+   assert(grads.getWidth()*grads.getHeight() == weightCount());
+   Mat view = weights();
+   optimizer.step(view, grads, learning_rate, grad_scale);
+   if (mat_backend != CPU_BACKEND) weightsChanged(view.m_event);
+}
+
+std::string ConvKernel::describe() const
+{
+   return std::to_string(m_input_height) + " " + std::to_string(m_input_width) + " " + std::to_string(m_channels) + " " +
+          std::to_string(m_height) + " " + std::to_string(m_width) + " " + std::to_string(m_filters) + " " +
+          (m_padding == SAME ? "same" : "valid");
+}
+
+void ConvKernel::save(CheckpointWriter& writer) const
+{
+   writer.tensor(weights());
+}
+
+void ConvKernel::load(CheckpointReader& reader)
+{
+   Mat view = weights();
+   reader.tensor(view);
+   if (mat_backend != CPU_BACKEND) weightsChanged(view.m_event);
+}
+
+void ConvKernel::weightsChanged(const cl::Event& event)
+{
+   m_event = event;
+   // repacked and reconverted from the new weights the next time they're needed
+   m_packed = cl::Buffer();
+   m_half_precision = STORAGE_FP32;
+}
+
+cl::Buffer ConvKernel::pad(const cl::Buffer& input, const cl::Event& input_event) const
 {  
    if (m_padding == VALID) return input;
 
@@ -280,10 +584,10 @@ cl::Buffer ConvKernel::pad(const cl::Buffer& input) const
    cl_int u = m_height / 2;
    cl_int d = (m_height - 1) - u;
 
-   return pad(input, l, r, u, d);
+   return pad(input, input_event, l, r, u, d);
 }
 
-cl::Buffer ConvKernel::parallelPad(const cl::Buffer& input, int num) const
+cl::Buffer ConvKernel::parallelPad(const cl::Buffer& input, const cl::Event& input_event, int num) const
 {  
    if (m_padding == VALID) return input;
 
@@ -292,11 +596,188 @@ cl::Buffer ConvKernel::parallelPad(const cl::Buffer& input, int num) const
    int u = m_height / 2;
    int d = (m_height - 1) - u;
 
-   return parallelPad(input, num, l, r, u, d);
+   return parallelPad(input, input_event, num, l, r, u, d);
 }
 
 
-cl::Buffer ConvKernel::pad(const cl::Buffer& input, int l, int r, int u, int d) const
+void ConvKernel::im2colConvolution(const cl::Buffer& padded, const cl::Buffer& out, unsigned num, const std::vector<cl::Event>& deps, cl::Event* event) const
+{
+   auto [output_h, output_w] = getOutputHeightWidth();
+   auto [padded_h, padded_w] = getPaddedHeightWidth();
+   const unsigned KERNEL_ELEMENTS = m_height*m_width;
+   const unsigned ROWS = m_channels*KERNEL_ELEMENTS;
+   const unsigned COLS = output_h*output_w;
+   const unsigned CHUNK = std::clamp<size_t>(CONV_SCRATCH_FLOATS / (ROWS*COLS), 1, num);
+
+   cl::Buffer cols(ocl_context, CL_MEM_READ_WRITE, CHUNK*ROWS*COLS*sizeof(float));
+
+   try {
+      // the column buffer is reused by every chunk, the in-order queue keeps the next
+      // im2col from overwriting it before the GEMM has read it
+      for (unsigned first = 0; first < num; first += CHUNK)
+      {
+         const unsigned count = std::min(CHUNK, num - first);
+
+         parallel_im2col_kernel.setArg( 0, padded );
+         parallel_im2col_kernel.setArg( 1, cols );
+         parallel_im2col_kernel.setArg( 2, static_cast<cl_int>(padded_w) );
+         parallel_im2col_kernel.setArg( 3, static_cast<cl_int>(padded_h) );
+         parallel_im2col_kernel.setArg( 4, static_cast<cl_int>(m_channels) );
+         parallel_im2col_kernel.setArg( 5, static_cast<cl_int>(m_width) );
+         parallel_im2col_kernel.setArg( 6, static_cast<cl_int>(m_height) );
+         parallel_im2col_kernel.setArg( 7, static_cast<cl_int>(output_w) );
+         parallel_im2col_kernel.setArg( 8, static_cast<cl_int>(output_h) );
+         parallel_im2col_kernel.setArg( 9, static_cast<cl_int>(first) );
+         ocl_queue.enqueueNDRangeKernel( parallel_im2col_kernel, cl::NullRange, cl::NDRange(count*ROWS*COLS), cl::NullRange, (first == 0 ? &deps : nullptr) );
+
+         // the weights already are the filters x (channels*kh*kw) matrix
+         enqueueTiledMatmul(m_buffer, cols, out, m_filters, ROWS, COLS, count, 0, ROWS*COLS, 0, first*m_filters*COLS, nullptr, event);
+      }
+   }
+   catch(cl::Error& err) {
+      std::cout << "Error in convKernel im2col convolution: " << err.what() << "(" << getErrorString(err.err()) << ")" << std::endl;
+   }
+}
+
+void ConvKernel::winogradConvolution(const cl::Buffer& padded, const cl::Buffer& out, unsigned num, const std::vector<cl::Event>& deps, cl::Event* event) const
+{
+   auto [output_h, output_w] = getOutputHeightWidth();
+   auto [padded_h, padded_w] = getPaddedHeightWidth();
+   const unsigned TILES_W = (output_w + 1) / 2;
+   const unsigned TILES_H = (output_h + 1) / 2;
+   const unsigned TILES = TILES_W*TILES_H;
+   const unsigned CHUNK = std::clamp<size_t>(CONV_SCRATCH_FLOATS / (16*std::max(m_channels, m_filters)*TILES), 1, num);
+
+   cl::Buffer U(ocl_context, CL_MEM_READ_WRITE, 16*m_filters*m_channels*sizeof(float));
+   cl::Buffer V(ocl_context, CL_MEM_READ_WRITE, 16*m_channels*CHUNK*TILES*sizeof(float));
+   cl::Buffer M(ocl_context, CL_MEM_READ_WRITE, 16*m_filters*CHUNK*TILES*sizeof(float));
+
+   try {
+      winograd_weights_kernel.setArg( 0, m_buffer );
+      winograd_weights_kernel.setArg( 1, U );
+      winograd_weights_kernel.setArg( 2, static_cast<cl_int>(m_filters) );
+      winograd_weights_kernel.setArg( 3, static_cast<cl_int>(m_channels) );
+      ocl_queue.enqueueNDRangeKernel( winograd_weights_kernel, cl::NullRange, cl::NDRange(m_filters*m_channels), cl::NullRange, &deps );
+
+      for (unsigned first = 0; first < num; first += CHUNK)
+      {
+         const unsigned count = std::min(CHUNK, num - first);
+         const unsigned P = count*TILES;
+
+         winograd_input_kernel.setArg( 0, padded );
+         winograd_input_kernel.setArg( 1, V );
+         winograd_input_kernel.setArg( 2, static_cast<cl_int>(padded_w) );
+         winograd_input_kernel.setArg( 3, static_cast<cl_int>(padded_h) );
+         winograd_input_kernel.setArg( 4, static_cast<cl_int>(m_channels) );
+         winograd_input_kernel.setArg( 5, static_cast<cl_int>(TILES_W) );
+         winograd_input_kernel.setArg( 6, static_cast<cl_int>(TILES_H) );
+         winograd_input_kernel.setArg( 7, static_cast<cl_int>(first) );
+         winograd_input_kernel.setArg( 8, static_cast<cl_int>(count) );
+         ocl_queue.enqueueNDRangeKernel( winograd_input_kernel, cl::NullRange, cl::NDRange(m_channels*P), cl::NullRange );
+
+         // one filters x channels by channels x tiles product per element of the 4x4 tile
+         enqueueTiledMatmul(U, V, M, m_filters, m_channels, P, 16, m_filters*m_channels, m_channels*P, 0, 0, nullptr, nullptr);
+
+         winograd_output_kernel.setArg( 0, M );
+         winograd_output_kernel.setArg( 1, out );
+         winograd_output_kernel.setArg( 2, static_cast<cl_int>(m_filters) );
+         winograd_output_kernel.setArg( 3, static_cast<cl_int>(output_w) );
+         winograd_output_kernel.setArg( 4, static_cast<cl_int>(output_h) );
+         winograd_output_kernel.setArg( 5, static_cast<cl_int>(TILES_W) );
+         winograd_output_kernel.setArg( 6, static_cast<cl_int>(TILES_H) );
+         winograd_output_kernel.setArg( 7, static_cast<cl_int>(first) );
+         winograd_output_kernel.setArg( 8, static_cast<cl_int>(count) );
+         ocl_queue.enqueueNDRangeKernel( winograd_output_kernel, cl::NullRange, cl::NDRange(m_filters*P), cl::NullRange, nullptr, event );
+      }
+   }
+   catch(cl::Error& err) {
+      std::cout << "Error in convKernel winograd convolution: " << err.what() << "(" << getErrorString(err.err()) << ")" << std::endl;
+   }
+}
+
+void ConvKernel::nhwc4Convolution(const cl::Buffer& input, const cl::Buffer& out, unsigned num, const std::vector<cl::Event>& deps, cl::Event* event) const
+{
+   auto [output_h, output_w] = getOutputHeightWidth();
+   auto [padded_h, padded_w] = getPaddedHeightWidth();
+   const unsigned PADDED_CHANNELS = (m_channels + 3) / 4 * 4;
+
+   cl_int l = 0, r = 0, u = 0, d = 0;
+   if (m_padding == SAME)
+   {
+      l = m_width / 2;
+      r = (m_width - 1) - l;
+      u = m_height / 2;
+      d = (m_height - 1) - u;
+   }
+
+   cl::Buffer padded(ocl_context, CL_MEM_READ_WRITE, num*padded_h*padded_w*PADDED_CHANNELS*sizeof(float));
+
+   try {
+      if (m_packed() == nullptr)
+      {
+         const unsigned PACKED_SIZE = m_filters*m_height*m_width*PADDED_CHANNELS;
+         m_packed = cl::Buffer(ocl_context, CL_MEM_READ_WRITE, PACKED_SIZE*sizeof(float));
+         pack_conv_weights_nhwc4_kernel.setArg( 0, m_buffer );
+         pack_conv_weights_nhwc4_kernel.setArg( 1, m_packed );
+         pack_conv_weights_nhwc4_kernel.setArg( 2, static_cast<cl_int>(m_height*m_width) );
+         pack_conv_weights_nhwc4_kernel.setArg( 3, static_cast<cl_int>(m_channels) );
+         auto pack_deps = ocl_wait_list({m_event});
+         ocl_queue.enqueueNDRangeKernel( pack_conv_weights_nhwc4_kernel, cl::NullRange, cl::NDRange(PACKED_SIZE), cl::NullRange, &pack_deps, &m_packed_event );
+      }
+
+      parallel_pad_nhwc4_kernel.setArg( 0, input );
+      parallel_pad_nhwc4_kernel.setArg( 1, padded );
+      parallel_pad_nhwc4_kernel.setArg( 2, static_cast<cl_int>(m_input_width) );
+      parallel_pad_nhwc4_kernel.setArg( 3, static_cast<cl_int>(m_input_height) );
+      parallel_pad_nhwc4_kernel.setArg( 4, static_cast<cl_int>(m_channels) );
+      parallel_pad_nhwc4_kernel.setArg( 5, l );
+      parallel_pad_nhwc4_kernel.setArg( 6, r );
+      parallel_pad_nhwc4_kernel.setArg( 7, u );
+      parallel_pad_nhwc4_kernel.setArg( 8, d );
+      ocl_queue.enqueueNDRangeKernel( parallel_pad_nhwc4_kernel, cl::NullRange, cl::NDRange(num*padded_h*padded_w*PADDED_CHANNELS), cl::NullRange, &deps );
+
+      parallel_convolution_nhwc4_kernel.setArg( 0,  m_packed );
+      parallel_convolution_nhwc4_kernel.setArg( 1,  padded );
+      parallel_convolution_nhwc4_kernel.setArg( 2,  out );
+      parallel_convolution_nhwc4_kernel.setArg( 3,  static_cast<cl_int>(m_width) );
+      parallel_convolution_nhwc4_kernel.setArg( 4,  static_cast<cl_int>(m_height) );
+      parallel_convolution_nhwc4_kernel.setArg( 5,  static_cast<cl_int>(padded_w) );
+      parallel_convolution_nhwc4_kernel.setArg( 6,  static_cast<cl_int>(padded_h) );
+      parallel_convolution_nhwc4_kernel.setArg( 7,  static_cast<cl_int>(m_channels) );
+      parallel_convolution_nhwc4_kernel.setArg( 8,  static_cast<cl_int>(m_filters) );
+      parallel_convolution_nhwc4_kernel.setArg( 9,  static_cast<cl_int>(output_w) );
+      parallel_convolution_nhwc4_kernel.setArg( 10, static_cast<cl_int>(output_h) );
+      // the packing may have happened on another device's queue
+      auto conv_deps = ocl_wait_list({m_packed_event});
+      ocl_queue.enqueueNDRangeKernel( parallel_convolution_nhwc4_kernel, cl::NullRange, cl::NDRange(num*m_filters*output_h*output_w), cl::NullRange, &conv_deps, event );
+   }
+   catch(cl::Error& err) {
+      std::cout << "Error in convKernel nhwc4 convolution: " << err.what() << "(" << getErrorString(err.err()) << ")" << std::endl;
+   }
+}
+
+HostBuffer ConvKernel::hostPad(const float* input, int num) const
+{
+   if (m_padding == VALID) return HostBuffer();
+
+   int l = m_width / 2;
+   int r = (m_width - 1) - l;
+   int u = m_height / 2;
+   int d = (m_height - 1) - u;
+
+   return hostPad(input, num, l, r, u, d);
+}
+
+HostBuffer ConvKernel::hostPad(const float* input, int num, int l, int r, int u, int d) const
+{
+   const int padded_w = l + r + m_input_width;
+   const int padded_h = u + d + m_input_height;
+   auto out = std::make_shared<std::vector<float>>(padded_w*padded_h*m_channels*num);
+   cpu_pad(input, out->data(), m_input_width, m_input_height, m_channels, l, r, u, d, num);
+   return out;
+}
+
+cl::Buffer ConvKernel::pad(const cl::Buffer& input, const cl::Event& input_event, int l, int r, int u, int d) const
 {
    cl_int l_padding = l;
    cl_int r_padding = r;
@@ -314,6 +795,7 @@ cl::Buffer ConvKernel::pad(const cl::Buffer& input, int l, int r, int u, int d)
    int N_ELEMENTS = padded_w*padded_h*m_channels;
    cl::NDRange global( N_ELEMENTS );
    cl::Buffer out_buffer(ocl_context, CL_MEM_READ_WRITE, N_ELEMENTS*sizeof(float));
+   cl::Event out_event;
 
    try {
       pad_kernel.setArg( 0,  input );
@@ -326,7 +808,9 @@ cl::Buffer ConvKernel::pad(const cl::Buffer& input, int l, int r, int u, int d)
       pad_kernel.setArg( 7,  u_padding );
       pad_kernel.setArg( 8,  d_padding );
 
-      ocl_queue.enqueueNDRangeKernel( pad_kernel, cl::NullRange, global );
+      auto deps = ocl_wait_list({input_event});
+
+      ocl_queue.enqueueNDRangeKernel( pad_kernel, cl::NullRange, global, cl::NullRange, &deps, &out_event );
    }
    catch(cl::Error& err) {
       std::cout << "Error in convKernel pad: " << err.what() << "(" << getErrorString(err.err()) << ")" << std::endl;
@@ -335,24 +819,30 @@ cl::Buffer ConvKernel::pad(const cl::Buffer& input, int l, int r, int u, int d)
    return out_buffer;
 }
 
-cl::Buffer ConvKernel::parallelPad(const cl::Buffer& input, int num, int l, int r, int u, int d) const
+cl::Buffer ConvKernel::parallelPad(const cl::Buffer& input, const cl::Event& input_event, int num, int l, int r, int u, int d) const
+{
+   return parallelPad(input, input_event, num, m_input_width, m_input_height, m_channels, l, r, u, d);
+}
+
+cl::Buffer ConvKernel::parallelPad(const cl::Buffer& input, const cl::Event& input_event, int num, int width, int height, int planes, int l, int r, int u, int d) const
 {
    cl_int l_padding = l;
    cl_int r_padding = r;
    cl_int u_padding = u;
    cl_int d_padding = d;
 
-   cl_int padded_w = l_padding + r_padding + m_input_width;
-   cl_int padded_h = u_padding + d_padding + m_input_height;
+   cl_int padded_w = l_padding + r_padding + width;
+   cl_int padded_h = u_padding + d_padding + height;
 
-   cl_int input_width = m_input_width;
-   cl_int input_height = m_input_height;
+   cl_int input_width = width;
+   cl_int input_height = height;
 
-   cl_int channels = m_channels;
+   cl_int channels = planes;
 
-   int N_ELEMENTS = padded_w*padded_h*m_channels*num;
+   int N_ELEMENTS = padded_w*padded_h*planes*num;
    cl::NDRange global( N_ELEMENTS );
    cl::Buffer out_buffer(ocl_context, CL_MEM_READ_WRITE, N_ELEMENTS*sizeof(float));
+   cl::Event out_event;
 
    try {
       parallel_pad_kernel.setArg( 0,  input );
@@ -365,7 +855,9 @@ cl::Buffer ConvKernel::parallelPad(const cl::Buffer& input, int num, int l, int
       parallel_pad_kernel.setArg( 7,  u_padding );
       parallel_pad_kernel.setArg( 8,  d_padding );
 
-      ocl_queue.enqueueNDRangeKernel( parallel_pad_kernel, cl::NullRange, global );
+      auto deps = ocl_wait_list({input_event});
+
+      ocl_queue.enqueueNDRangeKernel( parallel_pad_kernel, cl::NullRange, global, cl::NullRange, &deps, &out_event );
    }
    catch(cl::Error& err) {
       std::cout << "Error in convKernel parallel pad: " << err.what() << "(" << getErrorString(err.err()) << ")" << std::endl;
@@ -376,9 +868,17 @@ cl::Buffer ConvKernel::parallelPad(const cl::Buffer& input, int num, int l, int
 
 ConvKernel ConvKernel::rotated() const
 {
-   int N_ELEMENTS = m_width*m_height*m_filters;
+   if (mat_backend == CPU_BACKEND)
+   {
+      auto out = std::make_shared<std::vector<float>>(weightCount());
+      cpu_rotate_conv(m_host->data(), out->data(), m_width, m_height, m_filters*m_channels);
+      return ConvKernel(m_channels, m_height, m_width, m_filters, m_padding, m_input_height, m_input_width, out);
+   }
+
+   int N_ELEMENTS = weightCount();
    cl::NDRange global( N_ELEMENTS );
    cl::Buffer out_buffer(ocl_context, CL_MEM_READ_WRITE, N_ELEMENTS*sizeof(float));
+   cl::Event out_event;
 
    cl_int width = m_width;
    cl_int height = m_height;
@@ -389,7 +889,9 @@ ConvKernel ConvKernel::rotated() const
       rotate_conv_kernel.setArg( 2,  width );
       rotate_conv_kernel.setArg( 3,  height );
 
-      ocl_queue.enqueueNDRangeKernel( rotate_conv_kernel, cl::NullRange, global );
+      auto deps = ocl_wait_list({m_event});
+
+      ocl_queue.enqueueNDRangeKernel( rotate_conv_kernel, cl::NullRange, global, cl::NullRange, &deps, &out_event );
    }
    catch(cl::Error& err) {
       std::cout << "Error in convKernel rotated: " << err.what() << "(" << getErrorString(err.err()) << ")" << std::endl;
@@ -402,5 +904,6 @@ ConvKernel ConvKernel::rotated() const
                      m_padding,
                      m_input_height,
                      m_input_width,
-                     out_buffer);
+                     out_buffer,
+                     out_event);
 }
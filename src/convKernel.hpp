@@ -1,15 +1,41 @@
 #pragma once
+#include <array>
 #include "mat.hpp"
 
+class Int8Mat;
+class ParameterOptimizer;
+class CheckpointWriter;
+class CheckpointReader;
+
 enum Padding
 {
    VALID = 0,  // no padding
    SAME = 1    // output has same dimensions as input
 };
 
+// how the OpenCL backend computes ConvKernel::operator*
+enum ConvAlgorithm
+{
+   CONV_AUTO = 0,          // picked from the kernel size, channels and batch size
+   CONV_DIRECT = 1,        // one work item per output, straight from global memory
+   CONV_IM2COL_GEMM = 2,   // input patches unrolled into columns, times the weights as a tiled GEMM
+   CONV_WINOGRAD = 3       // F(2x2,3x3) tiles, 3x3 kernels only
+};
+
+// memory layout the direct OpenCL convolution works in. Inputs and outputs of
+// ConvKernel are always channel-planar, the direct kernel relays them out while padding
+enum ConvLayout
+{
+   CONV_LAYOUT_AUTO = 0,   // NHWC4 from 4 channels up
+   CONV_LAYOUT_NCHW = 1,   // channel planes, one channel per iteration of the inner loop
+   CONV_LAYOUT_NHWC4 = 2   // channels innermost in blocks of 4, read with vector loads
+};
+
 class ConvKernel
 {
 public:
+   // `vals` are [filters][channels][kernel_height][kernel_width], ie. the filters x
+   // (channels*kernel_height*kernel_width) weight matrix, in any shape with that many elements
    ConvKernel (unsigned channels,
                unsigned kernel_height,
                unsigned kernel_width,
@@ -41,12 +67,54 @@ public:
 
    ParallelMat operator* (const ParallelMat &other) const;
    Mat operator* (const Mat &other) const;
+
+   // operator* through im2col+GEMM with the weights and the unrolled inputs in 16 bit storage,
+   // accumulating in float. For inference; the CPU backend computes it in float
+   ParallelMat convolveHalf(const ParallelMat& other, StoragePrecision precision) const;
+   Mat convolveHalf(const Mat& other, StoragePrecision precision) const;
+
+   // operator* through im2col+GEMM in int8, with `weights` quantized from `weights()` and the
+   // unrolled inputs quantized with `input_scale`, see Int8Mat
+   ParallelMat convolveInt8(const ParallelMat& other, const Int8Mat& weights, float input_scale) const;
+   Mat convolveInt8(const Mat& other, const Int8Mat& weights, float input_scale) const;
    
+   // the input gradient of a convolution by `rotated()` of this kernel, given its output
+   // gradient `other`
    ParallelMat operator^(const ParallelMat& other) const;
    Mat operator^(const Mat& other) const;
 
+   // adds the gradient of the weights summed over a batch of `input`s and the gradients `delta`
+   // of their outputs to `gradient`, a filters x (channels*kernel_height*kernel_width) matrix
+   void addWeightGradient(Mat& gradient, const ParallelMat& input, const ParallelMat& delta) const;
+
+   // update the weights in place, `vals` laid out like the constructor's
+   const ConvKernel& operator-=(const Mat& vals) { return weights_eq_op('-', vals); }
+   const ConvKernel& operator^=(const Mat& vals) { return weights_eq_op('^', vals); }
+   // one step of `optimizer` on the weights from their gradient `grads`, see ParameterOptimizer
+   void step(ParameterOptimizer& optimizer, Mat& grads, float learning_rate, float grad_scale);
+
    ConvKernel rotated() const;
 
+   // forces an algorithm instead of CONV_AUTO, for benchmarking. Kernels that can't use
+   // the requested one fall back to im2col+GEMM
+   void setAlgorithm(ConvAlgorithm algorithm) { m_algorithm = algorithm; }
+   // what a batch of `count` inputs will be computed with
+   ConvAlgorithm algorithm(unsigned count) const;
+
+   void setLayout(ConvLayout layout) { m_layout = layout; }
+   ConvLayout layout() const;
+
+   unsigned weightCount() const { return m_filters*m_channels*m_height*m_width; }
+   unsigned getFilters() const { return m_filters; }
+   // the filters x (channels*kernel_height*kernel_width) weight matrix, sharing the kernel's storage
+   Mat weights() const;
+
+   // "input_height input_width channels kernel_height kernel_width filters same|valid"
+   std::string describe() const;
+   // the weights into a checkpoint and back, see CheckpointReader
+   void save(CheckpointWriter& writer) const;
+   void load(CheckpointReader& reader);
+
 private:
    ConvKernel (unsigned channels,
                unsigned kernel_height,
@@ -55,16 +123,49 @@ private:
                Padding padding,
                unsigned input_height,
                unsigned input_width,
-               const cl::Buffer& vals);
+               const cl::Buffer& vals,
+               const cl::Event& vals_event);
+   ConvKernel (unsigned channels,
+               unsigned kernel_height,
+               unsigned kernel_width,
+               unsigned filters,
+               Padding padding,
+               unsigned input_height,
+               unsigned input_width,
+               HostBuffer vals);
+
+   // `input_event` is the last write to `input`, padding waits on it
+   cl::Buffer pad(const cl::Buffer& input, const cl::Event& input_event) const;
+   cl::Buffer parallelPad(const cl::Buffer& input, const cl::Event& input_event, int num) const;
+
+   cl::Buffer pad(const cl::Buffer& input, const cl::Event& input_event, int l, int r, int u, int d) const;
+   cl::Buffer parallelPad(const cl::Buffer& input, const cl::Event& input_event, int num, int l, int r, int u, int d) const;
+   // pads `num` images of `planes` width x height planes, eg. output gradients
+   cl::Buffer parallelPad(const cl::Buffer& input, const cl::Event& input_event, int num, int width, int height, int planes, int l, int r, int u, int d) const;
+
+   const ConvKernel& weights_eq_op(char op, const Mat& vals);
+   // after the weights changed in place through a Mat view finished by `event`
+   void weightsChanged(const cl::Event& event);
+
+   // {l, r, u, d} padding of the output gradients in operator^
+   std::array<int,4> gradientPadding() const;
 
-   cl::Buffer pad(const cl::Buffer& input) const;
-   cl::Buffer parallelPad(const cl::Buffer& input, int num) const;
+   // CPU backend versions of `parallelPad`. Empty when there is no padding to do, the
+   // input can be used as is
+   HostBuffer hostPad(const float* input, int num) const;
+   HostBuffer hostPad(const float* input, int num, int l, int r, int u, int d) const;
 
-   cl::Buffer pad(const cl::Buffer& input, int l, int r, int u, int d) const;
-   cl::Buffer parallelPad(const cl::Buffer& input, int num, int l, int r, int u, int d) const;
+   // the GEMM based convolutions of `num` padded inputs into `out`. Both only wait on
+   // `deps` before their first command, the queue is in-order
+   void im2colConvolution(const cl::Buffer& padded, const cl::Buffer& out, unsigned num, const std::vector<cl::Event>& deps, cl::Event* event) const;
+   void winogradConvolution(const cl::Buffer& padded, const cl::Buffer& out, unsigned num, const std::vector<cl::Event>& deps, cl::Event* event) const;
+   // the direct convolution in the NHWC4 layout, pads `input` itself
+   void nhwc4Convolution(const cl::Buffer& input, const cl::Buffer& out, unsigned num, const std::vector<cl::Event>& deps, cl::Event* event) const;
 
 
    cl::Buffer m_buffer;
+   cl::Event m_event;
+   HostBuffer m_host;
    unsigned m_channels;
    unsigned m_height;
    unsigned m_width;
@@ -72,6 +173,15 @@ private:
    unsigned m_filters;
    unsigned m_input_height;
    unsigned m_input_width;
+   ConvAlgorithm m_algorithm = CONV_AUTO;
+   ConvLayout m_layout = CONV_LAYOUT_AUTO;
+   // `m_buffer` repacked for parallel_convolution_nhwc4, made the first time it's needed
+   mutable cl::Buffer m_packed;
+   mutable cl::Event m_packed_event;
+   // `m_buffer` in `m_half_precision` for convolveHalf, made the first time it's needed
+   mutable cl::Buffer m_half;
+   mutable cl::Event m_half_event;
+   mutable StoragePrecision m_half_precision = STORAGE_FP32;
 
    friend Mat;
 };
@@ -0,0 +1,939 @@
+#include "cpuKernels.hpp"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <vector>
+#include <omp.h>
+
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#include <immintrin.h>
+#endif
+
+// the clones are picked once when the binary is loaded. OpenMP outlines the bodies of
+// parallel loops into functions of their own which wouldn't be cloned, so the vector
+// loops live in the `_range` workers and the public functions only split the work
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#define CPU_KERNEL __attribute__((target_clones("avx512f","avx2","default")))
+#else
+#define CPU_KERNEL
+#endif
+
+// roughly how many multiply-adds are worth waking another thread for
+static constexpr std::size_t PARALLEL_GRAIN = 1 << 15;
+
+// calls `range(first, last)` over [0, n) split into one chunk per thread, or just once
+// when there are fewer than `grain` units of work per thread
+template <class Range>
+static void parallel_ranges(std::size_t n, std::size_t grain, Range range)
+{
+   const int chunks = static_cast<int>(std::min<std::size_t>(omp_get_max_threads(), n / std::max<std::size_t>(grain, 1)));
+   if (chunks <= 1)
+   {
+      range(0, n);
+      return;
+   }
+
+   #pragma omp parallel for
+   for (int chunk = 0; chunk < chunks; chunk++)
+   {
+      range(n*chunk/chunks, n*(chunk + 1)/chunks);
+   }
+}
+
+CPU_KERNEL
+static void matmul_range(const float* A, const float* B, float* C, int M, int K, int N,
+                         std::size_t a_stride, std::size_t b_stride, std::size_t first, std::size_t last)
+{
+   for (std::size_t unit = first; unit < last; unit++)
+   {
+      const std::size_t matrix = unit / M;
+      const std::size_t row = unit % M;
+      const float* a = A + matrix*a_stride + row*K;
+      const float* b = B + matrix*b_stride;
+      float* c = C + unit*N;
+
+      // matrix-vector products are what single position inference is made of
+      if (N == 1)
+      {
+         float total = 0;
+         #pragma omp simd reduction(+:total)
+         for (int k = 0; k < K; k++) total += a[k]*b[k];
+         c[0] = total;
+         continue;
+      }
+
+      std::fill(c, c + N, 0.f);
+      for (int k = 0; k < K; k++)
+      {
+         const float a_k = a[k];
+         const float* b_row = b + static_cast<std::size_t>(k)*N;
+         #pragma omp simd
+         for (int col = 0; col < N; col++) c[col] += a_k*b_row[col];
+      }
+   }
+}
+
+void cpu_matmul(const float* A, const float* B, float* C, int M, int K, int N, int count, std::size_t a_stride, std::size_t b_stride)
+{
+   const std::size_t rows = static_cast<std::size_t>(M)*count;
+   const std::size_t row_cost = std::max<std::size_t>(static_cast<std::size_t>(K)*N, 1);
+   parallel_ranges(rows, PARALLEL_GRAIN / row_cost, [&](std::size_t first, std::size_t last) {
+      matmul_range(A, B, C, M, K, N, a_stride, b_stride, first, last);
+   });
+}
+
+CPU_KERNEL
+static void transpose_range(const float* in, float* out, int H, int W, std::size_t first, std::size_t last)
+{
+   for (std::size_t unit = first; unit < last; unit++)
+   {
+      const std::size_t matrix = unit / H;
+      const std::size_t row = unit % H;
+      const float* in_row = in + unit*W;
+      float* out_matrix = out + matrix*H*W;
+      for (int col = 0; col < W; col++) out_matrix[col*H + row] = in_row[col];
+   }
+}
+
+void cpu_transpose(const float* in, float* out, int H, int W, int count)
+{
+   parallel_ranges(static_cast<std::size_t>(H)*count, PARALLEL_GRAIN / std::max(W, 1), [&](std::size_t first, std::size_t last) {
+      transpose_range(in, out, H, W, first, last);
+   });
+}
+
+CPU_KERNEL
+static void sum_range(const float* in, float* out, int count, int size, bool accumulate, std::size_t first, std::size_t last)
+{
+   if (not accumulate) std::fill(out + first, out + last, 0.f);
+   for (int i = 0; i < count; i++)
+   {
+      const float* array = in + static_cast<std::size_t>(i)*size;
+      #pragma omp simd
+      for (std::size_t j = first; j < last; j++) out[j] += array[j];
+   }
+}
+
+void cpu_sum(const float* in, float* out, int count, int size, bool accumulate)
+{
+   parallel_ranges(size, PARALLEL_GRAIN / std::max(count, 1), [&](std::size_t first, std::size_t last) {
+      sum_range(in, out, count, size, accumulate, first, last);
+   });
+}
+
+CPU_KERNEL
+static void matmul_tn_acc_range(const float* A, const float* B, float* C, int M, int K, int N, std::size_t first, std::size_t last)
+{
+   for (std::size_t row = first; row < last; row++)
+   {
+      float* c = C + row*N;
+      for (int k = 0; k < K; k++)
+      {
+         const float a_k = A[static_cast<std::size_t>(k)*M + row];
+         const float* b_row = B + static_cast<std::size_t>(k)*N;
+         #pragma omp simd
+         for (int col = 0; col < N; col++) c[col] += a_k*b_row[col];
+      }
+   }
+}
+
+void cpu_matmul_tn_acc(const float* A, const float* B, float* C, int M, int K, int N)
+{
+   const std::size_t row_cost = std::max<std::size_t>(static_cast<std::size_t>(K)*N, 1);
+   parallel_ranges(M, PARALLEL_GRAIN / row_cost, [&](std::size_t first, std::size_t last) {
+      matmul_tn_acc_range(A, B, C, M, K, N, first, last);
+   });
+}
+
+CPU_KERNEL
+static void elementwise_range(char op, const float* a, const float* b, float* out, std::size_t a_size, std::size_t first, std::size_t last)
+{
+   // `a` is either as long as `b` or repeats, walk it one repetition at a time so the
+   // inner loops stay contiguous
+   for (std::size_t start = first; start < last; )
+   {
+      const std::size_t a_idx = start % a_size;
+      const std::size_t n = std::min(last - start, a_size - a_idx);
+      const float* a_part = a + a_idx;
+      const float* b_part = b + start;
+      float* out_part = out + start;
+      switch (op)
+      {
+         case '+':
+            #pragma omp simd
+            for (std::size_t i = 0; i < n; i++) out_part[i] = a_part[i] + b_part[i];
+            break;
+         case '-':
+            #pragma omp simd
+            for (std::size_t i = 0; i < n; i++) out_part[i] = a_part[i] - b_part[i];
+            break;
+         case '^':
+         case '.':
+            #pragma omp simd
+            for (std::size_t i = 0; i < n; i++) out_part[i] = a_part[i] * b_part[i];
+            break;
+      }
+      start += n;
+   }
+}
+
+void cpu_elementwise(char op, const float* a, const float* b, float* out, std::size_t a_size, std::size_t n)
+{
+   parallel_ranges(n, PARALLEL_GRAIN, [&](std::size_t first, std::size_t last) {
+      elementwise_range(op, a, b, out, a_size, first, last);
+   });
+}
+
+CPU_KERNEL
+static void float_op_range(char op, const float* in, float* out, float val, std::size_t first, std::size_t last)
+{
+   switch (op)
+   {
+      case '*':
+         #pragma omp simd
+         for (std::size_t i = first; i < last; i++) out[i] = in[i] * val;
+         break;
+      case '/':
+         #pragma omp simd
+         for (std::size_t i = first; i < last; i++) out[i] = in[i] / val;
+         break;
+      case '+':
+         #pragma omp simd
+         for (std::size_t i = first; i < last; i++) out[i] = in[i] + val;
+         break;
+      case '-':
+         #pragma omp simd
+         for (std::size_t i = first; i < last; i++) out[i] = in[i] - val;
+         break;
+   }
+}
+
+void cpu_float_op(char op, const float* in, float* out, std::size_t n, float val)
+{
+   parallel_ranges(n, PARALLEL_GRAIN, [&](std::size_t first, std::size_t last) {
+      float_op_range(op, in, out, val, first, last);
+   });
+}
+
+CPU_KERNEL
+static void relu_range(const float* in, float* out, std::size_t first, std::size_t last)
+{
+   #pragma omp simd
+   for (std::size_t i = first; i < last; i++) out[i] = in[i] < 0.f ? 0.01f*in[i] : in[i];
+}
+
+void cpu_relu(const float* in, float* out, std::size_t n)
+{
+   parallel_ranges(n, PARALLEL_GRAIN, [&](std::size_t first, std::size_t last) { relu_range(in, out, first, last); });
+}
+
+CPU_KERNEL
+static void relu_inv_range(const float* in, float* out, std::size_t first, std::size_t last)
+{
+   #pragma omp simd
+   for (std::size_t i = first; i < last; i++) out[i] = in[i] < 0.f ? 0.01f : 1.f;
+}
+
+void cpu_relu_inv(const float* in, float* out, std::size_t n)
+{
+   parallel_ranges(n, PARALLEL_GRAIN, [&](std::size_t first, std::size_t last) { relu_inv_range(in, out, first, last); });
+}
+
+CPU_KERNEL
+static void sigmoid_range(const float* in, float* out, std::size_t first, std::size_t last)
+{
+   #pragma omp simd
+   for (std::size_t i = first; i < last; i++) out[i] = 1.f/(1.f + std::exp(-in[i]));
+}
+
+void cpu_sigmoid(const float* in, float* out, std::size_t n)
+{
+   parallel_ranges(n, PARALLEL_GRAIN, [&](std::size_t first, std::size_t last) { sigmoid_range(in, out, first, last); });
+}
+
+CPU_KERNEL
+static void sigmoid_inv_range(const float* in, float* out, std::size_t first, std::size_t last)
+{
+   #pragma omp simd
+   for (std::size_t i = first; i < last; i++)
+   {
+      const float neg_exp = std::exp(-in[i]);
+      out[i] = neg_exp/((1.f + neg_exp)*(1.f + neg_exp));
+   }
+}
+
+void cpu_sigmoid_inv(const float* in, float* out, std::size_t n)
+{
+   parallel_ranges(n, PARALLEL_GRAIN, [&](std::size_t first, std::size_t last) { sigmoid_inv_range(in, out, first, last); });
+}
+
+CPU_KERNEL
+static void log_range(const float* in, float* out, std::size_t first, std::size_t last)
+{
+   #pragma omp simd
+   for (std::size_t i = first; i < last; i++) out[i] = std::log(in[i]);
+}
+
+void cpu_log(const float* in, float* out, std::size_t n)
+{
+   parallel_ranges(n, PARALLEL_GRAIN, [&](std::size_t first, std::size_t last) { log_range(in, out, first, last); });
+}
+
+CPU_KERNEL
+static void exp_range(const float* in, float* out, std::size_t first, std::size_t last)
+{
+   #pragma omp simd
+   for (std::size_t i = first; i < last; i++) out[i] = std::exp(in[i]);
+}
+
+void cpu_exp(const float* in, float* out, std::size_t n)
+{
+   parallel_ranges(n, PARALLEL_GRAIN, [&](std::size_t first, std::size_t last) { exp_range(in, out, first, last); });
+}
+
+CPU_KERNEL
+static void binary_CEL_range(const float* truth, const float* prediction, float* out, std::size_t first, std::size_t last)
+{
+   #pragma omp simd
+   for (std::size_t i = first; i < last; i++)
+   {
+      out[i] = -(truth[i]*std::log(prediction[i])) + (1.f - truth[i])*std::log(1.f - prediction[i]);
+   }
+}
+
+void cpu_binary_CEL(const float* truth, const float* prediction, float* out, std::size_t n)
+{
+   parallel_ranges(n, PARALLEL_GRAIN, [&](std::size_t first, std::size_t last) { binary_CEL_range(truth, prediction, out, first, last); });
+}
+
+CPU_KERNEL
+static void binary_CEL_derivative_range(const float* truth, const float* prediction, float* out, std::size_t first, std::size_t last)
+{
+   #pragma omp simd
+   for (std::size_t i = first; i < last; i++)
+   {
+      out[i] = -(truth[i]/prediction[i] - (1.f - truth[i])/(1.f - prediction[i]));
+   }
+}
+
+void cpu_binary_CEL_derivative(const float* truth, const float* prediction, float* out, std::size_t n)
+{
+   parallel_ranges(n, PARALLEL_GRAIN, [&](std::size_t first, std::size_t last) { binary_CEL_derivative_range(truth, prediction, out, first, last); });
+}
+
+void cpu_pad(const float* in, float* out, int input_w, int input_h, int channels, int l, int r, int u, int d, int count)
+{
+   const int output_w = input_w + l + r;
+   const int output_h = input_h + u + d;
+   const std::size_t planes = static_cast<std::size_t>(channels)*count;
+
+   parallel_ranges(planes, PARALLEL_GRAIN / (output_w*output_h), [&](std::size_t first, std::size_t last) {
+      for (std::size_t plane = first; plane < last; plane++)
+      {
+         const float* in_plane = in + plane*input_w*input_h;
+         float* out_plane = out + plane*output_w*output_h;
+         std::fill(out_plane, out_plane + output_w*output_h, 0.f);
+         for (int row = 0; row < input_h; row++)
+         {
+            std::copy(in_plane + row*input_w, in_plane + (row + 1)*input_w, out_plane + (row + u)*output_w + l);
+         }
+      }
+   });
+}
+
+CPU_KERNEL
+static void convolution_range(const float* convkernel, const float* in, float* out,
+                              int convkernel_w, int convkernel_h, int input_w, int input_h,
+                              int channels, int filters, int output_w, int output_h,
+                              std::size_t first, std::size_t last)
+{
+   const int kernel_elements = convkernel_w*convkernel_h;
+   const std::size_t channel_elements = static_cast<std::size_t>(input_w)*input_h;
+
+   // one unit is a whole output plane of one filter
+   for (std::size_t unit = first; unit < last; unit++)
+   {
+      const std::size_t input = unit / filters;
+      const int filter = unit % filters;
+      const float* input_planes = in + input*channel_elements*channels;
+      const float* filter_vals = convkernel + static_cast<std::size_t>(filter)*channels*kernel_elements;
+      float* out_plane = out + unit*output_w*output_h;
+
+      for (int out_row = 0; out_row < output_h; out_row++)
+      {
+         float* out_vals = out_plane + out_row*output_w;
+         std::fill(out_vals, out_vals + output_w, 0.f);
+         for (int channel = 0; channel < channels; channel++)
+         {
+            for (int conv_row = 0; conv_row < convkernel_h; conv_row++)
+            {
+               for (int conv_col = 0; conv_col < convkernel_w; conv_col++)
+               {
+                  const float kernel_val = filter_vals[channel*kernel_elements + conv_row*convkernel_w + conv_col];
+                  const float* in_vals = input_planes + channel*channel_elements + (out_row + conv_row)*input_w + conv_col;
+                  #pragma omp simd
+                  for (int out_col = 0; out_col < output_w; out_col++) out_vals[out_col] += kernel_val*in_vals[out_col];
+               }
+            }
+         }
+      }
+   }
+}
+
+void cpu_convolution(const float* convkernel, const float* in, float* out,
+                     int convkernel_w, int convkernel_h, int input_w, int input_h,
+                     int channels, int filters, int output_w, int output_h, int count)
+{
+   const std::size_t plane_cost = static_cast<std::size_t>(output_w)*output_h*convkernel_w*convkernel_h*channels;
+   parallel_ranges(static_cast<std::size_t>(filters)*count, PARALLEL_GRAIN / std::max<std::size_t>(plane_cost, 1), [&](std::size_t first, std::size_t last) {
+      convolution_range(convkernel, in, out, convkernel_w, convkernel_h, input_w, input_h, channels, filters, output_w, output_h, first, last);
+   });
+}
+
+CPU_KERNEL
+static void transpose_convolution_range(const float* convkernel, float* in, const float* out,
+                                        int convkernel_w, int convkernel_h, int input_w, int input_h,
+                                        int channels, int filters, int output_w, int output_h,
+                                        std::size_t first, std::size_t last)
+{
+   const int kernel_elements = convkernel_w*convkernel_h;
+   const std::size_t output_elements = static_cast<std::size_t>(output_w)*output_h;
+   const std::size_t input_elements = static_cast<std::size_t>(input_w)*input_h;
+
+   // one unit is a row of one channel of one input
+   for (std::size_t unit = first; unit < last; unit++)
+   {
+      const std::size_t input = unit / (static_cast<std::size_t>(input_h)*channels);
+      const int channel = (unit / input_h) % channels;
+      const int input_row = unit % input_h;
+      const float* output_planes = out + input*output_elements*filters;
+      float* in_vals = in + (input*channels + channel)*input_elements + input_row*input_w;
+
+      std::fill(in_vals, in_vals + input_w, 0.f);
+      for (int conv_row = 0; conv_row < convkernel_h; conv_row++)
+      {
+         for (int conv_col = 0; conv_col < convkernel_w; conv_col++)
+         {
+            for (int filter = 0; filter < filters; filter++)
+            {
+               const float kernel_val = convkernel[(filter*channels + channel)*kernel_elements + conv_row*convkernel_w + conv_col];
+               const float* out_vals = output_planes + filter*output_elements + (input_row + conv_row)*output_w + conv_col;
+               #pragma omp simd
+               for (int input_col = 0; input_col < input_w; input_col++) in_vals[input_col] += kernel_val*out_vals[input_col];
+            }
+         }
+      }
+   }
+}
+
+void cpu_transpose_convolution(const float* convkernel, float* in, const float* out,
+                               int convkernel_w, int convkernel_h, int input_w, int input_h,
+                               int channels, int filters, int output_w, int output_h, int count)
+{
+   const std::size_t row_cost = static_cast<std::size_t>(input_w)*convkernel_w*convkernel_h*filters;
+   parallel_ranges(static_cast<std::size_t>(input_h)*channels*count, PARALLEL_GRAIN / std::max<std::size_t>(row_cost, 1), [&](std::size_t first, std::size_t last) {
+      transpose_convolution_range(convkernel, in, out, convkernel_w, convkernel_h, input_w, input_h, channels, filters, output_w, output_h, first, last);
+   });
+}
+
+CPU_KERNEL
+static void conv_weight_gradient_range(const float* in, const float* delta, float* gradient,
+                                       int convkernel_w, int convkernel_h, int input_w, int input_h,
+                                       int channels, int filters, int output_w, int output_h, int count,
+                                       std::size_t first, std::size_t last)
+{
+   const int kernel_elements = convkernel_w*convkernel_h;
+   const std::size_t output_elements = static_cast<std::size_t>(output_w)*output_h;
+   const std::size_t input_elements = static_cast<std::size_t>(input_w)*input_h;
+
+   // one unit is the kernel plane of one (filter, channel) pair
+   for (std::size_t unit = first; unit < last; unit++)
+   {
+      const int filter = unit / channels;
+      const int channel = unit % channels;
+      float* gradient_vals = gradient + unit*kernel_elements;
+
+      for (int input = 0; input < count; input++)
+      {
+         const float* input_plane = in + (static_cast<std::size_t>(input)*channels + channel)*input_elements;
+         const float* delta_plane = delta + (static_cast<std::size_t>(input)*filters + filter)*output_elements;
+         for (int conv_row = 0; conv_row < convkernel_h; conv_row++)
+         {
+            for (int conv_col = 0; conv_col < convkernel_w; conv_col++)
+            {
+               float total = 0.f;
+               for (int out_row = 0; out_row < output_h; out_row++)
+               {
+                  const float* in_vals = input_plane + (out_row + conv_row)*input_w + conv_col;
+                  const float* delta_vals = delta_plane + out_row*output_w;
+                  #pragma omp simd reduction(+:total)
+                  for (int out_col = 0; out_col < output_w; out_col++) total += delta_vals[out_col]*in_vals[out_col];
+               }
+               gradient_vals[conv_row*convkernel_w + conv_col] += total;
+            }
+         }
+      }
+   }
+}
+
+void cpu_conv_weight_gradient(const float* in, const float* delta, float* gradient,
+                              int convkernel_w, int convkernel_h, int input_w, int input_h,
+                              int channels, int filters, int output_w, int output_h, int count)
+{
+   const std::size_t plane_cost = static_cast<std::size_t>(output_w)*output_h*convkernel_w*convkernel_h*count;
+   parallel_ranges(static_cast<std::size_t>(filters)*channels, PARALLEL_GRAIN / std::max<std::size_t>(plane_cost, 1), [&](std::size_t first, std::size_t last) {
+      conv_weight_gradient_range(in, delta, gradient, convkernel_w, convkernel_h, input_w, input_h, channels, filters, output_w, output_h, count, first, last);
+   });
+}
+
+void cpu_rotate_conv(const float* in, float* out, int convkernel_w, int convkernel_h, int planes)
+{
+   const int kernel_elements = convkernel_w*convkernel_h;
+   for (int plane = 0; plane < planes; plane++)
+   {
+      // a 180 degree rotation is the plane read backwards
+      std::reverse_copy(in + plane*kernel_elements, in + (plane + 1)*kernel_elements, out + plane*kernel_elements);
+   }
+}
+
+void cpu_batch_norm_stats(const float* in, float* mean, float* var, int plane_size, int channels, int count)
+{
+   const std::size_t channel_cost = static_cast<std::size_t>(plane_size)*count*2;
+   parallel_ranges(channels, PARALLEL_GRAIN / std::max<std::size_t>(channel_cost, 1), [&](std::size_t first, std::size_t last) {
+      for (std::size_t channel = first; channel < last; channel++)
+      {
+         double total = 0;
+         for (int input = 0; input < count; input++)
+         {
+            const float* plane = in + (static_cast<std::size_t>(input)*channels + channel)*plane_size;
+            for (int i = 0; i < plane_size; i++) total += plane[i];
+         }
+         const float channel_mean = total / (static_cast<double>(plane_size)*count);
+
+         double squares = 0;
+         for (int input = 0; input < count; input++)
+         {
+            const float* plane = in + (static_cast<std::size_t>(input)*channels + channel)*plane_size;
+            for (int i = 0; i < plane_size; i++) squares += (plane[i] - channel_mean)*(plane[i] - channel_mean);
+         }
+         mean[channel] = channel_mean;
+         var[channel] = squares / (static_cast<double>(plane_size)*count);
+      }
+   });
+}
+
+void cpu_batch_norm(const float* in, float* out, const float* mean, const float* var, const float* gamma, const float* beta,
+                    float epsilon, int plane_size, int channels, int count)
+{
+   // one unit is one plane
+   parallel_ranges(static_cast<std::size_t>(channels)*count, PARALLEL_GRAIN / std::max(plane_size, 1), [&](std::size_t first, std::size_t last) {
+      for (std::size_t unit = first; unit < last; unit++)
+      {
+         const int channel = unit % channels;
+         const float scale = gamma[channel] / std::sqrt(var[channel] + epsilon);
+         const float shift = beta[channel] - mean[channel]*scale;
+         const float* in_vals = in + unit*plane_size;
+         float* out_vals = out + unit*plane_size;
+         #pragma omp simd
+         for (int i = 0; i < plane_size; i++) out_vals[i] = in_vals[i]*scale + shift;
+      }
+   });
+}
+
+void cpu_batch_norm_grads(const float* in, const float* delta, const float* mean, const float* var, float* dgamma, float* dbeta,
+                          float epsilon, int plane_size, int channels, int count)
+{
+   const std::size_t channel_cost = static_cast<std::size_t>(plane_size)*count;
+   parallel_ranges(channels, PARALLEL_GRAIN / std::max<std::size_t>(channel_cost, 1), [&](std::size_t first, std::size_t last) {
+      for (std::size_t channel = first; channel < last; channel++)
+      {
+         const float inv_std = 1.f / std::sqrt(var[channel] + epsilon);
+         float channel_dgamma = 0.f;
+         float channel_dbeta = 0.f;
+         for (int input = 0; input < count; input++)
+         {
+            const std::size_t offset = (static_cast<std::size_t>(input)*channels + channel)*plane_size;
+            for (int i = 0; i < plane_size; i++)
+            {
+               channel_dgamma += delta[offset + i]*(in[offset + i] - mean[channel])*inv_std;
+               channel_dbeta += delta[offset + i];
+            }
+         }
+         dgamma[channel] = channel_dgamma;
+         dbeta[channel] = channel_dbeta;
+      }
+   });
+}
+
+void cpu_batch_norm_backward(const float* in, const float* delta, float* out, const float* mean, const float* var,
+                             const float* gamma, const float* dgamma, const float* dbeta,
+                             float epsilon, int plane_size, int channels, int count)
+{
+   const float n = static_cast<float>(plane_size)*count;
+   parallel_ranges(static_cast<std::size_t>(channels)*count, PARALLEL_GRAIN / std::max(plane_size, 1), [&](std::size_t first, std::size_t last) {
+      for (std::size_t unit = first; unit < last; unit++)
+      {
+         const int channel = unit % channels;
+         const float inv_std = 1.f / std::sqrt(var[channel] + epsilon);
+         const float scale = gamma[channel]*inv_std / n;
+         const std::size_t offset = unit*plane_size;
+         #pragma omp simd
+         for (int i = 0; i < plane_size; i++)
+         {
+            const float normalized = (in[offset + i] - mean[channel])*inv_std;
+            out[offset + i] = scale*(n*delta[offset + i] - dbeta[channel] - normalized*dgamma[channel]);
+         }
+      }
+   });
+}
+
+static inline float half_to_float(std::uint16_t h, bool bf16)
+{
+   if (bf16)
+   {
+      const std::uint32_t bits = static_cast<std::uint32_t>(h) << 16;
+      float f;
+      std::memcpy(&f, &bits, sizeof(f));
+      return f;
+   }
+#ifdef __FLT16_MAX__
+   _Float16 f;
+   std::memcpy(&f, &h, sizeof(f));
+   return f;
+#else
+   const std::uint32_t sign = static_cast<std::uint32_t>(h & 0x8000) << 16;
+   const int exponent = (h >> 10) & 0x1f;
+   const std::uint32_t mantissa = h & 0x3ff;
+   float f;
+   if (exponent == 0) f = std::ldexp(static_cast<float>(mantissa), -24);
+   else if (exponent == 31) f = mantissa ? NAN : INFINITY;
+   else f = std::ldexp(static_cast<float>(mantissa | 0x400), exponent - 25);
+   std::uint32_t bits;
+   std::memcpy(&bits, &f, sizeof(bits));
+   bits |= sign;
+   std::memcpy(&f, &bits, sizeof(f));
+   return f;
+#endif
+}
+
+static inline std::uint16_t float_to_half(float f, bool bf16)
+{
+   std::uint32_t bits;
+   std::memcpy(&bits, &f, sizeof(bits));
+   if (bf16) return static_cast<std::uint16_t>((bits + 0x7fff + ((bits >> 16) & 1)) >> 16);
+#ifdef __FLT16_MAX__
+   const _Float16 h = static_cast<_Float16>(f);
+   std::uint16_t out;
+   std::memcpy(&out, &h, sizeof(out));
+   return out;
+#else
+   const std::uint16_t sign = (bits >> 16) & 0x8000;
+   const float magnitude = std::fabs(f);
+   if (std::isnan(f)) return sign | 0x7e00;
+   if (magnitude >= 65520.f) return sign | 0x7c00;
+   if (magnitude < 6.103515625e-05f) return sign | static_cast<std::uint16_t>(std::nearbyint(magnitude * 16777216.f));
+   int exponent;
+   const float fraction = std::frexp(magnitude, &exponent);
+   // 11 significant bits, the carry of a round up moves into the exponent by itself
+   const std::uint32_t significand = static_cast<std::uint32_t>(std::nearbyint(fraction * 2048.f));
+   return sign | static_cast<std::uint16_t>(((exponent + 14) << 10) + significand - 0x400);
+#endif
+}
+
+CPU_KERNEL
+static void to_half_range(const float* in, std::uint16_t* out, bool bf16, std::size_t first, std::size_t last)
+{
+   for (std::size_t i = first; i < last; i++) out[i] = float_to_half(in[i], bf16);
+}
+
+void cpu_to_half(const float* in, std::uint16_t* out, std::size_t n, bool bf16)
+{
+   parallel_ranges(n, PARALLEL_GRAIN, [&](std::size_t first, std::size_t last) {
+      to_half_range(in, out, bf16, first, last);
+   });
+}
+
+CPU_KERNEL
+static void from_half_range(const std::uint16_t* in, float* out, bool bf16, std::size_t first, std::size_t last)
+{
+   for (std::size_t i = first; i < last; i++) out[i] = half_to_float(in[i], bf16);
+}
+
+void cpu_from_half(const std::uint16_t* in, float* out, std::size_t n, bool bf16)
+{
+   parallel_ranges(n, PARALLEL_GRAIN, [&](std::size_t first, std::size_t last) {
+      from_half_range(in, out, bf16, first, last);
+   });
+}
+
+CPU_KERNEL
+static void half_matmul_range(const std::uint16_t* A, const float* B, float* C, int M, int K, int N,
+                              std::size_t a_stride, std::size_t b_stride, bool bf16, std::size_t first, std::size_t last)
+{
+   std::vector<float> a(K);
+   for (std::size_t unit = first; unit < last; unit++)
+   {
+      const std::size_t matrix = unit / M;
+      const std::size_t row = unit % M;
+      const std::uint16_t* a_half = A + matrix*a_stride + row*K;
+      const float* b = B + matrix*b_stride;
+      float* c = C + unit*N;
+
+      for (int k = 0; k < K; k++) a[k] = half_to_float(a_half[k], bf16);
+
+      if (N == 1)
+      {
+         float total = 0;
+         #pragma omp simd reduction(+:total)
+         for (int k = 0; k < K; k++) total += a[k]*b[k];
+         c[0] = total;
+         continue;
+      }
+
+      std::fill(c, c + N, 0.f);
+      for (int k = 0; k < K; k++)
+      {
+         const float a_k = a[k];
+         const float* b_row = b + static_cast<std::size_t>(k)*N;
+         #pragma omp simd
+         for (int col = 0; col < N; col++) c[col] += a_k*b_row[col];
+      }
+   }
+}
+
+void cpu_half_matmul(const std::uint16_t* A, const float* B, float* C, int M, int K, int N, int count,
+                     std::size_t a_stride, std::size_t b_stride, bool bf16)
+{
+   const std::size_t rows = static_cast<std::size_t>(M)*count;
+   const std::size_t row_cost = std::max<std::size_t>(static_cast<std::size_t>(K)*N, 1);
+   parallel_ranges(rows, PARALLEL_GRAIN / row_cost, [&](std::size_t first, std::size_t last) {
+      half_matmul_range(A, B, C, M, K, N, a_stride, b_stride, bf16, first, last);
+   });
+}
+
+static inline std::int8_t quantize_int8(float x, float scale)
+{
+   return static_cast<std::int8_t>(std::clamp(std::nearbyint(x / scale), -127.f, 127.f));
+}
+
+void cpu_quantize_int8(const float* in, std::int8_t* out, float scale, int rows, int cols, int count)
+{
+   parallel_ranges(static_cast<std::size_t>(rows)*count, PARALLEL_GRAIN / std::max(cols, 1), [&](std::size_t first, std::size_t last) {
+      for (std::size_t r = first; r < last; r++)
+      {
+         const std::size_t matrix = r / rows;
+         const std::size_t row = r % rows;
+         for (int col = 0; col < cols; col++)
+         {
+            out[(matrix*cols + col)*rows + row] = quantize_int8(in[r*cols + col], scale);
+         }
+      }
+   });
+}
+
+void cpu_quantize_rows_int8(const float* in, std::int8_t* out, float* scales, int rows, int cols)
+{
+   for (int row = 0; row < rows; row++)
+   {
+      const float* first = in + static_cast<std::size_t>(row)*cols;
+      float absmax = 0.f;
+      for (int col = 0; col < cols; col++) absmax = std::max(absmax, std::fabs(first[col]));
+      // an all zero row quantizes to zeros whatever its scale
+      scales[row] = absmax > 0.f ? absmax / 127.f : 1.f;
+      for (int col = 0; col < cols; col++) out[static_cast<std::size_t>(row)*cols + col] = quantize_int8(first[col], scales[row]);
+   }
+}
+
+void cpu_im2col_int8(const float* in, std::int8_t* out, float scale, int convkernel_w, int convkernel_h,
+                     int input_w, int input_h, int channels, int output_w, int output_h, int count)
+{
+   const std::size_t rows = static_cast<std::size_t>(channels)*convkernel_w*convkernel_h;
+   const std::size_t patches = static_cast<std::size_t>(output_w)*output_h*count;
+   parallel_ranges(patches, PARALLEL_GRAIN / std::max<std::size_t>(rows, 1), [&](std::size_t first, std::size_t last) {
+      for (std::size_t patch = first; patch < last; patch++)
+      {
+         const std::size_t input = patch / (output_w*output_h);
+         const int out_row = (patch / output_w) % output_h;
+         const int out_col = patch % output_w;
+         std::int8_t* col = out + patch*rows;
+         for (int channel = 0; channel < channels; channel++)
+         {
+            const float* plane = in + (input*channels + channel)*input_w*input_h;
+            for (int y = 0; y < convkernel_h; y++)
+            {
+               for (int x = 0; x < convkernel_w; x++)
+               {
+                  *col++ = quantize_int8(plane[(out_row + y)*input_w + out_col + x], scale);
+               }
+            }
+         }
+      }
+   });
+}
+
+// signed int8 dot products. VNNI and AVX2 only multiply unsigned by signed bytes, so `a`
+// goes in as |a| with its sign moved onto `b`; neither side holds -128, so nothing overflows
+static int dot_int8_default(const std::int8_t* a, const std::int8_t* b, int K)
+{
+   int total = 0;
+   for (int k = 0; k < K; k++) total += a[k]*b[k];
+   return total;
+}
+
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+__attribute__((target("avx512f,avx512bw,avx512vnni")))
+static int dot_int8_vnni(const std::int8_t* a, const std::int8_t* b, int K)
+{
+   __m512i acc = _mm512_setzero_si512();
+   int k = 0;
+   for (; k + 64 <= K; k += 64)
+   {
+      const __m512i va = _mm512_loadu_si512(a + k);
+      const __m512i vb = _mm512_loadu_si512(b + k);
+      const __m512i signed_b = _mm512_mask_sub_epi8(vb, _mm512_movepi8_mask(va), _mm512_setzero_si512(), vb);
+      acc = _mm512_dpbusd_epi32(acc, _mm512_abs_epi8(va), signed_b);
+   }
+   // halves added by hand, like dot_int8_avx2. The zero-masked extracts because GCC 12's plain
+   // ones (and _mm512_reduce_add_epi32) start from an uninitialized register and warn
+   const __m256i half = _mm256_add_epi32(_mm512_maskz_extracti64x4_epi64(0xFF, acc, 0), _mm512_maskz_extracti64x4_epi64(0xFF, acc, 1));
+   __m128i sum = _mm_add_epi32(_mm256_castsi256_si128(half), _mm256_extracti128_si256(half, 1));
+   sum = _mm_add_epi32(sum, _mm_shuffle_epi32(sum, _MM_SHUFFLE(1, 0, 3, 2)));
+   sum = _mm_add_epi32(sum, _mm_shuffle_epi32(sum, _MM_SHUFFLE(2, 3, 0, 1)));
+   return _mm_cvtsi128_si32(sum) + dot_int8_default(a + k, b + k, K - k);
+}
+
+__attribute__((target("avx2")))
+static int dot_int8_avx2(const std::int8_t* a, const std::int8_t* b, int K)
+{
+   const __m256i ones = _mm256_set1_epi16(1);
+   __m256i acc = _mm256_setzero_si256();
+   int k = 0;
+   for (; k + 32 <= K; k += 32)
+   {
+      const __m256i va = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(a + k));
+      const __m256i vb = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(b + k));
+      // pairs of products stay below 2*127*127, inside the int16 maddubs saturates at
+      const __m256i pairs = _mm256_maddubs_epi16(_mm256_abs_epi8(va), _mm256_sign_epi8(vb, va));
+      acc = _mm256_add_epi32(acc, _mm256_madd_epi16(pairs, ones));
+   }
+   __m128i sum = _mm_add_epi32(_mm256_castsi256_si128(acc), _mm256_extracti128_si256(acc, 1));
+   sum = _mm_add_epi32(sum, _mm_shuffle_epi32(sum, _MM_SHUFFLE(1, 0, 3, 2)));
+   sum = _mm_add_epi32(sum, _mm_shuffle_epi32(sum, _MM_SHUFFLE(2, 3, 0, 1)));
+   return _mm_cvtsi128_si32(sum) + dot_int8_default(a + k, b + k, K - k);
+}
+#endif
+
+using DotInt8 = int (*)(const std::int8_t*, const std::int8_t*, int);
+
+static DotInt8 pick_dot_int8()
+{
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+   __builtin_cpu_init();
+   if (__builtin_cpu_supports("avx512vnni") && __builtin_cpu_supports("avx512bw")) return dot_int8_vnni;
+   if (__builtin_cpu_supports("avx2")) return dot_int8_avx2;
+#endif
+   return dot_int8_default;
+}
+
+void cpu_int8_matmul(const std::int8_t* A, const float* a_scales, const std::int8_t* B, float* C, float b_scale,
+                     int M, int K, int N, int count)
+{
+   static const DotInt8 dot = pick_dot_int8();
+   parallel_ranges(static_cast<std::size_t>(M)*count, PARALLEL_GRAIN / std::max<std::size_t>(static_cast<std::size_t>(K)*N, 1), [&](std::size_t first, std::size_t last) {
+      for (std::size_t r = first; r < last; r++)
+      {
+         const std::size_t matrix = r / M;
+         const int row = r % M;
+         const float scale = a_scales[row]*b_scale;
+         for (int col = 0; col < N; col++)
+         {
+            C[r*N + col] = dot(A + static_cast<std::size_t>(row)*K, B + (matrix*N + col)*K, K) * scale;
+         }
+      }
+   });
+}
+
+CPU_KERNEL
+static void update_int16_rows_range(const std::int16_t* from, std::int16_t* to, const std::int16_t* table, int width,
+                                    const int* added, int n_added, const int* removed, int n_removed)
+{
+   if (to != from) std::memcpy(to, from, width*sizeof(std::int16_t));
+   for (int i = 0; i < n_added; i++)
+   {
+      const std::int16_t* row = table + static_cast<std::size_t>(added[i])*width;
+      for (int j = 0; j < width; j++) to[j] += row[j];
+   }
+   for (int i = 0; i < n_removed; i++)
+   {
+      const std::int16_t* row = table + static_cast<std::size_t>(removed[i])*width;
+      for (int j = 0; j < width; j++) to[j] -= row[j];
+   }
+}
+
+// a few rows of a few hundred values, not worth another thread
+void cpu_update_int16_rows(const std::int16_t* from, std::int16_t* to, const std::int16_t* table, int width,
+                           const int* added, int n_added, const int* removed, int n_removed)
+{
+   update_int16_rows_range(from, to, table, width, added, n_added, removed, n_removed);
+}
+
+CPU_KERNEL
+static void optimizer_step_range(float* params, float* grads, float* first, float* second,
+                                 int type, float learning_rate, float grad_scale, float clip, float weight_decay, bool decoupled,
+                                 float momentum, bool nesterov, float beta1, float beta2, float epsilon, float correction1, float correction2,
+                                 std::size_t begin, std::size_t end)
+{
+   for (std::size_t i = begin; i < end; i++)
+   {
+      float param = params[i];
+      float grad = grads[i] * grad_scale;
+      grads[i] = 0.f;
+
+      if (clip > 0.f) grad = std::clamp(grad, -clip, clip);
+      if (decoupled) param -= learning_rate * weight_decay * param;
+      else grad += weight_decay * param;
+
+      if (type == 0)
+      {
+         if (momentum > 0.f)
+         {
+            const float velocity = momentum * first[i] + grad;
+            first[i] = velocity;
+            grad = nesterov ? grad + momentum * velocity : velocity;
+         }
+      }
+      else
+      {
+         const float m = beta1 * first[i] + (1.f - beta1) * grad;
+         const float v = beta2 * second[i] + (1.f - beta2) * grad * grad;
+         first[i] = m;
+         second[i] = v;
+         grad = (m / correction1) / (std::sqrt(v / correction2) + epsilon);
+      }
+
+      params[i] = param - learning_rate * grad;
+   }
+}
+
+void cpu_optimizer_step(float* params, float* grads, float* first, float* second, std::size_t n,
+                        int type, float learning_rate, float grad_scale, float clip, float weight_decay, bool decoupled,
+                        float momentum, bool nesterov, float beta1, float beta2, float epsilon, float correction1, float correction2)
+{
+   parallel_ranges(n, PARALLEL_GRAIN, [&](std::size_t begin, std::size_t end) {
+      optimizer_step_range(params, grads, first, second, type, learning_rate, grad_scale, clip, weight_decay, decoupled,
+                           momentum, nesterov, beta1, beta2, epsilon, correction1, correction2, begin, end);
+   });
+}
+
+void cpu_permute_selected(const float* in, float* out, const int* permutation, const std::uint8_t* selected, int size, int count)
+{
+   parallel_ranges(count, PARALLEL_GRAIN / std::max(size, 1), [&](std::size_t first, std::size_t last) {
+      for (std::size_t matrix = first; matrix < last; matrix++)
+      {
+         const float* matrix_in = in + matrix*size;
+         float* matrix_out = out + matrix*size;
+         if (not selected[matrix]) std::copy_n(matrix_in, size, matrix_out);
+         else for (int i = 0; i < size; i++) matrix_out[i] = matrix_in[permutation[i]];
+      }
+   });
+}
@@ -0,0 +1,116 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+// Host versions of the kernels in src/kernels, used by the CPU backend. Each one is
+// compiled for AVX-512, AVX2 and baseline x86-64 and picks the best at load time,
+// and splits across cores with OpenMP once there is enough work to pay for it
+
+// `count` products of M x K and K x N matrices. A stride of 0 reuses the same matrix
+// for the whole batch
+void cpu_matmul(const float* A, const float* B, float* C, int M, int K, int N, int count, std::size_t a_stride, std::size_t b_stride);
+
+// `count` H x W matrices into W x H ones
+void cpu_transpose(const float* in, float* out, int H, int W, int count);
+
+// element-wise sum of `count` consecutive arrays of `size` floats, added to `out` when `accumulate` is set
+void cpu_sum(const float* in, float* out, int count, int size, bool accumulate = false);
+
+// C += A^T*B for a K x M matrix A and a K x N matrix B, as in tiled_matmul_tn_acc.cl
+void cpu_matmul_tn_acc(const float* A, const float* B, float* C, int M, int K, int N);
+
+// `op` is '+', '-' or '^'/'.' (element-wise product). `a` repeats every `a_size` elements,
+// so a single matrix can be applied to a whole batch
+void cpu_elementwise(char op, const float* a, const float* b, float* out, std::size_t a_size, std::size_t n);
+
+// `op` is '*', '/', '+' or '-'. `in` and `out` may be the same array
+void cpu_float_op(char op, const float* in, float* out, std::size_t n, float val);
+
+void cpu_relu(const float* in, float* out, std::size_t n);
+void cpu_relu_inv(const float* in, float* out, std::size_t n);
+void cpu_sigmoid(const float* in, float* out, std::size_t n);
+void cpu_sigmoid_inv(const float* in, float* out, std::size_t n);
+void cpu_log(const float* in, float* out, std::size_t n);
+void cpu_exp(const float* in, float* out, std::size_t n);
+
+void cpu_binary_CEL(const float* truth, const float* prediction, float* out, std::size_t n);
+void cpu_binary_CEL_derivative(const float* truth, const float* prediction, float* out, std::size_t n);
+
+// zero pads `count` images of `channels` input_h x input_w planes
+void cpu_pad(const float* in, float* out, int input_w, int input_h, int channels, int l, int r, int u, int d, int count);
+
+// same layouts and semantics as convolution.cl, over a batch of `count` padded inputs.
+// `convkernel` is [filters][channels][convkernel_h][convkernel_w]
+void cpu_convolution(const float* convkernel, const float* in, float* out,
+                     int convkernel_w, int convkernel_h, int input_w, int input_h,
+                     int channels, int filters, int output_w, int output_h, int count);
+
+// gradient of `cpu_convolution` with respect to its input, given a batch of `count` output
+// gradients padded so the (rotated) kernel can slide over them like a VALID convolution.
+// Layouts follow transpose_convolution.cl
+void cpu_transpose_convolution(const float* convkernel, float* in, const float* out,
+                               int convkernel_w, int convkernel_h, int input_w, int input_h,
+                               int channels, int filters, int output_w, int output_h, int count);
+
+// gradient of `cpu_convolution` with respect to its [filters][channels][convkernel_h][convkernel_w]
+// kernel, summed over a batch of `count` padded inputs and their output gradients `delta` and
+// added to `gradient`
+void cpu_conv_weight_gradient(const float* in, const float* delta, float* gradient,
+                              int convkernel_w, int convkernel_h, int input_w, int input_h,
+                              int channels, int filters, int output_w, int output_h, int count);
+
+// rotates each of `planes` kernel planes by 180 degrees
+void cpu_rotate_conv(const float* in, float* out, int convkernel_w, int convkernel_h, int planes);
+
+// batch normalization over `count` inputs of `channels` planes of `plane_size` floats, with
+// one mean, variance, gamma and beta per channel. Same semantics as the batch_norm*.cl kernels
+void cpu_batch_norm_stats(const float* in, float* mean, float* var, int plane_size, int channels, int count);
+void cpu_batch_norm(const float* in, float* out, const float* mean, const float* var, const float* gamma, const float* beta,
+                    float epsilon, int plane_size, int channels, int count);
+void cpu_batch_norm_grads(const float* in, const float* delta, const float* mean, const float* var, float* dgamma, float* dbeta,
+                          float epsilon, int plane_size, int channels, int count);
+void cpu_batch_norm_backward(const float* in, const float* delta, float* out, const float* mean, const float* var,
+                             const float* gamma, const float* dgamma, const float* dbeta,
+                             float epsilon, int plane_size, int channels, int count);
+
+// float to and from 16 bit storage, IEEE half or bfloat16 when `bf16` is set, rounding to
+// nearest even. Same formats as to_half.cl
+void cpu_to_half(const float* in, std::uint16_t* out, std::size_t n, bool bf16);
+void cpu_from_half(const std::uint16_t* in, float* out, std::size_t n, bool bf16);
+
+// `cpu_matmul` with A in 16 bit storage, widened a row at a time so the products accumulate in float
+void cpu_half_matmul(const std::uint16_t* A, const float* B, float* C, int M, int K, int N, int count,
+                     std::size_t a_stride, std::size_t b_stride, bool bf16);
+
+// int8 quantization as in quantize_int8.cl, q = round(x / scale) clamped to +-127. `count`
+// rows x cols matrices come out transposed, cols x rows
+void cpu_quantize_int8(const float* in, std::int8_t* out, float scale, int rows, int cols, int count);
+
+// rows x cols matrix into int8 with one scale per row, its largest magnitude over 127
+void cpu_quantize_rows_int8(const float* in, std::int8_t* out, float* scales, int rows, int cols);
+
+// im2col of `count` padded inputs quantized the same way, laid out like parallel_im2col_int8.cl:
+// one row of channels*convkernel_h*convkernel_w values per output position
+void cpu_im2col_int8(const float* in, std::int8_t* out, float scale, int convkernel_w, int convkernel_h,
+                     int input_w, int input_h, int channels, int output_w, int output_h, int count);
+
+// `count` products of the M x K int8 matrix A, scaled per row, with N x K int8 matrices B
+// (given transposed) scaled by `b_scale`. Accumulates in int32 with VNNI or AVX2 where available
+void cpu_int8_matmul(const std::int8_t* A, const float* a_scales, const std::int8_t* B, float* C, float b_scale,
+                     int M, int K, int N, int count);
+
+// `to` = `from` plus the rows `added` and minus the rows `removed` of the int16 `table`, all
+// `width` wide. Incremental updates of a sparse first layer; `from` and `to` may be the same
+void cpu_update_int16_rows(const std::int16_t* from, std::int16_t* to, const std::int16_t* table, int width,
+                           const int* added, int n_added, const int* removed, int n_removed);
+
+// one step of the optimizer in optimizer_step.cl over `n` parameters, zeroing their gradients.
+// `first` and `second` are only read by the optimizers that keep them
+void cpu_optimizer_step(float* params, float* grads, float* first, float* second, std::size_t n,
+                        int type, float learning_rate, float grad_scale, float clip, float weight_decay, bool decoupled,
+                        float momentum, bool nesterov, float beta1, float beta2, float epsilon, float correction1, float correction2);
+
+// `count` matrices of `size` floats, the ones with `selected` set gathered through `permutation`
+// as in permute_selected.cl, the others copied
+void cpu_permute_selected(const float* in, float* out, const int* permutation, const std::uint8_t* selected, int size, int count);
@@ -0,0 +1,79 @@
+#include "evaluationCache.hpp"
+#include <algorithm>
+
+EvaluationCache::EvaluationCache(std::size_t bytes, unsigned shards)
+   :m_shard_count{std::max(1u, shards)}
+   ,m_slots{std::max<std::size_t>(1, bytes / sizeof(Entry) / m_shard_count)}
+   ,m_shards{std::make_unique<Shard[]>(m_shard_count)}
+{
+   for (unsigned i = 0; i < m_shard_count; i++) m_shards[i].entries.assign(m_slots, Entry{});
+}
+
+bool EvaluationCache::lookup(std::uint64_t hash, float* policy, float* value)
+{
+   Shard& shard = m_shards[hash % m_shard_count];
+   {
+      std::lock_guard lock(shard.mutex);
+      const Entry& entry = slot(shard, hash);
+      if (entry.occupied && entry.hash == hash)
+      {
+         std::fill_n(policy, POLICY_SIZE, 0.f);
+         for (int i = 0; i < entry.moves; i++) policy[entry.indices[i]] = entry.priors[i];
+         *value = entry.value;
+         m_hits.fetch_add(1, std::memory_order_relaxed);
+         return true;
+      }
+   }
+   m_misses.fetch_add(1, std::memory_order_relaxed);
+   return false;
+}
+
+bool EvaluationCache::store(std::uint64_t hash, const float* policy, const std::vector<int>& legal, float value)
+{
+   if (legal.size() > CACHED_POLICY_MOVES)
+   {
+      m_oversized.fetch_add(1, std::memory_order_relaxed);
+      return false;
+   }
+
+   Entry entry{};
+   entry.hash = hash;
+   entry.value = value;
+   entry.occupied = 1;
+   for (int index : legal)
+   {
+      entry.indices[entry.moves] = index;
+      entry.priors[entry.moves++] = policy[index];
+   }
+
+   Shard& shard = m_shards[hash % m_shard_count];
+   std::lock_guard lock(shard.mutex);
+   Entry& replaced = slot(shard, hash);
+   if (replaced.occupied && replaced.hash != hash) m_evictions.fetch_add(1, std::memory_order_relaxed);
+   replaced = entry;
+   m_stores.fetch_add(1, std::memory_order_relaxed);
+   return true;
+}
+
+void EvaluationCache::clear()
+{
+   for (unsigned i = 0; i < m_shard_count; i++)
+   {
+      std::lock_guard lock(m_shards[i].mutex);
+      std::fill(m_shards[i].entries.begin(), m_shards[i].entries.end(), Entry{});
+   }
+}
+
+EvaluationCacheStats EvaluationCache::stats() const
+{
+   return {m_hits.load(), m_misses.load(), m_stores.load(), m_evictions.load(), m_oversized.load()};
+}
+
+void EvaluationCache::resetStats()
+{
+   m_hits = 0;
+   m_misses = 0;
+   m_stores = 0;
+   m_evictions = 0;
+   m_oversized = 0;
+}
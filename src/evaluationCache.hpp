@@ -0,0 +1,76 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <vector>
+#include "trainingData.hpp"
+
+// legal moves kept of a cached policy. Positions with more aren't cached
+constexpr int CACHED_POLICY_MOVES = 64;
+
+struct EvaluationCacheStats
+{
+   std::uint64_t hits = 0;
+   std::uint64_t misses = 0;
+   std::uint64_t stores = 0;
+   // stores that evicted another position
+   std::uint64_t evictions = 0;
+   // stores turned down for having more than CACHED_POLICY_MOVES legal moves
+   std::uint64_t oversized = 0;
+
+   double hitRate() const { return hits + misses ? double(hits) / (hits + misses) : 0.0; }
+};
+
+// policy and value net results by position_hash, in a fixed amount of memory. The table is
+// split into shards with a lock each, so threads rarely wait on one another, and every shard
+// is direct-mapped: a position goes in the one slot its hash picks, replacing whatever was
+// there. A policy is kept as the exact priors of the position's legal moves only, everything
+// else reads back as 0, so a search sees the same priors on a hit as it did on the miss
+class EvaluationCache
+{
+public:
+   // as many entries as fit in `bytes`, at least one per shard
+   explicit EvaluationCache(std::size_t bytes, unsigned shards = 64);
+
+   // the POLICY_SIZE policy and the value of a cached position, false if it isn't cached
+   bool lookup(std::uint64_t hash, float* policy, float* value);
+   // keeps the entries of `policy` at `legal`, the policy indices of the position's legal
+   // moves. False without storing anything if there are more than CACHED_POLICY_MOVES
+   bool store(std::uint64_t hash, const float* policy, const std::vector<int>& legal, float value);
+   void clear();
+
+   std::size_t capacity() const { return m_shard_count*m_slots; }
+   EvaluationCacheStats stats() const;
+   void resetStats();
+
+private:
+   struct Entry
+   {
+      std::uint64_t hash;
+      float value;
+      std::uint8_t moves;
+      std::uint8_t occupied;
+      std::uint16_t reserved;
+      std::uint16_t indices[CACHED_POLICY_MOVES];
+      float priors[CACHED_POLICY_MOVES];
+   };
+   struct Shard
+   {
+      std::mutex mutex;
+      std::vector<Entry> entries;
+   };
+
+   Entry& slot(Shard& shard, std::uint64_t hash) const { return shard.entries[hash / m_shard_count % m_slots]; }
+
+   unsigned m_shard_count;
+   std::size_t m_slots;
+   std::unique_ptr<Shard[]> m_shards;
+
+   std::atomic<std::uint64_t> m_hits = 0;
+   std::atomic<std::uint64_t> m_misses = 0;
+   std::atomic<std::uint64_t> m_stores = 0;
+   std::atomic<std::uint64_t> m_evictions = 0;
+   std::atomic<std::uint64_t> m_oversized = 0;
+};
@@ -0,0 +1,143 @@
+#include "halfMat.hpp"
+#include "oclData.hpp"
+#include "errors.hpp"
+#include "cpuKernels.hpp"
+#include <iostream>
+
+static constexpr int MATMUL_TILE = 16;
+
+cl::Buffer ocl_to_half(const cl::Buffer& input, const cl::Event& input_event, unsigned n, StoragePrecision precision, cl::Event* event)
+{
+   cl::Buffer out_buffer(ocl_context, CL_MEM_READ_WRITE, std::max(n, 1u)*sizeof(std::uint16_t));
+   try {
+      to_half_kernel.setArg( 0, input );
+      to_half_kernel.setArg( 1, out_buffer );
+      to_half_kernel.setArg( 2, static_cast<cl_int>(precision == STORAGE_BF16) );
+      auto deps = ocl_wait_list({input_event});
+      ocl_queue.enqueueNDRangeKernel( to_half_kernel, cl::NullRange, cl::NDRange(n), cl::NullRange, &deps, event );
+   }
+   catch(cl::Error& err) {
+      std::cout << "Error in to_half: " << err.what() << "(" << getErrorString(err.err()) << ")" << std::endl;
+   }
+   return out_buffer;
+}
+
+void ocl_tiled_matmul_half(const cl::Buffer& A, const cl::Buffer& B, const cl::Buffer& C,
+                           int M, int K, int N, int batch, int A_stride, int B_stride, int B_start, int C_start,
+                           StoragePrecision precision, const std::vector<cl::Event>* deps, cl::Event* event)
+{
+   tiled_matmul_half_kernel.setArg( 0, A );
+   tiled_matmul_half_kernel.setArg( 1, B );
+   tiled_matmul_half_kernel.setArg( 2, C );
+   tiled_matmul_half_kernel.setArg( 3, M );
+   tiled_matmul_half_kernel.setArg( 4, K );
+   tiled_matmul_half_kernel.setArg( 5, N );
+   tiled_matmul_half_kernel.setArg( 6, A_stride );
+   tiled_matmul_half_kernel.setArg( 7, B_stride );
+   tiled_matmul_half_kernel.setArg( 8, B_start );
+   tiled_matmul_half_kernel.setArg( 9, C_start );
+   tiled_matmul_half_kernel.setArg( 10, static_cast<cl_int>(precision == STORAGE_BF16) );
+
+   auto round_up = [](int n) { return (n + MATMUL_TILE - 1) / MATMUL_TILE * MATMUL_TILE; };
+   cl::NDRange global( round_up(N), round_up(M), batch );
+   cl::NDRange local( MATMUL_TILE, MATMUL_TILE, 1 );
+   ocl_queue.enqueueNDRangeKernel( tiled_matmul_half_kernel, cl::NullRange, global, local, deps, event );
+}
+
+HalfMat::HalfMat(const Mat& mat, StoragePrecision precision)
+   :m_height{mat.getHeight()}
+   ,m_width{mat.getWidth()}
+   ,m_precision{precision}
+{
+   assert(precision != STORAGE_FP32);
+   const unsigned N_ELEMENTS = m_height*m_width;
+   if (mat_backend == CPU_BACKEND)
+   {
+      m_host = std::make_shared<std::vector<std::uint16_t>>(N_ELEMENTS);
+      cpu_to_half(mat.m_host->data(), m_host->data(), N_ELEMENTS, precision == STORAGE_BF16);
+      return;
+   }
+   m_buffer = ocl_to_half(mat.m_buffer, mat.m_event, N_ELEMENTS, precision, &m_event);
+}
+
+HalfMat::HalfMat(unsigned height, unsigned width, const std::vector<float>& vals, StoragePrecision precision)
+   :m_height{height}
+   ,m_width{width}
+   ,m_precision{precision}
+{
+   assert(precision != STORAGE_FP32);
+   assert(vals.size() == height*width);
+   Mat::setup();
+
+   std::vector<std::uint16_t> half_vals(vals.size());
+   cpu_to_half(vals.data(), half_vals.data(), vals.size(), precision == STORAGE_BF16);
+   if (mat_backend == CPU_BACKEND)
+   {
+      m_host = std::make_shared<std::vector<std::uint16_t>>(std::move(half_vals));
+      return;
+   }
+   m_buffer = cl::Buffer(ocl_context, CL_MEM_READ_WRITE, std::max<size_t>(vals.size(), 1)*sizeof(std::uint16_t));
+   m_event = ocl_upload(m_buffer, std::move(half_vals));
+}
+
+Mat HalfMat::toMat() const
+{
+   const unsigned N_ELEMENTS = m_height*m_width;
+   if (mat_backend == CPU_BACKEND)
+   {
+      auto out = std::make_shared<std::vector<float>>(N_ELEMENTS);
+      cpu_from_half(m_host->data(), out->data(), N_ELEMENTS, m_precision == STORAGE_BF16);
+      return Mat(m_height, m_width, out);
+   }
+   cl::Buffer out_buffer(ocl_context, CL_MEM_READ_WRITE, N_ELEMENTS*sizeof(float));
+   cl::Event out_event;
+   try {
+      from_half_kernel.setArg( 0, m_buffer );
+      from_half_kernel.setArg( 1, out_buffer );
+      from_half_kernel.setArg( 2, static_cast<cl_int>(m_precision == STORAGE_BF16) );
+      auto deps = ocl_wait_list({m_event});
+      ocl_queue.enqueueNDRangeKernel( from_half_kernel, cl::NullRange, cl::NDRange(N_ELEMENTS), cl::NullRange, &deps, &out_event );
+   }
+   catch(cl::Error& err) {
+      std::cout << "Error in from_half: " << err.what() << "(" << getErrorString(err.err()) << ")" << std::endl;
+   }
+   return Mat(m_height, m_width, out_buffer, out_event);
+}
+
+Mat HalfMat::operator* (const Mat& other) const
+{
+   if (mat_backend == CPU_BACKEND)
+   {
+      return (*this * ParallelMat(other.m_height, other.m_width, 1, other.m_host)).at(0);
+   }
+   return (*this * ParallelMat(other.m_height, other.m_width, 1, other.m_buffer, other.m_event)).at(0);
+}
+
+ParallelMat HalfMat::operator* (const ParallelMat& other) const
+{
+   assert(m_width == other.m_height);
+
+   const int M = m_height;
+   const int K = m_width;
+   const int N = other.m_width;
+   const int C_N_ELEMENTS = M*N*other.m_count;
+   if (mat_backend == CPU_BACKEND)
+   {
+      auto out = std::make_shared<std::vector<float>>(C_N_ELEMENTS);
+      cpu_half_matmul(m_host->data(), other.hostData(), out->data(), M, K, N, other.m_count, 0, K*N, m_precision == STORAGE_BF16);
+      return ParallelMat(M, N, other.m_count, out);
+   }
+
+   cl::Buffer half_other = ocl_to_half(other.buffer(), other.m_event, K*N*other.m_count, m_precision);
+   cl::Buffer out_buffer(ocl_context, CL_MEM_READ_WRITE, C_N_ELEMENTS*sizeof(float));
+   cl::Event out_event;
+   try {
+      // the conversion of `other` is ahead on the in-order queue
+      auto deps = ocl_wait_list({m_event});
+      ocl_tiled_matmul_half(m_buffer, half_other, out_buffer, M, K, N, other.m_count, 0, K*N, 0, 0, m_precision, &deps, &out_event);
+   }
+   catch(cl::Error& err) {
+      std::cout << "Error in half operator*: " << err.what() << "(" << getErrorString(err.err()) << ")" << std::endl;
+   }
+   return ParallelMat(M, N, other.m_count, out_buffer, out_event);
+}
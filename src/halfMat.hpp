@@ -0,0 +1,45 @@
+#pragma once
+
+#include <cstdint>
+#include "mat.hpp"
+#include "parallelMat.hpp"
+
+// a matrix kept in 16 bit storage (STORAGE_FP16 or STORAGE_BF16) for inference, which halves
+// the bandwidth of reading it. Products widen every element back to float and accumulate in
+// float, so only the storage loses precision
+class HalfMat
+{
+public:
+   // converted on the device
+   HalfMat(const Mat& mat, StoragePrecision precision = half_storage());
+   // converted on the host, so only the 16 bit values are uploaded
+   HalfMat(unsigned height, unsigned width, const std::vector<float>& vals, StoragePrecision precision = half_storage());
+
+   Mat toMat() const;
+
+   // the activations are stored as 16 bit too before the OpenCL GEMM reads them, the CPU
+   // backend reads them as they are
+   Mat operator* (const Mat& other) const;
+   ParallelMat operator* (const ParallelMat& other) const;
+
+   unsigned getWidth() const { return m_width; }
+   unsigned getHeight() const { return m_height; }
+   StoragePrecision precision() const { return m_precision; }
+
+private:
+   cl::Buffer m_buffer;
+   cl::Event m_event;
+   // used instead of `m_buffer` on the CPU backend
+   std::shared_ptr<std::vector<std::uint16_t>> m_host;
+   unsigned m_height;
+   unsigned m_width;
+   StoragePrecision m_precision;
+};
+
+// `n` floats of `input` into a new 16 bit buffer once `input_event` has completed
+cl::Buffer ocl_to_half(const cl::Buffer& input, const cl::Event& input_event, unsigned n, StoragePrecision precision, cl::Event* event = nullptr);
+
+// tiled_matmul_half.cl over `batch` pairs of 16 bit matrices, see the kernel for the arguments
+void ocl_tiled_matmul_half(const cl::Buffer& A, const cl::Buffer& B, const cl::Buffer& C,
+                           int M, int K, int N, int batch, int A_stride, int B_stride, int B_start, int C_start,
+                           StoragePrecision precision, const std::vector<cl::Event>* deps, cl::Event* event);
@@ -0,0 +1,110 @@
+#include "int8Mat.hpp"
+#include "oclData.hpp"
+#include "errors.hpp"
+#include "cpuKernels.hpp"
+#include <algorithm>
+#include <iostream>
+
+void ocl_int8_matmul(const cl::Buffer& A, const cl::Buffer& A_scales, const cl::Buffer& B, const cl::Buffer& C, float B_scale,
+                     int M, int K, int N, int batch, int C_start, const std::vector<cl::Event>* deps, cl::Event* event)
+{
+   int8_matmul_kernel.setArg( 0, A );
+   int8_matmul_kernel.setArg( 1, A_scales );
+   int8_matmul_kernel.setArg( 2, B );
+   int8_matmul_kernel.setArg( 3, C );
+   int8_matmul_kernel.setArg( 4, B_scale );
+   int8_matmul_kernel.setArg( 5, M );
+   int8_matmul_kernel.setArg( 6, K );
+   int8_matmul_kernel.setArg( 7, N );
+   int8_matmul_kernel.setArg( 8, C_start );
+   ocl_queue.enqueueNDRangeKernel( int8_matmul_kernel, cl::NullRange, cl::NDRange(N, M, batch), cl::NullRange, deps, event );
+}
+
+Int8Mat::Int8Mat(const Mat& mat)
+   :m_height{mat.getHeight()}
+   ,m_width{mat.getWidth()}
+{
+   const std::vector<float> vals = mat.getVals();
+   std::vector<std::int8_t> quantized(vals.size());
+   std::vector<float> scales(m_height);
+   cpu_quantize_rows_int8(vals.data(), quantized.data(), scales.data(), m_height, m_width);
+   m_host_scales = std::make_shared<std::vector<float>>(scales);
+   if (mat_backend == CPU_BACKEND)
+   {
+      m_host = std::make_shared<std::vector<std::int8_t>>(std::move(quantized));
+      return;
+   }
+   m_buffer = cl::Buffer(ocl_context, CL_MEM_READ_WRITE, std::max<size_t>(quantized.size(), 1));
+   m_scales = cl::Buffer(ocl_context, CL_MEM_READ_WRITE, std::max<size_t>(scales.size(), 1)*sizeof(float));
+   m_scales_event = ocl_upload(m_scales, std::move(scales));
+   m_event = ocl_upload(m_buffer, std::move(quantized));
+}
+
+Mat Int8Mat::toMat() const
+{
+   std::vector<float> vals(m_height*m_width);
+   std::vector<std::int8_t> quantized(vals.size());
+   if (mat_backend == CPU_BACKEND)
+   {
+      quantized = *m_host;
+   }
+   else
+   {
+      auto deps = ocl_wait_list({m_event});
+      ocl_queue.enqueueReadBuffer( m_buffer, CL_TRUE, 0, quantized.size(), quantized.data(), &deps );
+   }
+   for (unsigned i = 0; i < vals.size(); i++)
+   {
+      vals[i] = quantized[i] * (*m_host_scales)[i / m_width];
+   }
+   return Mat(m_height, m_width, std::move(vals));
+}
+
+Mat Int8Mat::multiply(const Mat& other, float input_scale) const
+{
+   if (mat_backend == CPU_BACKEND)
+   {
+      return multiply(ParallelMat(other.m_height, other.m_width, 1, other.m_host), input_scale).at(0);
+   }
+   return multiply(ParallelMat(other.m_height, other.m_width, 1, other.m_buffer, other.m_event), input_scale).at(0);
+}
+
+ParallelMat Int8Mat::multiply(const ParallelMat& other, float input_scale) const
+{
+   assert(m_width == other.m_height);
+
+   const int M = m_height;
+   const int K = m_width;
+   const int N = other.m_width;
+   const int B_N_ELEMENTS = K*N*other.m_count;
+   const int C_N_ELEMENTS = M*N*other.m_count;
+   if (mat_backend == CPU_BACKEND)
+   {
+      std::vector<std::int8_t> quantized(B_N_ELEMENTS);
+      cpu_quantize_int8(other.hostData(), quantized.data(), input_scale, K, N, other.m_count);
+      auto out = std::make_shared<std::vector<float>>(C_N_ELEMENTS);
+      cpu_int8_matmul(m_host->data(), m_host_scales->data(), quantized.data(), out->data(), input_scale, M, K, N, other.m_count);
+      return ParallelMat(M, N, other.m_count, out);
+   }
+
+   cl::Buffer quantized(ocl_context, CL_MEM_READ_WRITE, std::max(B_N_ELEMENTS, 1));
+   cl::Buffer out_buffer(ocl_context, CL_MEM_READ_WRITE, C_N_ELEMENTS*sizeof(float));
+   cl::Event out_event;
+   try {
+      quantize_int8_kernel.setArg( 0, other.buffer() );
+      quantize_int8_kernel.setArg( 1, quantized );
+      quantize_int8_kernel.setArg( 2, input_scale );
+      quantize_int8_kernel.setArg( 3, K );
+      quantize_int8_kernel.setArg( 4, N );
+      auto quantize_deps = ocl_wait_list({other.m_event});
+      ocl_queue.enqueueNDRangeKernel( quantize_int8_kernel, cl::NullRange, cl::NDRange(B_N_ELEMENTS), cl::NullRange, &quantize_deps );
+
+      // the quantization of `other` is ahead on the in-order queue
+      auto deps = ocl_wait_list({m_event, m_scales_event});
+      ocl_int8_matmul(m_buffer, m_scales, quantized, out_buffer, input_scale, M, K, N, other.m_count, 0, &deps, &out_event);
+   }
+   catch(cl::Error& err) {
+      std::cout << "Error in int8 multiply: " << err.what() << "(" << getErrorString(err.err()) << ")" << std::endl;
+   }
+   return ParallelMat(M, N, other.m_count, out_buffer, out_event);
+}
@@ -0,0 +1,44 @@
+#pragma once
+
+#include <cstdint>
+#include "mat.hpp"
+#include "parallelMat.hpp"
+
+// a matrix quantized to int8 for inference, with one float scale per row (its largest magnitude
+// over 127) so a single large weight only costs precision in its own row. Products quantize the
+// activations with one scale for the whole input, accumulate in int32 and dequantize the result
+class Int8Mat
+{
+public:
+   // quantized on the host, so only the int8 values and the scales are uploaded
+   Int8Mat(const Mat& mat);
+
+   // `other` is quantized with `input_scale`, usually the largest activation seen while
+   // calibrating over 127. Activations past that range are clamped
+   Mat multiply(const Mat& other, float input_scale) const;
+   ParallelMat multiply(const ParallelMat& other, float input_scale) const;
+
+   // the dequantized weights, to see what quantizing lost
+   Mat toMat() const;
+
+   unsigned getWidth() const { return m_width; }
+   unsigned getHeight() const { return m_height; }
+   const std::vector<float>& scales() const { return *m_host_scales; }
+
+private:
+   cl::Buffer m_buffer;
+   cl::Buffer m_scales;
+   cl::Event m_event;
+   cl::Event m_scales_event;
+   // used instead of `m_buffer` on the CPU backend
+   std::shared_ptr<std::vector<std::int8_t>> m_host;
+   std::shared_ptr<std::vector<float>> m_host_scales;
+   unsigned m_height;
+   unsigned m_width;
+
+   friend ConvKernel;
+};
+
+// int8_matmul.cl over `batch` matrices B, see the kernel for the arguments
+void ocl_int8_matmul(const cl::Buffer& A, const cl::Buffer& A_scales, const cl::Buffer& B, const cl::Buffer& C, float B_scale,
+                     int M, int K, int N, int batch, int C_start, const std::vector<cl::Event>* deps, cl::Event* event);
@@ -0,0 +1,14 @@
+kernel void batch_norm( global float* INPUT, 
+                        global float* OUTPUT, 
+                        global float* MEAN, 
+                        global float* VAR, 
+                        global float* GAMMA, 
+                        global float* BETA, 
+                        float epsilon, 
+                        int plane_size, 
+                        int channels) {
+   const int idx = get_global_id(0);
+   const int channel = (idx / plane_size) % channels;
+
+   OUTPUT[idx] = (INPUT[idx] - MEAN[channel]) * rsqrt(VAR[channel] + epsilon) * GAMMA[channel] + BETA[channel];
+}
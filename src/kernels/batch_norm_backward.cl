@@ -0,0 +1,21 @@
+kernel void batch_norm_backward( global float* INPUT, 
+                                 global float* DELTA, 
+                                 global float* OUTPUT, 
+                                 global float* MEAN, 
+                                 global float* VAR, 
+                                 global float* GAMMA, 
+                                 global float* DGAMMA, 
+                                 global float* DBETA, 
+                                 float epsilon, 
+                                 int plane_size, 
+                                 int channels, 
+                                 int count) {
+   const int idx = get_global_id(0);
+   const int channel = (idx / plane_size) % channels;
+   const float n = plane_size*count;
+   const float inv_std = rsqrt(VAR[channel] + epsilon);
+   const float normalized = (INPUT[idx] - MEAN[channel]) * inv_std;
+
+   // the mean and variance depend on every input of the channel, hence the two batch wide terms
+   OUTPUT[idx] = GAMMA[channel] * inv_std / n * (n*DELTA[idx] - DBETA[channel] - normalized*DGAMMA[channel]);
+}
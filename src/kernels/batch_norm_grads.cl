@@ -0,0 +1,27 @@
+kernel void batch_norm_grads( global float* INPUT, 
+                              global float* DELTA, 
+                              global float* MEAN, 
+                              global float* VAR, 
+                              global float* DGAMMA, 
+                              global float* DBETA, 
+                              float epsilon, 
+                              int plane_size, 
+                              int channels, 
+                              int count) {
+   const int channel = get_global_id(0);
+   const float mean = MEAN[channel];
+   const float inv_std = rsqrt(VAR[channel] + epsilon);
+
+   float dgamma = 0;
+   float dbeta = 0;
+   for (int input = 0; input < count; input++) {
+      const int first = (input*channels + channel)*plane_size;
+      for (int i = first; i < first + plane_size; i++) {
+         dgamma += DELTA[i] * (INPUT[i] - mean) * inv_std;
+         dbeta += DELTA[i];
+      }
+   }
+
+   DGAMMA[channel] = dgamma;
+   DBETA[channel] = dbeta;
+}
@@ -0,0 +1,26 @@
+kernel void batch_norm_stats( global float* INPUT, 
+                              global float* MEAN, 
+                              global float* VAR, 
+                              int plane_size, 
+                              int channels, 
+                              int count) {
+   const int channel = get_global_id(0);
+   const int n = plane_size*count;
+
+   float total = 0;
+   for (int input = 0; input < count; input++) {
+      global const float* plane = INPUT + (input*channels + channel)*plane_size;
+      for (int i = 0; i < plane_size; i++) total += plane[i];
+   }
+   const float mean = total / n;
+
+   // second pass over the deviations, one pass with E[x^2] - E[x]^2 loses too much precision
+   float squares = 0;
+   for (int input = 0; input < count; input++) {
+      global const float* plane = INPUT + (input*channels + channel)*plane_size;
+      for (int i = 0; i < plane_size; i++) squares += (plane[i] - mean)*(plane[i] - mean);
+   }
+
+   MEAN[channel] = mean;
+   VAR[channel] = squares / n;
+}
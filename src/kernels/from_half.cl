@@ -0,0 +1,6 @@
+kernel void from_half( global ushort* INPUT, 
+                       global float* OUTPUT, 
+                       int bf16) {
+   const int idx = get_global_id(0);
+   OUTPUT[idx] = bf16 ? as_float((uint)INPUT[idx] << 16) : vload_half(idx, (global const half*)INPUT);
+}
@@ -0,0 +1,34 @@
+// C = A*B dequantized, for `batch` int8 matrices B given transposed (N x K). A is M x K with
+// one scale per row, B has the single scale `B_scale`. Products accumulate in int32, one
+// work item per element of C, launched over (N, M, batch)
+kernel void int8_matmul( global char* A,
+                         global float* A_SCALES,
+                         global char* B,
+                         global float* C,
+                         float B_scale,
+                         int M,
+                         int K,
+                         int N,
+                         int C_start)
+{
+    const int col = get_global_id(0);
+    const int row = get_global_id(1);
+    const int batch = get_global_id(2);
+
+    global const char* a = A + row*K;
+    global const char* b = B + (batch*N + col)*K;
+
+    int total = 0;
+    int k = 0;
+    for (; k + 4 <= K; k += 4)
+    {
+        int4 products = convert_int4(vload4(0, a + k)) * convert_int4(vload4(0, b + k));
+        total += products.x + products.y + products.z + products.w;
+    }
+    for (; k < K; k++)
+    {
+        total += a[k]*b[k];
+    }
+
+    C[C_start + (batch*M + row)*N + col] = total * A_SCALES[row] * B_scale;
+}
@@ -1,7 +1,7 @@
-kernel void multiple_add( global float* A, global float* B, global float* out, int B_size) {
+kernel void multiple_add( global float* A, global float* B, global float* out, int B_size, int B_start) {
    const int idx = get_global_id(0);
    
    int real_idx = idx % B_size;
    
-   out[idx] = A[real_idx] + B[idx];
+   out[idx] = A[real_idx] + B[B_start + idx];
 }
\ No newline at end of file
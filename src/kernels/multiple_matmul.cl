@@ -1,11 +1,11 @@
-kernel void multiple_matmul( global float* A, global float* B, global float* C, int common, int B_w, int A_h) {
+kernel void multiple_matmul( global float* A, global float* B, global float* C, int common, int B_w, int A_h, int B_start) {
     const int idx = get_global_id(0);
     
     const int OUT_NUM_ELEM = A_h*B_w;
     const int B_NUM_ELEM = B_w*common;
     const int real_idx = idx % OUT_NUM_ELEM;
     const int CURRENT_MATRIX = idx / OUT_NUM_ELEM;
-    const int B_offset = CURRENT_MATRIX*B_NUM_ELEM;
+    const int B_offset = B_start + CURRENT_MATRIX*B_NUM_ELEM;
 
     
     const int row = real_idx / B_w;
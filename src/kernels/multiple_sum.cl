@@ -1,7 +1,8 @@
-kernel void multiple_sum( global float* input, global float* output, int numArrays, int arraySize) {
+// sums `numArrays` arrays into `output`, or adds their sum to it when `accumulate` is set
+kernel void multiple_sum( global float* input, global float* output, int numArrays, int arraySize, int accumulate) {
    const int idx = get_global_id(0);
    
-   float sum = 0;
+   float sum = accumulate ? output[idx] : 0;
    for (int i = 0; i < numArrays; i += 1) {
       sum += input[idx + i*arraySize];
    }
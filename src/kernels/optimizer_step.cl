@@ -0,0 +1,48 @@
+// one optimizer step of a parameter tensor from its summed gradients, which are zeroed for the
+// next batch. `type` 0 is SGD, keeping its velocity in FIRST when `momentum` is set, 1 is Adam
+// with its moments in FIRST and SECOND. `correction1`/`correction2` are Adam's bias corrections
+// 1 - beta^t. See ParameterOptimizer in optimizer.hpp
+kernel void optimizer_step( global float* PARAMS,
+                            global float* GRADS,
+                            global float* FIRST,
+                            global float* SECOND,
+                            int type,
+                            float learning_rate,
+                            float grad_scale,
+                            float clip,
+                            float weight_decay,
+                            int decoupled,
+                            float momentum,
+                            int nesterov,
+                            float beta1,
+                            float beta2,
+                            float epsilon,
+                            float correction1,
+                            float correction2)
+{
+    const int idx = get_global_id(0);
+
+    float param = PARAMS[idx];
+    float grad = GRADS[idx] * grad_scale;
+    GRADS[idx] = 0.f;
+
+    if (clip > 0.f) grad = clamp(grad, -clip, clip);
+    if (decoupled) param -= learning_rate * weight_decay * param;
+    else grad += weight_decay * param;
+
+    if (type == 0) {
+        if (momentum > 0.f) {
+            float velocity = momentum * FIRST[idx] + grad;
+            FIRST[idx] = velocity;
+            grad = nesterov ? grad + momentum * velocity : velocity;
+        }
+    } else {
+        float m = beta1 * FIRST[idx] + (1.f - beta1) * grad;
+        float v = beta2 * SECOND[idx] + (1.f - beta2) * grad * grad;
+        FIRST[idx] = m;
+        SECOND[idx] = v;
+        grad = (m / correction1) / (sqrt(v / correction2) + epsilon);
+    }
+
+    PARAMS[idx] = param - learning_rate * grad;
+}
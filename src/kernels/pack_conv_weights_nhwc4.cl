@@ -0,0 +1,17 @@
+// repacks [filters][channels][kh][kw] weights to [filters][kh][kw][channel_blocks][4], with
+// the channels zero padded to a multiple of 4, so parallel_convolution_nhwc4 can read a
+// whole block of channels with one vector load
+kernel void pack_conv_weights_nhwc4( global float* CONVKERNEL,
+                                     global float* PACKED,
+                                     int kernel_elements,
+                                     int channels)
+{
+    const int idx = get_global_id(0);
+
+    int padded_channels = (channels + 3) / 4 * 4;
+    int channel = idx % padded_channels;
+    int element = (idx / padded_channels) % kernel_elements;
+    int filter = idx / (padded_channels*kernel_elements);
+
+    PACKED[idx] = channel < channels ? CONVKERNEL[(filter*channels + channel)*kernel_elements + element] : 0.f;
+}
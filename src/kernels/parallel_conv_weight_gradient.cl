@@ -0,0 +1,45 @@
+kernel void parallel_conv_weight_gradient( global float* INPUT, 
+                                           global float* DELTA, 
+                                           global float* GRADIENT, 
+                                           int convkernel_w, 
+                                           int convkernel_h,
+                                           int input_w,
+                                           int input_h,
+                                           int channels,
+                                           int filters,
+                                           int output_w,
+                                           int output_h,
+                                           int count)
+{
+    const int idx = get_global_id(0);
+
+    int kernel_elements = convkernel_w*convkernel_h;
+    int output_elements = output_w*output_h;
+    int input_elements = input_w*input_h;
+
+    int filter = idx / (channels*kernel_elements);
+    int channel = (idx / kernel_elements) % channels;
+    int conv_row = (idx % kernel_elements) / convkernel_w;
+    int conv_col = (idx % kernel_elements) % convkernel_w;
+
+    float total = 0;
+
+    // one weight summed over every output of every input in the batch, INPUT is padded
+    for (int input = 0; input < count; input++)
+    {
+        global const float* input_plane = INPUT + (input*channels + channel)*input_elements;
+        global const float* delta_plane = DELTA + (input*filters + filter)*output_elements;
+
+        for (int output_row = 0; output_row < output_h; output_row++)
+        {
+            global const float* input_vals = input_plane + (output_row + conv_row)*input_w + conv_col;
+            global const float* delta_vals = delta_plane + output_row*output_w;
+            for (int output_col = 0; output_col < output_w; output_col++)
+            {
+                total += delta_vals[output_col]*input_vals[output_col];
+            }
+        }
+    }
+
+    GRADIENT[idx] += total;
+}
@@ -36,7 +36,7 @@ kernel void parallel_convolution( global float* CONVKERNEL,
 
             for (int channel = 0; channel < channels; channel++)
             {
-                float kernel_val = CONVKERNEL[filter*kernel_elements + conv_row*convkernel_w + conv_col];
+                float kernel_val = CONVKERNEL[(filter*channels + channel)*kernel_elements + conv_row*convkernel_w + conv_col];
                 float input_val = INPUT[output*total_input_elements + channel*channel_elements + input_row*input_w + input_col];
                 total += kernel_val*input_val;
             }
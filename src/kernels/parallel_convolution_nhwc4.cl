@@ -0,0 +1,44 @@
+// parallel_convolution over inputs and weights in the channel-blocked layouts written by
+// parallel_pad_nhwc4 and pack_conv_weights_nhwc4. The channel loop runs 4 channels per
+// iteration with vector loads and multiply-adds; the output stays channel-planar
+kernel void parallel_convolution_nhwc4( global float* CONVKERNEL,
+                                        global float* INPUT,
+                                        global float* OUTPUT,
+                                        int convkernel_w,
+                                        int convkernel_h,
+                                        int input_w,
+                                        int input_h,
+                                        int channels,
+                                        int filters,
+                                        int output_w,
+                                        int output_h)
+{
+    const int idx = get_global_id(0);
+
+    int output_elements = output_w*output_h;
+    int total_output_elements = output_elements*filters;
+    int channel_blocks = (channels + 3) / 4;
+
+    int input = idx / total_output_elements;
+    int filter = (idx % total_output_elements) / output_elements;
+    int out_row = (idx % output_elements) / output_w;
+    int out_col = (idx % output_elements) % output_w;
+
+    float4 total = (float4)(0.f);
+
+    for (int conv_row = 0; conv_row < convkernel_h; conv_row++)
+    {
+        for (int conv_col = 0; conv_col < convkernel_w; conv_col++)
+        {
+            global float* pixel = INPUT + ((input*input_h + out_row + conv_row)*input_w + out_col + conv_col)*channel_blocks*4;
+            global float* weights = CONVKERNEL + ((filter*convkernel_h + conv_row)*convkernel_w + conv_col)*channel_blocks*4;
+
+            for (int block = 0; block < channel_blocks; block++)
+            {
+                total = fma(vload4(block, weights), vload4(block, pixel), total);
+            }
+        }
+    }
+
+    OUTPUT[idx] = total.x + total.y + total.z + total.w;
+}
@@ -0,0 +1,32 @@
+// unrolls the patches of padded inputs into column matrices, one per input, of
+// (channels*convkernel_h*convkernel_w) rows by (output_h*output_w) columns
+kernel void parallel_im2col( global float* INPUT,
+                             global float* COLS,
+                             int input_w,
+                             int input_h,
+                             int channels,
+                             int convkernel_w,
+                             int convkernel_h,
+                             int output_w,
+                             int output_h,
+                             int first_input)
+{
+    const int idx = get_global_id(0);
+
+    int kernel_elements = convkernel_w*convkernel_h;
+    int output_elements = output_w*output_h;
+    int channel_elements = input_w*input_h;
+    int rows = kernel_elements*channels;
+
+    int input = first_input + idx / (rows*output_elements);
+    int row = (idx / output_elements) % rows;
+    int pos = idx % output_elements;
+
+    int channel = row / kernel_elements;
+    int conv_row = (row % kernel_elements) / convkernel_w;
+    int conv_col = row % convkernel_w;
+    int out_row = pos / output_w;
+    int out_col = pos % output_w;
+
+    COLS[idx] = INPUT[input*channel_elements*channels + channel*channel_elements + (out_row + conv_row)*input_w + out_col + conv_col];
+}
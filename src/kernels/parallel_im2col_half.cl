@@ -0,0 +1,39 @@
+// parallel_im2col writing the columns in 16 bit storage (see to_half.cl), which halves the
+// traffic of the unrolled patches
+kernel void parallel_im2col_half( global float* INPUT,
+                                  global ushort* COLS,
+                                  int input_w,
+                                  int input_h,
+                                  int channels,
+                                  int convkernel_w,
+                                  int convkernel_h,
+                                  int output_w,
+                                  int output_h,
+                                  int first_input,
+                                  int bf16)
+{
+    const int idx = get_global_id(0);
+
+    int kernel_elements = convkernel_w*convkernel_h;
+    int output_elements = output_w*output_h;
+    int channel_elements = input_w*input_h;
+    int rows = kernel_elements*channels;
+
+    int input = first_input + idx / (rows*output_elements);
+    int row = (idx / output_elements) % rows;
+    int pos = idx % output_elements;
+
+    int channel = row / kernel_elements;
+    int conv_row = (row % kernel_elements) / convkernel_w;
+    int conv_col = row % convkernel_w;
+    int out_row = pos / output_w;
+    int out_col = pos % output_w;
+
+    float val = INPUT[input*channel_elements*channels + channel*channel_elements + (out_row + conv_row)*input_w + out_col + conv_col];
+    if (bf16) {
+        uint bits = as_uint(val);
+        COLS[idx] = (ushort)((bits + 0x7fff + ((bits >> 16) & 1)) >> 16);
+    } else {
+        vstore_half_rte(val, idx, (global half*)COLS);
+    }
+}
@@ -0,0 +1,34 @@
+// parallel_im2col quantized to int8 like quantize_int8.cl, one patch per row: (output_h*output_w)
+// rows of (channels*convkernel_h*convkernel_w) values per input
+kernel void parallel_im2col_int8( global float* INPUT,
+                                  global char* COLS,
+                                  int input_w,
+                                  int input_h,
+                                  int channels,
+                                  int convkernel_w,
+                                  int convkernel_h,
+                                  int output_w,
+                                  int output_h,
+                                  int first_input,
+                                  float scale)
+{
+    const int idx = get_global_id(0);
+
+    int kernel_elements = convkernel_w*convkernel_h;
+    int output_elements = output_w*output_h;
+    int channel_elements = input_w*input_h;
+    int rows = kernel_elements*channels;
+
+    int input = first_input + idx / (rows*output_elements);
+    int pos = (idx / rows) % output_elements;
+    int row = idx % rows;
+
+    int channel = row / kernel_elements;
+    int conv_row = (row % kernel_elements) / convkernel_w;
+    int conv_col = row % convkernel_w;
+    int out_row = pos / output_w;
+    int out_col = pos % output_w;
+
+    float val = INPUT[input*channel_elements*channels + channel*channel_elements + (out_row + conv_row)*input_w + out_col + conv_col];
+    COLS[idx] = (char)clamp(rint(val / scale), -127.f, 127.f);
+}
@@ -0,0 +1,29 @@
+// pads a batch of channel-planar inputs like parallel_pad, writing them channel-innermost
+// as [input][row][col][channel_blocks][4] with the channels zero padded to a multiple of 4
+kernel void parallel_pad_nhwc4( global float* INPUT,
+                                global float* OUTPUT,
+                                int input_width,
+                                int input_height,
+                                int channels,
+                                int lpad,
+                                int rpad,
+                                int upad,
+                                int dpad)
+{
+    const int idx = get_global_id(0);
+
+    int output_width = input_width + lpad + rpad;
+    int output_height = input_height + upad + dpad;
+    int padded_channels = (channels + 3) / 4 * 4;
+
+    int channel = idx % padded_channels;
+    int col = (idx / padded_channels) % output_width - lpad;
+    int row = (idx / (padded_channels*output_width)) % output_height - upad;
+    int input = idx / (padded_channels*output_width*output_height);
+
+    bool out_of_bounds = (row < 0 || row >= input_height) ||
+                         (col < 0 || col >= input_width) ||
+                         channel >= channels;
+
+    OUTPUT[idx] = out_of_bounds ? 0.f : INPUT[((input*channels + channel)*input_height + row)*input_width + col];
+}
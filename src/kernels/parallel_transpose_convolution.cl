@@ -21,11 +21,13 @@ kernel void parallel_transpose_convolution( global float* CONVKERNEL,
 
     int input = idx/total_input_elements;
 
+    int channel = (idx%total_input_elements) / input_elements;
     int input_row = ((idx%total_input_elements) % input_elements) / input_w;
     int input_col = ((idx%total_input_elements) % input_elements) % input_w;
     
     float total = 0;
 
+    // OUTPUT holds padded output gradients, so every input position sees a whole kernel of them
     for (int conv_row = 0; conv_row < convkernel_h; conv_row++)
     {
         int output_row = input_row + conv_row;
@@ -35,14 +37,13 @@ kernel void parallel_transpose_convolution( global float* CONVKERNEL,
 
             for (int filter = 0; filter < filters; filter++)
             {
-                float kernel_val = CONVKERNEL[filter*kernel_elements + conv_row*convkernel_w + conv_col];
-                float output_val = OUTPUT[input*total_input_elements + filter*input_elements + output_row*input_w + output_col];
-                // total += kernel_val*output_val;
-                total += kernel_val;
+                float kernel_val = CONVKERNEL[(filter*channels + channel)*kernel_elements + conv_row*convkernel_w + conv_col];
+                float output_val = OUTPUT[input*total_output_elements + filter*output_elements + output_row*output_w + output_col];
+                total += kernel_val*output_val;
             }
 
         }
     }
 
-    INPUT[idx] = total / channels;
-}
\ No newline at end of file
+    INPUT[idx] = total;
+}
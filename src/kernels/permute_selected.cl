@@ -0,0 +1,13 @@
+// `count` matrices of `size` elements, the ones with SELECTED set gathered through
+// PERMUTATION (element i of the output is element PERMUTATION[i] of the input), the others copied
+kernel void permute_selected( global float* INPUT, 
+                              global float* OUTPUT, 
+                              global int* PERMUTATION, 
+                              global int* SELECTED, 
+                              int size) {
+   const int idx = get_global_id(0);
+   const int matrix = idx / size;
+   const int element = idx % size;
+
+   OUTPUT[idx] = INPUT[matrix*size + (SELECTED[matrix] ? PERMUTATION[element] : element)];
+}
@@ -0,0 +1,14 @@
+// `count` rows x cols float matrices into int8, q = round(x / scale) clamped to +-127, and
+// transposed to cols x rows so the int8 products read both operands along their rows
+kernel void quantize_int8( global float* INPUT, 
+                           global char* OUTPUT, 
+                           float scale, 
+                           int rows, 
+                           int cols) {
+   const int idx = get_global_id(0);
+   const int matrix = idx / (rows*cols);
+   const int row = (idx / cols) % rows;
+   const int col = idx % cols;
+
+   OUTPUT[(matrix*cols + col)*rows + row] = (char)clamp(rint(INPUT[idx] / scale), -127.f, 127.f);
+}
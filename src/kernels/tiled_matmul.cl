@@ -0,0 +1,49 @@
+#define MATMUL_TILE 16
+
+// C = A*B for `batch` pairs of M x K and K x N matrices, 16x16 output tiles per work
+// group staged through local memory. Launched over (N, M, batch) rounded up to the tile
+// size with a 16x16x1 local size. A stride of 0 reuses the same matrix for every pair
+kernel void tiled_matmul( global float* A,
+                          global float* B,
+                          global float* C,
+                          int M,
+                          int K,
+                          int N,
+                          int A_stride,
+                          int B_stride,
+                          int B_start,
+                          int C_start)
+{
+    const int col = get_global_id(0);
+    const int row = get_global_id(1);
+    const int batch = get_global_id(2);
+    const int local_col = get_local_id(0);
+    const int local_row = get_local_id(1);
+
+    local float A_tile[MATMUL_TILE][MATMUL_TILE];
+    local float B_tile[MATMUL_TILE][MATMUL_TILE];
+
+    const int A_offset = batch*A_stride;
+    const int B_offset = B_start + batch*B_stride;
+
+    float total = 0;
+    for (int tile = 0; tile < K; tile += MATMUL_TILE)
+    {
+        const int A_col = tile + local_col;
+        const int B_row = tile + local_row;
+        A_tile[local_row][local_col] = (row < M && A_col < K) ? A[A_offset + row*K + A_col] : 0.f;
+        B_tile[local_row][local_col] = (B_row < K && col < N) ? B[B_offset + B_row*N + col] : 0.f;
+        barrier(CLK_LOCAL_MEM_FENCE);
+
+        for (int k = 0; k < MATMUL_TILE; k++)
+        {
+            total += A_tile[local_row][k]*B_tile[k][local_col];
+        }
+        barrier(CLK_LOCAL_MEM_FENCE);
+    }
+
+    if (row < M && col < N)
+    {
+        C[C_start + batch*M*N + row*N + col] = total;
+    }
+}
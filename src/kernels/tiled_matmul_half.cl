@@ -0,0 +1,55 @@
+#define MATMUL_TILE 16
+
+// tiled_matmul with A and B in 16 bit storage (see to_half.cl), widened to float as the
+// tiles are loaded so the products accumulate in float. C is float
+kernel void tiled_matmul_half( global ushort* A,
+                               global ushort* B,
+                               global float* C,
+                               int M,
+                               int K,
+                               int N,
+                               int A_stride,
+                               int B_stride,
+                               int B_start,
+                               int C_start,
+                               int bf16)
+{
+    const int col = get_global_id(0);
+    const int row = get_global_id(1);
+    const int batch = get_global_id(2);
+    const int local_col = get_local_id(0);
+    const int local_row = get_local_id(1);
+
+    local float A_tile[MATMUL_TILE][MATMUL_TILE];
+    local float B_tile[MATMUL_TILE][MATMUL_TILE];
+
+    const int A_offset = batch*A_stride;
+    const int B_offset = B_start + batch*B_stride;
+
+    float total = 0;
+    for (int tile = 0; tile < K; tile += MATMUL_TILE)
+    {
+        const int A_col = tile + local_col;
+        const int B_row = tile + local_row;
+        const int A_idx = A_offset + row*K + A_col;
+        const int B_idx = B_offset + B_row*N + col;
+        float A_val = 0.f;
+        float B_val = 0.f;
+        if (row < M && A_col < K) A_val = bf16 ? as_float((uint)A[A_idx] << 16) : vload_half(A_idx, (global const half*)A);
+        if (B_row < K && col < N) B_val = bf16 ? as_float((uint)B[B_idx] << 16) : vload_half(B_idx, (global const half*)B);
+        A_tile[local_row][local_col] = A_val;
+        B_tile[local_row][local_col] = B_val;
+        barrier(CLK_LOCAL_MEM_FENCE);
+
+        for (int k = 0; k < MATMUL_TILE; k++)
+        {
+            total += A_tile[local_row][k]*B_tile[k][local_col];
+        }
+        barrier(CLK_LOCAL_MEM_FENCE);
+    }
+
+    if (row < M && col < N)
+    {
+        C[C_start + batch*M*N + row*N + col] = total;
+    }
+}
@@ -0,0 +1,43 @@
+#define MATMUL_TILE 16
+
+// C += A^T*B for a K x M matrix A and a K x N matrix B, so K is the reduction dimension, eg.
+// the batch when summing outer products. Tiled like tiled_matmul.cl, launched over (N, M)
+// rounded up to the tile size with a 16x16 local size
+kernel void tiled_matmul_tn_acc( global float* A,
+                                 global float* B,
+                                 global float* C,
+                                 int M,
+                                 int K,
+                                 int N)
+{
+    const int col = get_global_id(0);
+    const int row = get_global_id(1);
+    const int local_col = get_local_id(0);
+    const int local_row = get_local_id(1);
+    const int group_row = row - local_row;
+
+    // both tiles are indexed [k][output], so both loads read consecutive addresses
+    local float A_tile[MATMUL_TILE][MATMUL_TILE];
+    local float B_tile[MATMUL_TILE][MATMUL_TILE];
+
+    float total = 0;
+    for (int tile = 0; tile < K; tile += MATMUL_TILE)
+    {
+        const int k = tile + local_row;
+        const int A_col = group_row + local_col;
+        A_tile[local_row][local_col] = (k < K && A_col < M) ? A[k*M + A_col] : 0.f;
+        B_tile[local_row][local_col] = (k < K && col < N) ? B[k*N + col] : 0.f;
+        barrier(CLK_LOCAL_MEM_FENCE);
+
+        for (int i = 0; i < MATMUL_TILE; i++)
+        {
+            total += A_tile[i][local_row]*B_tile[i][local_col];
+        }
+        barrier(CLK_LOCAL_MEM_FENCE);
+    }
+
+    if (row < M && col < N)
+    {
+        C[row*N + col] += total;
+    }
+}
@@ -0,0 +1,13 @@
+// float to 16 bit storage: IEEE half, or bfloat16 (the top half of the float) when `bf16`
+// is set. Both round to nearest even. vstore_half is core OpenCL, cl_khr_fp16 isn't needed
+kernel void to_half( global float* INPUT, 
+                     global ushort* OUTPUT, 
+                     int bf16) {
+   const int idx = get_global_id(0);
+   if (bf16) {
+      uint bits = as_uint(INPUT[idx]);
+      OUTPUT[idx] = (ushort)((bits + 0x7fff + ((bits >> 16) & 1)) >> 16);
+   } else {
+      vstore_half_rte(INPUT[idx], idx, (global half*)OUTPUT);
+   }
+}
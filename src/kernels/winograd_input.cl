@@ -0,0 +1,61 @@
+// Winograd F(2x2,3x3) input transform V = B^T d B of every overlapping 4x4 tile (stride 2)
+// of padded inputs, laid out as 16 channels x tiles matrices. Tiles hanging off the edge
+// of the input read zeros
+kernel void winograd_input( global float* INPUT,
+                            global float* V,
+                            int input_w,
+                            int input_h,
+                            int channels,
+                            int tiles_w,
+                            int tiles_h,
+                            int first_input,
+                            int num_inputs)
+{
+    const int idx = get_global_id(0);
+
+    int tiles = tiles_w*tiles_h;
+    int channel = idx / (num_inputs*tiles);
+    int p = idx % (num_inputs*tiles);
+    int input = first_input + p / tiles;
+    int tile_row = (p % tiles) / tiles_w;
+    int tile_col = (p % tiles) % tiles_w;
+
+    global float* plane = INPUT + (input*channels + channel)*input_w*input_h;
+
+    float d[4][4];
+    for (int row = 0; row < 4; row++)
+    {
+        int in_row = tile_row*2 + row;
+        for (int col = 0; col < 4; col++)
+        {
+            int in_col = tile_col*2 + col;
+            d[row][col] = (in_row < input_h && in_col < input_w) ? plane[in_row*input_w + in_col] : 0.f;
+        }
+    }
+
+    // B^T d
+    float t[4][4];
+    for (int col = 0; col < 4; col++)
+    {
+        t[0][col] = d[0][col] - d[2][col];
+        t[1][col] = d[1][col] + d[2][col];
+        t[2][col] = d[2][col] - d[1][col];
+        t[3][col] = d[1][col] - d[3][col];
+    }
+
+    // (B^T d) B
+    const int P = num_inputs*tiles;
+    const int matrix_elements = channels*P;
+    for (int row = 0; row < 4; row++)
+    {
+        float v[4];
+        v[0] = t[row][0] - t[row][2];
+        v[1] = t[row][1] + t[row][2];
+        v[2] = t[row][2] - t[row][1];
+        v[3] = t[row][1] - t[row][3];
+        for (int col = 0; col < 4; col++)
+        {
+            V[(row*4 + col)*matrix_elements + channel*P + p] = v[col];
+        }
+    }
+}
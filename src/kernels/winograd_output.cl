@@ -0,0 +1,53 @@
+// Winograd F(2x2,3x3) output transform Y = A^T m A of the 16 filters x tiles products,
+// writing each 2x2 result into the output planes
+kernel void winograd_output( global float* M,
+                             global float* OUTPUT,
+                             int filters,
+                             int output_w,
+                             int output_h,
+                             int tiles_w,
+                             int tiles_h,
+                             int first_input,
+                             int num_inputs)
+{
+    const int idx = get_global_id(0);
+
+    int tiles = tiles_w*tiles_h;
+    int P = num_inputs*tiles;
+    int filter = idx / P;
+    int p = idx % P;
+    int input = first_input + p / tiles;
+    int tile_row = (p % tiles) / tiles_w;
+    int tile_col = (p % tiles) % tiles_w;
+
+    const int matrix_elements = filters*P;
+    float m[4][4];
+    for (int row = 0; row < 4; row++)
+        for (int col = 0; col < 4; col++)
+            m[row][col] = M[(row*4 + col)*matrix_elements + filter*P + p];
+
+    // A^T m
+    float t[2][4];
+    for (int col = 0; col < 4; col++)
+    {
+        t[0][col] = m[0][col] + m[1][col] + m[2][col];
+        t[1][col] = m[1][col] - m[2][col] - m[3][col];
+    }
+
+    global float* plane = OUTPUT + (input*filters + filter)*output_w*output_h;
+    for (int row = 0; row < 2; row++)
+    {
+        int out_row = tile_row*2 + row;
+        float y[2];
+        y[0] = t[row][0] + t[row][1] + t[row][2];
+        y[1] = t[row][1] - t[row][2] - t[row][3];
+        for (int col = 0; col < 2; col++)
+        {
+            int out_col = tile_col*2 + col;
+            if (out_row < output_h && out_col < output_w)
+            {
+                plane[out_row*output_w + out_col] = y[col];
+            }
+        }
+    }
+}
@@ -0,0 +1,42 @@
+// Winograd F(2x2,3x3) weight transform U = G g G^T of each 3x3 filter, laid out as 16
+// filters x channels matrices, one per element of the 4x4 transformed tile
+kernel void winograd_weights( global float* CONVKERNEL,
+                              global float* U,
+                              int filters,
+                              int channels)
+{
+    const int idx = get_global_id(0);
+
+    int filter = idx / channels;
+    int channel = idx % channels;
+
+    float g[3][3];
+    for (int row = 0; row < 3; row++)
+        for (int col = 0; col < 3; col++)
+            g[row][col] = CONVKERNEL[(filter*channels + channel)*9 + row*3 + col];
+
+    // G g
+    float t[4][3];
+    for (int col = 0; col < 3; col++)
+    {
+        t[0][col] = g[0][col];
+        t[1][col] = 0.5f*(g[0][col] + g[1][col] + g[2][col]);
+        t[2][col] = 0.5f*(g[0][col] - g[1][col] + g[2][col]);
+        t[3][col] = g[2][col];
+    }
+
+    // (G g) G^T
+    const int matrix_elements = filters*channels;
+    for (int row = 0; row < 4; row++)
+    {
+        float u[4];
+        u[0] = t[row][0];
+        u[1] = 0.5f*(t[row][0] + t[row][1] + t[row][2]);
+        u[2] = 0.5f*(t[row][0] - t[row][1] + t[row][2]);
+        u[3] = t[row][2];
+        for (int col = 0; col < 4; col++)
+        {
+            U[(row*4 + col)*matrix_elements + filter*channels + channel] = u[col];
+        }
+    }
+}
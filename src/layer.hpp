@@ -1,8 +1,10 @@
 #pragma once
 
+#include <string>
 #include <utility>
 #include "mat.hpp"
 #include "parallelMat.hpp"
+#include "optimizer.hpp"
 
 enum InitializationMode
 {
@@ -13,9 +15,25 @@ enum InitializationMode
 enum ActivationFunction
 {
    RELU,
-   SIGMOID
+   SIGMOID,
+   LINEAR     // no activation, eg. in front of a LayerBatchNormalize
 };
 
+// as the activation appears in Layer::describe
+inline const char* activation_name(ActivationFunction activation_function)
+{
+   switch (activation_function)
+   {
+   case RELU: return "relu";
+   case SIGMOID: return "sigmoid";
+   case LINEAR: return "linear";
+   default: return "unknown";
+   }
+}
+
+class CheckpointWriter;
+class CheckpointReader;
+
 class Layer
 {
 public:
@@ -33,6 +51,14 @@ public:
 
    virtual bool isUpdatable() { return false; }
 
+   // the layer's type and shape on one line, eg. "fully_connected 64 32 relu". Checkpoints
+   // record the net's to check they're loaded into the same architecture
+   virtual std::string describe() const = 0;
+
+   // parameters and optimizer state into a checkpoint, read back by `load` in the same order
+   virtual void save(CheckpointWriter&) const {}
+   virtual void load(CheckpointReader&) {}
+
    virtual ~Layer() = default;
 };
 
@@ -60,10 +86,24 @@ public:
    // the previous layer. Will stay saved until `applyWeightsAndBiasesGradients` is called
    virtual ParallelMat updateWeightsAndBiasesGradients(const ParallelMat& output_preactivation, const ParallelMat& input_activation, const ParallelMat& delta) = 0;
 
+   // steps the layer's optimizers, which also zero the gradients for the next batch
    virtual void applyWeightsAndBiasesGradients(float learning_rate) = 0;
 
+   // how `applyWeightsAndBiasesGradients` updates the parameters, plain SGD by default. Resets
+   // any optimizer state. Weight decay only applies to the weights, not biases or norm scales
+   virtual void setOptimizer(const OptimizerSettings& settings) = 0;
+
+   // storage of the weights `compute` uses, for inference. Training always uses float
+   virtual void setInferencePrecision(StoragePrecision) {}
+
+   // int8 weights for `compute`, with its inputs quantized by `input_scale` (see Int8Mat).
+   // Layers without weights to quantize keep computing in float. Undone by `setInferencePrecision`
+   virtual void quantize(float /*input_scale*/) {}
+
    bool isUpdatable() override { return true; }
 
+   ActivationFunction activationFunction() const { return m_activation_function; }
+
 protected:
    ActivationFunction m_activation_function;
 };
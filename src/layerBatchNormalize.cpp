@@ -1,19 +1,176 @@
 #include "layerBatchNormalize.hpp"
+#include "layerConvolutional.hpp"
+#include "layerFullyConnected.hpp"
+#include "checkpoint.hpp"
+#include <sstream>
+#include <cmath>
 
-LayerBatchNormalize::LayerBatchNormalize(int size)
-:Layer(size, size)
+LayerBatchNormalize::LayerBatchNormalize(int channels, int plane_size, ActivationFunction activation_function, float momentum, float epsilon)
+:UpdatableLayer(channels*plane_size, channels*plane_size, activation_function)
+,m_channels{channels}
+,m_plane_size{plane_size}
+,m_momentum{momentum}
+,m_epsilon{epsilon}
+,m_gamma{Mat::ones(channels, 1)}
+,m_beta{Mat::zeros(channels, 1)}
+,m_running_mean{Mat::zeros(channels, 1)}
+,m_running_var{Mat::ones(channels, 1)}
+,m_gamma_grads{Mat::zeros(channels, 1)}
+,m_beta_grads{Mat::zeros(channels, 1)}
+,m_batch_size{0}
+,m_folded{false}
 {}
 
-Mat LayerBatchNormalize::compute(const Mat& input) const {
-   float mean = input.sum() / (input.getHeight() * input.getWidth());
-   return input - mean;
+ParallelMat LayerBatchNormalize::activate(const ParallelMat& preactivation) const
+{
+   switch (m_activation_function)
+   {
+   case RELU: return preactivation.relu();
+   case SIGMOID: return preactivation.sigmoid();
+   case LINEAR: return preactivation;
+   default: throw std::exception();
+   }
+}
+
+Mat LayerBatchNormalize::compute(const Mat& input) const
+{
+   if (m_folded)
+   {
+      switch (m_activation_function)
+      {
+      case RELU: return input.relu();
+      case SIGMOID: return input.sigmoid();
+      case LINEAR: return input;
+      default: throw std::exception();
+      }
+   }
+   return compute(ParallelMat{{input}}).at(0);
+}
+
+ParallelMat LayerBatchNormalize::compute(const ParallelMat& input) const
+{
+   if (m_folded) return activate(input);
+   return activate(input.batchNorm(m_running_mean, m_running_var, m_gamma, m_beta, m_epsilon));
+}
+
+std::pair<ParallelMat, ParallelMat> LayerBatchNormalize::feedForward(const ParallelMat& input) const
+{
+   auto [mean, var] = input.channelMoments(m_channels);
+   ParallelMat preactivation = input.batchNorm(mean, var, m_gamma, m_beta, m_epsilon);
+   return {preactivation, activate(preactivation)};
+}
+
+ParallelMat LayerBatchNormalize::createCostDerivative(const ParallelMat& final_activation, const ParallelMat& desired_output)
+{
+   return final_activation - desired_output;
+}
+
+ParallelMat LayerBatchNormalize::updateWeightsAndBiasesGradients(const ParallelMat& preactivation, const ParallelMat& activation, const ParallelMat& delta)
+{
+   ParallelMat this_delta = [this, &preactivation, &delta](){
+      switch (m_activation_function)
+      {
+      case RELU: return delta ^ preactivation.relu_inv();
+      case SIGMOID: return delta ^ preactivation.sigmoid_inv();
+      case LINEAR: return delta;
+      default: throw std::exception();
+      }
+   }();
+
+   // same moments as feedForward saw, recomputed rather than kept around between the passes
+   auto [mean, var] = activation.channelMoments(m_channels);
+   auto [gamma_grads, beta_grads] = activation.batchNormGradients(this_delta, mean, var, m_epsilon);
+   ParallelMat input_delta = activation.batchNormBackward(this_delta, mean, var, m_gamma, gamma_grads, beta_grads, m_epsilon);
+
+   m_gamma_grads += gamma_grads;
+   m_beta_grads += beta_grads;
+   m_batch_size += delta.getCount();
+
+   // the running variance is the unbiased estimate
+   const float n = static_cast<float>(m_plane_size)*delta.getCount();
+   m_running_mean *= 1.f - m_momentum;
+   m_running_mean += m_momentum * mean;
+   m_running_var *= 1.f - m_momentum;
+   m_running_var += (m_momentum * n / std::max(n - 1.f, 1.f)) * var;
+
+   return input_delta;
+}
+
+void LayerBatchNormalize::applyWeightsAndBiasesGradients(float learning_rate)
+{
+   const float grad_scale = 1.f / m_batch_size;
+   m_gamma_optimizer.step(m_gamma, m_gamma_grads, learning_rate, grad_scale);
+   m_beta_optimizer.step(m_beta, m_beta_grads, learning_rate, grad_scale);
+   m_batch_size = 0;
+}
+
+void LayerBatchNormalize::setOptimizer(const OptimizerSettings& settings)
+{
+   OptimizerSettings no_decay = settings;
+   no_decay.weight_decay = 0.f;
+   m_gamma_optimizer.setSettings(no_decay);
+   m_beta_optimizer.setSettings(no_decay);
 }
 
-ParallelMat LayerBatchNormalize::compute(const ParallelMat& input) const {
-   auto sub_mats = input.toVector();
-   for (Mat& mat : sub_mats)
+std::pair<std::vector<float>, std::vector<float>> LayerBatchNormalize::inferenceAffine() const
+{
+   std::vector<float> gamma = m_gamma.getVals();
+   std::vector<float> beta = m_beta.getVals();
+   std::vector<float> mean = m_running_mean.getVals();
+   std::vector<float> var = m_running_var.getVals();
+
+   std::vector<float> scale(m_channels);
+   std::vector<float> shift(m_channels);
+   for (int channel = 0; channel < m_channels; channel++)
    {
-      mat = compute(mat);
+      scale[channel] = gamma[channel] / std::sqrt(var[channel] + m_epsilon);
+      shift[channel] = beta[channel] - mean[channel]*scale[channel];
    }
-   return ParallelMat{sub_mats};
-}
\ No newline at end of file
+   return {scale, shift};
+}
+
+void LayerBatchNormalize::foldInto(LayerConvolutional& previous)
+{
+   assert(previous.activationFunction() == LINEAR && previous.output_size == input_size);
+   auto [scale, shift] = inferenceAffine();
+   previous.foldAffine(scale, shift);
+   m_folded = true;
+}
+
+void LayerBatchNormalize::foldInto(LayerFullyConnected& previous)
+{
+   assert(previous.activationFunction() == LINEAR && previous.output_size == input_size && m_plane_size == 1);
+   auto [scale, shift] = inferenceAffine();
+   previous.foldAffine(scale, shift);
+   m_folded = true;
+}
+
+std::string LayerBatchNormalize::describe() const
+{
+   std::ostringstream out;
+   out << "batch_normalize " << m_channels << " " << m_plane_size << " " << activation_name(m_activation_function)
+       << " " << m_momentum << " " << m_epsilon;
+   return out.str();
+}
+
+void LayerBatchNormalize::save(CheckpointWriter& writer) const
+{
+   writer.count(m_folded);
+   writer.tensor(m_gamma);
+   writer.tensor(m_beta);
+   writer.tensor(m_running_mean);
+   writer.tensor(m_running_var);
+   m_gamma_optimizer.save(writer);
+   m_beta_optimizer.save(writer);
+}
+
+void LayerBatchNormalize::load(CheckpointReader& reader)
+{
+   m_folded = reader.count();
+   reader.tensor(m_gamma);
+   reader.tensor(m_beta);
+   reader.tensor(m_running_mean);
+   reader.tensor(m_running_var);
+   m_gamma_optimizer.load(reader);
+   m_beta_optimizer.load(reader);
+}
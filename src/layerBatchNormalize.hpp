@@ -1,13 +1,58 @@
 #pragma once
 
+#include <vector>
 #include "layer.hpp"
 
-class LayerBatchNormalize : public Layer
+class LayerConvolutional;
+class LayerFullyConnected;
+
+// per-channel batch normalization with a learned scale (gamma) and shift (beta), followed by an
+// activation. Inputs are `channels` planes of `plane_size` values, a plane size of 1 normalizes
+// each output of a LayerFullyConnected. Training uses the statistics of each batch, `compute`
+// the running averages of them
+class LayerBatchNormalize : public UpdatableLayer
 {
 public:
-   LayerBatchNormalize(int size);
+   LayerBatchNormalize(int channels, int plane_size, ActivationFunction activation_function, float momentum = 0.1f, float epsilon = 1e-5f);
 
    Mat compute(const Mat& input) const override;
-
    ParallelMat compute(const ParallelMat& input) const override;
-};
\ No newline at end of file
+   std::pair<ParallelMat, ParallelMat> feedForward(const ParallelMat& input) const override;
+   ParallelMat createCostDerivative(const ParallelMat& final_activation, const ParallelMat& desired_output) override;
+   ParallelMat updateWeightsAndBiasesGradients(const ParallelMat& output, const ParallelMat& activation, const ParallelMat& delta) override;
+   void applyWeightsAndBiasesGradients(float learning_rate) override;
+   void setOptimizer(const OptimizerSettings& settings) override;
+   std::string describe() const override;
+   // also whether the layer was folded, a folded one is only the activation
+   void save(CheckpointWriter& writer) const override;
+   void load(CheckpointReader& reader) override;
+
+   // for inference: moves the normalization into the weights and biases of `previous`, the LINEAR
+   // layer feeding this one, after which only the activation is left here. Don't train afterwards
+   void foldInto(LayerConvolutional& previous);
+   void foldInto(LayerFullyConnected& previous);
+
+private:
+   ParallelMat activate(const ParallelMat& preactivation) const;
+   // {scale, shift} per channel doing the same as normalizing with the running statistics
+   std::pair<std::vector<float>, std::vector<float>> inferenceAffine() const;
+
+   int m_channels;
+   int m_plane_size;
+   float m_momentum;
+   float m_epsilon;
+
+   Mat m_gamma;
+   Mat m_beta;
+   Mat m_running_mean;
+   Mat m_running_var;
+
+   Mat m_gamma_grads;
+   Mat m_beta_grads;
+   int m_batch_size;
+
+   ParameterOptimizer m_gamma_optimizer;
+   ParameterOptimizer m_beta_optimizer;
+
+   bool m_folded;
+};
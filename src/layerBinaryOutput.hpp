@@ -9,4 +9,5 @@ public:
    :LayerFullyConnected(input_size, 1, initialization_mode, SIGMOID)
    {}
    ParallelMat createCostDerivative(const ParallelMat& final_activation, const ParallelMat& desired_output) override;
+   std::string describe() const override { return "binary_output " + std::to_string(input_size); }
 };
\ No newline at end of file
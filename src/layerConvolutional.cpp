@@ -1,4 +1,6 @@
 #include "layerConvolutional.hpp"
+#include "checkpoint.hpp"
+#include <algorithm>
 
 LayerConvolutional::LayerConvolutional
 (int input_height, 
@@ -26,38 +28,46 @@ LayerConvolutional::LayerConvolutional
    padding, 
    input_height, 
    input_width, 
-   [initialization_mode,kernel_width,kernel_height,kernel_filters]()->Mat{
+   [initialization_mode,channels,kernel_width,kernel_height,kernel_filters]()->Mat{
+      // one row per filter, so he() sees a fan in of channels*kernel_height*kernel_width
       switch(initialization_mode) {
          case HE:
-            return Mat::he(kernel_width*kernel_height*kernel_filters,1);
+            return Mat::he(kernel_filters,channels*kernel_width*kernel_height);
          case NORMAL:
-            return Mat::random(kernel_width*kernel_height*kernel_filters,1);
+            return Mat::random(kernel_filters,channels*kernel_width*kernel_height);
          default: throw std::exception();
       }
    }())
 ,m_biases{Mat::zeros(output_size,1)}
+,m_weight_grads{Mat::zeros(kernel_filters, channels*kernel_height*kernel_width)}
+,m_bias_grads{Mat::zeros(output_size,1)}
+,m_batch_size{0}
 {
 
 }
 
 Mat LayerConvolutional::compute(const Mat& input) const
 {
-   Mat preactivation = m_weights * input + m_biases;
+   Mat preactivation = (m_int8_weights ? m_weights.convolveInt8(input, *m_int8_weights, m_input_scale)
+                                       : m_weights.convolveHalf(input, m_inference_precision)) + m_biases;
    switch (m_activation_function)
    {
    case RELU: return preactivation.relu();
    case SIGMOID: return preactivation.sigmoid();
+   case LINEAR: return preactivation;
    default: throw std::exception();
    }
 }
 
 ParallelMat LayerConvolutional::compute(const ParallelMat& input) const
 {
-   ParallelMat preactivation = m_weights * input + m_biases;
+   ParallelMat preactivation = (m_int8_weights ? m_weights.convolveInt8(input, *m_int8_weights, m_input_scale)
+                                               : m_weights.convolveHalf(input, m_inference_precision)) + m_biases;
    switch (m_activation_function)
    {
    case RELU: return preactivation.relu();
    case SIGMOID: return preactivation.sigmoid();
+   case LINEAR: return preactivation;
    default: throw std::exception();
    }
 }
@@ -69,6 +79,7 @@ std::pair<ParallelMat, ParallelMat> LayerConvolutional::feedForward(const Parall
    {
    case RELU: return {preactivation, preactivation.relu()};
    case SIGMOID: return {preactivation, preactivation.sigmoid()};
+   case LINEAR: return {preactivation, preactivation};
    default: throw std::exception();
    }
 }
@@ -78,12 +89,98 @@ ParallelMat LayerConvolutional::createCostDerivative(const ParallelMat& final_ac
    return final_activation - desired_output;
 }
 
-ParallelMat LayerConvolutional::updateWeightsAndBiasesGradients(const ParallelMat& output, const ParallelMat& activation, const ParallelMat& delta)
+ParallelMat LayerConvolutional::updateWeightsAndBiasesGradients(const ParallelMat& preactivation, const ParallelMat& activation, const ParallelMat& delta)
 {
+   ParallelMat this_delta = [this, &preactivation, &delta](){
+      switch (m_activation_function)
+      {
+      case RELU: return delta ^ preactivation.relu_inv();
+      case SIGMOID: return delta ^ preactivation.sigmoid_inv();
+      case LINEAR: return delta;
+      default: throw std::exception();
+      }
+   }();
 
+   m_weights.addWeightGradient(m_weight_grads, activation, this_delta);
+   m_bias_grads.addSum(this_delta);
+   m_batch_size += delta.getCount();
+
+   return m_weights.rotated() ^ this_delta;
 }
 
 void LayerConvolutional::applyWeightsAndBiasesGradients(float learning_rate)
 {
+   const float grad_scale = 1.f / m_batch_size;
+   m_weights.step(m_weight_optimizer, m_weight_grads, learning_rate, grad_scale);
+   m_bias_optimizer.step(m_biases, m_bias_grads, learning_rate, grad_scale);
+   m_batch_size = 0;
+
+   if (m_int8_weights) m_int8_weights = Int8Mat(m_weights.weights());
+}
+
+void LayerConvolutional::setOptimizer(const OptimizerSettings& settings)
+{
+   OptimizerSettings bias_settings = settings;
+   bias_settings.weight_decay = 0.f;
+   m_weight_optimizer.setSettings(settings);
+   m_bias_optimizer.setSettings(bias_settings);
+}
+
+void LayerConvolutional::setInferencePrecision(StoragePrecision precision)
+{
+   m_int8_weights.reset();
+   m_inference_precision = precision;
+}
+
+void LayerConvolutional::quantize(float input_scale)
+{
+   m_int8_weights = Int8Mat(m_weights.weights());
+   m_input_scale = input_scale;
+}
+
+void LayerConvolutional::foldAffine(const std::vector<float>& scale, const std::vector<float>& shift)
+{
+   const unsigned filters = m_weights.getFilters();
+   const unsigned weights_per_filter = m_weights.weightCount() / filters;
+   const unsigned plane_size = output_size / filters;
+   assert(scale.size() == filters && shift.size() == filters);
+
+   std::vector<float> weight_scale(m_weights.weightCount());
+   std::vector<float> bias_scale(output_size);
+   std::vector<float> bias_shift(output_size);
+   for (unsigned filter = 0; filter < filters; filter++)
+   {
+      std::fill_n(weight_scale.begin() + filter*weights_per_filter, weights_per_filter, scale[filter]);
+      std::fill_n(bias_scale.begin() + filter*plane_size, plane_size, scale[filter]);
+      std::fill_n(bias_shift.begin() + filter*plane_size, plane_size, shift[filter]);
+   }
+
+   m_weights ^= Mat(filters, weights_per_filter, std::move(weight_scale));
+   m_biases ^= Mat(output_size, 1, std::move(bias_scale));
+   m_biases += Mat(output_size, 1, std::move(bias_shift));
+
+   if (m_int8_weights) m_int8_weights = Int8Mat(m_weights.weights());
+}
+
+std::string LayerConvolutional::describe() const
+{
+   return "convolutional " + m_weights.describe() + " " + activation_name(m_activation_function);
+}
+
+void LayerConvolutional::save(CheckpointWriter& writer) const
+{
+   m_weights.save(writer);
+   writer.tensor(m_biases);
+   m_weight_optimizer.save(writer);
+   m_bias_optimizer.save(writer);
+}
+
+void LayerConvolutional::load(CheckpointReader& reader)
+{
+   m_weights.load(reader);
+   reader.tensor(m_biases);
+   m_weight_optimizer.load(reader);
+   m_bias_optimizer.load(reader);
 
+   if (m_int8_weights) m_int8_weights = Int8Mat(m_weights.weights());
 }
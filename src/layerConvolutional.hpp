@@ -1,6 +1,8 @@
 #pragma once
 #include "layer.hpp"
+#include <optional>
 #include "convKernel.hpp"
+#include "int8Mat.hpp"
 
 
 class LayerConvolutional : public UpdatableLayer
@@ -23,8 +25,29 @@ public:
    ParallelMat createCostDerivative(const ParallelMat& final_activation, const ParallelMat& desired_output) override;
    ParallelMat updateWeightsAndBiasesGradients(const ParallelMat& output, const ParallelMat& activation, const ParallelMat& delta) override;
    void applyWeightsAndBiasesGradients(float learning_rate) override;
+   void setOptimizer(const OptimizerSettings& settings) override;
+   void setInferencePrecision(StoragePrecision precision) override;
+   void quantize(float input_scale) override;
+   std::string describe() const override;
+   void save(CheckpointWriter& writer) const override;
+   void load(CheckpointReader& reader) override;
+
+   // output channel c becomes output*scale[c] + shift[c], by changing the weights and biases
+   void foldAffine(const std::vector<float>& scale, const std::vector<float>& shift);
 
 private:
    ConvKernel m_weights;
    Mat m_biases;
+
+   Mat m_weight_grads;
+   Mat m_bias_grads;
+   int m_batch_size;
+
+   ParameterOptimizer m_weight_optimizer;
+   ParameterOptimizer m_bias_optimizer;
+
+   StoragePrecision m_inference_precision = STORAGE_FP32;
+   // the weights in int8 and the scale of the inputs, kept in sync with them while it's set
+   std::optional<Int8Mat> m_int8_weights;
+   float m_input_scale = 1.f;
 };
\ No newline at end of file
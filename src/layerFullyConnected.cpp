@@ -1,21 +1,27 @@
 #include "layerFullyConnected.hpp"
+#include "checkpoint.hpp"
+#include <algorithm>
 
 Mat LayerFullyConnected::compute(const Mat& input) const
 {
+   Mat preactivation = weightsTimes(input) + m_biases;
    switch (m_activation_function)
    {
-   case RELU: return (m_weights * input + m_biases).relu();
-   case SIGMOID: return (m_weights * input + m_biases).sigmoid();
+   case RELU: return preactivation.relu();
+   case SIGMOID: return preactivation.sigmoid();
+   case LINEAR: return preactivation;
    default: throw std::exception();
    }
 }
 
 ParallelMat LayerFullyConnected::compute(const ParallelMat& input) const
 {
+   ParallelMat preactivation = weightsTimes(input) + m_biases;
    switch (m_activation_function)
    {
-   case RELU: return (m_weights * input + m_biases).relu();
-   case SIGMOID: return (m_weights * input + m_biases).sigmoid();
+   case RELU: return preactivation.relu();
+   case SIGMOID: return preactivation.sigmoid();
+   case LINEAR: return preactivation;
    default: throw std::exception();
    }
 }
@@ -27,6 +33,7 @@ std::pair<ParallelMat, ParallelMat> LayerFullyConnected::feedForward(const Paral
    {
    case RELU: return {pre_activation, pre_activation.relu()};
    case SIGMOID: return {pre_activation, pre_activation.sigmoid()};
+   case LINEAR: return {pre_activation, pre_activation};
    default: throw std::exception();
    }
 }
@@ -38,17 +45,18 @@ ParallelMat LayerFullyConnected::createCostDerivative(const ParallelMat& final_a
 
 ParallelMat LayerFullyConnected::updateWeightsAndBiasesGradients(const ParallelMat& preactivation, const ParallelMat& activation, const ParallelMat& delta)
 {
-   ParallelMat this_delta = delta ^ [this, preactivation](){
+   ParallelMat this_delta = [this, &preactivation, &delta](){
       switch (m_activation_function)
       {
-      case RELU: return preactivation.relu_inv();
-      case SIGMOID: return preactivation.sigmoid_inv();
+      case RELU: return delta ^ preactivation.relu_inv();
+      case SIGMOID: return delta ^ preactivation.sigmoid_inv();
+      case LINEAR: return delta;
       default: throw std::exception();
       }
    }();
 
-   m_weight_grads += (this_delta * activation.transpose()).sum();
-   m_bias_grads += delta.sum();
+   m_weight_grads.addOuterProducts(this_delta, activation);
+   m_bias_grads.addSum(this_delta);
    m_batch_size += delta.getCount();
 
    return m_weights.transpose() * this_delta;
@@ -56,11 +64,88 @@ ParallelMat LayerFullyConnected::updateWeightsAndBiasesGradients(const ParallelM
 
 void LayerFullyConnected::applyWeightsAndBiasesGradients(float learning_rate)
 {
-   float d = learning_rate / m_batch_size;
-   m_weights -= d * m_weight_grads;
-   m_biases -= d * m_bias_grads;
-
-   m_weight_grads = Mat::zeros(output_size, input_size);
-   m_bias_grads = Mat::zeros(output_size, 1);
+   const float grad_scale = 1.f / m_batch_size;
+   m_weight_optimizer.step(m_weights, m_weight_grads, learning_rate, grad_scale);
+   m_bias_optimizer.step(m_biases, m_bias_grads, learning_rate, grad_scale);
    m_batch_size = 0;
-}
\ No newline at end of file
+
+   if (m_half_weights) m_half_weights = HalfMat(m_weights, m_half_weights->precision());
+   if (m_int8_weights) m_int8_weights = Int8Mat(m_weights);
+}
+
+void LayerFullyConnected::setOptimizer(const OptimizerSettings& settings)
+{
+   OptimizerSettings bias_settings = settings;
+   bias_settings.weight_decay = 0.f;
+   m_weight_optimizer.setSettings(settings);
+   m_bias_optimizer.setSettings(bias_settings);
+}
+
+void LayerFullyConnected::setInferencePrecision(StoragePrecision precision)
+{
+   m_int8_weights.reset();
+   if (precision == STORAGE_FP32) m_half_weights.reset();
+   else m_half_weights = HalfMat(m_weights, precision);
+}
+
+void LayerFullyConnected::quantize(float input_scale)
+{
+   m_half_weights.reset();
+   m_int8_weights = Int8Mat(m_weights);
+   m_input_scale = input_scale;
+}
+
+Mat LayerFullyConnected::weightsTimes(const Mat& input) const
+{
+   if (m_int8_weights) return m_int8_weights->multiply(input, m_input_scale);
+   if (m_half_weights) return *m_half_weights * input;
+   return m_weights * input;
+}
+
+ParallelMat LayerFullyConnected::weightsTimes(const ParallelMat& input) const
+{
+   if (m_int8_weights) return m_int8_weights->multiply(input, m_input_scale);
+   if (m_half_weights) return *m_half_weights * input;
+   return m_weights * input;
+}
+void LayerFullyConnected::foldAffine(const std::vector<float>& scale, const std::vector<float>& shift)
+{
+   assert(scale.size() == static_cast<unsigned>(output_size) && shift.size() == static_cast<unsigned>(output_size));
+
+   std::vector<float> weight_scale(output_size*input_size);
+   for (int row = 0; row < output_size; row++)
+   {
+      std::fill_n(weight_scale.begin() + row*input_size, input_size, scale[row]);
+   }
+
+   m_weights ^= Mat(output_size, input_size, std::move(weight_scale));
+   m_biases ^= Mat(output_size, 1, scale);
+   m_biases += Mat(output_size, 1, shift);
+
+   if (m_half_weights) m_half_weights = HalfMat(m_weights, m_half_weights->precision());
+   if (m_int8_weights) m_int8_weights = Int8Mat(m_weights);
+}
+
+std::string LayerFullyConnected::describe() const
+{
+   return "fully_connected " + std::to_string(input_size) + " " + std::to_string(output_size) + " " + activation_name(m_activation_function);
+}
+
+void LayerFullyConnected::save(CheckpointWriter& writer) const
+{
+   writer.tensor(m_weights);
+   writer.tensor(m_biases);
+   m_weight_optimizer.save(writer);
+   m_bias_optimizer.save(writer);
+}
+
+void LayerFullyConnected::load(CheckpointReader& reader)
+{
+   reader.tensor(m_weights);
+   reader.tensor(m_biases);
+   m_weight_optimizer.load(reader);
+   m_bias_optimizer.load(reader);
+
+   if (m_half_weights) m_half_weights = HalfMat(m_weights, m_half_weights->precision());
+   if (m_int8_weights) m_int8_weights = Int8Mat(m_weights);
+}
@@ -1,6 +1,9 @@
 #pragma once
 
+#include <optional>
 #include "layer.hpp"
+#include "halfMat.hpp"
+#include "int8Mat.hpp"
 
 class LayerFullyConnected : public UpdatableLayer
 {
@@ -31,6 +34,18 @@ public:
    ParallelMat createCostDerivative(const ParallelMat& final_activation, const ParallelMat& desired_output) override;
    ParallelMat updateWeightsAndBiasesGradients(const ParallelMat& output, const ParallelMat& activation, const ParallelMat& delta) override;
    void applyWeightsAndBiasesGradients(float learning_rate) override;
+   void setOptimizer(const OptimizerSettings& settings) override;
+   void setInferencePrecision(StoragePrecision precision) override;
+   void quantize(float input_scale) override;
+   std::string describe() const override;
+   void save(CheckpointWriter& writer) const override;
+   void load(CheckpointReader& reader) override;
+
+   const Mat& getWeights() const { return m_weights; }
+   const Mat& getBiases() const { return m_biases; }
+
+   // output i becomes output*scale[i] + shift[i], by changing the weights and biases
+   void foldAffine(const std::vector<float>& scale, const std::vector<float>& shift);
 
 protected:
    Mat m_weights;
@@ -39,4 +54,16 @@ protected:
    Mat m_weight_grads;
    Mat m_bias_grads;
    int m_batch_size;
+
+   ParameterOptimizer m_weight_optimizer;
+   ParameterOptimizer m_bias_optimizer;
+
+   // `m_weights` in 16 bit storage, kept in sync with them while it's set
+   std::optional<HalfMat> m_half_weights;
+   // `m_weights` in int8 and the scale of the inputs, kept in sync with them while it's set
+   std::optional<Int8Mat> m_int8_weights;
+   float m_input_scale = 1.f;
+
+   Mat weightsTimes(const Mat& input) const;
+   ParallelMat weightsTimes(const ParallelMat& input) const;
 };
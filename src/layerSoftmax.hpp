@@ -10,4 +10,6 @@ public:
    Mat compute(const Mat& input) const override;
 
    ParallelMat compute(const ParallelMat& input) const override;
+
+   std::string describe() const override { return "softmax " + std::to_string(input_size); }
 };
\ No newline at end of file
@@ -39,7 +39,7 @@ int main()
       0,0,0,0,0,
    }};
 
-   ConvKernel conv_kernel {channels,3,3,filters, SAME,5,5,Mat::ones(3*3*filters,1)};
+   ConvKernel conv_kernel {channels,3,3,filters, SAME,5,5,Mat::ones(3*3*channels*filters,1)};
 
    ParallelMat outputs {{output, output}};
    ParallelMat inputs = conv_kernel ^ outputs;
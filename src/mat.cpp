@@ -15,10 +15,14 @@
 #include "errors.hpp"
 #include <mutex>
 #include "oclData.hpp"
+#include "cpuKernels.hpp"
 
 using std::vector, std::unique_ptr, std::array, std::async, std::future;
 using namespace std::chrono_literals;
 
+// tile size of tiled_matmul_tn_acc.cl
+static constexpr int MATMUL_TILE = 16;
+
 // static variable setup
 std::random_device Mat::rd;
 std::mt19937 Mat::gen = std::mt19937(rd());
@@ -59,8 +63,8 @@ ParallelMat operator+(const ParallelMat& l, const Mat& r)
 
 
 void Mat::setup() {
-   if (ocl_setup) return;
-   ocl_init();
+   if (backend_setup) return;
+   backend_init();
 }
 
 Mat::Mat()
@@ -69,22 +73,37 @@ Mat::Mat()
 
    m_width = m_height = 0;
 
+   if (mat_backend == CPU_BACKEND)
+   {
+      m_host = std::make_shared<std::vector<float>>();
+      return;
+   }
    m_buffer = cl::Buffer(ocl_context, CL_MEM_READ_WRITE, 0);
 }
 
 
 Mat::Mat(unsigned int height, unsigned int width, const std::vector<float>& vals)
+   :Mat(height, width, std::vector<float>(vals))
+{
+}
+
+Mat::Mat(unsigned int height, unsigned int width, std::vector<float>&& vals)
 {
    setup();
 
    m_width = width;
    m_height = height;
 
+   if (mat_backend == CPU_BACKEND)
+   {
+      m_host = std::make_shared<std::vector<float>>(std::move(vals));
+      return;
+   }
    m_buffer = cl::Buffer(ocl_context, CL_MEM_READ_WRITE, (m_width*m_height)*sizeof(float));
-   ocl_queue.enqueueWriteBuffer( m_buffer, CL_TRUE, 0, (m_width*m_height)*sizeof(float), vals.data() );
+   m_event = ocl_upload(m_buffer, std::move(vals));
 }
 
-Mat::Mat(unsigned int height, unsigned int width, const cl::Buffer& new_buffer)
+Mat::Mat(unsigned int height, unsigned int width, const cl::Buffer& new_buffer, const cl::Event& event)
 {
    setup();
 
@@ -92,6 +111,25 @@ Mat::Mat(unsigned int height, unsigned int width, const cl::Buffer& new_buffer)
    m_height = height;
 
    m_buffer = new_buffer;
+   m_event = event;
+}
+
+Mat::Mat(unsigned int height, unsigned int width, HostBuffer host)
+{
+   setup();
+
+   m_width = width;
+   m_height = height;
+
+   m_host = std::move(host);
+}
+
+Mat Mat::host_map(void function(const float*, float*, std::size_t)) const
+{
+   const int N_ELEMENTS = m_width*m_height;
+   auto out = std::make_shared<std::vector<float>>(N_ELEMENTS);
+   function(m_host->data(), out->data(), N_ELEMENTS);
+   return Mat(m_height, m_width, out);
 }
 
 Mat::Mat(const Mat &mat)
@@ -101,15 +139,38 @@ Mat::Mat(const Mat &mat)
    m_width = mat.m_width;
    m_height = mat.m_height;
 
+   if (mat_backend == CPU_BACKEND)
+   {
+      m_host = std::make_shared<std::vector<float>>(*mat.m_host);
+      return;
+   }
    m_buffer = cl::Buffer(ocl_context, CL_MEM_READ_WRITE, (m_width*m_height)*sizeof(float));
-   ocl_queue.enqueueCopyBuffer(mat.m_buffer, m_buffer, 0, 0, (m_width*m_height)*sizeof(float));
+   auto deps = ocl_wait_list({mat.m_event});
+   ocl_queue.enqueueCopyBuffer(mat.m_buffer, m_buffer, 0, 0, (m_width*m_height)*sizeof(float), &deps, &m_event);
 }
 
 const Mat& Mat::operator=(const Mat &other)
 {
+   if (this == &other) return *this;
+   setup();
+   // same shape: copied into the existing storage, so assigning into a view writes through
+   // to what it views on either backend. Otherwise this gets storage of its own
+   const bool same_shape = m_width == other.m_width && m_height == other.m_height;
    m_width = other.m_width;
    m_height = other.m_height;
-   ocl_queue.enqueueCopyBuffer(other.m_buffer, m_buffer, 0, 0, (m_width*m_height)*sizeof(float));
+   if (mat_backend == CPU_BACKEND)
+   {
+      if (same_shape && m_host) std::copy(other.m_host->begin(), other.m_host->end(), m_host->begin());
+      else m_host = std::make_shared<std::vector<float>>(*other.m_host);
+      return *this;
+   }
+   if (not same_shape || m_buffer() == nullptr)
+   {
+      m_buffer = cl::Buffer(ocl_context, CL_MEM_READ_WRITE, (m_width*m_height)*sizeof(float));
+      m_event = cl::Event();
+   }
+   auto deps = ocl_wait_list({m_event, other.m_event});
+   ocl_queue.enqueueCopyBuffer(other.m_buffer, m_buffer, 0, 0, (m_width*m_height)*sizeof(float), &deps, &m_event);
 
    return *this;
 }
@@ -119,6 +180,8 @@ const Mat& Mat::operator=(const Mat &&other)
    m_width = other.m_width;
    m_height = other.m_height;
    m_buffer = other.m_buffer;
+   m_event = other.m_event;
+   m_host = other.m_host;
 
    return *this;
 }
@@ -137,7 +200,7 @@ Mat Mat::val(unsigned height, unsigned width, float val)
 {
    std::vector<float> vals(height*width);
    std::fill(begin(vals), end(vals), val);
-   return Mat(height, width, vals);
+   return Mat(height, width, std::move(vals));
 }
 
 Mat Mat::random(unsigned height, unsigned width)
@@ -149,7 +212,7 @@ Mat Mat::random(unsigned height, unsigned width)
       vals[i] = d(gen);
    }
 
-   return Mat(height, width, vals);
+   return Mat(height, width, std::move(vals));
 }
 
 Mat Mat::he(unsigned height, unsigned width)
@@ -162,23 +225,25 @@ Mat Mat::he(unsigned height, unsigned width)
       vals[i] = d(gen);
    }
 
-   return Mat(height, width, vals);
+   return Mat(height, width, std::move(vals));
 }
 
 Mat Mat::mat_add_sub_dot(const Mat &other, cl::Kernel &kernel) const {
    const int N_ELEMENTS = m_width * m_height;
    cl::Buffer out_buffer(ocl_context, CL_MEM_READ_WRITE, N_ELEMENTS*sizeof(float));
+   cl::Event out_event;
    cl::NDRange global( N_ELEMENTS );
    try {
       kernel.setArg( 0, m_buffer );
       kernel.setArg( 1, other.m_buffer);
       kernel.setArg( 2, out_buffer );
-      ocl_queue.enqueueNDRangeKernel( kernel, cl::NullRange, global );
+      auto deps = ocl_wait_list({m_event, other.m_event});
+      ocl_queue.enqueueNDRangeKernel( kernel, cl::NullRange, global, cl::NullRange, &deps, &out_event );
    }
    catch(cl::Error& err) {
       std::cout << "Error in mat_add_sub_dot: " << err.what() << "(" << getErrorString(err.err()) << ")" << std::endl;
    }
-   return Mat(m_height, m_width, out_buffer);
+   return Mat(m_height, m_width, out_buffer, out_event);
 }
 
 Mat& Mat::mat_add_sub_dot_eq(const Mat &other, cl::Kernel &kernel) {
@@ -187,7 +252,8 @@ Mat& Mat::mat_add_sub_dot_eq(const Mat &other, cl::Kernel &kernel) {
    try {
       kernel.setArg( 0, m_buffer );
       kernel.setArg( 1, other.m_buffer);
-      ocl_queue.enqueueNDRangeKernel( kernel, cl::NullRange, global );
+      auto deps = ocl_wait_list({m_event, other.m_event});
+      ocl_queue.enqueueNDRangeKernel( kernel, cl::NullRange, global, cl::NullRange, &deps, &m_event );
    }
    catch(cl::Error& err) {
       std::cout << "Error in mat_add_sub_dot_eq: " << err.what() << "(" << getErrorString(err.err()) << ")" << std::endl;
@@ -200,6 +266,11 @@ Mat& Mat::mat_add_sub_dot_eq(const Mat &other, cl::Kernel &kernel) {
 const Mat& Mat::float_eq_op(char op, float val)
 {
    const int N_ELEMENTS = m_width * m_height;
+   if (mat_backend == CPU_BACKEND)
+   {
+      cpu_float_op(op, m_host->data(), m_host->data(), N_ELEMENTS, val);
+      return *this;
+   }
    cl::NDRange global( N_ELEMENTS );
 
    cl_float buffer_val = val;
@@ -220,7 +291,8 @@ const Mat& Mat::float_eq_op(char op, float val)
       kernel.setArg( 0, m_buffer );
       kernel.setArg( 1, sizeof(cl_float), &buffer_val );
 
-      ocl_queue.enqueueNDRangeKernel( kernel, cl::NullRange, global );
+      auto deps = ocl_wait_list({m_event});
+      ocl_queue.enqueueNDRangeKernel( kernel, cl::NullRange, global, cl::NullRange, &deps, &m_event );
    }
    catch(cl::Error& err) {
       std::cout << "Error in mat_add_sub_dot_eq: " << err.what() << "(" << getErrorString(err.err()) << ")" << std::endl;
@@ -233,6 +305,14 @@ Mat Mat::mat_add_sub_dot_op(char op, const Mat &other) const {
    assert(m_height == other.m_height);
    assert(m_width == other.m_width);
 
+   if (mat_backend == CPU_BACKEND)
+   {
+      const int N_ELEMENTS = m_width * m_height;
+      auto out = std::make_shared<std::vector<float>>(N_ELEMENTS);
+      cpu_elementwise(op, m_host->data(), other.m_host->data(), out->data(), N_ELEMENTS, N_ELEMENTS);
+      return Mat(m_height, m_width, out);
+   }
+
    switch (op)
    {
       case '+': return (mat_add_sub_dot(other, add_mat_kernel));
@@ -247,6 +327,13 @@ Mat& Mat::mat_add_sub_dot_eq_op(char op, const Mat &other) {
    assert(m_height == other.m_height);
    assert(m_width == other.m_width);
 
+   if (mat_backend == CPU_BACKEND)
+   {
+      const int N_ELEMENTS = m_width * m_height;
+      cpu_elementwise(op, m_host->data(), other.m_host->data(), m_host->data(), N_ELEMENTS, N_ELEMENTS);
+      return *this;
+   }
+
    switch (op)
    {
       case '+': return (mat_add_sub_dot_eq(other, add_mat_eq_kernel));
@@ -276,99 +363,123 @@ void shrinkActivePoolToSize(vector<future<T>> &active_pool, unsigned s)
 
 Mat Mat::relu() const
 {
+   if (mat_backend == CPU_BACKEND) return host_map(cpu_relu);
+
    const int N_ELEMENTS = m_width*m_height;
    cl::Buffer out_buffer(ocl_context, CL_MEM_READ_WRITE, N_ELEMENTS * sizeof(float));
+   cl::Event out_event;
    try {
       relu_kernel.setArg( 0, m_buffer );
       relu_kernel.setArg( 1, out_buffer);
       cl::NDRange global( N_ELEMENTS );
-      ocl_queue.enqueueNDRangeKernel(relu_kernel, cl::NullRange, global );
+      auto deps = ocl_wait_list({m_event});
+      ocl_queue.enqueueNDRangeKernel( relu_kernel, cl::NullRange, global, cl::NullRange, &deps, &out_event );
    }
    catch(cl::Error& err) {
       std::cout << "Error in relu: " << err.what() << "(" << getErrorString(err.err()) << ")" << std::endl;
    }
-   return Mat(m_height, m_width, out_buffer);
+   return Mat(m_height, m_width, out_buffer, out_event);
 }
 
 Mat Mat::relu_inv() const
 {
+   if (mat_backend == CPU_BACKEND) return host_map(cpu_relu_inv);
+
    const int N_ELEMENTS = m_width*m_height;
    cl::Buffer out_buffer(ocl_context, CL_MEM_READ_WRITE, N_ELEMENTS * sizeof(float));
+   cl::Event out_event;
    try {
       relu_inv_kernel.setArg( 0, m_buffer );
       relu_inv_kernel.setArg( 1, out_buffer);
       cl::NDRange global( N_ELEMENTS );
-      ocl_queue.enqueueNDRangeKernel( relu_inv_kernel, cl::NullRange, global );
+      auto deps = ocl_wait_list({m_event});
+      ocl_queue.enqueueNDRangeKernel( relu_inv_kernel, cl::NullRange, global, cl::NullRange, &deps, &out_event );
    }
    catch(cl::Error& err) {
       std::cout << "Error in relu_inv: " << err.what() << "(" << getErrorString(err.err()) << ")" << std::endl;
    }
-   return Mat(m_height, m_width, out_buffer);
+   return Mat(m_height, m_width, out_buffer, out_event);
 }
 
 
 Mat Mat::sigmoid() const
 {
+   if (mat_backend == CPU_BACKEND) return host_map(cpu_sigmoid);
+
    const int N_ELEMENTS = m_width*m_height;
    cl::Buffer out_buffer(ocl_context, CL_MEM_READ_WRITE, N_ELEMENTS * sizeof(float));
+   cl::Event out_event;
    try {
       sigmoid_kernel.setArg( 0, m_buffer );
       sigmoid_kernel.setArg( 1, out_buffer);
       cl::NDRange global( N_ELEMENTS );
-      ocl_queue.enqueueNDRangeKernel(sigmoid_kernel, cl::NullRange, global );
+      auto deps = ocl_wait_list({m_event});
+      ocl_queue.enqueueNDRangeKernel( sigmoid_kernel, cl::NullRange, global, cl::NullRange, &deps, &out_event );
    }
    catch(cl::Error& err) {
       std::cout << "Error in sigmoid: " << err.what() << "(" << getErrorString(err.err()) << ")" << std::endl;
    }
-   return Mat(m_height, m_width, out_buffer);
+   return Mat(m_height, m_width, out_buffer, out_event);
 }
 
 Mat Mat::sigmoid_inv() const
 {
+   if (mat_backend == CPU_BACKEND) return host_map(cpu_sigmoid_inv);
+
    const int N_ELEMENTS = m_width*m_height;
    cl::Buffer out_buffer(ocl_context, CL_MEM_READ_WRITE, N_ELEMENTS * sizeof(float));
+   cl::Event out_event;
    try {
       sigmoid_inv_kernel.setArg( 0, m_buffer );
       sigmoid_inv_kernel.setArg( 1, out_buffer);
       cl::NDRange global( N_ELEMENTS );
-      ocl_queue.enqueueNDRangeKernel( sigmoid_inv_kernel, cl::NullRange, global );
+      auto deps = ocl_wait_list({m_event});
+      ocl_queue.enqueueNDRangeKernel( sigmoid_inv_kernel, cl::NullRange, global, cl::NullRange, &deps, &out_event );
    }
    catch(cl::Error& err) {
       std::cout << "Error in sigmoid_inv: " << err.what() << "(" << getErrorString(err.err()) << ")" << std::endl;
    }
-   return Mat(m_height, m_width, out_buffer);
+   return Mat(m_height, m_width, out_buffer, out_event);
 }
 
 Mat Mat::log() const
 {
+   if (mat_backend == CPU_BACKEND) return host_map(cpu_log);
+
    const int N_ELEMENTS = m_width*m_height;
    cl::Buffer out_buffer(ocl_context, CL_MEM_READ_WRITE, N_ELEMENTS * sizeof(float));
+   cl::Event out_event;
    try {
       log_kernel.setArg( 0, m_buffer );
       log_kernel.setArg( 1, out_buffer);
       cl::NDRange global( N_ELEMENTS );
-      ocl_queue.enqueueNDRangeKernel( log_kernel, cl::NullRange, global );
+      auto deps = ocl_wait_list({m_event});
+      ocl_queue.enqueueNDRangeKernel( log_kernel, cl::NullRange, global, cl::NullRange, &deps, &out_event );
    }
    catch(cl::Error& err) {
       std::cout << "Error in log: " << err.what() << "(" << getErrorString(err.err()) << ")" << std::endl;
    }
-   return Mat(m_height, m_width, out_buffer);
+   return Mat(m_height, m_width, out_buffer, out_event);
 }
 
 Mat Mat::exp() const
 {
+   if (mat_backend == CPU_BACKEND) return host_map(cpu_exp);
+
    const int N_ELEMENTS = m_width*m_height;
    cl::Buffer out_buffer(ocl_context, CL_MEM_READ_WRITE, N_ELEMENTS * sizeof(float));
+   cl::Event out_event;
    try {
       exp_kernel.setArg( 0, m_buffer );
       exp_kernel.setArg( 1, out_buffer);
       cl::NDRange global( N_ELEMENTS );
-      ocl_queue.enqueueNDRangeKernel( exp_kernel, cl::NullRange, global );
+      auto deps = ocl_wait_list({m_event});
+      ocl_queue.enqueueNDRangeKernel( exp_kernel, cl::NullRange, global, cl::NullRange, &deps, &out_event );
    }
    catch(cl::Error& err) {
       std::cout << "Error in exp: " << err.what() << "(" << getErrorString(err.err()) << ")" << std::endl;
    }
-   return Mat(m_height, m_width, out_buffer);
+   return Mat(m_height, m_width, out_buffer, out_event);
 }
 
 Mat Mat::softmax() const
@@ -380,35 +491,51 @@ Mat Mat::softmax() const
 Mat Mat::binary_crossentropy_loss(const Mat& prediction) const
 {
    const int N_ELEMENTS = m_width * m_height;
+   if (mat_backend == CPU_BACKEND)
+   {
+      auto out = std::make_shared<std::vector<float>>(N_ELEMENTS);
+      cpu_binary_CEL(m_host->data(), prediction.m_host->data(), out->data(), N_ELEMENTS);
+      return Mat(m_height, m_width, out);
+   }
    cl::Buffer out_buffer(ocl_context, CL_MEM_READ_WRITE, N_ELEMENTS*sizeof(float));
+   cl::Event out_event;
    cl::NDRange global( N_ELEMENTS );
    try {
       binary_CEL_kernel.setArg( 0, m_buffer );
       binary_CEL_kernel.setArg( 1, prediction.m_buffer);
       binary_CEL_kernel.setArg( 2, out_buffer );
-      ocl_queue.enqueueNDRangeKernel( binary_CEL_kernel, cl::NullRange, global );
+      auto deps = ocl_wait_list({m_event, prediction.m_event});
+      ocl_queue.enqueueNDRangeKernel( binary_CEL_kernel, cl::NullRange, global, cl::NullRange, &deps, &out_event );
    }
    catch(cl::Error& err) {
       std::cout << "Error in binary_crossentropy_loss: " << err.what() << "(" << getErrorString(err.err()) << ")" << std::endl;
    }
-   return Mat(m_height, m_width, out_buffer);
+   return Mat(m_height, m_width, out_buffer, out_event);
 }
 
 Mat Mat::binary_crossentropy_loss_derivative(const Mat& prediction)  const
 {
    const int N_ELEMENTS = m_width * m_height;
+   if (mat_backend == CPU_BACKEND)
+   {
+      auto out = std::make_shared<std::vector<float>>(N_ELEMENTS);
+      cpu_binary_CEL_derivative(m_host->data(), prediction.m_host->data(), out->data(), N_ELEMENTS);
+      return Mat(m_height, m_width, out);
+   }
    cl::Buffer out_buffer(ocl_context, CL_MEM_READ_WRITE, N_ELEMENTS*sizeof(float));
+   cl::Event out_event;
    cl::NDRange global( N_ELEMENTS );
    try {
       binary_CEL_derivative_kernel.setArg( 0, m_buffer );
       binary_CEL_derivative_kernel.setArg( 1, prediction.m_buffer);
       binary_CEL_derivative_kernel.setArg( 2, out_buffer );
-      ocl_queue.enqueueNDRangeKernel( binary_CEL_derivative_kernel, cl::NullRange, global );
+      auto deps = ocl_wait_list({m_event, prediction.m_event});
+      ocl_queue.enqueueNDRangeKernel( binary_CEL_derivative_kernel, cl::NullRange, global, cl::NullRange, &deps, &out_event );
    }
    catch(cl::Error& err) {
       std::cout << "Error in binary_crossentropy_loss_derivative: " << err.what() << "(" << getErrorString(err.err()) << ")" << std::endl;
    }
-   return Mat(m_height, m_width, out_buffer);
+   return Mat(m_height, m_width, out_buffer, out_event);
 }
 
 // sum of all the elements in this matrix
@@ -433,9 +560,8 @@ float Mat::sumOfSquares() const
 
 Mat Mat::runFun(float function(float)) const
 {
-   std::vector<float> invals(m_width * m_height);
+   std::vector<float> invals = getVals();
    std::vector<float> outvals(m_width * m_height);
-   ocl_queue.enqueueReadBuffer( m_buffer, CL_TRUE, 0, (m_width * m_height)*sizeof(float), invals.data() );
 
    using fl_iter = std::vector<float>::iterator;
    vector<future<fl_iter>> active_pool{};
@@ -453,17 +579,13 @@ Mat Mat::runFun(float function(float)) const
       ftr.wait();
    }
 
-   cl::Buffer out_buffer(ocl_context, CL_MEM_READ_WRITE, (m_width * m_height)*sizeof(float));
-   ocl_queue.enqueueWriteBuffer( out_buffer, CL_FALSE, 0, (m_width * m_height)*sizeof(float), outvals.data() );
-
-   return Mat(m_height, m_width, out_buffer);
+   return Mat(m_height, m_width, std::move(outvals));
 }
 
 Mat Mat::rectify() const
 {
-   std::vector<float> vals(m_width * m_height);
+   std::vector<float> vals = getVals();
    std::vector<float> out_vals(m_width * m_height);
-   ocl_queue.enqueueReadBuffer(m_buffer, CL_TRUE, 0, m_width*m_height*sizeof(float),vals.data());
    float sum = 0;
    for (unsigned i = 0; i < m_height * m_width; i++)
    {
@@ -472,16 +594,24 @@ Mat Mat::rectify() const
    }
    if (sum == 0)
    {
-      return Mat(m_height, m_width, m_buffer);
+      if (mat_backend == CPU_BACKEND) return Mat(m_height, m_width, m_host);
+      return Mat(m_height, m_width, m_buffer, m_event);
    }
 
-   return Mat(m_height, m_width, out_vals)/sum;
+   return Mat(m_height, m_width, std::move(out_vals))/sum;
 }
 
 Mat Mat::float_op(char op, float val) const 
 {
    const int N_ELEMENTS = m_height*m_width;
+   if (mat_backend == CPU_BACKEND)
+   {
+      auto out = std::make_shared<std::vector<float>>(N_ELEMENTS);
+      cpu_float_op(op, m_host->data(), out->data(), N_ELEMENTS, val);
+      return Mat(m_height, m_width, out);
+   }
    cl::Buffer out_buffer(ocl_context, CL_MEM_READ_WRITE, N_ELEMENTS * sizeof(float));
+   cl::Event out_event;
    
    cl_float buffer_val = val;
    try {
@@ -502,13 +632,14 @@ Mat Mat::float_op(char op, float val) const
    kernel.setArg( 2, sizeof(cl_float), &buffer_val );
 
    cl::NDRange global( N_ELEMENTS );
-   ocl_queue.enqueueNDRangeKernel( kernel, cl::NullRange, global );
+   auto deps = ocl_wait_list({m_event});
+   ocl_queue.enqueueNDRangeKernel( kernel, cl::NullRange, global, cl::NullRange, &deps, &out_event );
    }
    catch(cl::Error& err) {
       std::cout << "Error: " << err.what() << "(" << getErrorString(err.err()) << ")" << std::endl;
    }
 
-   return Mat(m_height, m_width, out_buffer);
+   return Mat(m_height, m_width, out_buffer, out_event);
 }
 
 float Mat::getVal(unsigned i, unsigned j)
@@ -516,7 +647,8 @@ float Mat::getVal(unsigned i, unsigned j)
    assert(m_height >= i && m_width >= j);
    float outval;
    int offset = i*m_width + j;
-   ocl_queue.enqueueReadBuffer( m_buffer, CL_TRUE, offset*sizeof(float), sizeof(float), &outval );
+   if (mat_backend == CPU_BACKEND) return (*m_host)[offset];
+   ocl_download(m_buffer, offset*sizeof(float), sizeof(float), &outval, ocl_wait_list({m_event}));
    return outval;
 }
 
@@ -525,7 +657,14 @@ Mat Mat::operator*(const Mat &other) const
    assert(m_width == other.m_height);
 
    const int C_N_ELEMENTS = m_height*other.m_width;
+   if (mat_backend == CPU_BACKEND)
+   {
+      auto out = std::make_shared<std::vector<float>>(C_N_ELEMENTS);
+      cpu_matmul(m_host->data(), other.m_host->data(), out->data(), m_height, m_width, other.m_width, 1, 0, 0);
+      return Mat(m_height, other.m_width, out);
+   }
    cl::Buffer out_buffer(ocl_context, CL_MEM_READ_WRITE, C_N_ELEMENTS * sizeof(float));
+   cl::Event out_event;
    try {
       cl_int buffer_a_w = m_width;
       cl_int buffer_b_w = other.m_width;
@@ -536,13 +675,14 @@ Mat Mat::operator*(const Mat &other) const
       matmul_kernel.setArg( 4, sizeof(cl_int), &buffer_b_w );
 
       cl::NDRange global( C_N_ELEMENTS );
-      ocl_queue.enqueueNDRangeKernel( matmul_kernel, cl::NullRange, global );
+      auto deps = ocl_wait_list({m_event, other.m_event});
+      ocl_queue.enqueueNDRangeKernel( matmul_kernel, cl::NullRange, global, cl::NullRange, &deps, &out_event );
    }
    catch(cl::Error& err) {
       std::cout << "Error in operator*: " << err.what() << "(" << getErrorString(err.err()) << ")" << std::endl;
    }
 
-   return Mat(m_height, other.getWidth(), out_buffer);
+   return Mat(m_height, other.getWidth(), out_buffer, out_event);
 }
 
 
@@ -551,7 +691,16 @@ const Mat& Mat::operator*=(const Mat &other)
    assert(m_width == other.m_height);
 
    const int C_N_ELEMENTS = m_height*other.m_width;
+   if (mat_backend == CPU_BACKEND)
+   {
+      auto out = std::make_shared<std::vector<float>>(C_N_ELEMENTS);
+      cpu_matmul(m_host->data(), other.m_host->data(), out->data(), m_height, m_width, other.m_width, 1, 0, 0);
+      m_host = out;
+      m_width = other.getWidth();
+      return *this;
+   }
    cl::Buffer out_buffer(ocl_context, CL_MEM_READ_WRITE, C_N_ELEMENTS * sizeof(float));
+   cl::Event out_event;
    try {
       cl_int buffer_a_w = m_width;
       cl_int buffer_b_w = other.m_width;
@@ -562,13 +711,15 @@ const Mat& Mat::operator*=(const Mat &other)
       matmul_kernel.setArg( 4, sizeof(cl_int), &buffer_b_w );
 
       cl::NDRange global( C_N_ELEMENTS );
-      ocl_queue.enqueueNDRangeKernel( matmul_kernel, cl::NullRange, global );
+      auto deps = ocl_wait_list({m_event, other.m_event});
+      ocl_queue.enqueueNDRangeKernel( matmul_kernel, cl::NullRange, global, cl::NullRange, &deps, &out_event );
    }
    catch(cl::Error& err) {
       std::cout << "Error in operator*: " << err.what() << "(" << getErrorString(err.err()) << ")" << std::endl;
    }
 
    m_buffer = out_buffer;
+   m_event = out_event;
    m_width = other.getWidth();
 
    return *this;
@@ -579,7 +730,14 @@ ParallelMat Mat::operator* (const ParallelMat &other) const
    assert(m_width == other.m_height);
 
    const int C_N_ELEMENTS = m_height*other.m_width*other.m_count;
+   if (mat_backend == CPU_BACKEND)
+   {
+      auto out = std::make_shared<std::vector<float>>(C_N_ELEMENTS);
+      cpu_matmul(m_host->data(), other.hostData(), out->data(), m_height, m_width, other.m_width, other.m_count, 0, m_width*other.m_width);
+      return ParallelMat(m_height, other.m_width, other.m_count, out);
+   }
    cl::Buffer out_buffer(ocl_context, CL_MEM_READ_WRITE, C_N_ELEMENTS * sizeof(float));
+   cl::Event out_event;
    try {
       cl_int buffer_common=m_width;
       cl_int buffer_a_h=m_height;
@@ -591,25 +749,48 @@ ParallelMat Mat::operator* (const ParallelMat &other) const
       multiple_matmul_kernel.setArg( 3, sizeof(cl_int), &buffer_common );
       multiple_matmul_kernel.setArg( 4, sizeof(cl_int), &buffer_b_w );
       multiple_matmul_kernel.setArg( 5, sizeof(cl_int), &buffer_a_h );
+      multiple_matmul_kernel.setArg( 6, static_cast<cl_int>(other.m_offset) );
 
       cl::NDRange global( C_N_ELEMENTS );
-      ocl_queue.enqueueNDRangeKernel( multiple_matmul_kernel, cl::NullRange, global );
+      auto deps = ocl_wait_list({m_event, other.m_event});
+      ocl_queue.enqueueNDRangeKernel( multiple_matmul_kernel, cl::NullRange, global, cl::NullRange, &deps, &out_event );
    }
    catch(cl::Error& err) {
       std::cout << "Error in multipleMultiply: " << err.what() << "(" << getErrorString(err.err()) << ")" << std::endl;
    }
 
-   return ParallelMat(m_height, other.m_width, other.m_count, out_buffer);
+   return ParallelMat(m_height, other.m_width, other.m_count, out_buffer, out_event);
 }
 
 std::vector<float> Mat::getVals() const {
+   if (mat_backend == CPU_BACKEND) return *m_host;
+
    const int N_ELEMENTS = m_width * m_height;
    std::vector<float> out(N_ELEMENTS);
 
-   ocl_queue.enqueueReadBuffer(m_buffer, CL_TRUE, 0, N_ELEMENTS*sizeof(float), out.data());
+   ocl_download(m_buffer, 0, N_ELEMENTS*sizeof(float), out.data(), ocl_wait_list({m_event}));
    return out;
 }
 
+std::future<std::vector<float>> Mat::getValsAsync() const {
+   if (mat_backend == CPU_BACKEND)
+   {
+      return std::async(std::launch::deferred, [host = m_host]() { return *host; });
+   }
+
+   const int N_ELEMENTS = m_width * m_height;
+   auto out = std::make_shared<std::vector<float>>(N_ELEMENTS);
+
+   cl::Event read_event;
+   ocl_download(m_buffer, 0, N_ELEMENTS*sizeof(float), out->data(), ocl_wait_list({m_event}), &read_event);
+   m_event = read_event;
+
+   return std::async(std::launch::deferred, [out, read_event]() {
+      read_event.wait();
+      return std::move(*out);
+   });
+}
+
 
 ParallelMat Mat::operator+ (const ParallelMat &other) const
 {
@@ -617,7 +798,14 @@ ParallelMat Mat::operator+ (const ParallelMat &other) const
 
    const int N_ELEMENTS = m_width * m_height * other.m_count;
    const int B_size = m_width * m_height;
+   if (mat_backend == CPU_BACKEND)
+   {
+      auto out = std::make_shared<std::vector<float>>(N_ELEMENTS);
+      cpu_elementwise('+', m_host->data(), other.hostData(), out->data(), B_size, N_ELEMENTS);
+      return ParallelMat(m_height, m_width, other.m_count, out);
+   }
    cl::Buffer out_buffer(ocl_context, CL_MEM_READ_WRITE, N_ELEMENTS*sizeof(float));
+   cl::Event out_event;
    cl_int bufferB_size=B_size;
    cl::NDRange global( N_ELEMENTS );
    try {
@@ -625,12 +813,14 @@ ParallelMat Mat::operator+ (const ParallelMat &other) const
       multiple_add_kernel.setArg( 1, other.m_buffer);
       multiple_add_kernel.setArg( 2, out_buffer );
       multiple_add_kernel.setArg( 3, sizeof(cl_int), &bufferB_size );
-      ocl_queue.enqueueNDRangeKernel( multiple_add_kernel, cl::NullRange, global );
+      multiple_add_kernel.setArg( 4, static_cast<cl_int>(other.m_offset) );
+      auto deps = ocl_wait_list({m_event, other.m_event});
+      ocl_queue.enqueueNDRangeKernel( multiple_add_kernel, cl::NullRange, global, cl::NullRange, &deps, &out_event );
    }
    catch(cl::Error& err) {
       std::cout << "Error in multipleAdd: " << err.what() << "(" << getErrorString(err.err()) << ")" << std::endl;
    }
-   return ParallelMat(m_height, m_width, other.m_count, out_buffer);
+   return ParallelMat(m_height, m_width, other.m_count, out_buffer, out_event);
 }
 
 ParallelMat Mat::operator^ (const ParallelMat &other) const
@@ -639,26 +829,41 @@ ParallelMat Mat::operator^ (const ParallelMat &other) const
 
    const int N_ELEMENTS = m_width * m_height * other.m_count;
    const int B_size = m_width * m_height;
+   if (mat_backend == CPU_BACKEND)
+   {
+      auto out = std::make_shared<std::vector<float>>(N_ELEMENTS);
+      cpu_elementwise('^', m_host->data(), other.hostData(), out->data(), B_size, N_ELEMENTS);
+      return ParallelMat(m_height, m_width, other.m_count, out);
+   }
    cl::Buffer out_buffer(ocl_context, CL_MEM_READ_WRITE, N_ELEMENTS*sizeof(float));
+   cl::Event out_event;
    cl_int bufferB_size=B_size;
    cl::NDRange global( N_ELEMENTS );
    try {
       multiple_dot_kernel.setArg( 0, m_buffer );
-      multiple_dot_kernel.setArg( 1, other.m_buffer);
+      multiple_dot_kernel.setArg( 1, other.buffer());
       multiple_dot_kernel.setArg( 2, out_buffer );
       multiple_dot_kernel.setArg( 3, sizeof(cl_int), &bufferB_size );
-      ocl_queue.enqueueNDRangeKernel( multiple_dot_kernel, cl::NullRange, global );
+      auto deps = ocl_wait_list({m_event, other.m_event});
+      ocl_queue.enqueueNDRangeKernel( multiple_dot_kernel, cl::NullRange, global, cl::NullRange, &deps, &out_event );
    }
    catch(cl::Error& err) {
       std::cout << "Error in multipleAdd: " << err.what() << "(" << getErrorString(err.err()) << ")" << std::endl;
    }
-   return ParallelMat(m_height, m_width, other.m_count, out_buffer);
+   return ParallelMat(m_height, m_width, other.m_count, out_buffer, out_event);
 }
 
 Mat Mat::transpose() const
 {
    const int N_ELEMENTS = m_width * m_height;
+   if (mat_backend == CPU_BACKEND)
+   {
+      auto out = std::make_shared<std::vector<float>>(N_ELEMENTS);
+      cpu_transpose(m_host->data(), out->data(), m_height, m_width, 1);
+      return Mat(m_width, m_height, out);
+   }
    cl::Buffer out_buffer(ocl_context, CL_MEM_READ_WRITE, N_ELEMENTS * sizeof(float));
+   cl::Event out_event;
    
    cl_int W = m_width;
    cl_int H = m_height;
@@ -670,11 +875,73 @@ Mat Mat::transpose() const
    transpose_kernel.setArg( 3, sizeof(cl_int), &H );
 
    cl::NDRange global( N_ELEMENTS );
-   ocl_queue.enqueueNDRangeKernel( transpose_kernel, cl::NullRange, global );
+   auto deps = ocl_wait_list({m_event});
+   ocl_queue.enqueueNDRangeKernel( transpose_kernel, cl::NullRange, global, cl::NullRange, &deps, &out_event );
    }
    catch(cl::Error& err) {
       std::cout << "Error in transpose: " << err.what() << "(" << getErrorString(err.err()) << ")" << std::endl;
    }
 
-   return Mat(m_width, m_height, out_buffer);
+   return Mat(m_width, m_height, out_buffer, out_event);
+}
+
+const Mat& Mat::addOuterProducts(const ParallelMat& left, const ParallelMat& right)
+{
+   assert(left.m_width == 1 && right.m_width == 1 && left.m_count == right.m_count);
+   assert(m_height == left.m_height && m_width == right.m_height);
+
+   // the batches are count x height matrices, so the product is left^T * right
+   const int M = m_height;
+   const int K = left.m_count;
+   const int N = m_width;
+   if (mat_backend == CPU_BACKEND)
+   {
+      cpu_matmul_tn_acc(left.hostData(), right.hostData(), m_host->data(), M, K, N);
+      return *this;
+   }
+
+   try {
+      tiled_matmul_tn_acc_kernel.setArg( 0, left.buffer() );
+      tiled_matmul_tn_acc_kernel.setArg( 1, right.buffer() );
+      tiled_matmul_tn_acc_kernel.setArg( 2, m_buffer );
+      tiled_matmul_tn_acc_kernel.setArg( 3, M );
+      tiled_matmul_tn_acc_kernel.setArg( 4, K );
+      tiled_matmul_tn_acc_kernel.setArg( 5, N );
+
+      auto round_up = [](int n) { return (n + MATMUL_TILE - 1) / MATMUL_TILE * MATMUL_TILE; };
+      auto deps = ocl_wait_list({m_event, left.m_event, right.m_event});
+      ocl_queue.enqueueNDRangeKernel( tiled_matmul_tn_acc_kernel, cl::NullRange, cl::NDRange(round_up(N), round_up(M)),
+                                      cl::NDRange(MATMUL_TILE, MATMUL_TILE), &deps, &m_event );
+   }
+   catch(cl::Error& err) {
+      std::cout << "Error in addOuterProducts: " << err.what() << "(" << getErrorString(err.err()) << ")" << std::endl;
+   }
+   return *this;
+}
+
+const Mat& Mat::addSum(const ParallelMat& mats)
+{
+   assert(m_height == mats.m_height && m_width == mats.m_width);
+
+   const cl_int arraySize = m_height*m_width;
+   if (mat_backend == CPU_BACKEND)
+   {
+      cpu_sum(mats.hostData(), m_host->data(), mats.m_count, arraySize, true);
+      return *this;
+   }
+
+   try {
+      multiple_sum_kernel.setArg( 0, mats.buffer() );
+      multiple_sum_kernel.setArg( 1, m_buffer );
+      multiple_sum_kernel.setArg( 2, static_cast<cl_int>(mats.m_count) );
+      multiple_sum_kernel.setArg( 3, arraySize );
+      multiple_sum_kernel.setArg( 4, static_cast<cl_int>(1) );
+
+      auto deps = ocl_wait_list({m_event, mats.m_event});
+      ocl_queue.enqueueNDRangeKernel( multiple_sum_kernel, cl::NullRange, cl::NDRange(arraySize), cl::NullRange, &deps, &m_event );
+   }
+   catch(cl::Error& err) {
+      std::cout << "Error in addSum: " << err.what() << "(" << getErrorString(err.err()) << ")" << std::endl;
+   }
+   return *this;
 }
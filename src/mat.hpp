@@ -4,13 +4,20 @@
 #include <assert.h>
 #include <ostream>
 #include <random>
+#include <future>
 #define CL_HPP_ENABLE_EXCEPTIONS
 #define CL_HPP_TARGET_OPENCL_VERSION 300
 #include <CL/opencl.hpp>
+#include "backend.hpp"
 
 class ParallelMat;
 class Mat;
 class ConvKernel;
+class HalfMat;
+class Int8Mat;
+class ParameterOptimizer;
+class CheckpointReader;
+class BatchPermutation;
 
 Mat operator* (float f, const Mat& mat);
 std::ostream& operator<<(std::ostream& out, const Mat& mat);
@@ -24,6 +31,10 @@ private:
    static void setup();
 
    cl::Buffer m_buffer;
+   // last command writing `m_buffer`, or an async read that later writes must not overtake
+   mutable cl::Event m_event;
+   // used instead of `m_buffer` on the CPU backend
+   HostBuffer m_host;
    unsigned m_width = 0;
    unsigned m_height = 0;
    Mat float_op(char op, float val) const;
@@ -34,12 +45,20 @@ private:
    Mat& mat_add_sub_dot_eq_op(char op, const Mat &other);
    Mat& mat_add_sub_dot_eq(const Mat &other, cl::Kernel& kernel);
 
-   Mat(unsigned height, unsigned width, const cl::Buffer& buffer);
+   Mat(unsigned height, unsigned width, const cl::Buffer& buffer, const cl::Event& event = cl::Event());
+   Mat(unsigned height, unsigned width, HostBuffer host);
+
+   // CPU backend: `function` applied to every element
+   Mat host_map(void function(const float*, float*, std::size_t)) const;
 
 public:
 
+   // uploads are non-blocking, the rvalue overload avoids copying `vals` to keep it alive
    Mat(unsigned height, unsigned width, const std::vector<float>& vals);
+   Mat(unsigned height, unsigned width, std::vector<float>&& vals);
+   // copies the elements, while moving takes over `mat`'s storage, so a view stays a view
    Mat(const Mat& mat);
+   Mat(Mat&& mat) noexcept = default;
    Mat();
 
    ParallelMat operator* (const ParallelMat &other) const;
@@ -68,6 +87,12 @@ public:
    const Mat& operator= (const Mat &other);
    const Mat& operator= (const Mat &&other);
 
+   // in place, without materializing a matrix per item of the batch: the sum over the batch of
+   // left_i * right_i^T (columns both), as one GEMM with the batch as the reduction dimension,
+   // and the sum of the batch's matrices
+   const Mat& addOuterProducts(const ParallelMat& left, const ParallelMat& right);
+   const Mat& addSum(const ParallelMat& mats);
+
 
    // assumes this matrix is your true values, `prediction` is your nn output
    Mat binary_crossentropy_loss(const Mat& prediction) const;
@@ -92,6 +117,8 @@ public:
 
    float getVal(unsigned row, unsigned col);
    std::vector<float> getVals() const;
+   // starts the download immediately, only waits on it when the future is read
+   std::future<std::vector<float>> getValsAsync() const;
 
    Mat runFun(float function(float)) const;
    Mat rectify() const;
@@ -107,5 +134,10 @@ public:
 
    friend ParallelMat;
    friend ConvKernel;
+   friend HalfMat;
+   friend Int8Mat;
+   friend ParameterOptimizer;
+   friend CheckpointReader;
+   friend BatchPermutation;
 };
 
@@ -0,0 +1,51 @@
+#include "memoryPlan.hpp"
+#include <algorithm>
+#include <numeric>
+
+static std::size_t align_floats(std::size_t floats)
+{
+   return (floats + MEMORY_PLAN_ALIGNMENT - 1) / MEMORY_PLAN_ALIGNMENT * MEMORY_PLAN_ALIGNMENT;
+}
+
+MemoryPlan plan_memory(const std::vector<TensorLifetime>& tensors)
+{
+   MemoryPlan plan;
+   std::vector<std::size_t> offsets(tensors.size(), 0);
+
+   std::vector<std::size_t> order(tensors.size());
+   std::iota(order.begin(), order.end(), 0);
+   std::stable_sort(order.begin(), order.end(), [&tensors](std::size_t l, std::size_t r) {
+      return tensors[l].floats > tensors[r].floats;
+   });
+
+   std::vector<std::size_t> placed;
+   // [begin, end) of the placed tensors whose lifetimes overlap the one being placed
+   std::vector<std::pair<std::size_t, std::size_t>> taken;
+   for (std::size_t tensor : order)
+   {
+      const TensorLifetime& lifetime = tensors[tensor];
+      const std::size_t size = align_floats(lifetime.floats);
+      plan.unplanned_floats += size;
+
+      taken.clear();
+      for (std::size_t other : placed)
+      {
+         if (tensors[other].first_use <= lifetime.last_use && lifetime.first_use <= tensors[other].last_use)
+         {
+            taken.push_back({offsets[other], offsets[other] + align_floats(tensors[other].floats)});
+         }
+      }
+      std::sort(taken.begin(), taken.end());
+
+      std::size_t offset = 0;
+      for (auto [begin, end] : taken)
+      {
+         if (offset + size <= begin) break;
+         offset = std::max(offset, end);
+      }
+      offsets[tensor] = offset;
+      plan.arena_floats = std::max(plan.arena_floats, offset + size);
+      placed.push_back(tensor);
+   }
+   return plan;
+}
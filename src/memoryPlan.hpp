@@ -0,0 +1,29 @@
+#pragma once
+
+#include <cstddef>
+#include <vector>
+
+// a tensor that is alive from the step that makes it to the last step reading it
+struct TensorLifetime
+{
+   std::size_t floats;
+   unsigned first_use;
+   unsigned last_use;
+};
+
+// an estimate of the memory a set of tensors needs. Nothing is allocated from it, it is for
+// sizing batches and comparing training setups before running them
+struct MemoryPlan
+{
+   // the arena they would all fit in, reusing the memory of tensors whose lifetimes have ended
+   std::size_t arena_floats = 0;
+   // every tensor allocated on its own, for comparison
+   std::size_t unplanned_floats = 0;
+};
+
+// tensors are placed at multiples of this many floats, 64 bytes
+constexpr std::size_t MEMORY_PLAN_ALIGNMENT = 16;
+
+// places every tensor so that no two tensors alive at the same step overlap, and returns the
+// memory that takes. Greedy by size, largest first, each at the lowest offset it fits at
+MemoryPlan plan_memory(const std::vector<TensorLifetime>& tensors);
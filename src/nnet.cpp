@@ -1,4 +1,7 @@
 #include "nnet.hpp"
+#include "oclData.hpp"
+#include "checkpoint.hpp"
+#include "architecture.hpp"
 
 #include <iostream>
 #include <iomanip>
@@ -7,6 +10,8 @@
 #include <ctime>
 #include <fstream>
 #include <assert.h>
+#include <algorithm>
+#include <stdexcept>
 #include <iostream>
 
 using std::shared_ptr, std::vector, std::make_shared, std::make_unique, std::setw, std::setprecision, std::ofstream, std::ifstream;
@@ -33,6 +38,39 @@ NNet::NNet(const std::vector<std::reference_wrapper<Layer>>& layers)
    }
 }
 
+static std::vector<std::reference_wrapper<Layer>> layer_references(const std::vector<std::unique_ptr<Layer>>& layers)
+{
+   std::vector<std::reference_wrapper<Layer>> references;
+   for (const std::unique_ptr<Layer>& layer : layers)
+   {
+      references.push_back(*layer);
+   }
+   return references;
+}
+
+NNet::NNet(std::vector<std::unique_ptr<Layer>> layers)
+:NNet(layer_references(layers))
+{
+   for (std::unique_ptr<Layer>& layer : layers)
+   {
+      m_owned_layers.push_back(std::move(layer));
+   }
+}
+
+NNet NNet::fromArchitecture(const std::string& architecture)
+{
+   return NNet(build_layers(architecture));
+}
+
+NNet NNet::fromCheckpoint(const std::string& path, bool verify_checksum)
+{
+   // the checksum is checked once, by `load`
+   const std::string architecture = CheckpointReader(path, false).architecture();
+   NNet net = fromArchitecture(architecture);
+   net.load(path, verify_checksum);
+   return net;
+}
+
 std::vector<Mat> NNet::compute(const std::vector<Mat>& inputs) const {
    const unsigned INPUT_SIZE = m_layers.front().get().input_size;
    for(auto &input : inputs) {
@@ -40,13 +78,19 @@ std::vector<Mat> NNet::compute(const std::vector<Mat>& inputs) const {
       assert(input.getHeight() == INPUT_SIZE);
    }
 
-   auto a_l = ParallelMat{inputs};
+   return compute(ParallelMat{inputs}).toVector();
+}
+
+ParallelMat NNet::compute(const ParallelMat& inputs) const
+{
+   assert(inputs.getWidth() == 1 && inputs.getHeight() == static_cast<unsigned>(m_layers.front().get().input_size));
+   auto a_l = inputs;
 
    for (Layer& layer : m_layers)
    {
       a_l = layer.compute(a_l);
    }
-   return a_l.toVector();
+   return a_l;
 }
 
 Mat NNet::compute(const Mat &input) const
@@ -68,43 +112,310 @@ void NNet::applyWeightsAndBiasesGradients(float learning_rate)
    }
 }
 
+void NNet::setOptimizer(const OptimizerSettings& settings)
+{
+   for (UpdatableLayer& layer : m_updatable_layers)
+   {
+      layer.setOptimizer(settings);
+   }
+}
+
 void NNet::backPropagate(
    const std::vector<Mat>& inputs_vec, 
    const std::vector<Mat>& desired_outputs_vec) const
 {
    assert(inputs_vec.size() == desired_outputs_vec.size());
+   backPropagate(ParallelMat{inputs_vec}, ParallelMat{desired_outputs_vec});
+}
 
-   std::vector<Mat> weight_grads;
-   std::vector<Mat> bias_grads;
+void NNet::backPropagate(const ParallelMat& inputs, const ParallelMat& desired_outputs) const
+{
+   assert(inputs.getCount() == desired_outputs.getCount());
 
-   vector<ParallelMat> activations;
-   activations.reserve(m_layers.size() + 1);
-   vector<ParallelMat> preactivations;
-   auto inputs = ParallelMat{inputs_vec};
-   auto desired_outputs = ParallelMat{desired_outputs_vec};
+   const unsigned devices = std::min<unsigned>(ocl_device_queues.size(), inputs.getCount());
+   if (devices <= 1)
+   {
+      backPropagateOnDevice(inputs, desired_outputs);
+      return;
+   }
 
-   activations.push_back(inputs);
+   unsigned first = 0;
+   for (unsigned device = 0; device < devices; device++)
+   {
+      unsigned count = inputs.getCount() / devices + (device < inputs.getCount() % devices ? 1 : 0);
+      OclDeviceScope scope(device);
+      backPropagateOnDevice(inputs.slice(first, count), desired_outputs.slice(first, count));
+      first += count;
+   }
+   ocl_join_devices();
+}
 
-   for (Layer& layer : m_layers)
+ParallelMat NNet::forwardSegment(const ParallelMat& input, unsigned first, unsigned last,
+                                 vector<ParallelMat>* activations, vector<ParallelMat>* preactivations) const
+{
+   ParallelMat a_l = input;
+   if (activations) activations->push_back(input);
+
+   for (unsigned i = first; i < last; i++)
    {
+      Layer& layer = m_layers[i];
       if (layer.isUpdatable())
       {
          UpdatableLayer& updatable_layer = dynamic_cast<UpdatableLayer&>(layer);
-         auto[preactivation, activation] = updatable_layer.feedForward(activations.back());
-         activations.push_back(activation);
-         preactivations.push_back(preactivation);
+         auto[preactivation, activation] = updatable_layer.feedForward(a_l);
+         a_l = activation;
+         if (activations)
+         {
+            activations->push_back(activation);
+            preactivations->push_back(preactivation);
+         }
       }
       else
       {
-         activations.back() = layer.compute(activations.back());
+         a_l = layer.compute(a_l);
+         if (activations) activations->back() = a_l;
       }
    }
+   return a_l;
+}
+
+// where each segment of `segment` updatable layers starts in `layers`, the first one at 0 so
+// it takes any layers in front of the first updatable one, and the end of the last one
+static vector<unsigned> segment_bounds(const vector<std::reference_wrapper<Layer>>& layers, unsigned segment)
+{
+   vector<unsigned> bounds{0};
+   unsigned updatable = 0;
+   for (unsigned i = 0; i < layers.size(); i++)
+   {
+      if (not layers[i].get().isUpdatable()) continue;
+      if (updatable > 0 && updatable % segment == 0) bounds.push_back(i);
+      updatable++;
+   }
+   bounds.push_back(layers.size());
+   return bounds;
+}
+
+void NNet::backPropagateOnDevice(const ParallelMat& inputs, const ParallelMat& desired_outputs) const
+{
+   const unsigned segment = m_checkpoint_segment ? m_checkpoint_segment : m_updatable_layers.size();
+   const vector<unsigned> bounds = segment_bounds(m_layers, segment);
+   const unsigned segments = bounds.size() - 1;
+
+   // the input of every segment, the last one's activations are kept as is
+   vector<ParallelMat> checkpoints{inputs};
+   for (unsigned s = 0; s + 1 < segments; s++)
+   {
+      checkpoints.push_back(forwardSegment(checkpoints.back(), bounds[s], bounds[s + 1], nullptr, nullptr));
+   }
+
+   vector<ParallelMat> activations;
+   vector<ParallelMat> preactivations;
+   activations.reserve(segment + 1);
+   forwardSegment(checkpoints.back(), bounds[segments - 1], bounds[segments], &activations, &preactivations);
+   if (m_profiler) m_profiler->mark(PHASE_FORWARD);
 
    ParallelMat delta = m_updatable_layers.back().get().createCostDerivative(activations.back(), desired_outputs);
 
-   for (int i = m_updatable_layers.size() - 1; i >= 0; i--)
+   for (int s = segments - 1; s >= 0; s--)
+   {
+      if (s < static_cast<int>(segments) - 1)
+      {
+         activations.clear();
+         preactivations.clear();
+         forwardSegment(checkpoints[s], bounds[s], bounds[s + 1], &activations, &preactivations);
+      }
+      checkpoints.pop_back();
+
+      const unsigned first_updatable = s*segment;
+      for (int i = preactivations.size() - 1; i >= 0; i--)
+      {
+         delta = m_updatable_layers.at(first_updatable + i).get().updateWeightsAndBiasesGradients(preactivations[i], activations[i], delta);
+      }
+   }
+   if (m_profiler) m_profiler->mark(PHASE_BACKWARD);
+}
+
+void NNet::setInferencePrecision(StoragePrecision precision)
+{
+   for (UpdatableLayer& layer : m_updatable_layers)
+   {
+      layer.setInferencePrecision(precision);
+   }
+}
+
+QuantizationReport NNet::quantize(const std::vector<Mat>& calibration, const std::vector<Mat>& validation)
+{
+   setInferencePrecision(STORAGE_FP32);
+   const std::vector<Mat> expected = compute(validation);
+
+   // symmetric ranges, the largest input magnitude each weighted layer sees
+   std::vector<std::pair<UpdatableLayer*, float>> input_ranges;
+   auto a_l = ParallelMat{calibration};
+   for (Layer& layer : m_layers)
+   {
+      if (layer.isUpdatable())
+      {
+         float absmax = 0.f;
+         for (float val : a_l.getVals()) absmax = std::max(absmax, std::fabs(val));
+         input_ranges.emplace_back(&static_cast<UpdatableLayer&>(layer), absmax);
+      }
+      a_l = layer.compute(a_l);
+   }
+   for (auto [layer, absmax] : input_ranges)
+   {
+      layer->quantize(absmax > 0.f ? absmax / 127.f : 1.f);
+   }
+
+   QuantizationReport report;
+   const std::vector<Mat> outputs = compute(validation);
+   size_t n = 0;
+   for (size_t i = 0; i < outputs.size(); i++)
+   {
+      const std::vector<float> expected_vals = expected[i].getVals();
+      const std::vector<float> vals = outputs[i].getVals();
+      for (size_t j = 0; j < vals.size(); j++)
+      {
+         const float error = std::fabs(vals[j] - expected_vals[j]);
+         report.max_abs_error = std::max(report.max_abs_error, error);
+         report.mean_abs_error += error;
+         report.mean_abs_output += std::fabs(expected_vals[j]);
+      }
+      n += vals.size();
+   }
+   if (n > 0)
+   {
+      report.mean_abs_error /= n;
+      report.mean_abs_output /= n;
+   }
+   return report;
+}
+
+std::string NNet::architecture() const
+{
+   std::string architecture;
+   for (const Layer& layer : m_layers)
+   {
+      architecture += layer.describe() + "\n";
+   }
+   return architecture;
+}
+
+void NNet::save(const std::string& path) const
+{
+   CheckpointWriter writer(architecture());
+   for (const Layer& layer : m_layers)
+   {
+      layer.save(writer);
+   }
+   writer.write(path);
+}
+
+void NNet::load(const std::string& path, bool verify_checksum)
+{
+   CheckpointReader reader(path, verify_checksum);
+   if (reader.architecture() != architecture())
+   {
+      throw std::runtime_error("checkpoint " + path + " is of a different architecture:\n" + reader.architecture());
+   }
+   for (Layer& layer : m_layers)
+   {
+      layer.load(reader);
+   }
+   if (not reader.done()) throw std::runtime_error("checkpoint " + path + " has more entries than the net saves");
+}
+
+ForwardPlan NNet::planForward(unsigned max_batch) const
+{
+   ForwardPlan plan;
+   plan.max_batch = max_batch;
+   plan.tensor_floats.push_back(std::size_t(m_layers.front().get().input_size)*max_batch);
+   for (Layer& layer : m_layers)
+   {
+      const std::size_t floats = std::size_t(layer.output_size)*max_batch;
+      plan.peak_floats = std::max(plan.peak_floats, plan.tensor_floats.back() + floats);
+      // updatable layers keep their pre-activation as well, the rest replace their input
+      if (layer.isUpdatable()) plan.training_floats += 2*floats;
+      plan.tensor_floats.push_back(floats);
+   }
+   plan.training_floats += plan.tensor_floats.front();
+   return plan;
+}
+
+MemoryPlan NNet::planTraining(unsigned batch) const
+{
+   // the same steps as backPropagate, with each tensor alive from the step making it to the
+   // last one reading it
+   vector<TensorLifetime> tensors;
+   unsigned step = 0;
+   auto make = [&tensors, &step, batch](int size) {
+      tensors.push_back(TensorLifetime{std::size_t(size)*batch, step, step});
+      return tensors.size() - 1;
+   };
+   auto use = [&tensors, &step](std::size_t tensor) { tensors[tensor].last_use = step; };
+
+   const unsigned segment = m_checkpoint_segment ? m_checkpoint_segment : m_updatable_layers.size();
+   const vector<unsigned> bounds = segment_bounds(m_layers, segment);
+   const unsigned segments = bounds.size() - 1;
+
+   // forwardSegment, returning its output and keeping {activations, preactivations} when `keep`
+   auto forward = [&](std::size_t input, unsigned first, unsigned last, bool keep,
+                      vector<std::size_t>& activations, vector<std::size_t>& preactivations) {
+      std::size_t a_l = input;
+      if (keep) activations.push_back(input);
+      for (unsigned i = first; i < last; i++)
+      {
+         Layer& layer = m_layers[i];
+         step++;
+         use(a_l);
+         if (layer.isUpdatable())
+         {
+            const std::size_t preactivation = make(layer.output_size);
+            if (keep) preactivations.push_back(preactivation);
+         }
+         const std::size_t output = make(layer.output_size);
+         // a replaced or dropped activation isn't needed past this step
+         if (keep && layer.isUpdatable()) activations.push_back(output);
+         else if (keep) activations.back() = output;
+         a_l = output;
+      }
+      return a_l;
+   };
+
+   vector<std::size_t> checkpoints{make(m_layers.front().get().input_size)};
+   vector<std::size_t> unused;
+   for (unsigned s = 0; s + 1 < segments; s++)
+   {
+      checkpoints.push_back(forward(checkpoints.back(), bounds[s], bounds[s + 1], false, unused, unused));
+   }
+
+   vector<std::size_t> activations;
+   vector<std::size_t> preactivations;
+   forward(checkpoints.back(), bounds[segments - 1], bounds[segments], true, activations, preactivations);
+
+   step++;
+   use(activations.back());
+   std::size_t delta = make(m_layers.back().get().output_size);
+
+   for (int s = segments - 1; s >= 0; s--)
    {
-      delta = m_updatable_layers.at(i).get().updateWeightsAndBiasesGradients(preactivations[i], activations[i], delta);
+      if (s < static_cast<int>(segments) - 1)
+      {
+         activations.clear();
+         preactivations.clear();
+         forward(checkpoints[s], bounds[s], bounds[s + 1], true, activations, preactivations);
+      }
+      step++;
+      use(checkpoints[s]);
+      checkpoints.pop_back();
+
+      for (int i = preactivations.size() - 1; i >= 0; i--)
+      {
+         step++;
+         use(preactivations[i]);
+         use(activations[i]);
+         use(delta);
+         delta = make(m_updatable_layers.at(s*segment + i).get().input_size);
+      }
    }
-   
+   return plan_memory(tensors);
 }
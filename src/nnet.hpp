@@ -4,7 +4,32 @@
 #include "parallelMat.hpp"
 #include <vector>
 #include <functional>
+#include <memory>
+#include <string>
 #include "layer.hpp"
+#include "memoryPlan.hpp"
+#include "profiler.hpp"
+
+// how far the outputs of a quantized net moved from its float ones, over a set of inputs
+struct QuantizationReport
+{
+   float max_abs_error = 0.f;
+   float mean_abs_error = 0.f;
+   // mean magnitude of the float outputs, to put the errors in scale
+   float mean_abs_output = 0.f;
+};
+
+// sizes of the intermediate tensors of a net over batches of up to `max_batch` inputs
+struct ForwardPlan
+{
+   unsigned max_batch = 0;
+   // floats of the input and of each layer's output over the whole batch
+   std::vector<std::size_t> tensor_floats;
+   // the two largest consecutive tensors, all a forward pass keeps alive at once
+   std::size_t peak_floats = 0;
+   // the activations and pre-activations `backPropagate` keeps for the backward pass
+   std::size_t training_floats = 0;
+};
 
 class NNet {
 public:
@@ -17,18 +42,84 @@ public:
 private:
    std::vector<std::reference_wrapper<Layer>> m_layers;
    std::vector<std::reference_wrapper<UpdatableLayer>> m_updatable_layers;
-   
+   // set when the net made its layers itself, copies of it share them
+   std::vector<std::shared_ptr<Layer>> m_owned_layers;
+   // updatable layers per segment of the backward pass, 0 when every activation is kept
+   unsigned m_checkpoint_segment = 0;
+   PhaseProfiler* m_profiler = nullptr;
+
+   // `backPropagate` on the current device
+   void backPropagateOnDevice(const ParallelMat& inputs, const ParallelMat& desired_outputs) const;
+   // `m_layers` from `first` up to `last` on `input`. With `activations` and `preactivations`
+   // it keeps what the backward pass needs: the input, then the pre-activation and the
+   // activation of each updatable layer, with the layers in between applied to the latter
+   ParallelMat forwardSegment(const ParallelMat& input, unsigned first, unsigned last,
+                              std::vector<ParallelMat>* activations, std::vector<ParallelMat>* preactivations) const;
+
 public:
    NNet(const std::vector<std::reference_wrapper<Layer>>& layers);
+   // a net owning its layers
+   NNet(std::vector<std::unique_ptr<Layer>> layers);
+
+   // builds the layers from a text description, see architecture.hpp
+   static NNet fromArchitecture(const std::string& architecture);
+   // the net a checkpoint was saved from, with its parameters and optimizer state
+   static NNet fromCheckpoint(const std::string& path, bool verify_checksum = true);
 
    std::vector<Mat> compute(const std::vector<Mat>& inputs) const;
+   ParallelMat compute(const ParallelMat& inputs) const;
    Mat compute(const Mat& input) const;
 
    // adds to the weightgrad and biasgrad update terms in each layer. A call to
-   // `applyWeightsAndBiasesGradients` is required in order to apply these gradients
+   // `applyWeightsAndBiasesGradients` is required in order to apply these gradients.
+   // With several OpenCL devices the batch is split between them and each slice's
+   // gradients are summed into the same terms
    void backPropagate(const std::vector<Mat>& inputs, const std::vector<Mat>& desired_outputs) const;
+   void backPropagate(const ParallelMat& inputs, const ParallelMat& desired_outputs) const;
 
    void applyWeightsAndBiasesGradients(float learning_rate);
+
+   // the optimizer every layer applies its gradients with, see OptimizerSettings
+   void setOptimizer(const OptimizerSettings& settings);
+
+   // weights of `compute` in 16 bit storage (see StoragePrecision), or back to float. Drops any
+   // int8 weights from `quantize`
+   void setInferencePrecision(StoragePrecision precision);
+
+   // post-training int8 quantization of the weighted layers' `compute`. The range of each
+   // layer's inputs is calibrated over `calibration` in float, then the outputs of the int8
+   // net are compared with the float ones over `validation`. Fold any LayerBatchNormalize
+   // into its layer first, quantization uses the weights as they are when it's called
+   QuantizationReport quantize(const std::vector<Mat>& calibration, const std::vector<Mat>& validation);
+
+   // every layer's `describe()`, one per line
+   std::string architecture() const;
+
+   ForwardPlan planForward(unsigned max_batch) const;
+
+   // gradient checkpointing: `backPropagate` only keeps the inputs of every `segment_layers`
+   // updatable layers through the forward pass, and recomputes the activations in between
+   // one segment at a time on the way back. About sqrt(updatable layers) trades one extra
+   // forward pass for memory growing with the square root of the depth. 0 turns it off
+   void setGradientCheckpointing(unsigned segment_layers) { m_checkpoint_segment = segment_layers; }
+
+   // estimates the memory of the activations, pre-activations and deltas of a training step
+   // over `batch` inputs, were they laid out in one arena that reuses memory once a tensor is
+   // no longer needed. The layers still allocate their own outputs, so this is the floor a
+   // training step could get down to. Follows the current gradient checkpointing.
+   // Temporaries inside the layers aren't included
+   MemoryPlan planTraining(unsigned batch) const;
+
+   // splits the time `backPropagate` takes between PHASE_FORWARD and PHASE_BACKWARD of
+   // `profiler`, nullptr stops
+   void setProfiler(PhaseProfiler* profiler) { m_profiler = profiler; }
+
+   // the parameters and optimizer state of every layer into a binary checkpoint, see checkpoint.hpp
+   void save(const std::string& path) const;
+   // reads a checkpoint written by `save` from a net of the same architecture, uploading
+   // the tensors straight from the mapped file. Throws std::runtime_error if the file is
+   // corrupt or was saved from a different architecture
+   void load(const std::string& path, bool verify_checksum = true);
 };
 
 
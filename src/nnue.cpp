@@ -0,0 +1,147 @@
+#include "nnue.hpp"
+#include "board.hpp"
+#include "layerFullyConnected.hpp"
+#include "cpuKernels.hpp"
+#include <algorithm>
+#include <cmath>
+
+int nnue_feature(Color perspective, int king_square, const Piece& piece, int square)
+{
+   if (perspective == BLACK)
+   {
+      king_square ^= 56;
+      square ^= 56;
+   }
+
+   int type = 0;
+   switch (piece.type)
+   {
+   case PAWN:   type = 0; break;
+   case KNIGHT: type = 1; break;
+   case BISHOP: type = 2; break;
+   case ROOK:   type = 3; break;
+   case QUEEN:  type = 4; break;
+   case KING:   assert(false); break;
+   }
+   const int piece_index = 2*type + (piece.color == perspective ? 0 : 1);
+   return (king_square*10 + piece_index)*64 + square;
+}
+
+Mat nnue_input(const Board& board)
+{
+   std::vector<float> vals(NNUE_FEATURES, 0.f);
+   for (int feature : board.nnueFeatures(board.currentPlayer()))
+   {
+      vals[feature] = 1.f;
+   }
+   return Mat(NNUE_FEATURES, 1, std::move(vals));
+}
+
+Nnue::Nnue(const std::vector<std::reference_wrapper<const LayerFullyConnected>>& layers, const std::vector<Board>& calibration)
+{
+   assert(layers.size() >= 2);
+   const LayerFullyConnected& features = layers.front();
+   assert(features.input_size == NNUE_FEATURES && features.output_size <= NNUE_MAX_WIDTH);
+   assert(features.activationFunction() == RELU);
+   assert(layers.back().get().output_size == 1);
+   m_width = features.output_size;
+
+   // the largest input each layer after the first sees, the accumulator's range for the first
+   std::vector<float> input_ranges;
+   std::vector<Mat> inputs;
+   for (const Board& board : calibration) inputs.push_back(nnue_input(board));
+   auto a_l = ParallelMat{inputs};
+   for (size_t i = 0; i + 1 < layers.size(); i++)
+   {
+      a_l = layers[i].get().compute(a_l);
+      float absmax = 0.f;
+      for (float val : a_l.getVals()) absmax = std::max(absmax, std::fabs(val));
+      input_ranges.push_back(absmax > 0.f ? absmax : 1.f);
+   }
+
+   // the accumulator counts in steps of the first layer's range over 127, so its RELU can be
+   // clamped straight to the int8 input of the next layer. Transposed so each feature's
+   // weights are one row to add
+   m_accumulator_scale = 127.f / input_ranges.front();
+   auto to_int16 = [this](float val) {
+      return static_cast<std::int16_t>(std::clamp(std::nearbyint(val*m_accumulator_scale), -32767.f, 32767.f));
+   };
+   const std::vector<float> weights = features.getWeights().getVals();
+   const std::vector<float> biases = features.getBiases().getVals();
+   m_feature_weights.resize(static_cast<size_t>(NNUE_FEATURES)*m_width);
+   for (unsigned out = 0; out < m_width; out++)
+   {
+      for (int feature = 0; feature < NNUE_FEATURES; feature++)
+      {
+         m_feature_weights[static_cast<size_t>(feature)*m_width + out] = to_int16(weights[static_cast<size_t>(out)*NNUE_FEATURES + feature]);
+      }
+   }
+   m_feature_biases.resize(m_width);
+   std::transform(biases.begin(), biases.end(), m_feature_biases.begin(), to_int16);
+
+   for (size_t i = 1; i < layers.size(); i++)
+   {
+      const LayerFullyConnected& layer = layers[i];
+      assert(layer.input_size == layers[i - 1].get().output_size && layer.output_size <= NNUE_MAX_WIDTH);
+      DenseLayer dense;
+      dense.outputs = layer.output_size;
+      dense.inputs = layer.input_size;
+      dense.input_scale = input_ranges[i - 1] / 127.f;
+      dense.activation = layer.activationFunction();
+      dense.weights.resize(dense.outputs*dense.inputs);
+      dense.scales.resize(dense.outputs);
+      const std::vector<float> layer_weights = layer.getWeights().getVals();
+      cpu_quantize_rows_int8(layer_weights.data(), dense.weights.data(), dense.scales.data(), dense.outputs, dense.inputs);
+      dense.biases = layer.getBiases().getVals();
+      m_layers.push_back(std::move(dense));
+   }
+}
+
+void Nnue::refresh(NnueAccumulator& accumulator, Color perspective, const std::vector<int>& features) const
+{
+   accumulator.values.resize(2*m_width);
+   std::int16_t* half = accumulator.values.data() + (perspective == WHITE ? 0 : m_width);
+   cpu_update_int16_rows(m_feature_biases.data(), half, m_feature_weights.data(), m_width, features.data(), features.size(), nullptr, 0);
+}
+
+void Nnue::update(const NnueAccumulator& from, NnueAccumulator& to, Color perspective,
+                  const int* added, int n_added, const int* removed, int n_removed) const
+{
+   to.values.resize(2*m_width);
+   const size_t offset = (perspective == WHITE ? 0 : m_width);
+   cpu_update_int16_rows(from.values.data() + offset, to.values.data() + offset, m_feature_weights.data(), m_width,
+                         added, n_added, removed, n_removed);
+}
+
+float Nnue::evaluate(const NnueAccumulator& accumulator, Color side_to_move) const
+{
+   alignas(64) std::int8_t quantized[NNUE_MAX_WIDTH];
+   alignas(64) float outputs[NNUE_MAX_WIDTH];
+
+   const std::int16_t* half = accumulator.values.data() + (side_to_move == WHITE ? 0 : m_width);
+   for (unsigned i = 0; i < m_width; i++)
+   {
+      quantized[i] = static_cast<std::int8_t>(std::clamp<std::int16_t>(half[i], 0, 127));
+   }
+
+   for (size_t i = 0; i < m_layers.size(); i++)
+   {
+      const DenseLayer& layer = m_layers[i];
+      cpu_int8_matmul(layer.weights.data(), layer.scales.data(), quantized, outputs, layer.input_scale, layer.outputs, layer.inputs, 1, 1);
+      for (int out = 0; out < layer.outputs; out++)
+      {
+         const float val = outputs[out] + layer.biases[out];
+         switch (layer.activation)
+         {
+         case RELU:    outputs[out] = std::max(val, 0.f); break;
+         case SIGMOID: outputs[out] = 1.f / (1.f + std::exp(-val)); break;
+         case LINEAR:  outputs[out] = val; break;
+         }
+      }
+      if (i + 1 < m_layers.size())
+      {
+         cpu_quantize_int8(outputs, quantized, m_layers[i + 1].input_scale, layer.outputs, 1, 1);
+      }
+   }
+   return outputs[0];
+}
@@ -0,0 +1,64 @@
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <vector>
+#include "piece.hpp"
+#include "layer.hpp"
+#include "nnueAccumulator.hpp"
+
+class Board;
+class LayerFullyConnected;
+
+// HalfKP inputs: one feature per (own king square, piece, square) for the 10 kinds of non-king
+// piece, seen from one side. Black's view is flipped vertically so both sides see their own
+// pieces from the bottom of the board. Squares are 8*row + col
+constexpr int NNUE_FEATURES = 64*10*64;
+constexpr int NNUE_MAX_WIDTH = 1024;
+
+int nnue_feature(Color perspective, int king_square, const Piece& piece, int square);
+
+// an efficiently updatable network for alpha-beta search: a sparse first layer over the HalfKP
+// features of the side to move, kept as an int16 accumulator that Board updates a move at a
+// time, followed by small int8 dense layers. Only the dense layers run for each evaluation
+class Nnue
+{
+public:
+   // quantized from a net trained in float on `nnue_input`s: NNUE_FEATURES inputs into a RELU
+   // layer of at most NNUE_MAX_WIDTH outputs, then any dense layers down to a single output.
+   // The range of each layer's inputs is calibrated on the positions in `calibration`
+   Nnue(const std::vector<std::reference_wrapper<const LayerFullyConnected>>& layers, const std::vector<Board>& calibration);
+
+   unsigned width() const { return m_width; }
+
+   // `perspective`'s half of `accumulator` from scratch, out of all its active `features`
+   void refresh(NnueAccumulator& accumulator, Color perspective, const std::vector<int>& features) const;
+   // `perspective`'s half of `to` as `from` with some features turned on and some off
+   void update(const NnueAccumulator& from, NnueAccumulator& to, Color perspective,
+               const int* added, int n_added, const int* removed, int n_removed) const;
+
+   float evaluate(const NnueAccumulator& accumulator, Color side_to_move) const;
+
+private:
+   struct DenseLayer
+   {
+      std::vector<std::int8_t> weights;
+      std::vector<float> scales;
+      std::vector<float> biases;
+      int outputs;
+      int inputs;
+      // the int8 step of this layer's inputs
+      float input_scale;
+      ActivationFunction activation;
+   };
+
+   unsigned m_width;
+   // [NNUE_FEATURES][m_width] first layer weights and its biases, in steps of 1/m_accumulator_scale
+   std::vector<std::int16_t> m_feature_weights;
+   std::vector<std::int16_t> m_feature_biases;
+   float m_accumulator_scale;
+   std::vector<DenseLayer> m_layers;
+};
+
+// the training input for the float net, the side to move's features as a one-hot column
+Mat nnue_input(const Board& board);
@@ -0,0 +1,11 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+// first layer outputs of an Nnue for both perspectives, [perspective][width], before the
+// activation. Kept apart from nnue.hpp so Board can hold them without the NN headers
+struct NnueAccumulator
+{
+   std::vector<std::int16_t> values;
+};
@@ -2,10 +2,29 @@
 #include "errors.hpp"
 #include <fstream>
 #include <iostream>
+#include <filesystem>
+#include <cstdlib>
+#include <cstdint>
+#include <sstream>
+#include <iomanip>
+#include <unistd.h>
+#include <algorithm>
+
+// every kernel in src/kernels, embedded as string literals by the Makefile
+static const char* const kernel_sources[] = {
+#include "kernels.inc"
+};
 
 bool ocl_setup = false;
 cl::Context ocl_context;
 cl::CommandQueue ocl_queue;
+cl::CommandQueue ocl_transfer_queue;
+std::vector<cl::Device> ocl_devices;
+std::vector<cl::CommandQueue> ocl_device_queues;
+std::vector<cl::CommandQueue> ocl_device_transfer_queues;
+bool ocl_host_unified_memory = false;
+unsigned ocl_mem_base_addr_align = 0;
+bool ocl_fp16 = false;
 cl::Kernel matmul_kernel;
 cl::Kernel multiple_multi_matmul_kernel;
 cl::Kernel multiple_matmul_kernel;
@@ -41,65 +60,276 @@ cl::Kernel parallel_convolution_kernel;
 cl::Kernel rotate_conv_kernel;
 cl::Kernel pad_kernel;
 cl::Kernel parallel_pad_kernel;
-cl::Kernel transpose_conv_kernel;
 cl::Kernel parallel_transpose_conv_kernel;
+cl::Kernel parallel_conv_weight_gradient_kernel;
+cl::Kernel tiled_matmul_kernel;
+cl::Kernel parallel_im2col_kernel;
+cl::Kernel winograd_weights_kernel;
+cl::Kernel winograd_input_kernel;
+cl::Kernel winograd_output_kernel;
+cl::Kernel pack_conv_weights_nhwc4_kernel;
+cl::Kernel parallel_pad_nhwc4_kernel;
+cl::Kernel parallel_convolution_nhwc4_kernel;
+cl::Kernel batch_norm_stats_kernel;
+cl::Kernel batch_norm_kernel;
+cl::Kernel batch_norm_grads_kernel;
+cl::Kernel batch_norm_backward_kernel;
+cl::Kernel to_half_kernel;
+cl::Kernel from_half_kernel;
+cl::Kernel tiled_matmul_half_kernel;
+cl::Kernel parallel_im2col_half_kernel;
+cl::Kernel quantize_int8_kernel;
+cl::Kernel parallel_im2col_int8_kernel;
+cl::Kernel int8_matmul_kernel;
+cl::Kernel optimizer_step_kernel;
+cl::Kernel tiled_matmul_tn_acc_kernel;
+cl::Kernel permute_selected_kernel;
+
+static uint64_t fnv1a(const std::string& data, uint64_t hash = 14695981039346656037ull)
+{
+   for (unsigned char c : data)
+   {
+      hash ^= c;
+      hash *= 1099511628211ull;
+   }
+   return hash;
+}
+
+// $CHESS_KERNEL_CACHE, otherwise the user's cache directory
+static std::filesystem::path kernelCacheDir()
+{
+   if (const char* dir = std::getenv("CHESS_KERNEL_CACHE")) return dir;
+   if (const char* dir = std::getenv("XDG_CACHE_HOME")) return std::filesystem::path(dir) / "chess";
+   if (const char* dir = std::getenv("HOME")) return std::filesystem::path(dir) / ".cache" / "chess";
+   return {};
+}
+
+// a device binary is only valid for the exact device, driver and source it was built from
+static std::filesystem::path kernelCachePath(const cl::Device& device, const std::string& source)
+{
+   std::filesystem::path dir = kernelCacheDir();
+   if (dir.empty()) return {};
+
+   std::string device_name = device.getInfo<CL_DEVICE_NAME>();
+   std::string device_version = device.getInfo<CL_DEVICE_VERSION>();
+   std::string driver_version = device.getInfo<CL_DRIVER_VERSION>();
+
+   uint64_t hash = fnv1a(source);
+   hash = fnv1a(device_name, hash);
+   hash = fnv1a(device_version, hash);
+   hash = fnv1a(driver_version, hash);
+
+   std::stringstream name;
+   name << std::hex << std::setw(16) << std::setfill('0') << hash << ".bin";
+   return dir / name.str();
+}
 
-void ocl_init()
+// loads the program from cached device binaries when every device has one,
+// otherwise compiles the embedded sources and caches the result
+static cl::Program buildProgram(const std::vector<cl::Device>& devices)
 {
+   std::string source;
+   for (const char* kernel_source : kernel_sources)
+   {
+      source += kernel_source;
+      source += '\n';
+   }
+
+   std::vector<std::filesystem::path> cache_paths;
+   cl::Program::Binaries binaries;
+   for (const cl::Device& device : devices)
+   {
+      cache_paths.push_back(kernelCachePath(device, source));
+      std::ifstream cached(cache_paths.back(), std::ios::binary);
+      if (not cached) continue;
+      binaries.push_back(std::vector<unsigned char>(std::istreambuf_iterator<char>(cached), (std::istreambuf_iterator<char>())));
+   }
+
+   if (binaries.size() == devices.size())
+   {
+      try {
+         cl::Program program(ocl_context, devices, binaries);
+         program.build(devices);
+         return program;
+      }
+      catch(cl::Error& err) {
+         // stale or corrupt cache entry, rebuild it from source
+         std::cout << "Discarding cached kernels: " << err.what() << "(" << getErrorString(err.err()) << ")" << std::endl;
+      }
+   }
+
+   cl::Program program(ocl_context, source);
    try {
-   unsigned int platform_id=0, device_id=0;
+      program.build(devices);
+   }
+   catch(cl::Error& err) {
+      for (const cl::Device& device : devices)
+      {
+         std::string log = program.getBuildInfo<CL_PROGRAM_BUILD_LOG>(device);
+         std::cout << log << std::endl;
+      }
+      throw;
+   }
+
+   std::vector<std::vector<unsigned char>> built = program.getInfo<CL_PROGRAM_BINARIES>();
+   for (unsigned i = 0; i < devices.size() && i < built.size(); i++)
+   {
+      if (cache_paths[i].empty() || built[i].empty()) continue;
+
+      // written under a temporary name first so concurrent starts never read a partial file
+      std::error_code ec;
+      std::filesystem::create_directories(cache_paths[i].parent_path(), ec);
+      std::filesystem::path tmp_path = cache_paths[i];
+      tmp_path += ".tmp" + std::to_string(getpid());
+      {
+         std::ofstream out(tmp_path, std::ios::binary);
+         out.write(reinterpret_cast<const char*>(built[i].data()), built[i].size());
+         if (not out) continue;
+      }
+      std::filesystem::rename(tmp_path, cache_paths[i], ec);
+   }
+
+   return program;
+}
+
+static OclDeviceSelection selectionFromEnvironment()
+{
+   OclDeviceSelection selection;
+   if (const char* platform = std::getenv("CHESS_OCL_PLATFORM")) selection.platform = std::stoul(platform);
+   if (const char* partitions = std::getenv("CHESS_OCL_CPU_PARTITIONS")) selection.cpu_partitions = std::stoul(partitions);
+   if (const char* devices = std::getenv("CHESS_OCL_DEVICES"))
+   {
+      selection.devices.clear();
+      std::stringstream list(devices);
+      std::string index;
+      while (std::getline(list, index, ','))
+      {
+         if (index == "all") { selection.devices.clear(); break; }
+         selection.devices.push_back(std::stoul(index));
+      }
+   }
+   return selection;
+}
+
+void ocl_init(QueueMode mode)
+{
+   ocl_init(selectionFromEnvironment(), mode);
+}
+
+std::vector<std::string> ocl_list_devices()
+{
+   std::vector<std::string> descriptions;
    std::vector<cl::Platform> platforms;
    cl::Platform::get(&platforms);
-   std::vector<cl::Device> devices;
-   platforms[platform_id].getDevices(CL_DEVICE_TYPE_GPU|CL_DEVICE_TYPE_CPU, &devices);
-   ocl_context = cl::Context(devices);
-   ocl_queue = cl::CommandQueue( ocl_context, devices[device_id] );
-   std::vector<std::string> sourcePaths = {
-      "kernels/matmul.cl",
-      "kernels/multiple_matmul.cl",
-      "kernels/multiple_add.cl",
-      "kernels/multiple_dot.cl",
-      "kernels/multiple_sum.cl",
-      "kernels/multiple_transpose.cl",
-      "kernels/multiple_multi_matmul.cl",
-      "kernels/transpose.cl",
-      "kernels/div_float.cl",
-      "kernels/mul_float.cl",
-      "kernels/add_float.cl",
-      "kernels/sub_float.cl",
-      "kernels/div_float_eq.cl",
-      "kernels/mul_float_eq.cl",
-      "kernels/add_float_eq.cl",
-      "kernels/sub_float_eq.cl",
-      "kernels/add_mat.cl",
-      "kernels/sub_mat.cl",
-      "kernels/dot_mat.cl",
-      "kernels/add_mat_eq.cl",
-      "kernels/sub_mat_eq.cl",
-      "kernels/dot_mat_eq.cl",
-      "kernels/relu.cl",
-      "kernels/relu_inv.cl",
-      "kernels/sigmoid.cl",
-      "kernels/sigmoid_inv.cl",
-      "kernels/binary_CEL.cl",
-      "kernels/binary_CEL_derivative.cl",
-      "kernels/log.cl",
-      "kernels/exp.cl",
-      "kernels/convolution.cl",
-      "kernels/parallel_convolution.cl",
-      "kernels/rotate_conv.cl",
-      "kernels/pad.cl",
-      "kernels/parallel_pad.cl",
-      "kernels/transpose_convolution.cl",
-      "kernels/parallel_transpose_convolution.cl"
-   };
-   cl::Program::Sources sources;
-   for (auto& path : sourcePaths) {
-      std::ifstream sourceFile(path);
-      sources.push_back(std::string(std::istreambuf_iterator<char>(sourceFile), (std::istreambuf_iterator<char>())));
-   }
-   cl::Program program=cl::Program(ocl_context, sources);
-   program.build(devices);
+   for (unsigned platform_id = 0; platform_id < platforms.size(); platform_id++)
+   {
+      std::vector<cl::Device> devices;
+      platforms[platform_id].getDevices(CL_DEVICE_TYPE_GPU|CL_DEVICE_TYPE_CPU, &devices);
+      for (unsigned device_id = 0; device_id < devices.size(); device_id++)
+      {
+         std::string name = devices[device_id].getInfo<CL_DEVICE_NAME>();
+         cl_uint compute_units = devices[device_id].getInfo<CL_DEVICE_MAX_COMPUTE_UNITS>();
+         descriptions.push_back(std::to_string(platform_id) + ":" + std::to_string(device_id) + " " + name + " (" + std::to_string(compute_units) + " compute units)");
+      }
+   }
+   return descriptions;
+}
+
+void ocl_join_devices()
+{
+   std::vector<cl::Event> markers;
+   for (unsigned i = 1; i < ocl_device_queues.size(); i++)
+   {
+      cl::Event marker;
+      ocl_device_queues[i].enqueueMarkerWithWaitList(nullptr, &marker);
+      ocl_device_queues[i].flush();
+      markers.push_back(marker);
+   }
+   if (markers.empty()) return;
+   ocl_device_queues[0].enqueueBarrierWithWaitList(&markers);
+}
+
+void ocl_finish()
+{
+   try {
+      for (cl::CommandQueue& queue : ocl_device_queues) queue.finish();
+      for (cl::CommandQueue& queue : ocl_device_transfer_queues) queue.finish();
+   }
+   catch(cl::Error& err) {
+      std::cout << "Error in finish: " << err.what() << "(" << getErrorString(err.err()) << ")" << std::endl;
+   }
+}
+
+OclDeviceScope::OclDeviceScope(unsigned index)
+   :m_previous_queue{ocl_queue}
+   ,m_previous_transfer_queue{ocl_transfer_queue}
+{
+   ocl_queue = ocl_device_queues.at(index);
+   ocl_transfer_queue = ocl_device_transfer_queues.at(index);
+}
+
+OclDeviceScope::~OclDeviceScope()
+{
+   // whatever went to this device has to actually start before others wait on it
+   ocl_queue.flush();
+   ocl_queue = m_previous_queue;
+   ocl_transfer_queue = m_previous_transfer_queue;
+}
+
+void ocl_init(const OclDeviceSelection& selection, QueueMode mode)
+{
+   try {
+   std::vector<cl::Platform> platforms;
+   cl::Platform::get(&platforms);
+   std::vector<cl::Device> platform_devices;
+   platforms.at(selection.platform).getDevices(CL_DEVICE_TYPE_GPU|CL_DEVICE_TYPE_CPU, &platform_devices);
+
+   ocl_devices.clear();
+   for (unsigned i = 0; i < platform_devices.size(); i++)
+   {
+      bool selected = selection.devices.empty() || std::find(selection.devices.begin(), selection.devices.end(), i) != selection.devices.end();
+      if (not selected) continue;
+
+      cl::Device& device = platform_devices[i];
+      cl_device_type device_type = device.getInfo<CL_DEVICE_TYPE>();
+      if (selection.cpu_partitions > 1 && device_type == CL_DEVICE_TYPE_CPU)
+      {
+         cl_uint compute_units = device.getInfo<CL_DEVICE_MAX_COMPUTE_UNITS>();
+         cl_device_partition_property properties[] = {
+            CL_DEVICE_PARTITION_EQUALLY,
+            static_cast<cl_device_partition_property>(std::max(1u, compute_units / selection.cpu_partitions)),
+            0
+         };
+         std::vector<cl::Device> sub_devices;
+         device.createSubDevices(properties, &sub_devices);
+         ocl_devices.insert(ocl_devices.end(), sub_devices.begin(), sub_devices.end());
+      }
+      else ocl_devices.push_back(device);
+   }
+
+   ocl_context = cl::Context(ocl_devices);
+   ocl_device_queues.clear();
+   ocl_device_transfer_queues.clear();
+   ocl_host_unified_memory = true;
+   ocl_mem_base_addr_align = 0;
+   ocl_fp16 = true;
+   for (const cl::Device& device : ocl_devices)
+   {
+      ocl_device_queues.push_back(cl::CommandQueue( ocl_context, device ));
+      ocl_device_transfer_queues.push_back(mode == MULTI_QUEUE ? cl::CommandQueue( ocl_context, device ) : ocl_device_queues.back());
+
+      cl_device_type device_type = device.getInfo<CL_DEVICE_TYPE>();
+      cl_bool unified = device.getInfo<CL_DEVICE_HOST_UNIFIED_MEMORY>();
+      ocl_host_unified_memory = ocl_host_unified_memory && ((device_type == CL_DEVICE_TYPE_CPU) || unified);
+      cl_uint align_bits = device.getInfo<CL_DEVICE_MEM_BASE_ADDR_ALIGN>();
+      ocl_mem_base_addr_align = std::max(ocl_mem_base_addr_align, align_bits / 8);
+      std::string extensions = device.getInfo<CL_DEVICE_EXTENSIONS>();
+      ocl_fp16 = ocl_fp16 && extensions.find("cl_khr_fp16") != std::string::npos;
+   }
+   ocl_queue = ocl_device_queues.front();
+   ocl_transfer_queue = ocl_device_transfer_queues.front();
+
+   cl::Program program = buildProgram(ocl_devices);
 
    matmul_kernel                    = cl::Kernel(program, "matmul");
    multiple_multi_matmul_kernel     = cl::Kernel(program, "multiple_multi_matmul");
@@ -136,8 +366,30 @@ void ocl_init()
    rotate_conv_kernel               = cl::Kernel(program, "rotate_conv");
    pad_kernel                       = cl::Kernel(program, "pad");
    parallel_pad_kernel              = cl::Kernel(program, "parallel_pad");
-   transpose_conv_kernel            = cl::Kernel(program, "transpose_convolution");
    parallel_transpose_conv_kernel   = cl::Kernel(program, "parallel_transpose_convolution");
+   parallel_conv_weight_gradient_kernel = cl::Kernel(program, "parallel_conv_weight_gradient");
+   tiled_matmul_kernel              = cl::Kernel(program, "tiled_matmul");
+   parallel_im2col_kernel           = cl::Kernel(program, "parallel_im2col");
+   winograd_weights_kernel          = cl::Kernel(program, "winograd_weights");
+   winograd_input_kernel            = cl::Kernel(program, "winograd_input");
+   winograd_output_kernel           = cl::Kernel(program, "winograd_output");
+   pack_conv_weights_nhwc4_kernel   = cl::Kernel(program, "pack_conv_weights_nhwc4");
+   parallel_pad_nhwc4_kernel        = cl::Kernel(program, "parallel_pad_nhwc4");
+   parallel_convolution_nhwc4_kernel = cl::Kernel(program, "parallel_convolution_nhwc4");
+   batch_norm_stats_kernel          = cl::Kernel(program, "batch_norm_stats");
+   batch_norm_kernel                = cl::Kernel(program, "batch_norm");
+   batch_norm_grads_kernel          = cl::Kernel(program, "batch_norm_grads");
+   batch_norm_backward_kernel       = cl::Kernel(program, "batch_norm_backward");
+   to_half_kernel                   = cl::Kernel(program, "to_half");
+   from_half_kernel                 = cl::Kernel(program, "from_half");
+   tiled_matmul_half_kernel         = cl::Kernel(program, "tiled_matmul_half");
+   parallel_im2col_half_kernel      = cl::Kernel(program, "parallel_im2col_half");
+   quantize_int8_kernel             = cl::Kernel(program, "quantize_int8");
+   parallel_im2col_int8_kernel      = cl::Kernel(program, "parallel_im2col_int8");
+   int8_matmul_kernel               = cl::Kernel(program, "int8_matmul");
+   optimizer_step_kernel            = cl::Kernel(program, "optimizer_step");
+   tiled_matmul_tn_acc_kernel       = cl::Kernel(program, "tiled_matmul_tn_acc");
+   permute_selected_kernel          = cl::Kernel(program, "permute_selected");
 
    ocl_queue.finish();
 
@@ -146,4 +398,68 @@ void ocl_init()
    catch(cl::Error& err) {
       std::cout << "Error in setup: " << err.what() << "(" << getErrorString(err.err()) << ")" << std::endl;
    }
+}
+
+std::vector<cl::Event> ocl_wait_list(std::initializer_list<cl::Event> events)
+{
+   std::vector<cl::Event> wait_list;
+   for (const cl::Event& event : events)
+   {
+      if (event() != nullptr) wait_list.push_back(event);
+   }
+   return wait_list;
+}
+
+template <class T>
+static cl::Event upload(const cl::Buffer& buffer, std::vector<T>&& vals)
+{
+   cl::Event event;
+   if (vals.empty()) return event;
+
+   auto staging = new std::vector<T>(std::move(vals));
+   try {
+      ocl_transfer_queue.enqueueWriteBuffer( buffer, CL_FALSE, 0, staging->size()*sizeof(T), staging->data(), nullptr, &event );
+      event.setCallback(CL_COMPLETE, [](cl_event, cl_int, void* data) {
+         delete static_cast<std::vector<T>*>(data);
+      }, staging);
+      ocl_transfer_queue.flush();
+   }
+   catch(cl::Error& err) {
+      delete staging;
+      std::cout << "Error in upload: " << err.what() << "(" << getErrorString(err.err()) << ")" << std::endl;
+   }
+   return event;
+}
+
+cl::Event ocl_upload(const cl::Buffer& buffer, std::vector<float>&& vals)
+{
+   return upload(buffer, std::move(vals));
+}
+
+cl::Event ocl_upload(const cl::Buffer& buffer, std::vector<std::uint16_t>&& vals)
+{
+   return upload(buffer, std::move(vals));
+}
+
+cl::Event ocl_upload(const cl::Buffer& buffer, std::vector<std::int8_t>&& vals)
+{
+   return upload(buffer, std::move(vals));
+}
+
+cl::Event ocl_upload(const cl::Buffer& buffer, std::vector<std::int32_t>&& vals)
+{
+   return upload(buffer, std::move(vals));
+}
+
+void ocl_download(const cl::Buffer& buffer, size_t offset, size_t size, void* dst, const std::vector<cl::Event>& deps, cl::Event* event)
+{
+   try {
+      // the transfer queue may be waiting on kernels that haven't been submitted yet
+      ocl_queue.flush();
+      ocl_transfer_queue.enqueueReadBuffer( buffer, (event == nullptr ? CL_TRUE : CL_FALSE), offset, size, dst, &deps, event );
+      if (event != nullptr) ocl_transfer_queue.flush();
+   }
+   catch(cl::Error& err) {
+      std::cout << "Error in download: " << err.what() << "(" << getErrorString(err.err()) << ")" << std::endl;
+   }
 }
\ No newline at end of file
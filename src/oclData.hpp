@@ -3,10 +3,44 @@
 #define CL_HPP_ENABLE_EXCEPTIONS
 #define CL_HPP_TARGET_OPENCL_VERSION 300
 #include <CL/opencl.hpp>
+#include <cstdint>
+
+enum QueueMode
+{
+   IN_ORDER = 0,     // kernels and transfers share one in-order queue
+   MULTI_QUEUE = 1   // uploads and downloads get their own queue so they overlap compute
+};
+
+// which devices `ocl_init` puts in the context. Every selected device gets its own
+// queue, the first one is where work goes outside of an OclDeviceScope
+struct OclDeviceSelection
+{
+   unsigned platform = 0;
+   std::vector<unsigned> devices = {0};   // empty selects every device on the platform
+   unsigned cpu_partitions = 0;           // split each CPU device into this many sub-devices
+};
 
 extern bool ocl_setup;
 extern cl::Context ocl_context;
+
+// kernels are always enqueued on `ocl_queue`, which is in-order, so commands on it
+// never need to wait on each other. Every Mat carries the event of the last command
+// that wrote its buffer - commands only wait on those to order themselves against
+// work on the transfer queue or other devices' queues
 extern cl::CommandQueue ocl_queue;
+extern cl::CommandQueue ocl_transfer_queue;
+
+extern std::vector<cl::Device> ocl_devices;
+extern std::vector<cl::CommandQueue> ocl_device_queues;
+extern std::vector<cl::CommandQueue> ocl_device_transfer_queues;
+
+// true when the device works out of host memory (CPU devices, integrated GPUs), so
+// host-mapped buffers can be used by kernels without any copies
+extern bool ocl_host_unified_memory;
+// alignment in bytes required of a sub-buffer's origin
+extern unsigned ocl_mem_base_addr_align;
+// every device has cl_khr_fp16, so 16 bit storage can be IEEE half rather than bfloat16
+extern bool ocl_fp16;
 extern cl::Kernel matmul_kernel;
 extern cl::Kernel multiple_multi_matmul_kernel;
 extern cl::Kernel multiple_matmul_kernel;
@@ -42,7 +76,70 @@ extern cl::Kernel parallel_convolution_kernel;
 extern cl::Kernel rotate_conv_kernel;
 extern cl::Kernel pad_kernel;
 extern cl::Kernel parallel_pad_kernel;
-extern cl::Kernel transpose_conv_kernel;
 extern cl::Kernel parallel_transpose_conv_kernel;
+extern cl::Kernel parallel_conv_weight_gradient_kernel;
+extern cl::Kernel tiled_matmul_kernel;
+extern cl::Kernel parallel_im2col_kernel;
+extern cl::Kernel winograd_weights_kernel;
+extern cl::Kernel winograd_input_kernel;
+extern cl::Kernel winograd_output_kernel;
+extern cl::Kernel pack_conv_weights_nhwc4_kernel;
+extern cl::Kernel parallel_pad_nhwc4_kernel;
+extern cl::Kernel parallel_convolution_nhwc4_kernel;
+extern cl::Kernel batch_norm_stats_kernel;
+extern cl::Kernel batch_norm_kernel;
+extern cl::Kernel batch_norm_grads_kernel;
+extern cl::Kernel batch_norm_backward_kernel;
+extern cl::Kernel to_half_kernel;
+extern cl::Kernel from_half_kernel;
+extern cl::Kernel tiled_matmul_half_kernel;
+extern cl::Kernel parallel_im2col_half_kernel;
+extern cl::Kernel quantize_int8_kernel;
+extern cl::Kernel parallel_im2col_int8_kernel;
+extern cl::Kernel int8_matmul_kernel;
+extern cl::Kernel optimizer_step_kernel;
+extern cl::Kernel tiled_matmul_tn_acc_kernel;
+extern cl::Kernel permute_selected_kernel;
+
+// takes the device selection from $CHESS_OCL_PLATFORM, $CHESS_OCL_DEVICES (comma
+// separated indices or "all") and $CHESS_OCL_CPU_PARTITIONS, defaulting to the first device
+void ocl_init(QueueMode mode = IN_ORDER);
+void ocl_init(const OclDeviceSelection& selection, QueueMode mode = IN_ORDER);
+
+// "<platform>:<device> <name>" for every OpenCL device on the machine
+std::vector<std::string> ocl_list_devices();
+
+// makes the first device's queue wait for everything enqueued on the others so far
+void ocl_join_devices();
+
+// blocks until every queue of every device has finished what was enqueued on it
+void ocl_finish();
+
+// sends everything enqueued while it's alive to `ocl_devices[index]`
+class OclDeviceScope
+{
+public:
+   explicit OclDeviceScope(unsigned index);
+   ~OclDeviceScope();
+
+   OclDeviceScope(const OclDeviceScope&) = delete;
+   OclDeviceScope& operator=(const OclDeviceScope&) = delete;
+
+private:
+   cl::CommandQueue m_previous_queue;
+   cl::CommandQueue m_previous_transfer_queue;
+};
+
+// wait list made of the events that have actually been set
+std::vector<cl::Event> ocl_wait_list(std::initializer_list<cl::Event> events);
+
+// non-blocking write of `vals` into `buffer`. `vals` is kept alive until the write
+// completes, the returned event tracks it
+cl::Event ocl_upload(const cl::Buffer& buffer, std::vector<float>&& vals);
+cl::Event ocl_upload(const cl::Buffer& buffer, std::vector<std::uint16_t>&& vals);
+cl::Event ocl_upload(const cl::Buffer& buffer, std::vector<std::int8_t>&& vals);
+cl::Event ocl_upload(const cl::Buffer& buffer, std::vector<std::int32_t>&& vals);
 
-void ocl_init();
\ No newline at end of file
+// reads `size` bytes from `offset` into `dst` once `deps` have completed. Blocks
+// unless `event` is given, in which case `dst` must stay alive until it completes
+void ocl_download(const cl::Buffer& buffer, size_t offset, size_t size, void* dst, const std::vector<cl::Event>& deps, cl::Event* event = nullptr);
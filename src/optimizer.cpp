@@ -0,0 +1,102 @@
+#include "optimizer.hpp"
+#include "oclData.hpp"
+#include "errors.hpp"
+#include "cpuKernels.hpp"
+#include "checkpoint.hpp"
+#include <cmath>
+#include <iostream>
+
+void ParameterOptimizer::setSettings(const OptimizerSettings& settings)
+{
+   m_settings = settings;
+   m_first.reset();
+   m_second.reset();
+   m_steps = 0;
+}
+
+void ParameterOptimizer::step(Mat& params, Mat& grads, float learning_rate, float grad_scale)
+{
+   assert(params.getHeight() == grads.getHeight() && params.getWidth() == grads.getWidth());
+
+   const bool adam = m_settings.type == OPTIMIZER_ADAM;
+   const bool uses_first = adam || m_settings.momentum > 0.f;
+   if (uses_first && not m_first) m_first = Mat::zeros(params.getHeight(), params.getWidth());
+   if (adam && not m_second) m_second = Mat::zeros(params.getHeight(), params.getWidth());
+
+   m_steps++;
+   const float correction1 = adam ? 1.f - std::pow(m_settings.beta1, m_steps) : 1.f;
+   const float correction2 = adam ? 1.f - std::pow(m_settings.beta2, m_steps) : 1.f;
+   const unsigned N_ELEMENTS = params.getHeight()*params.getWidth();
+
+   if (mat_backend == CPU_BACKEND)
+   {
+      cpu_optimizer_step(params.m_host->data(), grads.m_host->data(),
+                         uses_first ? m_first->m_host->data() : nullptr, adam ? m_second->m_host->data() : nullptr, N_ELEMENTS,
+                         m_settings.type, learning_rate, grad_scale, m_settings.clip, m_settings.weight_decay, m_settings.decoupled_weight_decay,
+                         m_settings.momentum, m_settings.nesterov, m_settings.beta1, m_settings.beta2, m_settings.epsilon, correction1, correction2);
+      return;
+   }
+
+   try {
+      // the kernel never touches the state an optimizer doesn't keep, so the parameters
+      // stand in for it
+      const cl::Buffer& first = uses_first ? m_first->m_buffer : params.m_buffer;
+      const cl::Buffer& second = adam ? m_second->m_buffer : params.m_buffer;
+      optimizer_step_kernel.setArg( 0,  params.m_buffer );
+      optimizer_step_kernel.setArg( 1,  grads.m_buffer );
+      optimizer_step_kernel.setArg( 2,  first );
+      optimizer_step_kernel.setArg( 3,  second );
+      optimizer_step_kernel.setArg( 4,  static_cast<cl_int>(m_settings.type) );
+      optimizer_step_kernel.setArg( 5,  learning_rate );
+      optimizer_step_kernel.setArg( 6,  grad_scale );
+      optimizer_step_kernel.setArg( 7,  m_settings.clip );
+      optimizer_step_kernel.setArg( 8,  m_settings.weight_decay );
+      optimizer_step_kernel.setArg( 9,  static_cast<cl_int>(m_settings.decoupled_weight_decay) );
+      optimizer_step_kernel.setArg( 10, m_settings.momentum );
+      optimizer_step_kernel.setArg( 11, static_cast<cl_int>(m_settings.nesterov) );
+      optimizer_step_kernel.setArg( 12, m_settings.beta1 );
+      optimizer_step_kernel.setArg( 13, m_settings.beta2 );
+      optimizer_step_kernel.setArg( 14, m_settings.epsilon );
+      optimizer_step_kernel.setArg( 15, correction1 );
+      optimizer_step_kernel.setArg( 16, correction2 );
+
+      auto deps = ocl_wait_list({params.m_event, grads.m_event,
+                                 uses_first ? m_first->m_event : cl::Event(), adam ? m_second->m_event : cl::Event()});
+      cl::Event event;
+      ocl_queue.enqueueNDRangeKernel( optimizer_step_kernel, cl::NullRange, cl::NDRange(N_ELEMENTS), cl::NullRange, &deps, &event );
+      params.m_event = event;
+      grads.m_event = event;
+      if (uses_first) m_first->m_event = event;
+      if (adam) m_second->m_event = event;
+   }
+   catch(cl::Error& err) {
+      std::cout << "Error in optimizer step: " << err.what() << "(" << getErrorString(err.err()) << ")" << std::endl;
+   }
+}
+
+void ParameterOptimizer::save(CheckpointWriter& writer) const
+{
+   writer.count(m_steps);
+   writer.count(bool(m_first) + bool(m_second));
+   if (m_first) writer.tensor(*m_first);
+   if (m_second) writer.tensor(*m_second);
+}
+
+void ParameterOptimizer::load(CheckpointReader& reader)
+{
+   const int steps = reader.count();
+   const unsigned n_state = reader.count();
+   const bool adam = m_settings.type == OPTIMIZER_ADAM;
+   const unsigned expected = (adam || m_settings.momentum > 0.f) + adam;
+   m_first.reset();
+   m_second.reset();
+   m_steps = 0;
+   if (n_state != expected)
+   {
+      for (unsigned i = 0; i < n_state; i++) reader.skip();
+      return;
+   }
+   m_steps = steps;
+   if (n_state > 0) m_first = reader.tensor();
+   if (n_state > 1) m_second = reader.tensor();
+}
@@ -0,0 +1,66 @@
+#pragma once
+
+#include <optional>
+#include "mat.hpp"
+
+class CheckpointWriter;
+class CheckpointReader;
+
+enum OptimizerType
+{
+   OPTIMIZER_SGD = 0,
+   OPTIMIZER_ADAM = 1
+};
+
+struct OptimizerSettings
+{
+   OptimizerType type = OPTIMIZER_SGD;
+
+   // SGD only: velocity decay, 0 for plain SGD, and whether to look ahead along it
+   float momentum = 0.f;
+   bool nesterov = false;
+
+   // Adam only
+   float beta1 = 0.9f;
+   float beta2 = 0.999f;
+   float epsilon = 1e-8f;
+
+   // L2 penalty added to the gradients, or shrinking the weights directly when
+   // `decoupled_weight_decay` is set (AdamW)
+   float weight_decay = 0.f;
+   bool decoupled_weight_decay = false;
+
+   // the averaged gradients are clamped to [-clip, clip], 0 for no clipping
+   float clip = 0.f;
+};
+
+// the optimizer of one parameter tensor, with its state kept next to the parameters (on the
+// device for the OpenCL backend). Each step is a single fused kernel, which also zeroes the
+// gradients in place for the next batch
+class ParameterOptimizer
+{
+public:
+   ParameterOptimizer(const OptimizerSettings& settings = OptimizerSettings())
+   :m_settings{settings}
+   {}
+
+   // starts over with no momentum or moments
+   void setSettings(const OptimizerSettings& settings);
+   const OptimizerSettings& settings() const { return m_settings; }
+
+   // updates `params` in place from the gradients summed in `grads`, which are scaled by
+   // `grad_scale` first (eg. 1/batch size) and zeroed
+   void step(Mat& params, Mat& grads, float learning_rate, float grad_scale);
+
+   // the step count and moments. State saved under different settings, eg. SGD's
+   // velocity loaded into Adam, is skipped and the optimizer starts over
+   void save(CheckpointWriter& writer) const;
+   void load(CheckpointReader& reader);
+
+private:
+   OptimizerSettings m_settings;
+   // SGD velocity or Adam's first moment, and Adam's second moment. Made on the first step
+   std::optional<Mat> m_first;
+   std::optional<Mat> m_second;
+   int m_steps = 0;
+};
@@ -1,12 +1,21 @@
 #include "parallelMat.hpp"
+#include "pinnedBuffer.hpp"
 #include "oclData.hpp"
 #include <iostream>
 #include "errors.hpp"
+#include "cpuKernels.hpp"
+#include <algorithm>
 
 
 ParallelMat::ParallelMat()
 {
+   Mat::setup();
    m_count = m_width = m_height = 0;
+   if (mat_backend == CPU_BACKEND)
+   {
+      m_host = std::make_shared<std::vector<float>>();
+      return;
+   }
    m_buffer = cl::Buffer(ocl_context, CL_MEM_READ_WRITE, 0);
 }
 
@@ -24,53 +33,270 @@ ParallelMat::ParallelMat(const std::vector<Mat>& mats)
    m_count = mats.size();
    const unsigned INPUT_SIZE = m_width*m_height;
 
-   std::vector<float> inputs_data(m_count*INPUT_SIZE);
-   for(unsigned i = 0; i < m_count; i++) {
-      const std::vector<float> input_data = mats[i].getVals();
-      std::copy(begin(input_data), end(input_data), begin(inputs_data) + i*INPUT_SIZE);
+   if (mat_backend == CPU_BACKEND)
+   {
+      m_host = std::make_shared<std::vector<float>>(m_count*INPUT_SIZE);
+      for(unsigned i = 0; i < m_count; i++) {
+         std::copy(mats[i].m_host->begin(), mats[i].m_host->end(), m_host->begin() + i*INPUT_SIZE);
+      }
+      return;
    }
 
+   // gather on the device rather than round-tripping through the host. The queue is
+   // in-order so the last copy finishing means they all have
    m_buffer = cl::Buffer(ocl_context, CL_MEM_READ_WRITE, (m_count*INPUT_SIZE)*sizeof(float));
-   ocl_queue.enqueueWriteBuffer( m_buffer, CL_TRUE, 0, (m_count*INPUT_SIZE)*sizeof(float), inputs_data.data() );
+   for(unsigned i = 0; i < m_count; i++) {
+      auto deps = ocl_wait_list({mats[i].m_event});
+      ocl_queue.enqueueCopyBuffer( mats[i].m_buffer, m_buffer, 0, i*INPUT_SIZE*sizeof(float), INPUT_SIZE*sizeof(float), &deps, &m_event );
+   }
 }
 
-std::vector<Mat> ParallelMat::toVector() const
+ParallelMat::ParallelMat(unsigned height, unsigned width, unsigned count, std::vector<float>&& vals)
+   :m_height{height}
+   ,m_width{width}
+   ,m_count{count}
+{
+   assert(vals.size() == std::size_t(height)*width*count);
+   Mat::setup();
+   if (mat_backend == CPU_BACKEND)
+   {
+      m_host = std::make_shared<std::vector<float>>(std::move(vals));
+      return;
+   }
+   m_buffer = cl::Buffer(ocl_context, CL_MEM_READ_WRITE, vals.size()*sizeof(float));
+   m_event = ocl_upload(m_buffer, std::move(vals));
+}
+
+ParallelMat::ParallelMat(PinnedBuffer& staging)
+   :m_height{staging.m_height}
+   ,m_width{staging.m_width}
+   ,m_count{staging.m_count}
 {
-   const unsigned MAT_SIZE = m_width*m_height;
-   const unsigned N_ELEMENTS = MAT_SIZE*m_count;
+   staging.unmap();
+   if (mat_backend == CPU_BACKEND)
+   {
+      m_host = staging.m_host;
+      m_offset = staging.m_host_offset;
+      return;
+   }
+   if (ocl_host_unified_memory)
+   {
+      // the device reads host memory anyway
+      m_buffer = staging.m_buffer;
+      m_event = staging.m_event;
+      return;
+   }
 
-   std::vector<float> all_mats_data(N_ELEMENTS);
+   const unsigned SIZE = staging.size()*sizeof(float);
+   m_buffer = cl::Buffer(ocl_context, CL_MEM_READ_WRITE, SIZE);
+   auto deps = ocl_wait_list({staging.m_event});
+   ocl_transfer_queue.enqueueCopyBuffer( staging.m_buffer, m_buffer, 0, 0, SIZE, &deps, &m_event );
+   ocl_transfer_queue.flush();
 
-   ocl_queue.enqueueReadBuffer(m_buffer, CL_TRUE, 0, N_ELEMENTS*sizeof(float), all_mats_data.data());
+   // refilling the staging buffer has to wait for the copy
+   staging.m_event = m_event;
+}
 
+std::vector<Mat> ParallelMat::toVector() const
+{
    std::vector<Mat> inputs;
+   inputs.reserve(m_count);
    for (unsigned i = 0; i < m_count; i++) {
-      std::vector<float> mat_data(begin(all_mats_data) + i*MAT_SIZE, begin(all_mats_data) + (i+1)*MAT_SIZE);
-      inputs.push_back(Mat(m_height, m_width, mat_data));
+      // Mat's copy constructor copies the view's elements out
+      const Mat view = at(i);
+      inputs.push_back(view);
    }  
    return inputs;
 }
 
+std::vector<Mat> ParallelMat::views() const
+{
+   std::vector<Mat> mats;
+   mats.reserve(m_count);
+   for (unsigned i = 0; i < m_count; i++) {
+      mats.push_back(at(i));
+   }
+   return mats;
+}
+
+Mat ParallelMat::at(unsigned i) const
+{
+   assert(i < m_count);
+   ParallelMat element = slice(i, 1);
+   if (mat_backend == CPU_BACKEND)
+   {
+      // Mat has no offset, so on the host this is always a copy
+      const float* first = element.hostData();
+      return Mat(m_height, m_width, std::make_shared<std::vector<float>>(first, first + m_height*m_width));
+   }
+   cl::Buffer element_buffer = element.buffer();
+   return Mat(m_height, m_width, element_buffer, element.m_event);
+}
+
+ParallelMat ParallelMat::slice(unsigned first, unsigned count) const
+{
+   assert(first + count <= m_count);
+   if (mat_backend == CPU_BACKEND) return ParallelMat(m_height, m_width, count, m_host, m_offset + first*m_height*m_width);
+   return ParallelMat(m_height, m_width, count, m_buffer, m_event, m_offset + first*m_height*m_width);
+}
+
+ParallelMat ParallelMat::reshape(unsigned height, unsigned width) const
+{
+   const unsigned N_ELEMENTS = m_height*m_width*m_count;
+   assert(N_ELEMENTS % (height*width) == 0);
+   if (mat_backend == CPU_BACKEND) return ParallelMat(height, width, N_ELEMENTS / (height*width), m_host, m_offset);
+   return ParallelMat(height, width, N_ELEMENTS / (height*width), m_buffer, m_event, m_offset);
+}
+
+ParallelMat ParallelMat::concat(const std::vector<ParallelMat>& parts)
+{
+   const unsigned height = parts.at(0).m_height;
+   const unsigned width = parts.at(0).m_width;
+   const unsigned MAT_SIZE = height*width;
+
+   // parts that are back to back views of one buffer (eg. slices of a batch) join for free
+   bool adjacent = true;
+   unsigned count = 0;
+   for (const ParallelMat& part : parts)
+   {
+      assert(part.m_height == height && part.m_width == width);
+      const bool same_storage = (mat_backend == CPU_BACKEND ? part.m_host == parts.front().m_host : part.m_buffer() == parts.front().m_buffer());
+      adjacent = adjacent && same_storage && part.m_offset == parts.front().m_offset + count*MAT_SIZE;
+      count += part.m_count;
+   }
+
+   if (adjacent && mat_backend == CPU_BACKEND) return ParallelMat(height, width, count, parts.front().m_host, parts.front().m_offset);
+   if (adjacent)
+   {
+      std::vector<cl::Event> deps;
+      for (const ParallelMat& part : parts)
+      {
+         if (part.m_event() != nullptr) deps.push_back(part.m_event);
+      }
+      // parts may have been written on the transfer queue or another device's, so the batch
+      // waits on a marker covering every one of them
+      cl::Event marker;
+      try {
+         ocl_queue.enqueueMarkerWithWaitList( &deps, &marker );
+      }
+      catch(cl::Error& err) {
+         std::cout << "Error in concat: " << err.what() << "(" << getErrorString(err.err()) << ")" << std::endl;
+      }
+      return ParallelMat(height, width, count, parts.front().m_buffer, marker, parts.front().m_offset);
+   }
+
+   if (mat_backend == CPU_BACKEND)
+   {
+      auto out = std::make_shared<std::vector<float>>(MAT_SIZE*count);
+      unsigned offset = 0;
+      for (const ParallelMat& part : parts)
+      {
+         std::copy(part.hostData(), part.hostData() + part.m_count*MAT_SIZE, out->begin() + offset);
+         offset += part.m_count*MAT_SIZE;
+      }
+      return ParallelMat(height, width, count, out);
+   }
+
+   cl::Buffer out_buffer(ocl_context, CL_MEM_READ_WRITE, MAT_SIZE*count*sizeof(float));
+   cl::Event out_event;
+   unsigned offset = 0;
+   for (const ParallelMat& part : parts)
+   {
+      auto deps = ocl_wait_list({part.m_event});
+      ocl_queue.enqueueCopyBuffer( part.m_buffer, out_buffer, part.m_offset*sizeof(float), offset*sizeof(float), part.m_count*MAT_SIZE*sizeof(float), &deps, &out_event );
+      offset += part.m_count*MAT_SIZE;
+   }
+   return ParallelMat(height, width, count, out_buffer, out_event);
+}
+
+cl::Buffer ParallelMat::buffer() const
+{
+   if (m_offset == 0) return m_buffer;
+
+   const size_t origin = m_offset*sizeof(float);
+   const size_t size = m_height*m_width*m_count*sizeof(float);
+   if (ocl_mem_base_addr_align != 0 && origin % ocl_mem_base_addr_align == 0)
+   {
+      cl_buffer_region region {origin, size};
+      cl::Buffer parent = m_buffer;
+      return parent.createSubBuffer(CL_MEM_READ_WRITE, CL_BUFFER_CREATE_TYPE_REGION, &region);
+   }
+
+   // sub-buffers have to start on an aligned address, everything else gets compacted. The
+   // copy follows the last write, so kernels waiting on `m_event` see it complete
+   cl::Buffer compacted(ocl_context, CL_MEM_READ_WRITE, size);
+   auto deps = ocl_wait_list({m_event});
+   ocl_queue.enqueueCopyBuffer( m_buffer, compacted, origin, 0, size, &deps, &m_event );
+   return compacted;
+}
+
+ParallelMat ParallelMat::host_map(void function(const float*, float*, std::size_t)) const
+{
+   const unsigned N_ELEMENTS = m_width*m_height*m_count;
+   auto out = std::make_shared<std::vector<float>>(N_ELEMENTS);
+   function(hostData(), out->data(), N_ELEMENTS);
+   return ParallelMat(m_height, m_width, m_count, out);
+}
+
+std::vector<float> ParallelMat::getVals() const
+{
+   const unsigned N_ELEMENTS = m_width*m_height*m_count;
+   if (mat_backend == CPU_BACKEND) return std::vector<float>(hostData(), hostData() + N_ELEMENTS);
+   std::vector<float> out(N_ELEMENTS);
+
+   ocl_download(m_buffer, m_offset*sizeof(float), N_ELEMENTS*sizeof(float), out.data(), ocl_wait_list({m_event}));
+   return out;
+}
+
+std::future<std::vector<float>> ParallelMat::getValsAsync() const
+{
+   if (mat_backend == CPU_BACKEND)
+   {
+      return std::async(std::launch::deferred, [this_view = *this]() { return this_view.getVals(); });
+   }
+
+   const unsigned N_ELEMENTS = m_width*m_height*m_count;
+   auto out = std::make_shared<std::vector<float>>(N_ELEMENTS);
+
+   cl::Event read_event;
+   ocl_download(m_buffer, m_offset*sizeof(float), N_ELEMENTS*sizeof(float), out->data(), ocl_wait_list({m_event}), &read_event);
+   m_event = read_event;
+
+   return std::async(std::launch::deferred, [out, read_event]() {
+      read_event.wait();
+      return std::move(*out);
+   });
+}
+
 Mat ParallelMat::sum() const
 {
    const cl_int arraySize = m_height*m_width;
+   if (mat_backend == CPU_BACKEND)
+   {
+      auto out = std::make_shared<std::vector<float>>(arraySize);
+      cpu_sum(hostData(), out->data(), m_count, arraySize);
+      return Mat(m_height, m_width, out);
+   }
    cl::Buffer out_buffer(ocl_context, CL_MEM_READ_WRITE, arraySize * sizeof(float));
+   cl::Event out_event;
    cl_int numArrays=m_count;
 
    try {
-      multiple_sum_kernel.setArg( 0, m_buffer );
+      multiple_sum_kernel.setArg( 0, buffer() );
       multiple_sum_kernel.setArg( 1, out_buffer );
       multiple_sum_kernel.setArg( 2, sizeof(cl_int), &numArrays );
       multiple_sum_kernel.setArg( 3, sizeof(cl_int), &arraySize );
+      multiple_sum_kernel.setArg( 4, static_cast<cl_int>(0) );
 
       cl::NDRange global( arraySize );
-      ocl_queue.enqueueNDRangeKernel( multiple_sum_kernel, cl::NullRange, global );
+      auto deps = ocl_wait_list({m_event});
+      ocl_queue.enqueueNDRangeKernel( multiple_sum_kernel, cl::NullRange, global, cl::NullRange, &deps, &out_event );
    }
    catch(cl::Error& err) {
       std::cout << "Error in multipleSum: " << err.what() << "(" << getErrorString(err.err()) << ")" << std::endl;
    }
 
-   return Mat(m_height, m_width, out_buffer);
+   return Mat(m_height, m_width, out_buffer, out_event);
 }
 
 ParallelMat ParallelMat::operator* (const ParallelMat &other) const
@@ -81,52 +307,75 @@ ParallelMat ParallelMat::operator* (const ParallelMat &other) const
    cl_int A_h    = m_height;
    cl_int B_w    = other.m_width;
    const int C_N_ELEMENTS = A_h*B_w*m_count;
+   if (mat_backend == CPU_BACKEND)
+   {
+      auto out = std::make_shared<std::vector<float>>(C_N_ELEMENTS);
+      cpu_matmul(hostData(), other.hostData(), out->data(), A_h, common, B_w, m_count, A_h*common, common*B_w);
+      return ParallelMat(A_h, B_w, m_count, out);
+   }
    cl::Buffer out_buffer(ocl_context, CL_MEM_READ_WRITE, C_N_ELEMENTS * sizeof(float));
+   cl::Event out_event;
    try {
-      multiple_multi_matmul_kernel.setArg( 0, m_buffer );
-      multiple_multi_matmul_kernel.setArg( 1, other.m_buffer );
+      multiple_multi_matmul_kernel.setArg( 0, buffer() );
+      multiple_multi_matmul_kernel.setArg( 1, other.buffer() );
       multiple_multi_matmul_kernel.setArg( 2, out_buffer );
       multiple_multi_matmul_kernel.setArg( 3, sizeof(cl_int), &common );
       multiple_multi_matmul_kernel.setArg( 4, sizeof(cl_int), &B_w );
       multiple_multi_matmul_kernel.setArg( 5, sizeof(cl_int), &A_h );
 
       cl::NDRange global( C_N_ELEMENTS );
-      ocl_queue.enqueueNDRangeKernel( multiple_multi_matmul_kernel, cl::NullRange, global );
+      auto deps = ocl_wait_list({m_event, other.m_event});
+      ocl_queue.enqueueNDRangeKernel( multiple_multi_matmul_kernel, cl::NullRange, global, cl::NullRange, &deps, &out_event );
    }
    catch(cl::Error& err) {
       std::cout << "Error in parallelMultiply: " << err.what() << "(" << getErrorString(err.err()) << ")" << std::endl;
    }
 
-   return ParallelMat(A_h, other.m_width, m_count, out_buffer);
+   return ParallelMat(A_h, other.m_width, m_count, out_buffer, out_event);
 }
 
 ParallelMat ParallelMat::transpose() const
 {
    const int N_ELEMENTS = m_width * m_height * m_count;
+   if (mat_backend == CPU_BACKEND)
+   {
+      auto out = std::make_shared<std::vector<float>>(N_ELEMENTS);
+      cpu_transpose(hostData(), out->data(), m_height, m_width, m_count);
+      return ParallelMat(m_width, m_height, m_count, out);
+   }
    cl::Buffer out_buffer(ocl_context, CL_MEM_READ_WRITE, N_ELEMENTS * sizeof(float));
+   cl::Event out_event;
    
    cl_int W = m_width;
    cl_int H = m_height;
 
    try {
-   multiple_transpose_kernel.setArg( 0, m_buffer );
+   multiple_transpose_kernel.setArg( 0, buffer() );
    multiple_transpose_kernel.setArg( 1, out_buffer );
    multiple_transpose_kernel.setArg( 2, sizeof(cl_int), &W );
    multiple_transpose_kernel.setArg( 3, sizeof(cl_int), &H );
 
    cl::NDRange global( N_ELEMENTS );
-   ocl_queue.enqueueNDRangeKernel( multiple_transpose_kernel, cl::NullRange, global );
+   auto deps = ocl_wait_list({m_event});
+   ocl_queue.enqueueNDRangeKernel( multiple_transpose_kernel, cl::NullRange, global, cl::NullRange, &deps, &out_event );
    }
    catch(cl::Error& err) {
       std::cout << "Error in parallelTranspose: " << err.what() << "(" << getErrorString(err.err()) << ")" << std::endl;
    }
 
-   return ParallelMat(m_width, m_height, m_count, out_buffer); // W & H are swapped because of the transpose
+   return ParallelMat(m_width, m_height, m_count, out_buffer, out_event); // W & H are swapped because of the transpose
 }
 
 ParallelMat ParallelMat::mat_add_sub_dot_op(char op, const ParallelMat &other) const
 {
    assert(m_width == other.m_width && m_height == m_height && m_count == other.m_count);
+   if (mat_backend == CPU_BACKEND)
+   {
+      const unsigned N_ELEMENTS = m_width * m_height * m_count;
+      auto out = std::make_shared<std::vector<float>>(N_ELEMENTS);
+      cpu_elementwise(op, hostData(), other.hostData(), out->data(), N_ELEMENTS, N_ELEMENTS);
+      return ParallelMat(m_height, m_width, m_count, out);
+   }
    switch(op)
    {
       case '+': return mat_add_sub_dot(other, add_mat_kernel); break;
@@ -141,89 +390,108 @@ ParallelMat ParallelMat::mat_add_sub_dot(const ParallelMat &other, cl::Kernel& k
 {
    const int N_ELEMENTS = m_width * m_height * m_count;
    cl::Buffer out_buffer(ocl_context, CL_MEM_READ_WRITE, N_ELEMENTS*sizeof(float));
+   cl::Event out_event;
    cl::NDRange global( N_ELEMENTS );
    try {
-      kernel.setArg( 0, m_buffer );
-      kernel.setArg( 1, other.m_buffer);
+      kernel.setArg( 0, buffer() );
+      kernel.setArg( 1, other.buffer());
       kernel.setArg( 2, out_buffer );
-      ocl_queue.enqueueNDRangeKernel( kernel, cl::NullRange, global );
+      auto deps = ocl_wait_list({m_event, other.m_event});
+      ocl_queue.enqueueNDRangeKernel( kernel, cl::NullRange, global, cl::NullRange, &deps, &out_event );
    }
    catch(cl::Error& err) {
       std::cout << "Error in mat_add_sub_dot: " << err.what() << "(" << getErrorString(err.err()) << ")" << std::endl;
    }
-   return ParallelMat(m_height, m_width, m_count, out_buffer);
+   return ParallelMat(m_height, m_width, m_count, out_buffer, out_event);
 }
 
 ParallelMat ParallelMat::relu() const
 {
+   if (mat_backend == CPU_BACKEND) return host_map(cpu_relu);
+
    const int N_ELEMENTS = m_width*m_height*m_count;
    cl::Buffer out_buffer(ocl_context, CL_MEM_READ_WRITE, N_ELEMENTS * sizeof(float));
+   cl::Event out_event;
    try {
-      relu_kernel.setArg( 0, m_buffer );
+      relu_kernel.setArg( 0, buffer() );
       relu_kernel.setArg( 1, out_buffer);
       cl::NDRange global( N_ELEMENTS );
-      ocl_queue.enqueueNDRangeKernel(relu_kernel, cl::NullRange, global );
+      auto deps = ocl_wait_list({m_event});
+      ocl_queue.enqueueNDRangeKernel( relu_kernel, cl::NullRange, global, cl::NullRange, &deps, &out_event );
    }
    catch(cl::Error& err) {
       std::cout << "Error in relu: " << err.what() << "(" << getErrorString(err.err()) << ")" << std::endl;
    }
-   return ParallelMat(m_height, m_width, m_count, out_buffer);
+   return ParallelMat(m_height, m_width, m_count, out_buffer, out_event);
 }
 
 ParallelMat ParallelMat::relu_inv() const
 {
+   if (mat_backend == CPU_BACKEND) return host_map(cpu_relu_inv);
+
    const int N_ELEMENTS = m_width*m_height*m_count;
    cl::Buffer out_buffer(ocl_context, CL_MEM_READ_WRITE, N_ELEMENTS * sizeof(float));
+   cl::Event out_event;
    try {
-      relu_inv_kernel.setArg( 0, m_buffer );
+      relu_inv_kernel.setArg( 0, buffer() );
       relu_inv_kernel.setArg( 1, out_buffer);
       cl::NDRange global( N_ELEMENTS );
-      ocl_queue.enqueueNDRangeKernel( relu_inv_kernel, cl::NullRange, global );
+      auto deps = ocl_wait_list({m_event});
+      ocl_queue.enqueueNDRangeKernel( relu_inv_kernel, cl::NullRange, global, cl::NullRange, &deps, &out_event );
    }
    catch(cl::Error& err) {
       std::cout << "Error in relu_inv: " << err.what() << "(" << getErrorString(err.err()) << ")" << std::endl;
    }
-   return ParallelMat(m_height, m_width, m_count, out_buffer);
+   return ParallelMat(m_height, m_width, m_count, out_buffer, out_event);
 }
 
 ParallelMat ParallelMat::sigmoid() const
 {
+   if (mat_backend == CPU_BACKEND) return host_map(cpu_sigmoid);
+
    const int N_ELEMENTS = m_width*m_height*m_count;
    cl::Buffer out_buffer(ocl_context, CL_MEM_READ_WRITE, N_ELEMENTS * sizeof(float));
+   cl::Event out_event;
    try {
-      sigmoid_kernel.setArg( 0, m_buffer );
+      sigmoid_kernel.setArg( 0, buffer() );
       sigmoid_kernel.setArg( 1, out_buffer);
       cl::NDRange global( N_ELEMENTS );
-      ocl_queue.enqueueNDRangeKernel(sigmoid_kernel, cl::NullRange, global );
+      auto deps = ocl_wait_list({m_event});
+      ocl_queue.enqueueNDRangeKernel( sigmoid_kernel, cl::NullRange, global, cl::NullRange, &deps, &out_event );
    }
    catch(cl::Error& err) {
       std::cout << "Error in sigmoid: " << err.what() << "(" << getErrorString(err.err()) << ")" << std::endl;
    }
-   return ParallelMat(m_height, m_width, m_count, out_buffer);
+   return ParallelMat(m_height, m_width, m_count, out_buffer, out_event);
 }
 
 ParallelMat ParallelMat::sigmoid_inv() const
 {
+   if (mat_backend == CPU_BACKEND) return host_map(cpu_sigmoid_inv);
+
    const int N_ELEMENTS = m_width*m_height*m_count;
    cl::Buffer out_buffer(ocl_context, CL_MEM_READ_WRITE, N_ELEMENTS * sizeof(float));
+   cl::Event out_event;
    try {
-      sigmoid_inv_kernel.setArg( 0, m_buffer );
+      sigmoid_inv_kernel.setArg( 0, buffer() );
       sigmoid_inv_kernel.setArg( 1, out_buffer);
       cl::NDRange global( N_ELEMENTS );
-      ocl_queue.enqueueNDRangeKernel( sigmoid_inv_kernel, cl::NullRange, global );
+      auto deps = ocl_wait_list({m_event});
+      ocl_queue.enqueueNDRangeKernel( sigmoid_inv_kernel, cl::NullRange, global, cl::NullRange, &deps, &out_event );
    }
    catch(cl::Error& err) {
       std::cout << "Error in sigmoid_inv: " << err.what() << "(" << getErrorString(err.err()) << ")" << std::endl;
    }
-   return ParallelMat(m_height, m_width, m_count, out_buffer);
+   return ParallelMat(m_height, m_width, m_count, out_buffer, out_event);
 }
 
 ParallelMat ParallelMat::softmax() const
 {
-   auto subvecs = toVector();
-   for (unsigned i = 0; i < subvecs.size(); i++)
+   // softmax() makes new matrices, so the views are only read
+   std::vector<Mat> subvecs;
+   for (const Mat& view : views())
    {
-      subvecs[i] = subvecs[i].softmax();
+      subvecs.push_back(view.softmax());
    }
    return ParallelMat{subvecs};
 }
@@ -231,33 +499,184 @@ ParallelMat ParallelMat::softmax() const
 ParallelMat ParallelMat::binary_crossentropy_loss(const ParallelMat& prediction) const
 {
    const int N_ELEMENTS = m_width*m_height*m_count;
+   if (mat_backend == CPU_BACKEND)
+   {
+      auto out = std::make_shared<std::vector<float>>(N_ELEMENTS);
+      cpu_binary_CEL(hostData(), prediction.hostData(), out->data(), N_ELEMENTS);
+      return ParallelMat(m_height, m_width, m_count, out);
+   }
    cl::Buffer out_buffer(ocl_context, CL_MEM_READ_WRITE, N_ELEMENTS*sizeof(float));
+   cl::Event out_event;
    cl::NDRange global( N_ELEMENTS );
    try {
-      binary_CEL_kernel.setArg( 0, m_buffer );
-      binary_CEL_kernel.setArg( 1, prediction.m_buffer);
+      binary_CEL_kernel.setArg( 0, buffer() );
+      binary_CEL_kernel.setArg( 1, prediction.buffer());
       binary_CEL_kernel.setArg( 2, out_buffer );
-      ocl_queue.enqueueNDRangeKernel( binary_CEL_kernel, cl::NullRange, global );
+      auto deps = ocl_wait_list({m_event, prediction.m_event});
+      ocl_queue.enqueueNDRangeKernel( binary_CEL_kernel, cl::NullRange, global, cl::NullRange, &deps, &out_event );
    }
    catch(cl::Error& err) {
       std::cout << "Error in binary_crossentropy_loss: " << err.what() << "(" << getErrorString(err.err()) << ")" << std::endl;
    }
-   return ParallelMat(m_height, m_width, m_count, out_buffer);
+   return ParallelMat(m_height, m_width, m_count, out_buffer, out_event);
 }
 
 ParallelMat ParallelMat::binary_crossentropy_loss_derivative(const ParallelMat& prediction)  const
 {
    const int N_ELEMENTS = m_width*m_height*m_count;
+   if (mat_backend == CPU_BACKEND)
+   {
+      auto out = std::make_shared<std::vector<float>>(N_ELEMENTS);
+      cpu_binary_CEL_derivative(hostData(), prediction.hostData(), out->data(), N_ELEMENTS);
+      return ParallelMat(m_height, m_width, m_count, out);
+   }
    cl::Buffer out_buffer(ocl_context, CL_MEM_READ_WRITE, N_ELEMENTS*sizeof(float));
+   cl::Event out_event;
    cl::NDRange global( N_ELEMENTS );
    try {
-      binary_CEL_derivative_kernel.setArg( 0, m_buffer );
-      binary_CEL_derivative_kernel.setArg( 1, prediction.m_buffer);
+      binary_CEL_derivative_kernel.setArg( 0, buffer() );
+      binary_CEL_derivative_kernel.setArg( 1, prediction.buffer());
       binary_CEL_derivative_kernel.setArg( 2, out_buffer );
-      ocl_queue.enqueueNDRangeKernel( binary_CEL_derivative_kernel, cl::NullRange, global );
+      auto deps = ocl_wait_list({m_event, prediction.m_event});
+      ocl_queue.enqueueNDRangeKernel( binary_CEL_derivative_kernel, cl::NullRange, global, cl::NullRange, &deps, &out_event );
    }
    catch(cl::Error& err) {
       std::cout << "Error in binary_crossentropy_loss_derivative: " << err.what() << "(" << getErrorString(err.err()) << ")" << std::endl;
    }
-   return ParallelMat(m_height, m_width, m_count, out_buffer);
+   return ParallelMat(m_height, m_width, m_count, out_buffer, out_event);
+}
+
+std::pair<Mat, Mat> ParallelMat::channelMoments(unsigned channels) const
+{
+   const cl_int plane_size = m_height*m_width / channels;
+   if (mat_backend == CPU_BACKEND)
+   {
+      auto mean = std::make_shared<std::vector<float>>(channels);
+      auto var = std::make_shared<std::vector<float>>(channels);
+      cpu_batch_norm_stats(hostData(), mean->data(), var->data(), plane_size, channels, m_count);
+      return {Mat(channels, 1, mean), Mat(channels, 1, var)};
+   }
+   cl::Buffer mean_buffer(ocl_context, CL_MEM_READ_WRITE, channels*sizeof(float));
+   cl::Buffer var_buffer(ocl_context, CL_MEM_READ_WRITE, channels*sizeof(float));
+   cl::Event out_event;
+   try {
+      batch_norm_stats_kernel.setArg( 0, buffer() );
+      batch_norm_stats_kernel.setArg( 1, mean_buffer );
+      batch_norm_stats_kernel.setArg( 2, var_buffer );
+      batch_norm_stats_kernel.setArg( 3, plane_size );
+      batch_norm_stats_kernel.setArg( 4, static_cast<cl_int>(channels) );
+      batch_norm_stats_kernel.setArg( 5, static_cast<cl_int>(m_count) );
+      auto deps = ocl_wait_list({m_event});
+      ocl_queue.enqueueNDRangeKernel( batch_norm_stats_kernel, cl::NullRange, cl::NDRange(channels), cl::NullRange, &deps, &out_event );
+   }
+   catch(cl::Error& err) {
+      std::cout << "Error in channelMoments: " << err.what() << "(" << getErrorString(err.err()) << ")" << std::endl;
+   }
+   return {Mat(channels, 1, mean_buffer, out_event), Mat(channels, 1, var_buffer, out_event)};
+}
+
+ParallelMat ParallelMat::batchNorm(const Mat& mean, const Mat& var, const Mat& gamma, const Mat& beta, float epsilon) const
+{
+   const unsigned channels = mean.getHeight();
+   const cl_int plane_size = m_height*m_width / channels;
+   const int N_ELEMENTS = m_width*m_height*m_count;
+   if (mat_backend == CPU_BACKEND)
+   {
+      auto out = std::make_shared<std::vector<float>>(N_ELEMENTS);
+      cpu_batch_norm(hostData(), out->data(), mean.m_host->data(), var.m_host->data(), gamma.m_host->data(), beta.m_host->data(),
+                     epsilon, plane_size, channels, m_count);
+      return ParallelMat(m_height, m_width, m_count, out);
+   }
+   cl::Buffer out_buffer(ocl_context, CL_MEM_READ_WRITE, N_ELEMENTS*sizeof(float));
+   cl::Event out_event;
+   try {
+      batch_norm_kernel.setArg( 0, buffer() );
+      batch_norm_kernel.setArg( 1, out_buffer );
+      batch_norm_kernel.setArg( 2, mean.m_buffer );
+      batch_norm_kernel.setArg( 3, var.m_buffer );
+      batch_norm_kernel.setArg( 4, gamma.m_buffer );
+      batch_norm_kernel.setArg( 5, beta.m_buffer );
+      batch_norm_kernel.setArg( 6, static_cast<cl_float>(epsilon) );
+      batch_norm_kernel.setArg( 7, plane_size );
+      batch_norm_kernel.setArg( 8, static_cast<cl_int>(channels) );
+      auto deps = ocl_wait_list({m_event, mean.m_event, var.m_event, gamma.m_event, beta.m_event});
+      ocl_queue.enqueueNDRangeKernel( batch_norm_kernel, cl::NullRange, cl::NDRange(N_ELEMENTS), cl::NullRange, &deps, &out_event );
+   }
+   catch(cl::Error& err) {
+      std::cout << "Error in batchNorm: " << err.what() << "(" << getErrorString(err.err()) << ")" << std::endl;
+   }
+   return ParallelMat(m_height, m_width, m_count, out_buffer, out_event);
+}
+
+std::pair<Mat, Mat> ParallelMat::batchNormGradients(const ParallelMat& delta, const Mat& mean, const Mat& var, float epsilon) const
+{
+   const unsigned channels = mean.getHeight();
+   const cl_int plane_size = m_height*m_width / channels;
+   if (mat_backend == CPU_BACKEND)
+   {
+      auto dgamma = std::make_shared<std::vector<float>>(channels);
+      auto dbeta = std::make_shared<std::vector<float>>(channels);
+      cpu_batch_norm_grads(hostData(), delta.hostData(), mean.m_host->data(), var.m_host->data(), dgamma->data(), dbeta->data(),
+                           epsilon, plane_size, channels, m_count);
+      return {Mat(channels, 1, dgamma), Mat(channels, 1, dbeta)};
+   }
+   cl::Buffer dgamma_buffer(ocl_context, CL_MEM_READ_WRITE, channels*sizeof(float));
+   cl::Buffer dbeta_buffer(ocl_context, CL_MEM_READ_WRITE, channels*sizeof(float));
+   cl::Event out_event;
+   try {
+      batch_norm_grads_kernel.setArg( 0, buffer() );
+      batch_norm_grads_kernel.setArg( 1, delta.buffer() );
+      batch_norm_grads_kernel.setArg( 2, mean.m_buffer );
+      batch_norm_grads_kernel.setArg( 3, var.m_buffer );
+      batch_norm_grads_kernel.setArg( 4, dgamma_buffer );
+      batch_norm_grads_kernel.setArg( 5, dbeta_buffer );
+      batch_norm_grads_kernel.setArg( 6, static_cast<cl_float>(epsilon) );
+      batch_norm_grads_kernel.setArg( 7, plane_size );
+      batch_norm_grads_kernel.setArg( 8, static_cast<cl_int>(channels) );
+      batch_norm_grads_kernel.setArg( 9, static_cast<cl_int>(m_count) );
+      auto deps = ocl_wait_list({m_event, delta.m_event, mean.m_event, var.m_event});
+      ocl_queue.enqueueNDRangeKernel( batch_norm_grads_kernel, cl::NullRange, cl::NDRange(channels), cl::NullRange, &deps, &out_event );
+   }
+   catch(cl::Error& err) {
+      std::cout << "Error in batchNormGradients: " << err.what() << "(" << getErrorString(err.err()) << ")" << std::endl;
+   }
+   return {Mat(channels, 1, dgamma_buffer, out_event), Mat(channels, 1, dbeta_buffer, out_event)};
+}
+
+ParallelMat ParallelMat::batchNormBackward(const ParallelMat& delta, const Mat& mean, const Mat& var, const Mat& gamma,
+                                           const Mat& dgamma, const Mat& dbeta, float epsilon) const
+{
+   const unsigned channels = mean.getHeight();
+   const cl_int plane_size = m_height*m_width / channels;
+   const int N_ELEMENTS = m_width*m_height*m_count;
+   if (mat_backend == CPU_BACKEND)
+   {
+      auto out = std::make_shared<std::vector<float>>(N_ELEMENTS);
+      cpu_batch_norm_backward(hostData(), delta.hostData(), out->data(), mean.m_host->data(), var.m_host->data(),
+                              gamma.m_host->data(), dgamma.m_host->data(), dbeta.m_host->data(),
+                              epsilon, plane_size, channels, m_count);
+      return ParallelMat(m_height, m_width, m_count, out);
+   }
+   cl::Buffer out_buffer(ocl_context, CL_MEM_READ_WRITE, N_ELEMENTS*sizeof(float));
+   cl::Event out_event;
+   try {
+      batch_norm_backward_kernel.setArg( 0,  buffer() );
+      batch_norm_backward_kernel.setArg( 1,  delta.buffer() );
+      batch_norm_backward_kernel.setArg( 2,  out_buffer );
+      batch_norm_backward_kernel.setArg( 3,  mean.m_buffer );
+      batch_norm_backward_kernel.setArg( 4,  var.m_buffer );
+      batch_norm_backward_kernel.setArg( 5,  gamma.m_buffer );
+      batch_norm_backward_kernel.setArg( 6,  dgamma.m_buffer );
+      batch_norm_backward_kernel.setArg( 7,  dbeta.m_buffer );
+      batch_norm_backward_kernel.setArg( 8,  static_cast<cl_float>(epsilon) );
+      batch_norm_backward_kernel.setArg( 9,  plane_size );
+      batch_norm_backward_kernel.setArg( 10, static_cast<cl_int>(channels) );
+      batch_norm_backward_kernel.setArg( 11, static_cast<cl_int>(m_count) );
+      auto deps = ocl_wait_list({m_event, delta.m_event, mean.m_event, var.m_event, gamma.m_event, dgamma.m_event, dbeta.m_event});
+      ocl_queue.enqueueNDRangeKernel( batch_norm_backward_kernel, cl::NullRange, cl::NDRange(N_ELEMENTS), cl::NullRange, &deps, &out_event );
+   }
+   catch(cl::Error& err) {
+      std::cout << "Error in batchNormBackward: " << err.what() << "(" << getErrorString(err.err()) << ")" << std::endl;
+   }
+   return ParallelMat(m_height, m_width, m_count, out_buffer, out_event);
 }
@@ -2,14 +2,42 @@
 #include "mat.hpp"
 
 class ConvKernel;
+class PinnedBuffer;
+class HalfMat;
+class Int8Mat;
+class BatchPermutation;
 
 class ParallelMat
 {
 public:
    ParallelMat ();
    ParallelMat (const std::vector<Mat>& mats);
+   // unmaps `staging` and takes its contents. On unified memory devices the
+   // staging buffer is used directly, so it must not be refilled while this
+   // batch is still needed
+   explicit ParallelMat (PinnedBuffer& staging);
+   // `count` height x width matrices back to back in `vals`, uploaded without blocking
+   ParallelMat (unsigned height, unsigned width, unsigned count, std::vector<float>&& vals);
 
+   // copies of the matrices, independent of this batch
    std::vector<Mat> toVector() const;
+   // the matrices as `at` returns them, for reading without copying where that's possible
+   std::vector<Mat> views() const;
+
+   // the i-th matrix. Mat has no offset, so only on OpenCL, and only when the matrix starts
+   // on an aligned address, is it a view sharing this batch's buffer. Otherwise, and always
+   // on the CPU backend, it is a copy that changes made in place don't reach the batch through.
+   // `slice` and `reshape` never copy
+   Mat at(unsigned i) const;
+   ParallelMat slice(unsigned first, unsigned count) const;
+   // same elements seen as a batch of height x width matrices
+   ParallelMat reshape(unsigned height, unsigned width) const;
+   // free when `parts` are back to back views of the same buffer
+   static ParallelMat concat(const std::vector<ParallelMat>& parts);
+
+   std::vector<float> getVals() const;
+   // starts the download immediately, only waits on it when the future is read
+   std::future<std::vector<float>> getValsAsync() const;
    Mat sum() const;
 
    ParallelMat operator* (const ParallelMat &other) const;
@@ -28,6 +56,17 @@ public:
    ParallelMat exp() const;
    ParallelMat softmax() const;
 
+   // batch normalization, every matrix being `channels` planes of height*width/channels values.
+   // {mean, biased variance} of each channel over the whole batch, both channels x 1
+   std::pair<Mat, Mat> channelMoments(unsigned channels) const;
+   // (x - mean) / sqrt(var + epsilon) * gamma + beta per channel, the arguments channels x 1
+   ParallelMat batchNorm(const Mat& mean, const Mat& var, const Mat& gamma, const Mat& beta, float epsilon) const;
+   // {dgamma, dbeta} of `batchNorm` given the gradient `delta` of its output
+   std::pair<Mat, Mat> batchNormGradients(const ParallelMat& delta, const Mat& mean, const Mat& var, float epsilon) const;
+   // gradient of `batchNorm` with respect to this batch, when `mean` and `var` are this batch's moments
+   ParallelMat batchNormBackward(const ParallelMat& delta, const Mat& mean, const Mat& var, const Mat& gamma,
+                                 const Mat& dgamma, const Mat& dbeta, float epsilon) const;
+
    // assumes this matrix is your true values, `prediction` is your nn output
    ParallelMat binary_crossentropy_loss(const ParallelMat& prediction) const;
    ParallelMat binary_crossentropy_loss_derivative(const ParallelMat& prediction) const;
@@ -37,15 +76,40 @@ public:
    unsigned getCount() const { return m_count; }
 
 private:
-   ParallelMat( unsigned height, unsigned width, unsigned count, const cl::Buffer& buffer )
+   ParallelMat( unsigned height, unsigned width, unsigned count, const cl::Buffer& buffer, const cl::Event& event = cl::Event(), unsigned offset = 0 )
       :m_buffer{buffer}
+      ,m_event{event}
+      ,m_offset{offset}
       ,m_height{height}
       ,m_width{width}
       ,m_count{count}
    {
    }
+   ParallelMat( unsigned height, unsigned width, unsigned count, HostBuffer host, unsigned offset = 0 )
+      :m_host{std::move(host)}
+      ,m_offset{offset}
+      ,m_height{height}
+      ,m_width{width}
+      ,m_count{count}
+   {
+   }
+
+   // buffer starting at this view's first element, for kernels that only read it and don't
+   // take an offset. A sub-buffer when the view starts on an aligned address, otherwise a
+   // fresh copy made on every call (so it's never stale) that writes don't reach
+   cl::Buffer buffer() const;
+   // CPU backend: first element of this view
+   float* hostData() const { return m_host->data() + m_offset; }
+   // CPU backend: `function` applied to every element
+   ParallelMat host_map(void function(const float*, float*, std::size_t)) const;
 
+   // `m_buffer` is shared by every view of it, this one starts `m_offset` floats in
    cl::Buffer m_buffer;
+   // last command writing `m_buffer`, or an async read that later writes must not overtake
+   mutable cl::Event m_event;
+   // used instead of `m_buffer` on the CPU backend, shared between views the same way
+   HostBuffer m_host;
+   unsigned m_offset = 0;
    unsigned m_height = 0;
    unsigned m_width = 0;
    unsigned m_count = 0;
@@ -56,4 +120,8 @@ private:
 
    friend Mat;
    friend ConvKernel;
+   friend PinnedBuffer;
+   friend HalfMat;
+   friend Int8Mat;
+   friend BatchPermutation;
 };
\ No newline at end of file
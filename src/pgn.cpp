@@ -0,0 +1,332 @@
+#include "pgn.hpp"
+#include "trainingData.hpp"
+#include <algorithm>
+#include <atomic>
+#include <charconv>
+#include <chrono>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <thread>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace {
+
+std::optional<PieceType> piece_letter(char letter)
+{
+   switch (letter)
+   {
+   case 'N': return KNIGHT;
+   case 'B': return BISHOP;
+   case 'R': return ROOK;
+   case 'Q': return QUEEN;
+   case 'K': return KING;
+   default: return std::nullopt;
+   }
+}
+
+bool is_space(char c) { return c == ' ' || c == '\n' || c == '\r' || c == '\t'; }
+
+// the start of the line after `offset`, or the end of `text`
+std::size_t next_line(std::string_view text, std::size_t offset)
+{
+   const std::size_t newline = text.find('\n', offset);
+   return newline == std::string_view::npos ? text.size() : newline + 1;
+}
+
+// 1 if white won, -1 if black did, 0 for a draw and empty for anything else
+std::optional<int> parse_result(std::string_view result)
+{
+   if (result == "1-0") return 1;
+   if (result == "0-1") return -1;
+   if (result == "1/2-1/2") return 0;
+   return std::nullopt;
+}
+
+}
+
+std::optional<Move> parse_san(const Board& board, std::string_view san)
+{
+   while (not san.empty() && (san.back() == '+' || san.back() == '#' || san.back() == '!' || san.back() == '?'))
+   {
+      san.remove_suffix(1);
+   }
+   const std::set<Move> legal_moves = board.getAllLegalMoves();
+   const int home_row = board.currentPlayer() == WHITE ? 0 : 7;
+
+   if (san == "O-O" || san == "0-0" || san == "O-O-O" || san == "0-0-0")
+   {
+      const Move castle({home_row, 4}, {home_row, san.size() == 3 ? 6 : 2});
+      const OptionalPiece& king = board.pieceAt(castle.start);
+      if (not king || king->type != KING || not legal_moves.contains(castle)) return std::nullopt;
+      return castle;
+   }
+
+   PieceType type = PAWN;
+   if (not san.empty() && piece_letter(san.front()))
+   {
+      type = *piece_letter(san.front());
+      san.remove_prefix(1);
+   }
+   std::optional<PieceType> promotion;
+   if (san.size() >= 2 && piece_letter(san.back()) && piece_letter(san.back()) != KING)
+   {
+      promotion = piece_letter(san.back());
+      san.remove_suffix(san[san.size() - 2] == '=' ? 2 : 1);
+   }
+   if (san.size() < 2) return std::nullopt;
+   const Square end{san[san.size() - 1] - '1', san[san.size() - 2] - 'a'};
+   if (end.row < 0 || end.row > 7 || end.col < 0 || end.col > 7) return std::nullopt;
+
+   // what's left is the file and/or rank of the start square, and whether it's a capture
+   std::optional<int> start_col, start_row;
+   for (char c : san.substr(0, san.size() - 2))
+   {
+      if (c >= 'a' && c <= 'h') start_col = c - 'a';
+      else if (c >= '1' && c <= '8') start_row = c - '1';
+      else if (c != 'x' && c != ':') return std::nullopt;
+   }
+
+   std::optional<Move> found;
+   for (const Move& move : legal_moves)
+   {
+      if (not (move.end == end) || move.promotion != promotion) continue;
+      if ((start_col && move.start.col != *start_col) || (start_row && move.start.row != *start_row)) continue;
+      if (board.pieceAt(move.start)->type != type) continue;
+      if (found) return std::nullopt;
+      found = move;
+   }
+   return found;
+}
+
+std::optional<std::string_view> PgnGame::tag(std::string_view name) const
+{
+   for (std::size_t line = 0; line < tags.size(); line = next_line(tags, line))
+   {
+      const std::string_view rest = tags.substr(line);
+      if (rest.size() < name.size() + 2 || rest[0] != '[' || rest.substr(1, name.size()) != name
+          || not is_space(rest[name.size() + 1])) continue;
+      const std::size_t open = rest.find('"');
+      const std::size_t close = rest.find("\"]", open + 1);
+      if (open == std::string_view::npos || close == std::string_view::npos) return std::nullopt;
+      return rest.substr(open + 1, close - open - 1);
+   }
+   return std::nullopt;
+}
+
+PgnReader::PgnReader(const std::string& path)
+{
+   const int fd = open(path.c_str(), O_RDONLY);
+   if (fd < 0) throw std::runtime_error("couldn't open " + path);
+   struct stat info;
+   if (fstat(fd, &info) == 0) m_size = info.st_size;
+   if (m_size > 0) m_mapping = mmap(nullptr, m_size, PROT_READ, MAP_PRIVATE, fd, 0);
+   close(fd);
+   if (m_mapping == MAP_FAILED || (m_mapping == nullptr && m_size > 0))
+   {
+      m_mapping = nullptr;
+      throw std::runtime_error("couldn't map " + path);
+   }
+   if (m_mapping) madvise(m_mapping, m_size, MADV_SEQUENTIAL);
+}
+
+PgnReader::~PgnReader()
+{
+   if (m_mapping) munmap(m_mapping, m_size);
+}
+
+std::optional<PgnGame> PgnReader::game(std::size_t& offset) const
+{
+   const std::string_view text = this->text();
+   while (offset < text.size() && is_space(text[offset])) offset++;
+   if (offset >= text.size()) return std::nullopt;
+
+   PgnGame game;
+   const std::size_t tags = offset;
+   while (offset < text.size() && text[offset] == '[') offset = next_line(text, offset);
+   game.tags = text.substr(tags, offset - tags);
+
+   // the movetext runs up to the next line starting a tag outside of a comment
+   const std::size_t movetext = offset;
+   bool comment = false;
+   for (bool line_start = true; offset < text.size(); offset++)
+   {
+      const char c = text[offset];
+      if (line_start && c == '[' && not comment) break;
+      if (c == '{') comment = true;
+      else if (c == '}') comment = false;
+      line_start = c == '\n';
+   }
+   game.movetext = text.substr(movetext, offset - movetext);
+   return game;
+}
+
+std::vector<std::size_t> PgnReader::split(unsigned parts) const
+{
+   const std::string_view text = this->text();
+   std::vector<std::size_t> offsets{0};
+   for (unsigned part = 1; part < parts; part++)
+   {
+      // games are separated by a blank line, so a tag line right after one starts a game
+      std::size_t line = std::max<std::size_t>(offsets.back(), text.size() / parts * part);
+      line = line == 0 ? 0 : next_line(text, line - 1);
+      bool previous_blank = false;
+      for (; line < text.size(); line = next_line(text, line))
+      {
+         if (text[line] == '[' && previous_blank) break;
+         previous_blank = text[line] == '\n' || text.substr(line, 2) == "\r\n";
+      }
+      offsets.push_back(std::min(line, text.size()));
+   }
+   offsets.push_back(text.size());
+   offsets.erase(std::unique(offsets.begin(), offsets.end()), offsets.end());
+   return offsets;
+}
+
+namespace {
+
+struct PgnChunk
+{
+   std::shared_ptr<const PgnReader> reader;
+   std::size_t begin;
+   std::size_t end;
+};
+
+// the moves of `game` played out on a board, or empty when one can't be
+std::optional<std::vector<PositionRecord>> replay(const PgnGame& game, int result, std::uint32_t game_id)
+{
+   Board board;
+   std::vector<PositionRecord> records;
+   std::string_view text = game.movetext;
+   std::size_t i = 0;
+   int depth = 0;    // of variations, which are skipped
+   while (i < text.size())
+   {
+      const char c = text[i];
+      if (is_space(c)) { i++; continue; }
+      if (c == '{') { i = std::min(text.find('}', i), text.size()); i++; continue; }
+      if (c == ';') { i = next_line(text, i); continue; }
+      if (c == '(') { depth++; i++; continue; }
+      if (c == ')') { depth--; i++; continue; }
+
+      std::size_t end = i;
+      while (end < text.size() && not is_space(text[end]) && text[end] != '{' && text[end] != '(' && text[end] != ')' && text[end] != ';') end++;
+      std::string_view token = text.substr(i, end - i);
+      i = end;
+      if (depth > 0 || token.front() == '$') continue;
+      if (token == "*" || parse_result(token)) break;
+
+      // a move number, possibly run into its move ("12.e4", "12...Nf6")
+      if (token.front() >= '1' && token.front() <= '9')
+      {
+         const std::size_t dot = token.find_first_not_of("0123456789");
+         if (dot == std::string_view::npos || token[dot] != '.') return std::nullopt;
+         const std::size_t san = token.find_first_not_of('.', dot);
+         if (san == std::string_view::npos) continue;
+         token.remove_prefix(san);
+      }
+
+      const std::optional<Move> move = parse_san(board, token);
+      if (not move) return std::nullopt;
+
+      PositionRecord record;
+      record.board = pack_board(board);
+      record.result = result;
+      record.ply = records.size();
+      record.game_id = game_id;
+      record.policy = {{policy_index(*move, board.currentPlayer()), 1.f}};
+      records.push_back(std::move(record));
+      board.doMove(*move);
+   }
+   return records;
+}
+
+int elo(const PgnGame& game, std::string_view tag)
+{
+   const std::optional<std::string_view> value = game.tag(tag);
+   int rating = 0;
+   if (value) std::from_chars(value->data(), value->data() + value->size(), rating);
+   return rating;
+}
+
+}
+
+PgnImportStats import_pgn(const std::vector<std::string>& paths, const PgnImportSettings& settings)
+{
+   const auto start = std::chrono::steady_clock::now();
+   const unsigned threads = std::max(1u, settings.threads);
+
+   std::vector<PgnChunk> chunks;
+   for (const std::string& path : paths)
+   {
+      auto reader = std::make_shared<const PgnReader>(path);
+      const std::vector<std::size_t> offsets = reader->split(threads*std::max(1u, settings.chunks_per_thread));
+      for (std::size_t i = 0; i + 1 < offsets.size(); i++) chunks.push_back({reader, offsets[i], offsets[i + 1]});
+   }
+
+   std::atomic<std::size_t> next_chunk = 0;
+   std::atomic<std::uint32_t> next_game_id = 0;
+   std::mutex mutex;
+   PgnImportStats stats;
+
+   auto work = [&](unsigned thread) {
+      PgnImportStats thread_stats;
+      std::optional<PositionWriter> writer;
+      unsigned shard = 0;
+      std::size_t in_shard = 0;
+      try {
+         for (std::size_t chunk = next_chunk++; chunk < chunks.size(); chunk = next_chunk++)
+         {
+            const PgnChunk& run = chunks[chunk];
+            std::size_t offset = run.begin;
+            while (offset < run.end)
+            {
+               const std::optional<PgnGame> game = run.reader->game(offset);
+               if (not game) break;
+               const std::optional<int> result = parse_result(game->tag("Result").value_or("*"));
+               std::optional<std::vector<PositionRecord>> records;
+               if (result && elo(*game, "WhiteElo") >= settings.min_elo && elo(*game, "BlackElo") >= settings.min_elo)
+               {
+                  records = replay(*game, *result, next_game_id++);
+               }
+               if (not records)
+               {
+                  thread_stats.skipped_games++;
+                  continue;
+               }
+
+               // a game doesn't straddle shards, so every shard holds whole games
+               if (not writer || in_shard >= settings.positions_per_shard)
+               {
+                  writer.emplace(settings.output_prefix + std::to_string(thread) + "_" + std::to_string(shard++) + ".bin");
+                  in_shard = 0;
+               }
+               for (const PositionRecord& record : *records) writer->write(record);
+               in_shard += records->size();
+               thread_stats.games++;
+               thread_stats.positions += records->size();
+            }
+         }
+         if (writer) writer->flush();
+      }
+      catch (std::exception& err) {
+         std::cout << "Error in PGN import: " << err.what() << std::endl;
+      }
+
+      std::lock_guard lock(mutex);
+      stats.games += thread_stats.games;
+      stats.positions += thread_stats.positions;
+      stats.skipped_games += thread_stats.skipped_games;
+   };
+
+   std::vector<std::thread> workers;
+   for (unsigned thread = 0; thread < threads; thread++) workers.emplace_back(work, thread);
+   for (std::thread& worker : workers) worker.join();
+
+   stats.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+   return stats;
+}
@@ -0,0 +1,70 @@
+#pragma once
+
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+#include "board.hpp"
+
+// the legal move of `board` that the Standard Algebraic Notation `san` names ("Nbd7", "exd8=Q+",
+// "O-O", ...). Empty if there's no such move or more than one
+std::optional<Move> parse_san(const Board& board, std::string_view san);
+
+// a game of a PGN file, pointing into the reader's mapping
+struct PgnGame
+{
+   std::string_view tags;        // the [Name "value"] lines
+   std::string_view movetext;    // moves, comments, variations and the result
+
+   // the value of the tag `name`, escapes left as they are
+   std::optional<std::string_view> tag(std::string_view name) const;
+};
+
+// a mapped PGN file, read in place
+class PgnReader
+{
+public:
+   // throws std::runtime_error if `path` can't be mapped
+   explicit PgnReader(const std::string& path);
+   ~PgnReader();
+   PgnReader(const PgnReader&) = delete;
+   PgnReader& operator=(const PgnReader&) = delete;
+
+   std::string_view text() const { return {static_cast<const char*>(m_mapping), m_size}; }
+
+   // the first game starting at or after `offset`, which moves past it. Empty at the end of the file
+   std::optional<PgnGame> game(std::size_t& offset) const;
+   // offsets splitting the file into `parts` runs of whole games, from 0 to the size of the file
+   std::vector<std::size_t> split(unsigned parts) const;
+
+private:
+   void* m_mapping = nullptr;
+   std::size_t m_size = 0;
+};
+
+struct PgnImportSettings
+{
+   unsigned threads = 8;
+   // files are split into this many runs of games per thread, so threads finishing early take
+   // over the rest
+   unsigned chunks_per_thread = 16;
+   // games where either player is rated below this are skipped
+   int min_elo = 0;
+   // every thread writes "<output_prefix><thread>_<shard>.bin", a new shard every `positions_per_shard`
+   std::string output_prefix = "pgn_";
+   std::size_t positions_per_shard = 1 << 20;
+};
+
+struct PgnImportStats
+{
+   std::size_t games = 0;
+   std::size_t positions = 0;
+   // games without a result, below min_elo or with a move that couldn't be played
+   std::size_t skipped_games = 0;
+   double seconds = 0.0;
+};
+
+// replays the games of `paths` into training records, one per position before each move, its
+// policy the move played and the game's result as the value target
+PgnImportStats import_pgn(const std::vector<std::string>& paths, const PgnImportSettings& settings = PgnImportSettings());
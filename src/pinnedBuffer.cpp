@@ -0,0 +1,68 @@
+#include "pinnedBuffer.hpp"
+#include "oclData.hpp"
+#include "errors.hpp"
+#include <iostream>
+
+PinnedBuffer::PinnedBuffer(unsigned height, unsigned width, unsigned count)
+   :m_height{height}
+   ,m_width{width}
+   ,m_count{count}
+{
+   if (not backend_setup) backend_init();
+   if (mat_backend == CPU_BACKEND)
+   {
+      m_host = std::make_shared<std::vector<float>>(size());
+      return;
+   }
+   m_buffer = cl::Buffer(ocl_context, CL_MEM_READ_WRITE | CL_MEM_ALLOC_HOST_PTR, size()*sizeof(float));
+}
+
+PinnedBuffer::PinnedBuffer(const ParallelMat& mat)
+   :m_height{mat.m_height}
+   ,m_width{mat.m_width}
+   ,m_count{mat.m_count}
+{
+   if (mat_backend == CPU_BACKEND)
+   {
+      m_host = mat.m_host;
+      m_host_offset = mat.m_offset;
+      return;
+   }
+   m_buffer = mat.buffer();
+   m_event = mat.m_event;
+}
+
+PinnedBuffer::~PinnedBuffer()
+{
+   unmap();
+}
+
+float* PinnedBuffer::data()
+{
+   if (mat_backend == CPU_BACKEND) return m_host->data() + m_host_offset;
+   if (m_mapped != nullptr) return m_mapped;
+
+   // mapped on the compute queue, which is in-order, so the map also waits for
+   // kernels still reading the buffer
+   try {
+      auto deps = ocl_wait_list({m_event});
+      m_mapped = static_cast<float*>(ocl_queue.enqueueMapBuffer( m_buffer, CL_TRUE, CL_MAP_READ | CL_MAP_WRITE, 0, size()*sizeof(float), &deps ));
+   }
+   catch(cl::Error& err) {
+      std::cout << "Error in PinnedBuffer map: " << err.what() << "(" << getErrorString(err.err()) << ")" << std::endl;
+   }
+   return m_mapped;
+}
+
+void PinnedBuffer::unmap()
+{
+   if (m_mapped == nullptr) return;
+
+   try {
+      ocl_queue.enqueueUnmapMemObject( m_buffer, m_mapped, nullptr, &m_event );
+   }
+   catch(cl::Error& err) {
+      std::cout << "Error in PinnedBuffer unmap: " << err.what() << "(" << getErrorString(err.err()) << ")" << std::endl;
+   }
+   m_mapped = nullptr;
+}
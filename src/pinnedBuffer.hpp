@@ -0,0 +1,45 @@
+#pragma once
+#include "parallelMat.hpp"
+
+// Host-mapped staging memory for a batch of `count` height x width matrices.
+// The buffer is allocated with CL_MEM_ALLOC_HOST_PTR so mapping it is free, and
+// on unified memory devices (pocl, integrated GPUs) ParallelMats built from it
+// use it directly without any copies. On the CPU backend it is plain host memory
+// that ParallelMats share
+class PinnedBuffer
+{
+public:
+   PinnedBuffer(unsigned height, unsigned width, unsigned count);
+
+   // exports `mat` for reading on the host. Shares its buffer, so on unified
+   // memory devices the values are never copied
+   explicit PinnedBuffer(const ParallelMat& mat);
+
+   PinnedBuffer(const PinnedBuffer&) = delete;
+   PinnedBuffer& operator=(const PinnedBuffer&) = delete;
+   ~PinnedBuffer();
+
+   // host pointer to the contents, mapping the buffer if needed. Waits for
+   // device commands using the buffer to finish first
+   float* data();
+
+   // hands the buffer back to the device
+   void unmap();
+
+   unsigned getWidth() const { return m_width; }
+   unsigned getHeight() const { return m_height; }
+   unsigned getCount() const { return m_count; }
+   unsigned size() const { return m_width*m_height*m_count; }
+
+private:
+   cl::Buffer m_buffer;
+   cl::Event m_event;
+   float* m_mapped = nullptr;
+   HostBuffer m_host;
+   unsigned m_host_offset = 0;
+   unsigned m_height;
+   unsigned m_width;
+   unsigned m_count;
+
+   friend ParallelMat;
+};
@@ -0,0 +1,251 @@
+#include "positionIndex.hpp"
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <optional>
+#include <set>
+#include <sstream>
+#include <stdexcept>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+static constexpr char INDEX_MAGIC[8] = {'C', 'H', 'E', 'S', 'S', 'I', 'D', 'X'};
+static constexpr std::uint32_t INDEX_VERSION = 1;
+
+namespace {
+
+constexpr std::uint64_t splitmix64(std::uint64_t& state)
+{
+   std::uint64_t z = (state += 0x9E3779B97F4A7C15ull);
+   z = (z ^ (z >> 30))*0xBF58476D1CE4E5B9ull;
+   z = (z ^ (z >> 27))*0x94D049BB133111EBull;
+   return z ^ (z >> 31);
+}
+
+// a key per piece code of PackedBoard and square, for white to move, for each of the 16 sets
+// of castling rights and for each en passant file
+struct ZobristKeys
+{
+   std::array<std::array<std::uint64_t, 64>, 12> pieces{};
+   std::uint64_t white_to_move = 0;
+   std::array<std::uint64_t, 16> castling{};
+   std::array<std::uint64_t, 8> en_passant{};
+};
+
+constexpr ZobristKeys make_zobrist_keys()
+{
+   ZobristKeys keys;
+   std::uint64_t state = 0x43484553534e4e31ull;
+   for (auto& piece : keys.pieces)
+   {
+      for (std::uint64_t& key : piece) key = splitmix64(state);
+   }
+   keys.white_to_move = splitmix64(state);
+   for (std::uint64_t& key : keys.castling) key = splitmix64(state);
+   for (std::uint64_t& key : keys.en_passant) key = splitmix64(state);
+   return keys;
+}
+
+constexpr ZobristKeys ZOBRIST = make_zobrist_keys();
+
+// counts of one hash summed, `counts` sorted by hash first
+void compact(std::vector<PositionCount>& counts)
+{
+   std::sort(counts.begin(), counts.end(), [](const PositionCount& a, const PositionCount& b) { return a.hash < b.hash; });
+   std::size_t out = 0;
+   for (std::size_t i = 0; i < counts.size(); i++)
+   {
+      if (out > 0 && counts[out - 1].hash == counts[i].hash) counts[out - 1].count += counts[i].count;
+      else counts[out++] = counts[i];
+   }
+   counts.resize(out);
+}
+
+// the counts of `old` (if there is one) and the compacted `added` into a new index at `path`
+// covering `shards`. Written next to it first, so a reader never sees half an index
+void write_merged(const std::string& path, const PositionIndex* old, const PositionCount* old_counts,
+                  const std::vector<PositionCount>& added, std::uint64_t added_records,
+                  const std::vector<std::string>& shards)
+{
+   const std::string temporary = path + ".tmp";
+   std::ofstream file(temporary, std::ios::binary | std::ios::trunc);
+   PositionIndexHeader header{};
+   file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+
+   std::vector<PositionCount> block;
+   block.reserve(4096);
+   auto flush = [&] {
+      file.write(reinterpret_cast<const char*>(block.data()), block.size()*sizeof(PositionCount));
+      header.position_count += block.size();
+      block.clear();
+   };
+
+   // both are sorted, so a single pass merges them
+   const std::size_t old_size = old ? old->positions() : 0;
+   std::size_t a = 0, b = 0;
+   while (a < old_size || b < added.size())
+   {
+      PositionCount count;
+      if (b == added.size() || (a < old_size && old_counts[a].hash < added[b].hash)) count = old_counts[a++];
+      else if (a == old_size || added[b].hash < old_counts[a].hash) count = added[b++];
+      else
+      {
+         count = old_counts[a++];
+         count.count += added[b++].count;
+      }
+      block.push_back(count);
+      if (block.size() == block.capacity()) flush();
+   }
+   flush();
+
+   std::string paths;
+   for (const std::string& shard : shards) paths += shard + "\n";
+   header.shards_offset = sizeof(header) + header.position_count*sizeof(PositionCount);
+   header.shards_size = paths.size();
+   file.write(paths.data(), paths.size());
+
+   std::memcpy(header.magic, INDEX_MAGIC, sizeof(header.magic));
+   header.version = INDEX_VERSION;
+   header.record_count = (old ? old->records() : 0) + added_records;
+   file.seekp(0);
+   file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+   file.close();
+   if (not file) throw std::runtime_error("couldn't write position index " + temporary);
+   if (std::rename(temporary.c_str(), path.c_str()) != 0)
+   {
+      throw std::runtime_error("couldn't replace position index " + path);
+   }
+}
+
+// the hash of every record of the shard at `path` onto `counts`, returns how many there were
+std::uint64_t count_shard(const std::string& path, std::vector<PositionCount>& counts)
+{
+   std::ifstream file(path, std::ios::binary);
+   PositionShardHeader header;
+   if (not file.read(reinterpret_cast<char*>(&header), sizeof(header)) || std::memcmp(header.magic, POSITION_SHARD_MAGIC, sizeof(header.magic)) != 0
+       || header.version != POSITION_SHARD_VERSION)
+   {
+      throw std::runtime_error(path + " isn't a position shard");
+   }
+   std::uint64_t records = 0;
+   PositionRecordHeader record;
+   while (file.read(reinterpret_cast<char*>(&record), sizeof(record)))
+   {
+      counts.push_back({position_hash(record.board), 1, 0});
+      records++;
+      file.seekg(record_size(record.policy_count) - sizeof(record), std::ios::cur);
+   }
+   return records;
+}
+
+}
+
+std::uint64_t position_hash(const PackedBoard& board)
+{
+   std::uint64_t hash = 0;
+   std::uint64_t occupancy = board.occupancy;
+   for (int i = 0; occupancy; i++, occupancy &= occupancy - 1)
+   {
+      const int square = std::countr_zero(occupancy);
+      const int code = (board.pieces[i / 2] >> (i % 2 * 4)) & 0xF;
+      if (code < 12) hash ^= ZOBRIST.pieces[code][square];
+   }
+   if (board.flags & 1) hash ^= ZOBRIST.white_to_move;
+   hash ^= ZOBRIST.castling[(board.flags >> 1) & 0xF];
+   if (board.en_passant < 8) hash ^= ZOBRIST.en_passant[board.en_passant];
+   return hash;
+}
+
+PositionIndex::PositionIndex(const std::string& path)
+{
+   const int fd = open(path.c_str(), O_RDONLY);
+   if (fd < 0) throw std::runtime_error("couldn't open position index " + path);
+   struct stat info;
+   if (fstat(fd, &info) == 0) m_size = info.st_size;
+   if (m_size >= sizeof(PositionIndexHeader)) m_mapping = mmap(nullptr, m_size, PROT_READ, MAP_PRIVATE, fd, 0);
+   close(fd);
+   if (m_mapping == MAP_FAILED || m_mapping == nullptr)
+   {
+      m_mapping = nullptr;
+      throw std::runtime_error("couldn't map position index " + path);
+   }
+
+   std::memcpy(&m_header, m_mapping, sizeof(m_header));
+   if (std::memcmp(m_header.magic, INDEX_MAGIC, sizeof(m_header.magic)) != 0 || m_header.version != INDEX_VERSION
+       || m_header.shards_offset + m_header.shards_size > m_size
+       || sizeof(m_header) + m_header.position_count*sizeof(PositionCount) > m_header.shards_offset)
+   {
+      munmap(m_mapping, m_size);
+      m_mapping = nullptr;
+      throw std::runtime_error(path + " isn't a position index");
+   }
+   m_counts = reinterpret_cast<const PositionCount*>(static_cast<const char*>(m_mapping) + sizeof(m_header));
+
+   // lookups land all over the file
+   madvise(m_mapping, m_size, MADV_RANDOM);
+   m_fences.reserve(m_header.position_count / FENCE_STRIDE + 1);
+   for (std::size_t i = 0; i < m_header.position_count; i += FENCE_STRIDE)
+   {
+      m_fences.push_back(m_counts[i].hash);
+   }
+}
+
+PositionIndex::~PositionIndex()
+{
+   if (m_mapping) munmap(m_mapping, m_size);
+}
+
+std::uint32_t PositionIndex::count(std::uint64_t hash) const
+{
+   // the last block starting at or before `hash`
+   const auto fence = std::upper_bound(m_fences.begin(), m_fences.end(), hash);
+   if (fence == m_fences.begin()) return 0;
+   const std::size_t first = (fence - m_fences.begin() - 1)*FENCE_STRIDE;
+   const std::size_t last = std::min<std::size_t>(first + FENCE_STRIDE, m_header.position_count);
+   const PositionCount* found = std::lower_bound(m_counts + first, m_counts + last, hash,
+      [](const PositionCount& count, std::uint64_t hash) { return count.hash < hash; });
+   return found != m_counts + last && found->hash == hash ? found->count : 0;
+}
+
+std::vector<std::string> PositionIndex::shards() const
+{
+   std::vector<std::string> shards;
+   std::istringstream paths(std::string(static_cast<const char*>(m_mapping) + m_header.shards_offset, m_header.shards_size));
+   for (std::string path; std::getline(paths, path);) shards.push_back(path);
+   return shards;
+}
+
+void PositionIndex::update(const std::string& path, const std::vector<std::string>& shards, std::size_t max_positions)
+{
+   std::vector<std::string> covered;
+   if (std::ifstream(path).good()) covered = PositionIndex(path).shards();
+   std::set<std::string> known(covered.begin(), covered.end());
+
+   std::vector<PositionCount> added;
+   std::uint64_t added_records = 0;
+   auto merge = [&] {
+      compact(added);
+      std::optional<PositionIndex> old;
+      if (std::ifstream(path).good()) old.emplace(path);
+      write_merged(path, old ? &*old : nullptr, old ? old->m_counts : nullptr, added, added_records, covered);
+      added.clear();
+      added_records = 0;
+   };
+
+   for (const std::string& shard : shards)
+   {
+      if (not known.insert(shard).second) continue;
+      added_records += count_shard(shard, added);
+      covered.push_back(shard);
+      if (added.size() < max_positions) continue;
+      // positions repeat, so compacting first often saves a pass over the index
+      compact(added);
+      if (added.size() >= max_positions / 2) merge();
+   }
+   if (added_records > 0 || not std::ifstream(path).good()) merge();
+}
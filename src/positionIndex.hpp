@@ -0,0 +1,71 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include "trainingData.hpp"
+
+// Zobrist hash of a position: its pieces, side to move, castling rights and en passant file.
+// The move counters don't count, so transpositions hash the same
+std::uint64_t position_hash(const PackedBoard& board);
+inline std::uint64_t position_hash(const Board& board) { return position_hash(pack_board(board)); }
+
+// How often each position occurs across a set of shards, kept on disk:
+//
+//   PositionIndexHeader                 64 bytes
+//   PositionCount[position_count]       sorted by hash
+//   shard paths                         one per line, the shards already counted
+//
+// Lookups map the file and only keep every PositionIndex::FENCE_STRIDE'th hash in memory, so
+// finding a position reads a single block of the file
+struct PositionIndexHeader
+{
+   char magic[8];                   // "CHESSIDX"
+   std::uint32_t version;
+   std::uint32_t reserved;
+   std::uint64_t position_count;
+   std::uint64_t record_count;
+   std::uint64_t shards_offset;
+   std::uint64_t shards_size;
+   std::uint64_t reserved2[2];
+};
+static_assert(sizeof(PositionIndexHeader) == 64);
+
+struct PositionCount
+{
+   std::uint64_t hash;
+   std::uint32_t count;
+   std::uint32_t reserved;
+};
+
+class PositionIndex
+{
+public:
+   static constexpr std::size_t FENCE_STRIDE = 256;
+
+   // throws std::runtime_error if `path` isn't an index
+   explicit PositionIndex(const std::string& path);
+   ~PositionIndex();
+   PositionIndex(const PositionIndex&) = delete;
+   PositionIndex& operator=(const PositionIndex&) = delete;
+
+   // counts the records of the `shards` the index at `path` doesn't cover yet into it, making
+   // it if there's none. Counts are gathered in memory up to `max_positions` distinct positions
+   // at a time, then merged into the file streaming, so the index itself is never loaded
+   static void update(const std::string& path, const std::vector<std::string>& shards, std::size_t max_positions = 1 << 24);
+
+   // occurrences of the position, 0 for one that was never counted
+   std::uint32_t count(std::uint64_t hash) const;
+
+   std::uint64_t positions() const { return m_header.position_count; }
+   std::uint64_t records() const { return m_header.record_count; }
+   std::vector<std::string> shards() const;
+
+private:
+   void* m_mapping = nullptr;
+   std::size_t m_size = 0;
+   PositionIndexHeader m_header;
+   const PositionCount* m_counts = nullptr;
+   // the hash of every FENCE_STRIDE'th count
+   std::vector<std::uint64_t> m_fences;
+};
@@ -0,0 +1,36 @@
+#include "profiler.hpp"
+#include "backend.hpp"
+#include "oclData.hpp"
+
+const char* phase_name(TrainingPhase phase)
+{
+   switch (phase)
+   {
+   case PHASE_DATA: return "data";
+   case PHASE_FORWARD: return "forward";
+   case PHASE_BACKWARD: return "backward";
+   case PHASE_UPDATE: return "update";
+   case PHASE_VALIDATION: return "validation";
+   case PHASE_CHECKPOINT: return "checkpoint";
+   default: return "unknown";
+   }
+}
+
+void PhaseProfiler::reset()
+{
+   m_seconds.fill(0.0);
+   m_start = m_last = Clock::now();
+}
+
+void PhaseProfiler::mark(TrainingPhase phase)
+{
+   if (m_synchronize && mat_backend != CPU_BACKEND) ocl_finish();
+   const Clock::time_point now = Clock::now();
+   m_seconds[phase] += std::chrono::duration<double>(now - m_last).count();
+   m_last = now;
+}
+
+double PhaseProfiler::totalSeconds() const
+{
+   return std::chrono::duration<double>(Clock::now() - m_start).count();
+}
@@ -0,0 +1,43 @@
+#pragma once
+
+#include <array>
+#include <chrono>
+
+enum TrainingPhase
+{
+   PHASE_DATA = 0,         // waiting for the next batch
+   PHASE_FORWARD,
+   PHASE_BACKWARD,         // including forward passes recomputed by gradient checkpointing
+   PHASE_UPDATE,           // the optimizers
+   PHASE_VALIDATION,
+   PHASE_CHECKPOINT,
+   PHASE_COUNT
+};
+
+const char* phase_name(TrainingPhase phase);
+
+// wall time spent in each phase of training. Commands run asynchronously on OpenCL devices,
+// so with `synchronize` set each phase waits for them to finish before it's timed, which puts
+// device time in the phase that queued it at the cost of overlapping the next phase with it
+class PhaseProfiler
+{
+public:
+   PhaseProfiler(bool synchronize = true) :m_synchronize{synchronize} { reset(); }
+
+   // zeroes every phase and starts timing
+   void reset();
+   // the time since the last `mark` or `reset` goes to `phase`
+   void mark(TrainingPhase phase);
+
+   double seconds(TrainingPhase phase) const { return m_seconds[phase]; }
+   // since `reset`
+   double totalSeconds() const;
+   bool synchronizes() const { return m_synchronize; }
+
+private:
+   using Clock = std::chrono::steady_clock;
+   bool m_synchronize;
+   Clock::time_point m_start;
+   Clock::time_point m_last;
+   std::array<double, PHASE_COUNT> m_seconds;
+};
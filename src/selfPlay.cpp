@@ -0,0 +1,424 @@
+#include "selfPlay.hpp"
+#include "positionIndex.hpp"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <iostream>
+#include <numeric>
+#include <unordered_map>
+
+BatchedEvaluator::BatchedEvaluator(const NNet& policy_net, const NNet& value_net)
+   :m_policy_net{policy_net}
+   ,m_value_net{value_net}
+{
+}
+
+BatchedEvaluator::Evaluation BatchedEvaluator::evaluate(const std::vector<PackedBoard>& positions, const std::vector<std::vector<int>>& legal)
+{
+   assert(legal.empty() || legal.size() == positions.size());
+   const unsigned count = positions.size();
+   Evaluation evaluation{std::vector<float>(std::size_t(count)*POLICY_SIZE), std::vector<float>(count)};
+
+   // the positions the nets have to evaluate, and the ones repeating one of them
+   std::vector<unsigned> misses;
+   std::vector<std::pair<unsigned, unsigned>> repeats;
+   std::vector<std::uint64_t> hashes;
+   if (m_cache)
+   {
+      std::unordered_map<std::uint64_t, unsigned> queued;
+      hashes.resize(count);
+      for (unsigned i = 0; i < count; i++)
+      {
+         hashes[i] = position_hash(positions[i]);
+         if (m_cache->lookup(hashes[i], &evaluation.policy[std::size_t(i)*POLICY_SIZE], &evaluation.value[i])) continue;
+         const auto [first, inserted] = queued.try_emplace(hashes[i], i);
+         if (inserted) misses.push_back(i);
+         else repeats.push_back({i, first->second});
+      }
+   }
+   else
+   {
+      misses.resize(count);
+      std::iota(misses.begin(), misses.end(), 0);
+   }
+   if (misses.empty()) return evaluation;
+
+   const unsigned n_misses = misses.size();
+   std::vector<float> inputs(std::size_t(n_misses)*POSITION_INPUT_SIZE);
+   for (unsigned i = 0; i < n_misses; i++)
+   {
+      encode_position(positions[misses[i]], &inputs[std::size_t(i)*POSITION_INPUT_SIZE]);
+   }
+   const ParallelMat batch(POSITION_INPUT_SIZE, 1, n_misses, std::move(inputs));
+
+   // both nets are queued before either result is waited on
+   auto policy_future = m_policy_net.compute(batch).getValsAsync();
+   auto value_future = m_value_net.compute(batch).getValsAsync();
+   const std::vector<float> policy = policy_future.get();
+   const std::vector<float> value = value_future.get();
+   assert(policy.size() == std::size_t(n_misses)*POLICY_SIZE && value.size() == n_misses);
+
+   for (unsigned i = 0; i < n_misses; i++)
+   {
+      const unsigned position = misses[i];
+      float* position_policy = &evaluation.policy[std::size_t(position)*POLICY_SIZE];
+      std::copy_n(&policy[std::size_t(i)*POLICY_SIZE], POLICY_SIZE, position_policy);
+      evaluation.value[position] = 2.f*value[i] - 1.f;
+      if (m_cache && not legal.empty()) m_cache->store(hashes[position], position_policy, legal[position], evaluation.value[position]);
+   }
+   for (auto [position, first] : repeats)
+   {
+      std::copy_n(&evaluation.policy[std::size_t(first)*POLICY_SIZE], POLICY_SIZE, &evaluation.policy[std::size_t(position)*POLICY_SIZE]);
+      evaluation.value[position] = evaluation.value[first];
+   }
+   m_positions += n_misses;
+   m_batches++;
+   return evaluation;
+}
+
+namespace {
+
+struct Node
+{
+   Node(const Move& move, float prior) :move{move}, prior{prior} {}
+
+   Move move;
+   float prior;
+   unsigned visits = 0;
+   // from the point of view of the side that made `move`
+   float value_sum = 0.f;
+   unsigned first_child = 0;
+   unsigned n_children = 0;
+   // set once the position is known to be over, its value for the side to move
+   std::optional<float> terminal;
+};
+
+}
+
+struct SelfPlay::Game
+{
+   Board board;
+   std::uint32_t id;
+   unsigned ply = 0;
+   std::mt19937 rng;
+   std::vector<PositionRecord> records;
+   // position_hash of every position of the game so far, the current one last
+   std::vector<std::uint64_t> history;
+
+   // the search of the current move, the root first
+   std::vector<Node> tree;
+   // from the root to the leaf waiting on the evaluator, whose moves are done on `board`
+   std::vector<unsigned> path;
+   std::vector<Move> leaf_moves;
+   bool waiting = false;
+   std::optional<int> result;   // for white, once the game is over
+
+   bool can_resign = true;
+   // moves in a row each side has made with the root's value below the resign threshold
+   unsigned low_value_moves[2] = {0, 0};
+   std::optional<Color> would_resign;
+
+   Game(std::uint32_t id, std::uint64_t seed)
+      :id{id}
+      ,rng(seed)
+   {
+      resetTree();
+      history.push_back(position_hash(board));
+   }
+
+   // how often the game itself has been in the position on `board`
+   unsigned occurrences() const
+   {
+      return std::count(history.begin(), history.end(), position_hash(board));
+   }
+
+   void resetTree()
+   {
+      tree.clear();
+      tree.push_back(Node(Move({0, 0}, {0, 0}), 1.f));
+   }
+
+   // root visits for the side to move
+   float rootValue() const
+   {
+      return tree[0].visits ? -tree[0].value_sum / tree[0].visits : 0.f;
+   }
+
+   // `value` for the side to move at the end of `path`, up to the root
+   void backup(float value)
+   {
+      value = -value;
+      for (auto it = path.rbegin(); it != path.rend(); it++)
+      {
+         tree[*it].visits++;
+         tree[*it].value_sum += value;
+         value = -value;
+      }
+      for (std::size_t i = 1; i < path.size(); i++) board.undoMove();
+      path.clear();
+   }
+
+   unsigned bestChild(unsigned parent, float c_puct) const
+   {
+      const Node& node = tree[parent];
+      const float exploration = c_puct*std::sqrt(static_cast<float>(std::max(1u, node.visits)));
+      unsigned best = node.first_child;
+      float best_score = -1e30f;
+      for (unsigned child = node.first_child; child < node.first_child + node.n_children; child++)
+      {
+         const Node& c = tree[child];
+         const float q = c.visits ? c.value_sum / c.visits : 0.f;
+         const float score = q + exploration*c.prior / (1 + c.visits);
+         if (score > best_score)
+         {
+            best_score = score;
+            best = child;
+         }
+      }
+      return best;
+   }
+
+   // walks down to a leaf that needs the evaluator, backing up the positions that are over on
+   // the way. Stops early once the root has its playouts or the game itself is over
+   void select(const SelfPlaySettings& settings)
+   {
+      while (tree[0].visits < settings.playouts || tree[0].n_children == 0)
+      {
+         path = {0};
+         unsigned node = 0;
+         while (tree[node].n_children > 0)
+         {
+            node = bestChild(node, settings.c_puct);
+            board.doMove(tree[node].move);
+            path.push_back(node);
+         }
+
+         if (not tree[node].terminal)
+         {
+            std::set<Move> moves = board.getAllLegalMoves();
+            if (moves.empty()) tree[node].terminal = board.inCheck() ? -1.f : 0.f;
+            // a leaf the game has been in twice already would be a threefold repetition
+            else if (board.halfmoves() >= 100 || (node != 0 && occurrences() >= 2)) tree[node].terminal = 0.f;
+            else
+            {
+               leaf_moves.assign(moves.begin(), moves.end());
+               waiting = true;
+               return;
+            }
+         }
+         if (node == 0)
+         {
+            // checkmate or a draw in the game itself
+            const float value = *tree[0].terminal;
+            result = value == 0.f ? 0 : (board.currentPlayer() == WHITE ? -1 : 1);
+            path.clear();
+            return;
+         }
+         backup(*tree[node].terminal);
+      }
+   }
+
+   void expand(const float* policy, float value, const SelfPlaySettings& settings)
+   {
+      const unsigned leaf = path.back();
+      const Color mover = board.currentPlayer();
+      tree[leaf].first_child = tree.size();
+      tree[leaf].n_children = leaf_moves.size();
+      float total = 0.f;
+      for (const Move& move : leaf_moves)
+      {
+         const float prior = policy[policy_index(move, mover)];
+         tree.push_back(Node(move, prior));
+         total += prior;
+      }
+      for (unsigned child = tree[leaf].first_child; child < tree.size(); child++)
+      {
+         tree[child].prior = total > 0.f ? tree[child].prior / total : 1.f / leaf_moves.size();
+      }
+
+      if (leaf == 0 && settings.noise_fraction > 0.f)
+      {
+         std::gamma_distribution<float> gamma(settings.dirichlet_alpha, 1.f);
+         std::vector<float> noise(leaf_moves.size());
+         float noise_total = 0.f;
+         for (float& n : noise) noise_total += n = gamma(rng);
+         for (unsigned i = 0; i < noise.size(); i++)
+         {
+            float& prior = tree[tree[0].first_child + i].prior;
+            prior = (1.f - settings.noise_fraction)*prior + settings.noise_fraction*noise[i] / std::max(noise_total, 1e-20f);
+         }
+      }
+
+      waiting = false;
+      backup(value);
+   }
+};
+
+SelfPlay::SelfPlay(BatchedEvaluator& evaluator, const SelfPlaySettings& settings)
+   :m_evaluator{evaluator}
+   ,m_settings{settings}
+   ,m_rng(settings.seed)
+{
+}
+
+void SelfPlay::startGame(std::vector<std::unique_ptr<Game>>& games)
+{
+   auto game = std::make_unique<Game>(m_games_started++, m_rng());
+   game->can_resign = std::uniform_real_distribution<float>(0.f, 1.f)(m_rng) >= m_settings.no_resign_fraction;
+   games.push_back(std::move(game));
+}
+
+SelfPlayStats SelfPlay::play(unsigned games_to_play)
+{
+   const auto start = std::chrono::steady_clock::now();
+   const std::size_t positions_before = m_evaluator.positions();
+   const std::size_t batches_before = m_evaluator.batches();
+   m_stats = SelfPlayStats();
+
+   std::vector<std::unique_ptr<Game>> games;
+   unsigned started = 0;
+   for (; started < std::min(games_to_play, m_settings.games_in_flight); started++) startGame(games);
+
+   std::vector<PackedBoard> leaves;
+   std::vector<std::vector<int>> legal;
+   std::vector<Game*> waiting;
+   while (not games.empty())
+   {
+      #pragma omp parallel for schedule(dynamic)
+      for (std::size_t i = 0; i < games.size(); i++)
+      {
+         games[i]->select(m_settings);
+      }
+
+      leaves.clear();
+      legal.clear();
+      waiting.clear();
+      for (auto& game : games)
+      {
+         if (not game->waiting) continue;
+         leaves.push_back(pack_board(game->board));
+         std::vector<int>& indices = legal.emplace_back();
+         for (const Move& move : game->leaf_moves) indices.push_back(policy_index(move, game->board.currentPlayer()));
+         waiting.push_back(game.get());
+      }
+
+      if (not leaves.empty())
+      {
+         const BatchedEvaluator::Evaluation evaluation = m_evaluator.evaluate(leaves, legal);
+         #pragma omp parallel for schedule(dynamic)
+         for (std::size_t i = 0; i < waiting.size(); i++)
+         {
+            waiting[i]->expand(&evaluation.policy[i*POLICY_SIZE], evaluation.value[i], m_settings);
+         }
+      }
+
+      for (std::size_t i = 0; i < games.size();)
+      {
+         Game& game = *games[i];
+         if (not game.result && game.tree[0].n_children > 0 && game.tree[0].visits >= m_settings.playouts) move(game);
+         if (not game.result)
+         {
+            i++;
+            continue;
+         }
+         finish(game, *game.result);
+         games.erase(games.begin() + i);
+         if (started < games_to_play)
+         {
+            startGame(games);
+            started++;
+         }
+      }
+   }
+
+   if (m_writer) m_writer->flush();
+   m_stats.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+   const std::size_t batches = m_evaluator.batches() - batches_before;
+   m_stats.average_batch = batches ? double(m_evaluator.positions() - positions_before) / batches : 0.0;
+   return m_stats;
+}
+
+void SelfPlay::move(Game& game)
+{
+   const Node& root = game.tree[0];
+   const Color mover = game.board.currentPlayer();
+
+   PositionRecord record;
+   record.board = pack_board(game.board);
+   record.ply = game.ply;
+   record.game_id = game.id;
+   record.value = game.rootValue();
+   std::vector<float> weights;
+   const float temperature = m_settings.temperature(game.ply);
+   unsigned child_visits = 0;
+   for (unsigned child = root.first_child; child < root.first_child + root.n_children; child++)
+   {
+      child_visits += game.tree[child].visits;
+   }
+   for (unsigned child = root.first_child; child < root.first_child + root.n_children; child++)
+   {
+      const Node& node = game.tree[child];
+      record.policy.push_back({policy_index(node.move, mover), static_cast<float>(node.visits) / std::max(1u, child_visits)});
+      weights.push_back(temperature > 0.f ? std::pow(static_cast<float>(node.visits), 1.f / temperature) : 0.f);
+   }
+   game.records.push_back(std::move(record));
+
+   unsigned& low_value_moves = game.low_value_moves[mover];
+   if (game.rootValue() < m_settings.resign_threshold) low_value_moves++;
+   else low_value_moves = 0;
+   if (low_value_moves >= m_settings.resign_moves)
+   {
+      if (game.can_resign)
+      {
+         m_stats.resignations++;
+         game.result = mover == WHITE ? -1 : 1;
+         return;
+      }
+      if (not game.would_resign) game.would_resign = mover;
+   }
+
+   unsigned chosen = 0;
+   if (temperature > 0.f)
+   {
+      chosen = std::discrete_distribution<unsigned>(weights.begin(), weights.end())(game.rng);
+   }
+   else
+   {
+      for (unsigned i = 1; i < root.n_children; i++)
+      {
+         if (game.tree[root.first_child + i].visits > game.tree[root.first_child + chosen].visits) chosen = i;
+      }
+   }
+
+   game.board.doMove(game.tree[root.first_child + chosen].move);
+   game.ply++;
+   game.resetTree();
+   game.history.push_back(position_hash(game.board));
+   if (game.ply >= m_settings.max_plies || game.occurrences() >= 3) game.result = 0;
+}
+
+void SelfPlay::finish(Game& game, int result)
+{
+   m_stats.games++;
+   m_stats.positions += game.records.size();
+   if (result > 0) m_stats.white_wins++;
+   else if (result < 0) m_stats.black_wins++;
+   else m_stats.draws++;
+   if (game.would_resign)
+   {
+      m_stats.would_resign++;
+      if (result != (*game.would_resign == WHITE ? -1 : 1)) m_stats.false_resignations++;
+   }
+
+   if (not m_writer || m_games_in_shard == m_settings.games_per_shard)
+   {
+      m_writer.emplace(m_settings.output_prefix + std::to_string(m_shard++) + ".bin");
+      m_games_in_shard = 0;
+   }
+   for (PositionRecord& record : game.records)
+   {
+      record.result = result;
+      m_writer->write(record);
+   }
+   m_games_in_shard++;
+}
@@ -0,0 +1,118 @@
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <optional>
+#include <random>
+#include <string>
+#include <vector>
+#include "board.hpp"
+#include "evaluationCache.hpp"
+#include "nnet.hpp"
+#include "trainingData.hpp"
+
+// the policy and value nets of self-play, run on whole batches of positions. The policy net
+// maps POSITION_INPUT_SIZE inputs to a distribution over POLICY_SIZE moves, the value net to
+// the chance the side to move wins, as trained on TrainingBatch::policy and ::value
+class BatchedEvaluator
+{
+public:
+   BatchedEvaluator(const NNet& policy_net, const NNet& value_net);
+
+   struct Evaluation
+   {
+      std::vector<float> policy;    // POLICY_SIZE per position
+      std::vector<float> value;     // for the side to move, in [-1, 1]
+   };
+   // `legal` holds the policy indices of each position's legal moves, which is all a cache
+   // keeps of a policy; without it positions are still looked up, but none are stored
+   Evaluation evaluate(const std::vector<PackedBoard>& positions, const std::vector<std::vector<int>>& legal = {});
+
+   // positions found in `cache` aren't evaluated again, and the ones that aren't go into it.
+   // Repeats of a position within a batch are evaluated once as well. The evaluator doesn't
+   // own the cache, which can be shared between evaluators of the same nets; nullptr turns it off
+   void setCache(EvaluationCache* cache) { m_cache = cache; }
+
+   // positions the nets evaluated, and in how many batches
+   std::size_t positions() const { return m_positions; }
+   std::size_t batches() const { return m_batches; }
+
+private:
+   const NNet& m_policy_net;
+   const NNet& m_value_net;
+   EvaluationCache* m_cache = nullptr;
+   std::size_t m_positions = 0;
+   std::size_t m_batches = 0;
+};
+
+struct SelfPlaySettings
+{
+   // games played at once, each contributing a position to every evaluator batch
+   unsigned games_in_flight = 256;
+   // visits of the root before each move
+   unsigned playouts = 800;
+   float c_puct = 1.5f;
+   // noise mixed into the root's priors
+   float dirichlet_alpha = 0.3f;
+   float noise_fraction = 0.25f;
+   // moves are sampled from the root's visits to the power of 1/temperature, 0 picks the most visited
+   std::function<float(unsigned ply)> temperature = [](unsigned ply) { return ply < 30 ? 1.f : 0.f; };
+   // a side resigns once the root's value for it stays below this for `resign_moves` moves
+   // in a row, -1 never resigns. `no_resign_fraction` of games play on regardless, to count
+   // how often resigning would have thrown away a game that wasn't lost
+   float resign_threshold = -0.95f;
+   unsigned resign_moves = 3;
+   float no_resign_fraction = 0.1f;
+   // games still going are drawn here
+   unsigned max_plies = 512;
+   // finished games go to "<output_prefix><shard>.bin", a new shard every `games_per_shard`
+   std::string output_prefix = "selfplay_";
+   unsigned games_per_shard = 1000;
+   std::uint64_t seed = 0;
+};
+
+struct SelfPlayStats
+{
+   unsigned games = 0;
+   std::size_t positions = 0;
+   unsigned white_wins = 0;
+   unsigned black_wins = 0;
+   unsigned draws = 0;
+   unsigned resignations = 0;
+   // games played on that would have resigned, and how many of those the resigning side didn't lose
+   unsigned would_resign = 0;
+   unsigned false_resignations = 0;
+   double average_batch = 0.0;
+   double seconds = 0.0;
+};
+
+// AlphaZero style self-play: many games at once, each searched by its own MCTS, with the
+// leaves of all of them evaluated together. Every round each game walks its tree down to one
+// unexpanded leaf (in parallel across games), the leaves are evaluated as a single batch,
+// then each game expands its leaf and backs the value up
+class SelfPlay
+{
+public:
+   SelfPlay(BatchedEvaluator& evaluator, const SelfPlaySettings& settings = SelfPlaySettings());
+
+   // plays `games` more games to the end, writing them out as they finish
+   SelfPlayStats play(unsigned games);
+
+private:
+   struct Game;
+
+   // the game's next move once its root has had its playouts, or the end of the game
+   void move(Game& game);
+   void finish(Game& game, int result);
+   void startGame(std::vector<std::unique_ptr<Game>>& games);
+
+   BatchedEvaluator& m_evaluator;
+   SelfPlaySettings m_settings;
+   std::mt19937_64 m_rng;
+   std::optional<PositionWriter> m_writer;
+   unsigned m_shard = 0;
+   unsigned m_games_started = 0;
+   unsigned m_games_in_shard = 0;
+   SelfPlayStats m_stats;
+};
@@ -0,0 +1,202 @@
+#include "trainer.hpp"
+#include "trainingData.hpp"
+#include <algorithm>
+#include <cmath>
+#include <filesystem>
+#include <iomanip>
+#include <numbers>
+#include <sstream>
+
+LearningRateSchedule constant_schedule(float learning_rate)
+{
+   return [learning_rate](unsigned) { return learning_rate; };
+}
+
+LearningRateSchedule step_schedule(float initial, float factor, unsigned every)
+{
+   return [=](unsigned step) { return initial*std::pow(factor, static_cast<float>(step / every)); };
+}
+
+LearningRateSchedule cosine_schedule(float peak, unsigned warmup_steps, unsigned total_steps, float final_rate)
+{
+   return [=](unsigned step) {
+      if (step < warmup_steps) return peak*(step + 1) / warmup_steps;
+      if (step >= total_steps) return final_rate;
+      const float progress = static_cast<float>(step - warmup_steps) / std::max(1u, total_steps - warmup_steps);
+      return final_rate + 0.5f*(peak - final_rate)*(1.f + std::cos(std::numbers::pi_v<float>*progress));
+   };
+}
+
+BatchSource value_batches(TrainingDataLoader& loader)
+{
+   return [&loader]() -> std::optional<std::pair<ParallelMat, ParallelMat>> {
+      std::optional<TrainingBatch> batch = loader.next();
+      if (not batch) return std::nullopt;
+      return std::pair{batch->inputs, batch->value};
+   };
+}
+
+BatchSource policy_batches(TrainingDataLoader& loader)
+{
+   return [&loader]() -> std::optional<std::pair<ParallelMat, ParallelMat>> {
+      std::optional<TrainingBatch> batch = loader.next();
+      if (not batch) return std::nullopt;
+      return std::pair{batch->inputs, batch->policy};
+   };
+}
+
+Trainer::Trainer(NNet& net, const TrainerSettings& settings)
+   :m_net{net}
+   ,m_settings{settings}
+   ,m_profiler(settings.synchronize_phases)
+{
+}
+
+TrainingReport Trainer::train(const BatchSource& source)
+{
+   m_net.setProfiler(&m_profiler);
+   m_profiler.reset();
+   std::size_t samples = 0;
+   unsigned steps = 0;
+   std::optional<ValidationResult> validation;
+
+   for (unsigned epoch = 0; epoch < m_settings.epochs; epoch++)
+   {
+      unsigned epoch_steps = 0;
+      while (m_settings.steps_per_epoch == 0 || epoch_steps < m_settings.steps_per_epoch)
+      {
+         std::optional<std::pair<ParallelMat, ParallelMat>> batch = source();
+         m_profiler.mark(PHASE_DATA);
+         if (not batch) break;
+
+         m_net.backPropagate(batch->first, batch->second);
+         m_net.applyWeightsAndBiasesGradients(m_settings.learning_rate(m_step));
+         m_profiler.mark(PHASE_UPDATE);
+
+         samples += batch->first.getCount();
+         steps++;
+         epoch_steps++;
+         m_step++;
+
+         if (m_settings.validation_interval > 0 && m_step % m_settings.validation_interval == 0 && not m_validation.empty())
+         {
+            validation = validate();
+            m_profiler.mark(PHASE_VALIDATION);
+         }
+         if (m_settings.checkpoint_interval > 0 && m_step % m_settings.checkpoint_interval == 0)
+         {
+            checkpoint();
+            m_profiler.mark(PHASE_CHECKPOINT);
+         }
+         if (m_settings.report_interval > 0 && m_step % m_settings.report_interval == 0)
+         {
+            TrainingReport progress = report(samples, steps);
+            progress.validation = validation;
+            logProgress(progress);
+         }
+      }
+
+      if (not m_validation.empty())
+      {
+         validation = validate();
+         m_profiler.mark(PHASE_VALIDATION);
+      }
+      checkpoint();
+      m_profiler.mark(PHASE_CHECKPOINT);
+      // a source that's out of batches at the start of an epoch has none left at all
+      if (epoch_steps == 0) break;
+   }
+
+   m_net.setProfiler(nullptr);
+   TrainingReport final_report = report(samples, steps);
+   final_report.validation = validation;
+   logProgress(final_report);
+   return final_report;
+}
+
+ValidationResult Trainer::validate() const
+{
+   double loss = 0.0;
+   unsigned correct = 0;
+   unsigned counted = 0;
+   ValidationResult result;
+   for (const auto& [inputs, targets] : m_validation)
+   {
+      const std::vector<float> outputs = m_net.compute(inputs).getVals();
+      const std::vector<float> desired = targets.getVals();
+      const unsigned size = targets.getHeight()*targets.getWidth();
+      for (unsigned i = 0; i < targets.getCount(); i++)
+      {
+         const float* output = &outputs[i*size];
+         const float* target = &desired[i*size];
+         if (size == 1)
+         {
+            const float p = std::clamp(*output, 1e-7f, 1.f - 1e-7f);
+            loss -= *target*std::log(p) + (1.f - *target)*std::log(1.f - p);
+            if (*target != 0.5f)
+            {
+               counted++;
+               correct += (*output > 0.5f) == (*target > 0.5f);
+            }
+         }
+         else
+         {
+            for (unsigned j = 0; j < size; j++)
+            {
+               if (target[j] > 0.f) loss -= target[j]*std::log(std::max(output[j], 1e-7f));
+            }
+            counted++;
+            correct += std::max_element(output, output + size) - output == std::max_element(target, target + size) - target;
+         }
+      }
+      result.samples += targets.getCount();
+   }
+   result.loss = result.samples ? loss / result.samples : 0.f;
+   result.accuracy = counted ? static_cast<float>(correct) / counted : 0.f;
+   return result;
+}
+
+TrainingReport Trainer::report(std::size_t samples, unsigned steps) const
+{
+   TrainingReport report;
+   report.steps = steps;
+   report.samples = samples;
+   report.seconds = m_profiler.totalSeconds();
+   report.samples_per_second = report.seconds > 0.0 ? samples / report.seconds : 0.0;
+   for (int phase = 0; phase < PHASE_COUNT; phase++)
+   {
+      report.phase_seconds[phase] = m_profiler.seconds(static_cast<TrainingPhase>(phase));
+   }
+   const double device = report.phase_seconds[PHASE_FORWARD] + report.phase_seconds[PHASE_BACKWARD] + report.phase_seconds[PHASE_UPDATE];
+   report.device_utilization = report.seconds > 0.0 ? device / report.seconds : 0.0;
+   return report;
+}
+
+void Trainer::logProgress(const TrainingReport& report) const
+{
+   if (m_settings.log == nullptr) return;
+   // formatted aside, so the log stream keeps its own precision
+   std::ostringstream line;
+   line << "step " << m_step << std::fixed << std::setprecision(0) << "  " << report.samples_per_second << " samples/s ";
+   for (int phase = 0; phase < PHASE_COUNT; phase++)
+   {
+      const double share = report.seconds > 0.0 ? 100.0*report.phase_seconds[phase] / report.seconds : 0.0;
+      line << " " << phase_name(static_cast<TrainingPhase>(phase)) << " " << share << "%";
+   }
+   line << "  device " << 100.0*report.device_utilization << "%";
+   if (report.validation)
+   {
+      line << std::setprecision(4) << "  validation loss " << report.validation->loss
+           << " accuracy " << std::setprecision(1) << 100.f*report.validation->accuracy << "%";
+   }
+   *m_settings.log << line.str() << std::endl;
+}
+
+void Trainer::checkpoint() const
+{
+   if (m_settings.checkpoint_path.empty()) return;
+   // written aside first so a crash never leaves a half written checkpoint behind
+   const std::string temporary = m_settings.checkpoint_path + ".tmp";
+   m_net.save(temporary);
+   std::filesystem::rename(temporary, m_settings.checkpoint_path);
+}
@@ -0,0 +1,103 @@
+#pragma once
+
+#include <functional>
+#include <iostream>
+#include <optional>
+#include <string>
+#include <utility>
+#include <vector>
+#include "nnet.hpp"
+#include "profiler.hpp"
+
+class TrainingDataLoader;
+
+// the learning rate of each step, counting from 0
+using LearningRateSchedule = std::function<float(unsigned step)>;
+
+LearningRateSchedule constant_schedule(float learning_rate);
+// multiplied by `factor` every `every` steps
+LearningRateSchedule step_schedule(float initial, float factor, unsigned every);
+// linear warmup to `peak` over `warmup_steps`, then a cosine down to `final_rate` at `total_steps`
+LearningRateSchedule cosine_schedule(float peak, unsigned warmup_steps, unsigned total_steps, float final_rate = 0.f);
+
+// the next {inputs, desired outputs} batch, or nothing at the end of an epoch. Called again
+// after that it starts the next epoch
+using BatchSource = std::function<std::optional<std::pair<ParallelMat, ParallelMat>>()>;
+
+// batches of a TrainingDataLoader against their value or policy targets
+BatchSource value_batches(TrainingDataLoader& loader);
+BatchSource policy_batches(TrainingDataLoader& loader);
+
+struct TrainerSettings
+{
+   unsigned epochs = 1;
+   // 0 trains each epoch until the source runs out, which a looping one never does
+   unsigned steps_per_epoch = 0;
+   LearningRateSchedule learning_rate = constant_schedule(0.01f);
+   // steps between validations, 0 to only validate at the end of each epoch
+   unsigned validation_interval = 0;
+   // steps between progress lines on `log`, 0 for none
+   unsigned report_interval = 100;
+   // steps between checkpoints to `checkpoint_path`, 0 to only save at the end of each epoch.
+   // No checkpoints without a path
+   unsigned checkpoint_interval = 0;
+   std::string checkpoint_path;
+   // see PhaseProfiler. Off keeps the device busy across phases, but then the times are
+   // only how long the host took to queue the work
+   bool synchronize_phases = true;
+   std::ostream* log = &std::cout;
+};
+
+struct ValidationResult
+{
+   // binary cross entropy for a single output, cross entropy against the target distribution otherwise
+   float loss = 0.f;
+   // a single output is right when it's on the same side of 0.5 as the target, which draws
+   // (targets of exactly 0.5) don't count for. Otherwise the largest output has to be the target's
+   float accuracy = 0.f;
+   unsigned samples = 0;
+};
+
+struct TrainingReport
+{
+   unsigned steps = 0;
+   std::size_t samples = 0;
+   double seconds = 0.0;
+   double samples_per_second = 0.0;
+   std::array<double, PHASE_COUNT> phase_seconds{};
+   // the share of the time spent in the forward, backward and update phases, which is how
+   // busy the device was when the phases are synchronized
+   double device_utilization = 0.0;
+   std::optional<ValidationResult> validation;
+};
+
+// runs the training loop of an NNet: minibatches from a BatchSource, the learning rate from a
+// schedule, periodic validation and checkpoints, and where the time went
+class Trainer
+{
+public:
+   Trainer(NNet& net, const TrainerSettings& settings = TrainerSettings());
+
+   // evaluated whole at every validation
+   void setValidation(std::vector<std::pair<ParallelMat, ParallelMat>> batches) { m_validation = std::move(batches); }
+
+   // `settings.epochs` epochs over `source`, continuing the step count and learning rate
+   // schedule of earlier calls
+   TrainingReport train(const BatchSource& source);
+
+   ValidationResult validate() const;
+
+   unsigned step() const { return m_step; }
+
+private:
+   // since the last reset of `m_profiler`
+   TrainingReport report(std::size_t samples, unsigned steps) const;
+   void logProgress(const TrainingReport& report) const;
+   void checkpoint() const;
+
+   NNet& m_net;
+   TrainerSettings m_settings;
+   std::vector<std::pair<ParallelMat, ParallelMat>> m_validation;
+   PhaseProfiler m_profiler;
+   unsigned m_step = 0;
+};
@@ -0,0 +1,383 @@
+#include "trainingData.hpp"
+#include "positionIndex.hpp"
+#include "augmentation.hpp"
+#include <algorithm>
+#include <bit>
+#include <cmath>
+#include <cstring>
+#include <iostream>
+#include <numeric>
+#include <random>
+#include <stdexcept>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+static_assert(std::endian::native == std::endian::little);
+
+
+int policy_index(const Move& move, Color side_to_move)
+{
+   if (move.promotion && *move.promotion != QUEEN)
+   {
+      const int piece = *move.promotion == KNIGHT ? 0 : *move.promotion == BISHOP ? 1 : 2;
+      const int direction = move.end.col - move.start.col + 1;
+      return 64*64 + (move.start.col*3 + direction)*3 + piece;
+   }
+   const int flip = side_to_move == BLACK ? 56 : 0;
+   return ((8*move.start.row + move.start.col) ^ flip)*64 + ((8*move.end.row + move.end.col) ^ flip);
+}
+
+PackedBoard pack_board(const Board& board)
+{
+   PackedBoard packed{};
+   int n_pieces = 0;
+   for (int square = 0; square < 64; square++)
+   {
+      const OptionalPiece& piece = board.pieceAt(Square{.row = square / 8, .col = square % 8});
+      if (not piece) continue;
+      packed.occupancy |= std::uint64_t(1) << square;
+      const int code = piece->type + (piece->color == BLACK ? 6 : 0);
+      packed.pieces[n_pieces / 2] |= code << (4*(n_pieces % 2));
+      n_pieces++;
+   }
+   packed.flags = (board.currentPlayer() == WHITE) |
+                  board.kingsideAvailable(WHITE) << 1 | board.queensideAvailable(WHITE) << 2 |
+                  board.kingsideAvailable(BLACK) << 3 | board.queensideAvailable(BLACK) << 4;
+   packed.en_passant = board.enPassantSquare() ? board.enPassantSquare()->col : 0xFF;
+   packed.halfmoves = std::min(board.halfmoves(), 255);
+   packed.fullmoves = board.fullmoves();
+   return packed;
+}
+
+Color side_to_move(const PackedBoard& board)
+{
+   return board.flags & 1 ? WHITE : BLACK;
+}
+
+PositionWriter::PositionWriter(const std::string& path)
+   :m_file(path, std::ios::binary | std::ios::trunc)
+   ,m_path{path}
+{
+   PositionShardHeader header{};
+   std::memcpy(header.magic, POSITION_SHARD_MAGIC, sizeof(header.magic));
+   header.version = POSITION_SHARD_VERSION;
+   m_file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+   if (not m_file) throw std::runtime_error("couldn't write shard " + m_path);
+}
+
+void PositionWriter::write(const PositionRecord& record)
+{
+   if (record.policy.size() > 255) throw std::runtime_error("a position has at most 218 legal moves");
+
+   PositionRecordHeader header{record.board, record.result, static_cast<std::uint8_t>(record.policy.size()),
+                               record.ply, record.game_id, record.value, 0};
+   std::vector<PolicyEntry> policy;
+   for (auto [index, probability] : record.policy)
+   {
+      if (index < 0 || index >= POLICY_SIZE) throw std::runtime_error("policy index " + std::to_string(index) + " is out of range");
+      policy.push_back(PolicyEntry{static_cast<std::uint16_t>(index),
+                                   static_cast<std::uint16_t>(std::lround(std::clamp(probability, 0.f, 1.f)*65535.f))});
+   }
+   m_file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+   policy.resize((record_size(policy.size()) - sizeof(header)) / sizeof(PolicyEntry), PolicyEntry{0, 0});
+   m_file.write(reinterpret_cast<const char*>(policy.data()), policy.size()*sizeof(PolicyEntry));
+   if (not m_file) throw std::runtime_error("couldn't write shard " + m_path);
+}
+
+void encode_position(const PackedBoard& board, float* input)
+{
+   const Color mover = side_to_move(board);
+   const int flip = mover == BLACK ? 56 : 0;
+
+   std::fill_n(input, POSITION_INPUT_SIZE, 0.f);
+   std::uint64_t occupancy = board.occupancy;
+   for (int n = 0; occupancy; n++, occupancy &= occupancy - 1)
+   {
+      const int square = std::countr_zero(occupancy);
+      const int code = (board.pieces[n / 2] >> (4*(n % 2))) & 0xF;
+      const Color color = code >= 6 ? BLACK : WHITE;
+      const int plane = code % 6 + (color == mover ? 0 : 6);
+      input[plane*64 + (square ^ flip)] = 1.f;
+   }
+}
+
+void PositionWriter::flush()
+{
+   m_file.flush();
+   if (not m_file) throw std::runtime_error("couldn't write shard " + m_path);
+}
+
+void decode_record(const PositionRecordHeader& record, float* input, float* policy, float* value)
+{
+   encode_position(record.board, input);
+
+   // the entries follow the record, as they do in a shard
+   const PolicyEntry* entries = reinterpret_cast<const PolicyEntry*>(&record + 1);
+   std::fill_n(policy, POLICY_SIZE, 0.f);
+   for (int i = 0; i < record.policy_count; i++)
+   {
+      policy[entries[i].index] = entries[i].probability / 65535.f;
+   }
+
+   const int result = side_to_move(record.board) == WHITE ? record.result : -record.result;
+   *value = 0.5f + 0.5f*result;
+}
+
+// a shard mapped for as long as records in the shuffle buffer point into it
+struct TrainingDataLoader::Shard
+{
+   Shard(const std::string& path)
+      :path{path}
+   {
+      const int fd = open(path.c_str(), O_RDONLY);
+      if (fd < 0) throw std::runtime_error("couldn't open shard " + path);
+      struct stat info;
+      if (fstat(fd, &info) == 0) size = info.st_size;
+      if (size >= sizeof(PositionShardHeader)) mapping = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+      close(fd);
+      if (mapping == MAP_FAILED || mapping == nullptr)
+      {
+         mapping = nullptr;
+         throw std::runtime_error("couldn't map shard " + path);
+      }
+      madvise(mapping, size, MADV_SEQUENTIAL);
+
+      PositionShardHeader header;
+      std::memcpy(&header, mapping, sizeof(header));
+      if (std::memcmp(header.magic, POSITION_SHARD_MAGIC, sizeof(header.magic)) != 0 || header.version != POSITION_SHARD_VERSION)
+      {
+         munmap(mapping, size);
+         mapping = nullptr;
+         throw std::runtime_error(path + " isn't a position shard");
+      }
+   }
+   ~Shard() { if (mapping) munmap(mapping, size); }
+   Shard(const Shard&) = delete;
+   Shard& operator=(const Shard&) = delete;
+
+   // the record at `offset` and the offset of the one after it, or nullptr past the last
+   // complete record. Throws std::runtime_error on a record `decode_record` can't take
+   const PositionRecordHeader* record(std::size_t& offset) const
+   {
+      if (offset + sizeof(PositionRecordHeader) > size) return nullptr;
+      const auto* record = reinterpret_cast<const PositionRecordHeader*>(static_cast<const char*>(mapping) + offset);
+      const std::size_t next = offset + record_size(record->policy_count);
+      if (next > size) return nullptr;
+      const PolicyEntry* entries = reinterpret_cast<const PolicyEntry*>(record + 1);
+      for (int i = 0; i < record->policy_count; i++)
+      {
+         if (entries[i].index >= POLICY_SIZE)
+         {
+            throw std::runtime_error(path + " has a policy index out of range at offset " + std::to_string(offset));
+         }
+      }
+      offset = next;
+      return record;
+   }
+
+   std::string path;
+
+   void* mapping = nullptr;
+   std::size_t size = 0;
+};
+
+TrainingDataLoader::TrainingDataLoader(const std::vector<std::string>& shards, const LoaderSettings& settings)
+   :m_shard_paths{shards}
+   ,m_settings{settings}
+{
+   assert(m_settings.batch_size > 0 && m_settings.prefetch > 0);
+   m_settings.decode_threads = std::max(1u, m_settings.decode_threads);
+   m_settings.shuffle_buffer = std::max<std::size_t>(1, m_settings.shuffle_buffer);
+   // fails here rather than on the reader thread
+   for (const std::string& path : m_shard_paths) Shard shard(path);
+
+   if (m_settings.mirror_probability > 0.f)
+   {
+      m_mirror_inputs = std::make_unique<const BatchPermutation>(mirror_inputs());
+      m_mirror_policy = std::make_unique<const BatchPermutation>(mirror_policy());
+   }
+
+   m_decoding = m_settings.decode_threads;
+   m_threads.emplace_back(&TrainingDataLoader::readShards, this);
+   for (unsigned i = 0; i < m_settings.decode_threads; i++)
+   {
+      m_threads.emplace_back(&TrainingDataLoader::decodeBatches, this, i);
+   }
+}
+
+TrainingDataLoader::~TrainingDataLoader()
+{
+   {
+      std::lock_guard lock(m_mutex);
+      m_stop = true;
+   }
+   m_changed.notify_all();
+   for (std::thread& thread : m_threads) thread.join();
+}
+
+void TrainingDataLoader::readShards()
+{
+   std::mt19937_64 rng(m_settings.seed);
+   std::vector<RecordRef> buffer;
+   std::vector<RecordRef> batch;
+
+   // false once the loader is stopping
+   auto emit = [this, &batch](RecordRef&& record) {
+      batch.push_back(std::move(record));
+      if (batch.size() < m_settings.batch_size) return true;
+      std::unique_lock lock(m_mutex);
+      m_changed.wait(lock, [this] { return m_stop || m_shuffled.size() < m_settings.prefetch; });
+      if (m_stop) return false;
+      m_shuffled.push_back(std::move(batch));
+      batch.clear();
+      m_changed.notify_all();
+      return true;
+   };
+
+   bool running = true;
+   for (bool first_pass = true; running && (first_pass || m_settings.loop); first_pass = false)
+   {
+      std::vector<std::size_t> order(m_shard_paths.size());
+      std::iota(order.begin(), order.end(), 0);
+      std::shuffle(order.begin(), order.end(), rng);
+
+      std::size_t records = 0;
+      for (std::size_t i = 0; running && i < order.size(); i++)
+      {
+         std::shared_ptr<const Shard> shard;
+         try {
+            shard = std::make_shared<const Shard>(m_shard_paths[order[i]]);
+         }
+         catch (std::exception& err) {
+            std::cout << "Error in training data: " << err.what() << std::endl;
+            continue;
+         }
+         std::size_t offset = sizeof(PositionShardHeader);
+         while (running)
+         {
+            const PositionRecordHeader* record;
+            try {
+               record = shard->record(offset);
+            }
+            catch (std::exception& err) {
+               // nothing past a corrupt record can be trusted, so the rest of the shard is skipped
+               std::cout << "Error in training data: " << err.what() << std::endl;
+               break;
+            }
+            if (record == nullptr) break;
+            records++;
+            if (m_settings.index)
+            {
+               const float occurrences = m_settings.index->count(position_hash(record->board));
+               if (occurrences > m_settings.max_occurrences
+                   && std::uniform_real_distribution<float>(0.f, occurrences)(rng) >= m_settings.max_occurrences) continue;
+            }
+            RecordRef ref{shard, record};
+            if (buffer.size() < m_settings.shuffle_buffer)
+            {
+               buffer.push_back(std::move(ref));
+               continue;
+            }
+            std::swap(ref, buffer[rng() % buffer.size()]);
+            running = emit(std::move(ref));
+         }
+      }
+      // an epoch without a single record would loop forever
+      if (records == 0) break;
+   }
+
+   std::shuffle(buffer.begin(), buffer.end(), rng);
+   for (std::size_t i = 0; running && i < buffer.size(); i++)
+   {
+      running = emit(std::move(buffer[i]));
+   }
+
+   std::lock_guard lock(m_mutex);
+   m_reading_done = true;
+   m_changed.notify_all();
+}
+
+void TrainingDataLoader::decodeBatches(unsigned worker)
+{
+   std::mt19937_64 rng(m_settings.seed + 1 + worker);
+   std::bernoulli_distribution mirror(std::clamp(m_settings.mirror_probability, 0.f, 1.f));
+   while (true)
+   {
+      std::vector<RecordRef> records;
+      {
+         std::unique_lock lock(m_mutex);
+         m_changed.wait(lock, [this] { return m_stop || not m_shuffled.empty() || m_reading_done; });
+         if (m_stop || m_shuffled.empty()) break;
+         records = std::move(m_shuffled.front());
+         m_shuffled.pop_front();
+      }
+      m_changed.notify_all();
+
+      const std::size_t count = records.size();
+      HostBatch batch{std::vector<float>(count*POSITION_INPUT_SIZE), std::vector<float>(count*POLICY_SIZE), std::vector<float>(count),
+                      std::vector<std::uint8_t>(count)};
+      for (std::size_t i = 0; i < count; i++)
+      {
+         decode_record(*records[i].record, &batch.inputs[i*POSITION_INPUT_SIZE], &batch.policy[i*POLICY_SIZE], &batch.value[i]);
+         batch.mirrored[i] = m_mirror_inputs && mirror_symmetric(records[i].record->board) && mirror(rng);
+      }
+      // unmaps shards no record points into any more
+      records.clear();
+
+      std::unique_lock lock(m_mutex);
+      m_changed.wait(lock, [this] { return m_stop || m_decoded.size() < m_settings.prefetch; });
+      if (m_stop) break;
+      m_decoded.push_back(std::move(batch));
+      m_changed.notify_all();
+   }
+
+   std::lock_guard lock(m_mutex);
+   m_decoding--;
+   m_changed.notify_all();
+}
+
+TrainingBatch TrainingDataLoader::upload(HostBatch&& batch) const
+{
+   const unsigned count = batch.value.size();
+   TrainingBatch uploaded{ParallelMat(POSITION_INPUT_SIZE, 1, count, std::move(batch.inputs)),
+                          ParallelMat(POLICY_SIZE, 1, count, std::move(batch.policy)),
+                          ParallelMat(1, 1, count, std::move(batch.value))};
+   if (std::find(batch.mirrored.begin(), batch.mirrored.end(), 1) != batch.mirrored.end())
+   {
+      uploaded.inputs = m_mirror_inputs->apply(uploaded.inputs, batch.mirrored);
+      uploaded.policy = m_mirror_policy->apply(uploaded.policy, batch.mirrored);
+   }
+   return uploaded;
+}
+
+std::optional<TrainingBatch> TrainingDataLoader::next()
+{
+   if (not m_uploaded)
+   {
+      std::unique_lock lock(m_mutex);
+      m_changed.wait(lock, [this] { return not m_decoded.empty() || m_decoding == 0; });
+      if (m_decoded.empty()) return std::nullopt;
+      HostBatch batch = std::move(m_decoded.front());
+      m_decoded.pop_front();
+      lock.unlock();
+      m_changed.notify_all();
+      m_uploaded = upload(std::move(batch));
+   }
+
+   std::optional<TrainingBatch> batch = std::move(m_uploaded);
+   m_uploaded.reset();
+
+   // starts uploading the next batch now if it's ready, so it overlaps training on this one
+   std::unique_lock lock(m_mutex);
+   if (not m_decoded.empty())
+   {
+      HostBatch decoded = std::move(m_decoded.front());
+      m_decoded.pop_front();
+      lock.unlock();
+      m_changed.notify_all();
+      m_uploaded = upload(std::move(decoded));
+   }
+   return batch;
+}
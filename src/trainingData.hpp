@@ -0,0 +1,201 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <thread>
+#include <vector>
+#include "board.hpp"
+#include "parallelMat.hpp"
+
+class PositionIndex;
+class BatchPermutation;
+
+// Training positions from self-play, stored in shard files of variable length records:
+//
+//   PositionShardHeader                16 bytes
+//   records                            PositionRecordHeader then `policy_count` PolicyEntry
+//
+// Everything is little-endian and records start on 8 byte boundaries. Positions are fed to the net from the side
+// to move's point of view, with the board flipped vertically when black is to move
+
+// one plane of 64 squares per piece type, the side to move's pieces first
+constexpr int POSITION_PLANES = 12;
+constexpr int POSITION_INPUT_SIZE = POSITION_PLANES*64;
+// every from x to square pair, then underpromotions to a knight, bishop or rook by the file
+// moved from and the direction, see policy_index
+constexpr int POLICY_SIZE = 64*64 + 8*3*3;
+
+// index of `move` in the policy, from the point of view of `side_to_move`
+int policy_index(const Move& move, Color side_to_move);
+
+// a position in 32 bytes
+struct PackedBoard
+{
+   std::uint64_t occupancy;      // a bit per occupied square, A1 lowest
+   std::uint8_t pieces[16];      // 4 bits per occupied square in order, the PieceType plus 6 for black
+   std::uint8_t flags;           // bit 0: white to move, bits 1-4: castling rights KQkq
+   std::uint8_t en_passant;      // file of the en passant square, 0xFF for none
+   std::uint8_t halfmoves;       // saturates at 255
+   std::uint8_t reserved;
+   std::uint16_t fullmoves;
+   std::uint16_t reserved2;
+};
+static_assert(sizeof(PackedBoard) == 32);
+
+PackedBoard pack_board(const Board& board);
+Color side_to_move(const PackedBoard& board);
+
+struct PolicyEntry
+{
+   std::uint16_t index;          // see policy_index
+   std::uint16_t probability;    // of 65535
+};
+
+struct PositionRecordHeader
+{
+   PackedBoard board;
+   std::int8_t result;           // of the game for white: 1 won, 0 drawn, -1 lost
+   std::uint8_t policy_count;
+   std::uint16_t ply;
+   std::uint32_t game_id;
+   float value;                  // search value for the side to move, metadata only
+   std::uint32_t reserved;
+};
+static_assert(sizeof(PositionRecordHeader) == 48);
+
+// bytes of a record in a shard, its policy padded so the next one starts 8 byte aligned
+inline std::size_t record_size(int policy_count)
+{
+   return sizeof(PositionRecordHeader) + (policy_count + 1) / 2 * 2 * sizeof(PolicyEntry);
+}
+
+constexpr char POSITION_SHARD_MAGIC[8] = {'C', 'H', 'E', 'S', 'S', 'P', 'O', 'S'};
+constexpr std::uint32_t POSITION_SHARD_VERSION = 1;
+
+struct PositionShardHeader
+{
+   char magic[8];                // POSITION_SHARD_MAGIC
+   std::uint32_t version;
+   std::uint32_t reserved;
+};
+
+// a position as the writer takes it, with its policy over the legal moves
+struct PositionRecord
+{
+   PackedBoard board;
+   std::int8_t result = 0;
+   std::uint16_t ply = 0;
+   std::uint32_t game_id = 0;
+   float value = 0.f;
+   std::vector<std::pair<int, float>> policy;   // {policy_index, probability}
+};
+
+// appends records to a new shard. Throws std::runtime_error when the file can't be written
+class PositionWriter
+{
+public:
+   PositionWriter(const std::string& path);
+   void write(const PositionRecord& record);
+   // everything written so far into the file, for readers of a shard still being written
+   void flush();
+
+private:
+   std::ofstream m_file;
+   std::string m_path;
+};
+
+// the POSITION_INPUT_SIZE inputs of the net for `board`
+void encode_position(const PackedBoard& board, float* input);
+
+// the net's inputs and targets for one record: POSITION_INPUT_SIZE inputs, POLICY_SIZE policy
+// probabilities and the result for the side to move, 1 for a win, 0.5 a draw and 0 a loss.
+// The record's policy indices have to be below POLICY_SIZE, which the loader checks as it reads
+void decode_record(const PositionRecordHeader& record, float* input, float* policy, float* value);
+
+struct TrainingBatch
+{
+   ParallelMat inputs;     // POSITION_INPUT_SIZE x 1 each
+   ParallelMat policy;     // POLICY_SIZE x 1 each
+   ParallelMat value;      // 1 x 1 each
+};
+
+struct LoaderSettings
+{
+   unsigned batch_size = 256;
+   // records shuffled together; the larger, the further apart positions of one game end up
+   std::size_t shuffle_buffer = 1 << 20;
+   unsigned decode_threads = 4;
+   // batches decoded ahead of the one being trained on
+   unsigned prefetch = 4;
+   // goes over the shards again, in a new order, once they're done
+   bool loop = true;
+   std::uint64_t seed = 0;
+   // with an index of the shards, a position that occurs more than `max_occurrences` times is
+   // kept with probability max_occurrences/occurrences, so each pass sees it about that often
+   // and the common openings don't crowd out everything else. The loader doesn't own it
+   const PositionIndex* index = nullptr;
+   float max_occurrences = 1.f;
+   // positions no side can castle in any more are mirrored left to right with this probability,
+   // on the device once the batch is uploaded, see augmentation.hpp
+   float mirror_probability = 0.f;
+};
+
+// streams shuffled batches out of mapped shards. One thread reads the shards through the
+// shuffle buffer, `decode_threads` workers decode whole batches on the host, and the batch
+// after the one `next` returns is already uploading while it's trained on
+class TrainingDataLoader
+{
+public:
+   // throws std::runtime_error if a shard can't be mapped or isn't one
+   TrainingDataLoader(const std::vector<std::string>& shards, const LoaderSettings& settings = LoaderSettings());
+   ~TrainingDataLoader();
+   TrainingDataLoader(const TrainingDataLoader&) = delete;
+   TrainingDataLoader& operator=(const TrainingDataLoader&) = delete;
+
+   // empty once every record has been seen without `loop`. The last partial batch is dropped
+   std::optional<TrainingBatch> next();
+
+private:
+   struct Shard;
+   // a record inside a mapped shard, which it keeps mapped
+   struct RecordRef
+   {
+      std::shared_ptr<const Shard> shard;
+      const PositionRecordHeader* record;
+   };
+   struct HostBatch
+   {
+      std::vector<float> inputs;
+      std::vector<float> policy;
+      std::vector<float> value;
+      std::vector<std::uint8_t> mirrored;
+   };
+
+   void readShards();
+   void decodeBatches(unsigned worker);
+   // a decoded batch into device memory, without waiting for the upload
+   TrainingBatch upload(HostBatch&& batch) const;
+
+   std::vector<std::string> m_shard_paths;
+   LoaderSettings m_settings;
+
+   std::mutex m_mutex;
+   std::condition_variable m_changed;
+   std::deque<std::vector<RecordRef>> m_shuffled;   // batches of records waiting to be decoded
+   std::deque<HostBatch> m_decoded;
+   bool m_reading_done = false;
+   unsigned m_decoding = 0;                         // workers still running
+   bool m_stop = false;
+
+   std::optional<TrainingBatch> m_uploaded;
+   // only with a mirror_probability
+   std::unique_ptr<const BatchPermutation> m_mirror_inputs;
+   std::unique_ptr<const BatchPermutation> m_mirror_policy;
+   std::vector<std::thread> m_threads;
+};
@@ -0,0 +1,76 @@
+#include <cstdio>
+#include <memory>
+#include <vector>
+#include "backend.hpp"
+#include "selfPlay.hpp"
+
+namespace {
+
+// a value "net" that has white lost and black won. With one game in flight and one playout
+// per move, the evaluator sees the root of every ply in turn, white's first
+class AlternatingValue : public Layer
+{
+public:
+   AlternatingValue() :Layer(POSITION_INPUT_SIZE, 1) {}
+
+   Mat compute(const Mat&) const override { return Mat(1, 1, std::vector<float>{next()}); }
+   ParallelMat compute(const ParallelMat& input) const override
+   {
+      std::vector<float> values(input.getCount());
+      for (float& value : values) value = next();
+      return ParallelMat(1, 1, values.size(), std::move(values));
+   }
+   std::string describe() const override { return "alternating_value"; }
+
+private:
+   float next() const { return m_calls++ % 2 ? 1.f : 0.f; }
+
+   mutable unsigned m_calls = 0;
+};
+
+int failures = 0;
+
+void check(bool condition, const char* what)
+{
+   if (not condition)
+   {
+      std::printf("FAILED: %s\n", what);
+      failures++;
+   }
+}
+
+void lost_position_resigns()
+{
+   NNet policy_net = NNet::fromArchitecture("fully_connected 768 16 relu\nfully_connected 16 4168 linear\nsoftmax 4168\n");
+   std::vector<std::unique_ptr<Layer>> layers;
+   layers.push_back(std::make_unique<AlternatingValue>());
+   NNet value_net(std::move(layers));
+   BatchedEvaluator evaluator(policy_net, value_net);
+
+   SelfPlaySettings settings;
+   settings.games_in_flight = 1;
+   settings.playouts = 1;
+   settings.noise_fraction = 0.f;
+   settings.no_resign_fraction = 0.f;
+   settings.max_plies = 40;
+   settings.output_prefix = "selfPlayTest_";
+   SelfPlay self_play(evaluator, settings);
+   const SelfPlayStats stats = self_play.play(1);
+   std::remove("selfPlayTest_0.bin");
+
+   // white's value stays at -1 while black's is 1 in between, so white resigns on its
+   // `resign_moves`th move, before making it
+   check(stats.resignations == 1, "white resigns the lost game");
+   check(stats.black_wins == 1, "the resigned game goes to black");
+   check(stats.positions == 2*settings.resign_moves - 1, "white resigns after resign_moves of its own moves");
+}
+
+}
+
+int main()
+{
+   backend_init(CPU_BACKEND);
+   lost_position_resigns();
+   if (failures == 0) std::printf("selfPlayTest passed\n");
+   return failures == 0 ? 0 : 1;
+}